@@ -0,0 +1,247 @@
+// SPDX-License-Identifier: GPL-2.0
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+/* Microbenchmark of the crypto primitives of the data path, built with BENCH=1.
+ *
+ * When the module is loaded with bench=1, ovpn_aead_encrypt(), ovpn_aead_decrypt()
+ * and ovpn_pktid_recv() are driven directly, without any device or socket, and
+ * their cost is reported in the kernel log.
+ */
+
+#include "main.h"
+#include "bench.h"
+#include "crypto.h"
+#include "crypto_aead.h"
+#include "peer.h"
+#include "pktid.h"
+#include "proto.h"
+#include "skb.h"
+#include "stats.h"
+
+#include <linux/ktime.h>
+#include <linux/moduleparam.h>
+#include <linux/random.h>
+#include <linux/sched.h>
+#include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <linux/timex.h>
+
+static bool ovpn_bench;
+module_param_named(bench, ovpn_bench, bool, 0444);
+MODULE_PARM_DESC(bench, "run the crypto microbenchmark at load time");
+
+static unsigned int ovpn_bench_iters = 100000;
+module_param_named(bench_iters, ovpn_bench_iters, uint, 0444);
+MODULE_PARM_DESC(bench_iters, "packets processed by each microbenchmark run");
+
+static const unsigned int ovpn_bench_sizes[] = { 64, 512, 1400, 8192 };
+
+/* room for the network headers and the AEAD encapsulation, so that skbs are
+ * never reallocated by the encryption
+ */
+#define OVPN_BENCH_HEADROOM (OVPN_HEAD_ROOM + OVPN_OP_SIZE_V2 + NONCE_WIRE_SIZE + 16)
+
+struct ovpn_bench_result {
+	u64 ns;
+	u64 cycles;
+};
+
+static void ovpn_bench_report(const char *what, unsigned int size, unsigned int n,
+			      const struct ovpn_bench_result *res)
+{
+	u64 mbps = res->ns ? div64_u64((u64)size * n * 8 * 1000, res->ns) : 0;
+
+	pr_info("ovpn: bench %-28s %5u bytes: %6llu ns/pkt %7llu cycles/pkt %6llu Mbit/s\n",
+		what, size, div_u64(res->ns, n), div_u64(res->cycles, n), mbps);
+}
+
+/* encrypt and then decrypt n packets of the given size in batches, the two
+ * directions being timed separately
+ */
+static int ovpn_bench_aead(struct ovpn_peer *peer, struct ovpn_crypto_key_slot *ks,
+			   unsigned int size, unsigned int n, struct ovpn_bench_result *enc,
+			   struct ovpn_bench_result *dec)
+{
+	struct sk_buff *skbs[OVPN_BATCH_MAX];
+	unsigned int done, batch, i;
+	cycles_t c;
+	int ret = 0;
+	u64 t;
+
+	memset(enc, 0, sizeof(*enc));
+	memset(dec, 0, sizeof(*dec));
+
+	for (done = 0; done < n; done += batch) {
+		batch = min_t(unsigned int, n - done, OVPN_BATCH_MAX);
+
+		for (i = 0; i < batch; i++) {
+			skbs[i] = alloc_skb(OVPN_BENCH_HEADROOM + size, GFP_KERNEL);
+			if (!skbs[i]) {
+				batch = i;
+				ret = -ENOMEM;
+				goto free_skbs;
+			}
+
+			skb_reserve(skbs[i], OVPN_BENCH_HEADROOM);
+			memset(skb_put(skbs[i], size), 0x5a, size);
+			memset(skbs[i]->cb, 0, sizeof(skbs[i]->cb));
+			OVPN_SKB_CB(skbs[i])->peer = peer;
+			OVPN_SKB_CB(skbs[i])->ks = ks;
+		}
+
+		t = ktime_get_ns();
+		c = get_cycles();
+		for (i = 0; i < batch; i++) {
+			ret = ovpn_aead_encrypt(skbs[i], true);
+			ovpn_aead_encrypt_release(skbs[i]);
+			if (ret < 0)
+				goto free_skbs;
+		}
+		enc->cycles += get_cycles() - c;
+		enc->ns += ktime_get_ns() - t;
+
+		t = ktime_get_ns();
+		c = get_cycles();
+		for (i = 0; i < batch; i++) {
+			ret = ovpn_aead_decrypt(skbs[i], true);
+			ovpn_aead_decrypt_release(skbs[i], ret);
+			if (ret < 0)
+				goto free_skbs;
+		}
+		dec->cycles += get_cycles() - c;
+		dec->ns += ktime_get_ns() - t;
+
+free_skbs:
+		for (i = 0; i < batch; i++)
+			kfree_skb(skbs[i]);
+
+		if (ret < 0)
+			return ret;
+
+		cond_resched();
+	}
+
+	return 0;
+}
+
+static void ovpn_bench_alg(struct ovpn_peer *peer, enum ovpn_cipher_alg alg, const char *name)
+{
+	struct ovpn_bench_result enc, dec;
+	struct ovpn_crypto_key_slot *ks;
+	u8 key[32], nonce_tail[NONCE_TAIL_SIZE];
+	struct ovpn_key_config kc = {
+		.cipher_alg = alg,
+		.encrypt = {
+			.cipher_key = key,
+			.cipher_key_size = sizeof(key),
+			.nonce_tail = nonce_tail,
+			.nonce_tail_size = sizeof(nonce_tail),
+		},
+	};
+	char what[32];
+	unsigned int i;
+	int ret;
+
+	get_random_bytes(key, sizeof(key));
+	get_random_bytes(nonce_tail, sizeof(nonce_tail));
+
+	/* same key in both directions, so that packets can be decrypted by their sender */
+	kc.decrypt = kc.encrypt;
+
+	ks = ovpn_aead_crypto_key_slot_new(&kc);
+	if (IS_ERR(ks)) {
+		pr_err("ovpn: bench %s: cannot create key slot: %ld\n", name, PTR_ERR(ks));
+		return;
+	}
+
+	/* completion handlers belong to the data path, which is not set up here */
+	if (!ks->sync) {
+		pr_info("ovpn: bench %s: skipping asynchronous implementation\n", name);
+		goto out;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(ovpn_bench_sizes); i++) {
+		ret = ovpn_bench_aead(peer, ks, ovpn_bench_sizes[i], ovpn_bench_iters, &enc, &dec);
+		if (ret < 0) {
+			pr_err("ovpn: bench %s: crypto failed: %d\n", name, ret);
+			goto out;
+		}
+
+		snprintf(what, sizeof(what), "%s encrypt", name);
+		ovpn_bench_report(what, ovpn_bench_sizes[i], ovpn_bench_iters, &enc);
+		snprintf(what, sizeof(what), "%s decrypt", name);
+		ovpn_bench_report(what, ovpn_bench_sizes[i], ovpn_bench_iters, &dec);
+	}
+
+out:
+	ovpn_aead_crypto_key_slot_destroy(ks);
+}
+
+/* feed the replay window with IDs in order, or swapped by pairs so that half
+ * of them land below the current head
+ */
+static void ovpn_bench_pktid(bool reorder)
+{
+	struct ovpn_bench_result res = {};
+	struct ovpn_pktid_recv *pr;
+	unsigned int i;
+	cycles_t c;
+	u32 pkt_id;
+	u64 t;
+
+	pr = kmalloc(sizeof(*pr), GFP_KERNEL);
+	if (!pr)
+		return;
+
+	ovpn_pktid_recv_init(pr);
+
+	t = ktime_get_ns();
+	c = get_cycles();
+	for (i = 0; i < ovpn_bench_iters; i++) {
+		pkt_id = (reorder ? i ^ 1 : i) + 1;
+
+		if (unlikely(ovpn_pktid_recv(pr, pkt_id, 0) < 0)) {
+			pr_err("ovpn: bench pktid: ID %u rejected\n", pkt_id);
+			goto out;
+		}
+	}
+	res.cycles = get_cycles() - c;
+	res.ns = ktime_get_ns() - t;
+
+	ovpn_bench_report(reorder ? "pktid_recv reordered" : "pktid_recv in order", 0,
+			  ovpn_bench_iters, &res);
+out:
+	kfree(pr);
+}
+
+void ovpn_bench_run(void)
+{
+	struct ovpn_peer *peer;
+
+	if (!ovpn_bench || !ovpn_bench_iters)
+		return;
+
+	/* the crypto layer only needs the ID and the stats of the peer */
+	peer = kzalloc(sizeof(*peer), GFP_KERNEL);
+	if (!peer)
+		return;
+
+	if (ovpn_peer_stats_init(&peer->stats) < 0)
+		goto free_peer;
+
+	peer->id = 1;
+
+	ovpn_bench_alg(peer, OVPN_CIPHER_ALG_AES_GCM, "aes-gcm");
+	ovpn_bench_alg(peer, OVPN_CIPHER_ALG_CHACHA20_POLY1305, "chacha20poly1305");
+	ovpn_bench_pktid(false);
+	ovpn_bench_pktid(true);
+
+	ovpn_peer_stats_free(&peer->stats);
+free_peer:
+	kfree(peer);
+}
@@ -0,0 +1,20 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+#ifndef _NET_OVPN_DCO_BENCH_H_
+#define _NET_OVPN_DCO_BENCH_H_
+
+#ifdef CONFIG_OVPN_DCO_BENCH
+void ovpn_bench_run(void);
+#else
+static inline void ovpn_bench_run(void)
+{
+}
+#endif
+
+#endif /* _NET_OVPN_DCO_BENCH_H_ */
@@ -37,18 +37,28 @@ struct ovpn_bind *ovpn_bind_from_sockaddr(const struct sockaddr_storage *ss)
 	if (unlikely(!bind))
 		return ERR_PTR(-ENOMEM);
 
+	if (unlikely(dst_cache_init(&bind->dst_cache, GFP_ATOMIC) < 0)) {
+		kfree(bind);
+		return ERR_PTR(-ENOMEM);
+	}
+
 	memcpy(&bind->sa, ss, sa_len);
 
 	return bind;
 }
 
-static void ovpn_bind_release_rcu(struct rcu_head *head)
+/* Free a bind that was never published */
+void ovpn_bind_free(struct ovpn_bind *bind)
 {
-	struct ovpn_bind *bind = container_of(head, struct ovpn_bind, rcu);
-
+	dst_cache_destroy(&bind->dst_cache);
 	kfree(bind);
 }
 
+static void ovpn_bind_release_rcu(struct rcu_head *head)
+{
+	ovpn_bind_free(container_of(head, struct ovpn_bind, rcu));
+}
+
 void ovpn_bind_reset(struct ovpn_peer *peer, struct ovpn_bind *new)
 {
 	struct ovpn_bind *old;
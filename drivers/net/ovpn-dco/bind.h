@@ -11,6 +11,7 @@
 #include "addr.h"
 #include "rcu.h"
 
+#include <net/dst_cache.h>
 #include <net/ip.h>
 #include <linux/skbuff.h>
 #include <linux/spinlock.h>
@@ -25,6 +26,9 @@ struct ovpn_bind {
 		struct in6_addr ipv6;
 	} local;
 
+	/* route to the remote endpoint: a new bind always starts from a new lookup */
+	struct dst_cache dst_cache;
+
 	struct rcu_head rcu;
 };
 
@@ -62,6 +66,7 @@ static inline bool ovpn_bind_skb_src_match(const struct ovpn_bind *bind, struct
 }
 
 struct ovpn_bind *ovpn_bind_from_sockaddr(const struct sockaddr_storage *sa);
+void ovpn_bind_free(struct ovpn_bind *bind);
 void ovpn_bind_reset(struct ovpn_peer *peer, struct ovpn_bind *bind);
 
 #endif /* _NET_OVPN_DCO_OVPNBIND_H_ */
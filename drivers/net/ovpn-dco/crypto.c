@@ -10,6 +10,7 @@
 #include "main.h"
 #include "crypto_aead.h"
 #include "crypto.h"
+#include "offload.h"
 
 #include <uapi/linux/ovpn_dco.h>
 
@@ -21,31 +22,44 @@ static void ovpn_ks_destroy_rcu(struct rcu_head *head)
 	ovpn_aead_crypto_key_slot_destroy(ks);
 }
 
-void ovpn_crypto_key_slot_release(struct kref *kref)
+/* invoked once the slot has been retired and the last packet using it is done */
+void ovpn_crypto_key_slot_release(struct percpu_ref *ref)
 {
 	struct ovpn_crypto_key_slot *ks;
 
-	ks = container_of(kref, struct ovpn_crypto_key_slot, refcount);
+	ks = container_of(ref, struct ovpn_crypto_key_slot, refcount);
 	call_rcu(&ks->rcu, ovpn_ks_destroy_rcu);
 }
 
+/* Return the index in cs->slots of slot */
+static unsigned int ovpn_crypto_slot_index(const struct ovpn_crypto_state *cs,
+					   enum ovpn_key_slot slot)
+	__must_hold(cs->mutex)
+{
+	return slot == OVPN_KEY_SLOT_PRIMARY ? cs->primary : !cs->primary;
+}
+
+/* Replace the key slot at index i with ks, retiring the old one */
+static void ovpn_crypto_slot_replace(struct ovpn_crypto_state *cs, unsigned int i,
+				     struct ovpn_crypto_key_slot *ks)
+	__must_hold(cs->mutex)
+{
+	struct ovpn_crypto_key_slot *old;
+
+	old = rcu_replace_pointer(cs->slots[i], ks, lockdep_is_held(&cs->mutex));
+	ovpn_crypto_key_slot_retire(old);
+}
+
 /* can only be invoked when all peer references have been dropped (i.e. RCU
  * release routine)
  */
 void ovpn_crypto_state_release(struct ovpn_crypto_state *cs)
 {
-	struct ovpn_crypto_key_slot *ks;
-
-	ks = rcu_access_pointer(cs->primary);
-	if (ks) {
-		RCU_INIT_POINTER(cs->primary, NULL);
-		ovpn_crypto_key_slot_put(ks);
-	}
+	int i;
 
-	ks = rcu_access_pointer(cs->secondary);
-	if (ks) {
-		RCU_INIT_POINTER(cs->secondary, NULL);
-		ovpn_crypto_key_slot_put(ks);
+	for (i = 0; i < ARRAY_SIZE(cs->slots); i++) {
+		ovpn_crypto_key_slot_retire(rcu_access_pointer(cs->slots[i]));
+		RCU_INIT_POINTER(cs->slots[i], NULL);
 	}
 
 	mutex_destroy(&cs->mutex);
@@ -54,11 +68,8 @@ void ovpn_crypto_state_release(struct ovpn_crypto_state *cs)
 /* removes the primary key from the crypto context */
 void ovpn_crypto_kill_primary(struct ovpn_crypto_state *cs)
 {
-	struct ovpn_crypto_key_slot *ks;
-
 	mutex_lock(&cs->mutex);
-	ks = rcu_replace_pointer(cs->primary, NULL, lockdep_is_held(&cs->mutex));
-	ovpn_crypto_key_slot_put(ks);
+	ovpn_crypto_slot_replace(cs, cs->primary, NULL);
 	mutex_unlock(&cs->mutex);
 }
 
@@ -66,73 +77,55 @@ void ovpn_crypto_kill_primary(struct ovpn_crypto_state *cs)
  * to RCU readers.
  */
 int ovpn_crypto_state_reset(struct ovpn_crypto_state *cs,
-			    const struct ovpn_peer_key_reset *pkr)
+			    const struct ovpn_peer_key_reset *pkr, struct ovpn_peer *peer)
 	__must_hold(cs->mutex)
 {
-	struct ovpn_crypto_key_slot *old = NULL;
 	struct ovpn_crypto_key_slot *new;
 
 	lockdep_assert_held(&cs->mutex);
 
+	if (pkr->slot != OVPN_KEY_SLOT_PRIMARY && pkr->slot != OVPN_KEY_SLOT_SECONDARY)
+		return -EINVAL;
+
 	new = ovpn_aead_crypto_key_slot_new(&pkr->key);
 	if (IS_ERR(new))
 		return PTR_ERR(new);
 
-	switch (pkr->slot) {
-	case OVPN_KEY_SLOT_PRIMARY:
-		old = rcu_replace_pointer(cs->primary, new,
-					  lockdep_is_held(&cs->mutex));
-		break;
-	case OVPN_KEY_SLOT_SECONDARY:
-		old = rcu_replace_pointer(cs->secondary, new,
-					  lockdep_is_held(&cs->mutex));
-		break;
-	default:
-		goto free_key;
-	}
+	/* before the key becomes visible to the data path */
+	ovpn_offload_key_add(peer, new, &pkr->key);
 
-	if (old)
-		ovpn_crypto_key_slot_put(old);
+	ovpn_crypto_slot_replace(cs, ovpn_crypto_slot_index(cs, pkr->slot), new);
 
 	return 0;
-free_key:
-	ovpn_crypto_key_slot_put(new);
-	return -EINVAL;
 }
 
 void ovpn_crypto_key_slot_delete(struct ovpn_crypto_state *cs,
 				 enum ovpn_key_slot slot)
 {
-	struct ovpn_crypto_key_slot *ks = NULL;
+	struct ovpn_crypto_key_slot *ks;
+	unsigned int i;
 
-	mutex_lock(&cs->mutex);
-	switch (slot) {
-	case OVPN_KEY_SLOT_PRIMARY:
-		ks = rcu_replace_pointer(cs->primary, NULL,
-					 lockdep_is_held(&cs->mutex));
-		break;
-	case OVPN_KEY_SLOT_SECONDARY:
-		ks = rcu_replace_pointer(cs->secondary, NULL,
-					 lockdep_is_held(&cs->mutex));
-		break;
-	default:
+	if (slot != OVPN_KEY_SLOT_PRIMARY && slot != OVPN_KEY_SLOT_SECONDARY) {
 		pr_warn("Invalid slot to release: %u\n", slot);
-		break;
+		return;
 	}
-	mutex_unlock(&cs->mutex);
 
+	mutex_lock(&cs->mutex);
+	i = ovpn_crypto_slot_index(cs, slot);
+	ks = rcu_dereference_protected(cs->slots[i], lockdep_is_held(&cs->mutex));
 	if (!ks) {
+		mutex_unlock(&cs->mutex);
 		pr_debug("Key slot already released: %u\n", slot);
 		return;
 	}
-	pr_debug("deleting key slot %u, key_id=%u\n", slot, ks->key_id);
 
-	ovpn_crypto_key_slot_put(ks);
+	pr_debug("deleting key slot %u, key_id=%u\n", slot, ks->key_id);
+	ovpn_crypto_slot_replace(cs, i, NULL);
+	mutex_unlock(&cs->mutex);
 }
 
-/* this swap is not atomic, but there will be a very short time frame where the
- * old_secondary key won't be available. This should not be a big deal as most
- * likely both peers are already using the new primary at this point.
+/* Swap primary and secondary key slots with a single store, so that both keys
+ * remain available to the data path at all times
  */
 void ovpn_crypto_key_slots_swap(struct ovpn_crypto_state *cs)
 {
@@ -140,11 +133,11 @@ void ovpn_crypto_key_slots_swap(struct ovpn_crypto_state *cs)
 
 	mutex_lock(&cs->mutex);
 
-	old_secondary = rcu_dereference_protected(cs->secondary,
+	old_primary = rcu_dereference_protected(cs->slots[cs->primary],
+						lockdep_is_held(&cs->mutex));
+	old_secondary = rcu_dereference_protected(cs->slots[!cs->primary],
 						  lockdep_is_held(&cs->mutex));
-	old_primary = rcu_replace_pointer(cs->primary, old_secondary,
-					  lockdep_is_held(&cs->mutex));
-	rcu_assign_pointer(cs->secondary, old_primary);
+	WRITE_ONCE(cs->primary, !cs->primary);
 
 	pr_debug("key swapped: %u <-> %u\n",
 		 old_primary ? old_primary->key_id : 0,
@@ -14,10 +14,14 @@
 #include "pktid.h"
 
 #include <uapi/linux/ovpn_dco.h>
+#include <linux/mutex.h>
+#include <linux/percpu-refcount.h>
+#include <linux/rcupdate.h>
 #include <linux/skbuff.h>
 
 struct ovpn_peer;
 struct ovpn_crypto_key_slot;
+struct ovpn_offload_sa;
 
 /* info needed for both encrypt and decrypt directions */
 struct ovpn_key_direction {
@@ -49,29 +53,69 @@ struct ovpn_crypto_key_slot {
 	struct ovpn_nonce_tail nonce_tail_xmit;
 	struct ovpn_nonce_tail nonce_tail_recv;
 
+	/* both tfms complete requests synchronously */
+	bool sync;
+
+	/* key installed on the lower device, or NULL for software crypto only */
+	struct ovpn_offload_sa *offload;
+
+	/* per-CPU cache of preallocated crypto scratch areas (IV, request and
+	 * scatterlist), one per direction
+	 */
+	void * __percpu *encrypt_tmp;
+	void * __percpu *decrypt_tmp;
+
+	/* packets in flight take a reference each, which only touches a per-CPU
+	 * counter until the slot is retired by ovpn_crypto_key_slot_retire().
+	 * Kept away from the packet ID state, written for every packet
+	 */
+	struct percpu_ref refcount;
+
 	struct ovpn_pktid_recv pid_recv ____cacheline_aligned_in_smp;
 	struct ovpn_pktid_xmit pid_xmit ____cacheline_aligned_in_smp;
-	struct kref refcount;
 	struct rcu_head rcu;
 };
 
+/* Key slots of a peer.
+ *
+ * slots[primary] is the primary key slot and slots[!primary] the secondary one,
+ * so that swapping them is a single store: readers always see a consistent pair
+ * and both keys remain available throughout a renegotiation.
+ * The state owns the slots it points to. The data path only uses RCU to look
+ * them up, and the slots are retired once replaced or deleted.
+ */
 struct ovpn_crypto_state {
-	struct ovpn_crypto_key_slot __rcu *primary;
-	struct ovpn_crypto_key_slot __rcu *secondary;
+	struct ovpn_crypto_key_slot __rcu *slots[2];
+	u8 primary;
 
-	/* protects primary and secondary slots */
+	/* serializes the updates of slots and primary */
 	struct mutex mutex;
 };
 
 static inline bool ovpn_crypto_key_slot_hold(struct ovpn_crypto_key_slot *ks)
 {
-	return kref_get_unless_zero(&ks->refcount);
+	return percpu_ref_tryget_live(&ks->refcount);
+}
+
+static inline void ovpn_crypto_key_slot_put(struct ovpn_crypto_key_slot *ks)
+{
+	percpu_ref_put(&ks->refcount);
+}
+
+/* Drop the reference owned by the crypto state: the slot is released once
+ * the packets still using it are done
+ */
+static inline void ovpn_crypto_key_slot_retire(struct ovpn_crypto_key_slot *ks)
+{
+	if (ks)
+		percpu_ref_kill(&ks->refcount);
 }
 
 static inline void ovpn_crypto_state_init(struct ovpn_crypto_state *cs)
 {
-	RCU_INIT_POINTER(cs->primary, NULL);
-	RCU_INIT_POINTER(cs->secondary, NULL);
+	RCU_INIT_POINTER(cs->slots[0], NULL);
+	RCU_INIT_POINTER(cs->slots[1], NULL);
+	cs->primary = 0;
 	mutex_init(&cs->mutex);
 }
 
@@ -79,28 +123,22 @@ static inline struct ovpn_crypto_key_slot *
 ovpn_crypto_key_id_to_slot(const struct ovpn_crypto_state *cs, u8 key_id)
 {
 	struct ovpn_crypto_key_slot *ks;
+	int i;
 
 	if (unlikely(!cs))
 		return NULL;
 
 	rcu_read_lock();
-	ks = rcu_dereference(cs->primary);
-	if (ks && ks->key_id == key_id) {
-		if (unlikely(!ovpn_crypto_key_slot_hold(ks)))
-			ks = NULL;
-		goto out;
-	}
-
-	ks = rcu_dereference(cs->secondary);
-	if (ks && ks->key_id == key_id) {
-		if (unlikely(!ovpn_crypto_key_slot_hold(ks)))
-			ks = NULL;
-		goto out;
+	for (i = 0; i < ARRAY_SIZE(cs->slots); i++) {
+		ks = rcu_dereference(cs->slots[i]);
+		if (ks && ks->key_id == key_id) {
+			if (unlikely(!ovpn_crypto_key_slot_hold(ks)))
+				ks = NULL;
+			goto out;
+		}
 	}
 
-	/* when both key slots are occupied but no matching key ID is found, ks has to be reset to
-	 * NULL to avoid carrying a stale pointer
-	 */
+	/* no slot matches the key ID */
 	ks = NULL;
 out:
 	rcu_read_unlock();
@@ -114,7 +152,7 @@ ovpn_crypto_key_slot_primary(const struct ovpn_crypto_state *cs)
 	struct ovpn_crypto_key_slot *ks;
 
 	rcu_read_lock();
-	ks = rcu_dereference(cs->primary);
+	ks = rcu_dereference(cs->slots[READ_ONCE(cs->primary)]);
 	if (unlikely(ks && !ovpn_crypto_key_slot_hold(ks)))
 		ks = NULL;
 	rcu_read_unlock();
@@ -122,15 +160,10 @@ ovpn_crypto_key_slot_primary(const struct ovpn_crypto_state *cs)
 	return ks;
 }
 
-void ovpn_crypto_key_slot_release(struct kref *kref);
-
-static inline void ovpn_crypto_key_slot_put(struct ovpn_crypto_key_slot *ks)
-{
-	kref_put(&ks->refcount, ovpn_crypto_key_slot_release);
-}
+void ovpn_crypto_key_slot_release(struct percpu_ref *ref);
 
 int ovpn_crypto_state_reset(struct ovpn_crypto_state *cs,
-			    const struct ovpn_peer_key_reset *pkr);
+			    const struct ovpn_peer_key_reset *pkr, struct ovpn_peer *peer);
 
 void ovpn_crypto_key_slot_delete(struct ovpn_crypto_state *cs,
 				 enum ovpn_key_slot slot);
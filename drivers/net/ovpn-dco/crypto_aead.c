@@ -9,16 +9,24 @@
 
 #include "crypto_aead.h"
 #include "crypto.h"
+#include "offload.h"
+#include "ovpn.h"
+#include "peer.h"
 #include "pktid.h"
+#include "pool.h"
 #include "proto.h"
 #include "skb.h"
 
 #include <crypto/aead.h>
+#include <linux/percpu.h>
 #include <linux/skbuff.h>
 #include <linux/printk.h>
 
 #define AUTH_TAG_SIZE	16
 
+/* entries of each scatterlist of a crypto operation */
+#define OVPN_AEAD_SG_MAX (MAX_SKB_FRAGS + 2)
+
 static int ovpn_aead_encap_overhead(const struct ovpn_crypto_key_slot *ks)
 {
 	return  OVPN_OP_SIZE_V2 +			/* OP header size */
@@ -26,17 +34,300 @@ static int ovpn_aead_encap_overhead(const struct ovpn_crypto_key_slot *ks)
 		crypto_aead_authsize(ks->encrypt);	/* Auth Tag */
 }
 
-int ovpn_aead_encrypt(struct ovpn_crypto_key_slot *ks, struct sk_buff *skb, u32 peer_id)
+/* crypto API completion callbacks, handing the processed skb over to the
+ * data path
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+static void ovpn_aead_encrypt_done(struct crypto_async_request *areq, int ret)
+{
+	ovpn_encrypt_post(areq->data, ret);
+}
+
+static void ovpn_aead_decrypt_done(struct crypto_async_request *areq, int ret)
+{
+	ovpn_decrypt_post(areq->data, ret);
+}
+#else
+static void ovpn_aead_encrypt_done(void *data, int ret)
+{
+	ovpn_encrypt_post(data, ret);
+}
+
+static void ovpn_aead_decrypt_done(void *data, int ret)
+{
+	ovpn_decrypt_post(data, ret);
+}
+#endif
+
+/* Allocate the scratch area of a crypto operation.
+ *
+ * The destination skb of an out of place decryption, the IV, the aead_request
+ * (followed by the tfm private context) and the source and destination
+ * scatterlists are carved out of a single buffer, because they all have to
+ * outlive the submitting function when the request completes asynchronously.
+ * The scatterlists are always sized for the largest skb we can handle, so that
+ * scratch areas can be recycled across packets.
+ * Layout is modelled after esp_alloc_tmp().
+ */
+static void *ovpn_aead_crypto_tmp_alloc(struct crypto_aead *tfm, gfp_t gfp)
+{
+	unsigned int len;
+
+	len = sizeof(struct sk_buff *) + NONCE_SIZE;
+	len += crypto_aead_alignmask(tfm) & ~(crypto_tfm_ctx_alignment() - 1);
+	len = ALIGN(len, crypto_tfm_ctx_alignment());
+
+	len += sizeof(struct aead_request) + crypto_aead_reqsize(tfm);
+	len = ALIGN(len, __alignof__(struct scatterlist));
+
+	len += sizeof(struct scatterlist) * OVPN_AEAD_SG_MAX * 2;
+
+	return kmalloc(len, gfp);
+}
+
+/* Cache slot of a CPU whose scratch area is in use, as opposed to NULL for a
+ * CPU that did not run any crypto operation with this key yet
+ */
+#define OVPN_AEAD_TMP_TAKEN ((void *)1UL)
+
+/* Take the scratch area cached on the local CPU, if any, or allocate a new one.
+ * Caches are filled lazily, by the first operation completing on each CPU, so
+ * that a key only costs memory on the CPUs that actually use it.
+ * Allocating while the cached area is in use is accounted in the peer stats,
+ * as it should happen only when more requests than CPUs are in flight.
+ */
+static void *ovpn_aead_crypto_tmp_get(struct ovpn_peer *peer, void * __percpu *cache,
+				      struct crypto_aead *tfm, gfp_t gfp)
+{
+	void *tmp;
+
+	tmp = this_cpu_xchg(*cache, OVPN_AEAD_TMP_TAKEN);
+	if (likely(tmp && tmp != OVPN_AEAD_TMP_TAKEN))
+		return tmp;
+
+	if (tmp)
+		ovpn_peer_stats_increment_crypto_fallback(&peer->stats);
+
+	return ovpn_aead_crypto_tmp_alloc(tfm, gfp);
+}
+
+/* Allocation flags and request flags of a crypto operation, depending on
+ * whether the submitting context is allowed to sleep
+ */
+static gfp_t ovpn_aead_gfp(bool may_sleep)
+{
+	return may_sleep ? GFP_KERNEL : GFP_ATOMIC;
+}
+
+static u32 ovpn_aead_req_flags(bool may_sleep)
+{
+	return CRYPTO_TFM_REQ_MAY_BACKLOG | (may_sleep ? CRYPTO_TFM_REQ_MAY_SLEEP : 0);
+}
+
+/* Return scratch area to the local CPU cache, or free it if the slot is busy */
+static void ovpn_aead_crypto_tmp_put(void * __percpu *cache, void *tmp)
+{
+	void *old = this_cpu_cmpxchg(*cache, OVPN_AEAD_TMP_TAKEN, tmp);
+
+	if (old == OVPN_AEAD_TMP_TAKEN)
+		return;
+
+	/* completed on a CPU with an empty slot, e.g. by an async crypto engine */
+	if (old || this_cpu_cmpxchg(*cache, NULL, tmp))
+		kfree(tmp);
+}
+
+static int ovpn_aead_crypto_tmp_cache_init(void * __percpu **cache)
+{
+	/* zeroed, each CPU gets its scratch area on first use */
+	*cache = alloc_percpu(void *);
+	if (!*cache)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static void ovpn_aead_crypto_tmp_cache_free(void * __percpu *cache)
+{
+	int cpu;
+
+	if (!cache)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		void *tmp = *per_cpu_ptr(cache, cpu);
+
+		if (tmp != OVPN_AEAD_TMP_TAKEN)
+			kfree(tmp);
+	}
+	free_percpu(cache);
+}
+
+/* Release the scratch area attached to skb once its crypto operation is over */
+void ovpn_aead_encrypt_release(struct sk_buff *skb)
+{
+	void *tmp = OVPN_SKB_CB(skb)->crypto_tmp;
+
+	if (!tmp)
+		return;
+
+	ovpn_aead_crypto_tmp_put(OVPN_SKB_CB(skb)->ks->encrypt_tmp, tmp);
+	OVPN_SKB_CB(skb)->crypto_tmp = NULL;
+}
+
+static struct sk_buff **ovpn_aead_tmp_out(void *tmp)
+{
+	return tmp;
+}
+
+/* Replace the data of skb with the plaintext decrypted out of place into out.
+ * The skb itself is kept, as it may be referenced by the RX ring
+ */
+static void ovpn_aead_decrypt_swap(struct sk_buff *skb, struct sk_buff *out)
+{
+	out->dev = skb->dev;
+	out->skb_iif = skb->skb_iif;
+	out->mark = skb->mark;
+	out->priority = skb->priority;
+	out->tstamp = skb->tstamp;
+	skb_copy_queue_mapping(out, skb);
+	memcpy(out->cb, skb->cb, sizeof(skb->cb));
+
+	/* skb now shares the data of out, which becomes its only user */
+	skb_morph(skb, out);
+	consume_skb(out);
+}
+
+void ovpn_aead_decrypt_release(struct sk_buff *skb, int ret)
+{
+	void *tmp = OVPN_SKB_CB(skb)->crypto_tmp;
+	struct sk_buff *out;
+
+	if (!tmp)
+		return;
+
+	out = *ovpn_aead_tmp_out(tmp);
+	ovpn_aead_crypto_tmp_put(OVPN_SKB_CB(skb)->ks->decrypt_tmp, tmp);
+	OVPN_SKB_CB(skb)->crypto_tmp = NULL;
+
+	if (!out)
+		return;
+
+	if (unlikely(ret < 0)) {
+		kfree_skb(out);
+		return;
+	}
+
+	ovpn_aead_decrypt_swap(skb, out);
+}
+
+static u8 *ovpn_aead_tmp_iv(struct crypto_aead *tfm, void *tmp)
+{
+	return PTR_ALIGN((u8 *)tmp + sizeof(struct sk_buff *), crypto_aead_alignmask(tfm) + 1);
+}
+
+static struct aead_request *ovpn_aead_tmp_req(struct crypto_aead *tfm, u8 *iv)
+{
+	struct aead_request *req;
+
+	req = (void *)PTR_ALIGN(iv + NONCE_SIZE, crypto_tfm_ctx_alignment());
+	aead_request_set_tfm(req, tfm);
+
+	return req;
+}
+
+static struct scatterlist *ovpn_aead_tmp_sg(struct crypto_aead *tfm, struct aead_request *req)
+{
+	return (void *)ALIGN((unsigned long)(req + 1) + crypto_aead_reqsize(tfm),
+			     __alignof__(struct scatterlist));
+}
+
+/* Push the opcode, the packet ID and the room for the tag in front of the
+ * payload of skb in one go, leaving the nonce in iv
+ */
+static int ovpn_aead_push_header(struct sk_buff *skb, struct ovpn_crypto_key_slot *ks,
+				 const struct ovpn_peer *peer, unsigned int head_size, u8 *iv)
+{
+	__be32 *hdr;
+	u32 pktid;
+	int ret;
+
+	/* obtain packet ID, which is used both as a first
+	 * 4 bytes of nonce and last 4 bytes of associated data,
+	 * unless it was reserved when the packet was queued
+	 */
+	pktid = OVPN_SKB_CB(skb)->tx_pktid;
+	if (!pktid) {
+		ret = ovpn_pktid_xmit_next(&ks->pid_xmit, &pktid);
+		if (unlikely(ret < 0))
+			return ret;
+	}
+
+	/* concat 4 bytes packet id and 8 bytes nonce tail into 12 bytes nonce */
+	ovpn_pktid_aead_write(pktid, &ks->nonce_tail_xmit, iv);
+
+	/* packet op and packet id form the additional data, the tag follows */
+	hdr = __skb_push(skb, head_size);
+	BUILD_BUG_ON(sizeof(*hdr) != OVPN_OP_SIZE_V2 || sizeof(*hdr) != NONCE_WIRE_SIZE);
+	hdr[0] = htonl(ovpn_opcode_compose(OVPN_DATA_V2, ks->key_id, peer->id));
+	hdr[1] = htonl(pktid);
+
+	return 0;
+}
+
+/* Frame skb for the lower device, which encrypts it on transmission.
+ * Invoked under rcu_read_lock()
+ */
+static int ovpn_aead_encrypt_offload(struct sk_buff *skb, struct ovpn_crypto_key_slot *ks,
+				     const struct ovpn_peer *peer, unsigned int head_size)
 {
+	u8 iv[NONCE_SIZE];
+	int ret;
+
+	/* the tag is computed by the device */
+	ret = ovpn_aead_push_header(skb, ks, peer, head_size, iv);
+	if (unlikely(ret < 0))
+		return ret;
+
+	ret = ovpn_offload_tx(ks->offload, skb);
+	if (unlikely(ret < 0))
+		return ret;
+
+	OVPN_SKB_CB(skb)->offload = true;
+	return 0;
+}
+
+/* Whether skb is a single private buffer, which can be encrypted in place as it is.
+ * This is the common case for packets coming from the stack that fit the MTU
+ */
+static bool ovpn_aead_encrypt_linear(const struct sk_buff *skb)
+{
+	return !skb_is_nonlinear(skb) && !skb_cloned(skb);
+}
+
+/* Encrypt skb with the key slot stored in its control block.
+ *
+ * Return 0 if encryption completed synchronously, -EINPROGRESS or -EBUSY if
+ * the request was queued and ovpn_encrypt_post() will be invoked upon
+ * completion, or a negative error code otherwise.
+ * The scratch area is stored in OVPN_SKB_CB(skb)->crypto_tmp and is owned by
+ * the completion handler.
+ * may_sleep must be false when invoked from atomic context (i.e. inline mode).
+ */
+int ovpn_aead_encrypt(struct sk_buff *skb, bool may_sleep)
+{
+	struct ovpn_crypto_key_slot *ks = OVPN_SKB_CB(skb)->ks;
+	struct ovpn_peer *peer = OVPN_SKB_CB(skb)->peer;
 	const unsigned int tag_size = crypto_aead_authsize(ks->encrypt);
 	const unsigned int head_size = ovpn_aead_encap_overhead(ks);
-	struct scatterlist sg[MAX_SKB_FRAGS + 2];
-	DECLARE_CRYPTO_WAIT(wait);
 	struct aead_request *req;
 	struct sk_buff *trailer;
-	u8 iv[NONCE_SIZE];
+	struct scatterlist *sg;
+	unsigned int headroom;
 	int nfrags, ret;
-	u32 pktid, op;
+	bool linear;
+	void *tmp;
+	u8 *iv;
 
 	/* Sample AEAD header format:
 	 * 48000001 00000005 7e7046bd 444a7e28 cc6387b1 64a4d6c1 380275a...
@@ -46,23 +337,55 @@ int ovpn_aead_encrypt(struct ovpn_crypto_key_slot *ks, struct sk_buff *skb, u32
 	 */
 
 	/* check that there's enough headroom in the skb for packet
-	 * encapsulation, after adding network header and encryption overhead
+	 * encapsulation, after adding network header and encryption overhead.
+	 * The outer headers need exactly what the route to the peer requires
 	 */
-	if (unlikely(skb_cow_head(skb, OVPN_HEAD_ROOM + head_size)))
-		return -ENOBUFS;
+	headroom = READ_ONCE(peer->tx_headroom) + head_size;
+	if (unlikely(skb_headroom(skb) < headroom || skb_header_cloned(skb))) {
+		ovpn_peer_stats_increment_headroom_realloc(&peer->stats);
+		if (unlikely(skb_cow_head(skb, headroom)))
+			return -ENOBUFS;
+	}
 
-	/* get number of skb frags and ensure that packet data is writable */
-	nfrags = skb_cow_data(skb, 0, &trailer);
-	if (unlikely(nfrags < 0))
-		return nfrags;
+	/* the device encrypts on transmission, as long as the peer is routed through it */
+	if (ks->offload) {
+		rcu_read_lock();
+		if (ovpn_offload_tx_ok(ks->offload, READ_ONCE(peer->tx_ifindex))) {
+			ret = ovpn_aead_encrypt_offload(skb, ks, peer, head_size);
+			rcu_read_unlock();
+			return ret;
+		}
+		rcu_read_unlock();
+	}
 
-	if (unlikely(nfrags + 2 > ARRAY_SIZE(sg)))
-		return -ENOSPC;
+	/* linear packets are mapped as a single buffer, with nothing to
+	 * unshare: skb_cow_data() and skb_to_sgvec() are left to the others
+	 */
+	linear = ovpn_aead_encrypt_linear(skb);
+	if (likely(linear)) {
+		nfrags = 1;
+	} else {
+		/* get number of skb frags and ensure that packet data is writable */
+		nfrags = skb_cow_data(skb, 0, &trailer);
+		if (unlikely(nfrags < 0))
+			return nfrags;
+
+		if (unlikely(nfrags + 2 > OVPN_AEAD_SG_MAX))
+			return -ENOSPC;
+	}
 
-	req = aead_request_alloc(ks->encrypt, GFP_KERNEL);
-	if (unlikely(!req))
+	tmp = ovpn_aead_crypto_tmp_get(peer, ks->encrypt_tmp, ks->encrypt,
+				       ovpn_aead_gfp(may_sleep));
+	if (unlikely(!tmp))
 		return -ENOMEM;
 
+	/* from now on the scratch area is released by ovpn_encrypt_post() */
+	OVPN_SKB_CB(skb)->crypto_tmp = tmp;
+
+	iv = ovpn_aead_tmp_iv(ks->encrypt, tmp);
+	req = ovpn_aead_tmp_req(ks->encrypt, iv);
+	sg = ovpn_aead_tmp_sg(ks->encrypt, req);
+
 	/* sg table:
 	 * 0: op, wire nonce (AD, len=OVPN_OP_SIZE_V2+NONCE_WIRE_SIZE),
 	 * 1, 2, 3, ..., n: payload,
@@ -70,70 +393,69 @@ int ovpn_aead_encrypt(struct ovpn_crypto_key_slot *ks, struct sk_buff *skb, u32
 	 */
 	sg_init_table(sg, nfrags + 2);
 
-	/* build scatterlist to encrypt packet payload */
-	ret = skb_to_sgvec_nomark(skb, sg + 1, 0, skb->len);
-	if (unlikely(nfrags != ret)) {
-		ret = -EINVAL;
-		goto free_req;
-	}
-
-	/* append auth_tag onto scatterlist */
-	__skb_push(skb, tag_size);
-	sg_set_buf(sg + nfrags + 1, skb->data, tag_size);
-
-	/* obtain packet ID, which is used both as a first
-	 * 4 bytes of nonce and last 4 bytes of associated data.
-	 */
-	ret = ovpn_pktid_xmit_next(&ks->pid_xmit, &pktid);
+	ret = ovpn_aead_push_header(skb, ks, peer, head_size, iv);
 	if (unlikely(ret < 0))
-		goto free_req;
-
-	/* concat 4 bytes packet id and 8 bytes nonce tail into 12 bytes nonce */
-	ovpn_pktid_aead_write(pktid, &ks->nonce_tail_xmit, iv);
-
-	/* make space for packet id and push it to the front */
-	__skb_push(skb, NONCE_WIRE_SIZE);
-	memcpy(skb->data, iv, NONCE_WIRE_SIZE);
-
-	/* add packet op as head of additional data */
-	op = ovpn_opcode_compose(OVPN_DATA_V2, ks->key_id, peer_id);
-	__skb_push(skb, OVPN_OP_SIZE_V2);
-	BUILD_BUG_ON(sizeof(op) != OVPN_OP_SIZE_V2);
-	*((__force __be32 *)skb->data) = htonl(op);
+		return ret;
 
 	/* AEAD Additional data */
 	sg_set_buf(sg, skb->data, OVPN_OP_SIZE_V2 + NONCE_WIRE_SIZE);
 
+	/* build scatterlist to encrypt packet payload */
+	if (likely(linear)) {
+		sg_set_buf(sg + 1, skb->data + head_size, skb->len - head_size);
+	} else {
+		ret = skb_to_sgvec_nomark(skb, sg + 1, head_size, skb->len - head_size);
+		if (unlikely(nfrags != ret))
+			return -EINVAL;
+	}
+
+	/* append auth_tag onto scatterlist */
+	sg_set_buf(sg + nfrags + 1, skb->data + OVPN_OP_SIZE_V2 + NONCE_WIRE_SIZE, tag_size);
+
 	/* setup async crypto operation */
-	aead_request_set_tfm(req, ks->encrypt);
-	aead_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG |
-				       CRYPTO_TFM_REQ_MAY_SLEEP,
-				  crypto_req_done, &wait);
+	aead_request_set_callback(req, ovpn_aead_req_flags(may_sleep), ovpn_aead_encrypt_done,
+				  skb);
 	aead_request_set_crypt(req, sg, sg, skb->len - head_size, iv);
 	aead_request_set_ad(req, OVPN_OP_SIZE_V2 + NONCE_WIRE_SIZE);
 
 	/* encrypt it */
-	ret = crypto_wait_req(crypto_aead_encrypt(req), &wait);
-	if (ret < 0)
-		net_err_ratelimited("%s: encrypt failed: %d\n", __func__, ret);
+	return crypto_aead_encrypt(req);
+}
 
-free_req:
-	aead_request_free(req);
-	return ret;
+/* Whether skb_cow_data() would copy the whole packet, i.e. it is shared or paged:
+ * such packets are better decrypted out of place. Frag lists are left to
+ * skb_cow_data(), as they may not fit the scatterlist as they are
+ */
+static bool ovpn_aead_decrypt_oop(const struct sk_buff *skb)
+{
+	return (skb_cloned(skb) || skb_is_nonlinear(skb)) && !skb_has_frag_list(skb);
 }
 
-int ovpn_aead_decrypt(struct ovpn_crypto_key_slot *ks, struct sk_buff *skb)
+/* Decrypt skb with the key slot stored in its control block.
+ *
+ * Shared or paged packets are decrypted out of place into a new skb, drawn from
+ * the page pool, whose data replaces the original one upon completion, rather
+ * than being copied first by skb_cow_data().
+ *
+ * Return values follow the same convention as ovpn_aead_encrypt(), with
+ * ovpn_decrypt_post() acting as completion handler.
+ * Replay protection is performed by the completion handler, because the
+ * packet ID can be trusted only once the packet has been authenticated.
+ */
+int ovpn_aead_decrypt(struct sk_buff *skb, bool may_sleep)
 {
+	struct ovpn_crypto_key_slot *ks = OVPN_SKB_CB(skb)->ks;
 	const unsigned int tag_size = crypto_aead_authsize(ks->decrypt);
-	struct scatterlist sg[MAX_SKB_FRAGS + 2];
+	struct scatterlist *sg, *dst;
 	int ret, payload_len, nfrags;
-	u8 *sg_data, iv[NONCE_SIZE];
 	unsigned int payload_offset;
-	DECLARE_CRYPTO_WAIT(wait);
 	struct aead_request *req;
 	struct sk_buff *trailer;
+	struct sk_buff *out;
 	unsigned int sg_len;
-	__be32 *pid;
+	u8 *sg_data, *iv;
+	bool oop;
+	void *tmp;
 
 	payload_offset = OVPN_OP_SIZE_V2 + NONCE_WIRE_SIZE + tag_size;
 	payload_len = skb->len - payload_offset;
@@ -148,18 +470,46 @@ int ovpn_aead_decrypt(struct ovpn_crypto_key_slot *ks, struct sk_buff *skb)
 	if (unlikely(!pskb_may_pull(skb, payload_offset)))
 		return -ENODATA;
 
-	/* get number of skb frags and ensure that packet data is writable */
-	nfrags = skb_cow_data(skb, 0, &trailer);
-	if (unlikely(nfrags < 0))
-		return nfrags;
+	/* decrypted and authenticated in place by the device */
+	if (ks->offload) {
+		rcu_read_lock();
+		ret = ovpn_offload_rx(ks->offload, skb);
+		rcu_read_unlock();
+		if (ret != -EOPNOTSUPP) {
+			OVPN_SKB_CB(skb)->payload_offset = payload_offset;
+			return ret;
+		}
+	}
+
+	oop = ovpn_aead_decrypt_oop(skb);
+	if (oop) {
+		/* the source is only read: map it as it is */
+		nfrags = skb_shinfo(skb)->nr_frags + (skb_headlen(skb) > payload_offset);
+	} else {
+		/* get number of skb frags and ensure that packet data is writable */
+		nfrags = skb_cow_data(skb, 0, &trailer);
+		if (unlikely(nfrags < 0))
+			return nfrags;
+	}
 
-	if (unlikely(nfrags + 2 > ARRAY_SIZE(sg)))
+	if (unlikely(nfrags + 2 > OVPN_AEAD_SG_MAX))
 		return -ENOSPC;
 
-	req = aead_request_alloc(ks->decrypt, GFP_KERNEL);
-	if (unlikely(!req))
+	tmp = ovpn_aead_crypto_tmp_get(OVPN_SKB_CB(skb)->peer, ks->decrypt_tmp, ks->decrypt,
+				       ovpn_aead_gfp(may_sleep));
+	if (unlikely(!tmp))
 		return -ENOMEM;
 
+	/* from now on the scratch area is released by ovpn_decrypt_post() */
+	*ovpn_aead_tmp_out(tmp) = NULL;
+	OVPN_SKB_CB(skb)->crypto_tmp = tmp;
+	OVPN_SKB_CB(skb)->payload_offset = payload_offset;
+
+	iv = ovpn_aead_tmp_iv(ks->decrypt, tmp);
+	req = ovpn_aead_tmp_req(ks->decrypt, iv);
+	sg = ovpn_aead_tmp_sg(ks->decrypt, req);
+	dst = sg;
+
 	/* sg table:
 	 * 0: op, wire nonce (AD, len=OVPN_OP_SIZE_V2+NONCE_WIRE_SIZE),
 	 * 1, 2, 3, ..., n: payload,
@@ -174,47 +524,53 @@ int ovpn_aead_decrypt(struct ovpn_crypto_key_slot *ks, struct sk_buff *skb)
 
 	/* build scatterlist to decrypt packet payload */
 	ret = skb_to_sgvec_nomark(skb, sg + 1, payload_offset, payload_len);
-	if (unlikely(nfrags != ret)) {
-		ret = -EINVAL;
-		goto free_req;
-	}
+	if (unlikely(nfrags != ret))
+		return -EINVAL;
 
 	/* append auth_tag onto scatterlist */
 	sg_set_buf(sg + nfrags + 1, skb->data + sg_len, tag_size);
 
+	if (oop) {
+		/* the destination carries the AD too, so that the decrypted packet
+		 * looks the same as after an in place decryption
+		 */
+		out = ovpn_pool_alloc_skb(OVPN_SKB_CB(skb)->peer, NET_SKB_PAD, sg_len + payload_len,
+					  ovpn_aead_gfp(may_sleep));
+		if (unlikely(!out))
+			return -ENOMEM;
+
+		/* from now on out is released or swapped in by ovpn_aead_decrypt_release() */
+		*ovpn_aead_tmp_out(tmp) = out;
+		memcpy(out->data, sg_data, sg_len);
+		OVPN_SKB_CB(skb)->payload_offset = sg_len;
+
+		dst = sg + OVPN_AEAD_SG_MAX;
+		sg_init_table(dst, OVPN_AEAD_SG_MAX);
+		ret = skb_to_sgvec(out, dst, 0, out->len);
+		if (unlikely(ret < 0))
+			return ret;
+	}
+
 	/* copy nonce into IV buffer */
 	memcpy(iv, skb->data + OVPN_OP_SIZE_V2, NONCE_WIRE_SIZE);
 	memcpy(iv + NONCE_WIRE_SIZE, ks->nonce_tail_recv.u8,
 	       sizeof(struct ovpn_nonce_tail));
 
 	/* setup async crypto operation */
-	aead_request_set_tfm(req, ks->decrypt);
-	aead_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG |
-				       CRYPTO_TFM_REQ_MAY_SLEEP,
-				  crypto_req_done, &wait);
-	aead_request_set_crypt(req, sg, sg, payload_len + tag_size, iv);
+	aead_request_set_callback(req, ovpn_aead_req_flags(may_sleep), ovpn_aead_decrypt_done,
+				  skb);
+	aead_request_set_crypt(req, sg, dst, payload_len + tag_size, iv);
 
 	aead_request_set_ad(req, NONCE_WIRE_SIZE + OVPN_OP_SIZE_V2);
 
 	/* decrypt it */
-	ret = crypto_wait_req(crypto_aead_decrypt(req), &wait);
-	if (ret < 0) {
-		net_err_ratelimited("%s: decrypt failed: %d\n", __func__, ret);
-		goto free_req;
-	}
-
-	/* PID sits after the op */
-	pid = (__force __be32 *)(skb->data + OVPN_OP_SIZE_V2);
-	ret = ovpn_pktid_recv(&ks->pid_recv, ntohl(*pid), 0);
-	if (unlikely(ret < 0))
-		goto free_req;
-
-	/* point to encapsulated IP packet */
-	__skb_pull(skb, payload_offset);
+	return crypto_aead_decrypt(req);
+}
 
-free_req:
-	aead_request_free(req);
-	return ret;
+/* Return true if the tfm never defers requests to another context */
+static bool ovpn_aead_is_sync(struct crypto_aead *tfm)
+{
+	return !(crypto_aead_alg(tfm)->base.cra_flags & CRYPTO_ALG_ASYNC);
 }
 
 /* Initialize a struct crypto_aead object */
@@ -257,6 +613,7 @@ struct crypto_aead *ovpn_aead_init(const char *title, const char *alg_name,
 	pr_debug("*** block size=%u\n", crypto_aead_blocksize(aead));
 	pr_debug("*** auth size=%u\n", crypto_aead_authsize(aead));
 	pr_debug("*** alignmask=0x%x\n", crypto_aead_alignmask(aead));
+	pr_debug("*** sync=%d\n", ovpn_aead_is_sync(aead));
 
 	return aead;
 
@@ -270,8 +627,12 @@ void ovpn_aead_crypto_key_slot_destroy(struct ovpn_crypto_key_slot *ks)
 	if (!ks)
 		return;
 
+	ovpn_offload_sa_release(ks->offload);
+	ovpn_aead_crypto_tmp_cache_free(ks->encrypt_tmp);
+	ovpn_aead_crypto_tmp_cache_free(ks->decrypt_tmp);
 	crypto_free_aead(ks->encrypt);
 	crypto_free_aead(ks->decrypt);
+	percpu_ref_exit(&ks->refcount);
 	kfree(ks);
 }
 
@@ -310,9 +671,18 @@ ovpn_aead_crypto_key_slot_init(enum ovpn_cipher_alg alg,
 
 	ks->encrypt = NULL;
 	ks->decrypt = NULL;
-	kref_init(&ks->refcount);
+	ks->encrypt_tmp = NULL;
+	ks->decrypt_tmp = NULL;
+	ks->offload = NULL;
 	ks->key_id = key_id;
 
+	/* the reference owned by the crypto state */
+	ret = percpu_ref_init(&ks->refcount, ovpn_crypto_key_slot_release, 0, GFP_KERNEL);
+	if (ret < 0) {
+		kfree(ks);
+		return ERR_PTR(ret);
+	}
+
 	ks->encrypt = ovpn_aead_init("encrypt", alg_name, encrypt_key,
 				     encrypt_keylen);
 	if (IS_ERR(ks->encrypt)) {
@@ -329,12 +699,25 @@ ovpn_aead_crypto_key_slot_init(enum ovpn_cipher_alg alg,
 		goto destroy_ks;
 	}
 
+	ret = ovpn_aead_crypto_tmp_cache_init(&ks->encrypt_tmp);
+	if (ret < 0)
+		goto destroy_ks;
+
+	ret = ovpn_aead_crypto_tmp_cache_init(&ks->decrypt_tmp);
+	if (ret < 0)
+		goto destroy_ks;
+
 	if (sizeof(struct ovpn_nonce_tail) != encrypt_nonce_tail_len ||
 	    sizeof(struct ovpn_nonce_tail) != decrypt_nonce_tail_len) {
 		ret = -EINVAL;
 		goto destroy_ks;
 	}
 
+	/* the inline crypto mode runs this key in softirq context only if
+	 * requests complete right away
+	 */
+	ks->sync = ovpn_aead_is_sync(ks->encrypt) && ovpn_aead_is_sync(ks->decrypt);
+
 	memcpy(ks->nonce_tail_xmit.u8, encrypt_nonce_tail,
 	       sizeof(struct ovpn_nonce_tail));
 	memcpy(ks->nonce_tail_recv.u8, decrypt_nonce_tail,
@@ -18,8 +18,10 @@
 struct crypto_aead *ovpn_aead_init(const char *title, const char *alg_name,
 				   const unsigned char *key, unsigned int keylen);
 
-int ovpn_aead_encrypt(struct ovpn_crypto_key_slot *ks, struct sk_buff *skb, u32 peer_id);
-int ovpn_aead_decrypt(struct ovpn_crypto_key_slot *ks, struct sk_buff *skb);
+int ovpn_aead_encrypt(struct sk_buff *skb, bool may_sleep);
+int ovpn_aead_decrypt(struct sk_buff *skb, bool may_sleep);
+void ovpn_aead_encrypt_release(struct sk_buff *skb);
+void ovpn_aead_decrypt_release(struct sk_buff *skb, int ret);
 
 struct ovpn_crypto_key_slot *ovpn_aead_crypto_key_slot_new(const struct ovpn_key_config *kc);
 void ovpn_aead_crypto_key_slot_destroy(struct ovpn_crypto_key_slot *ks);
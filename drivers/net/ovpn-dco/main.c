@@ -9,9 +9,13 @@
 
 #include "main.h"
 
+#include "bench.h"
 #include "ovpn.h"
 #include "ovpnstruct.h"
 #include "netlink.h"
+#include "offload.h"
+#include "peer.h"
+#include "udp.h"
 
 #include <linux/ethtool.h>
 #include <linux/genetlink.h>
@@ -34,17 +38,44 @@
 #define DRV_DESCRIPTION	"OpenVPN data channel offload (ovpn-dco)"
 #define DRV_COPYRIGHT	"(C) 2020-2022 OpenVPN, Inc."
 
+/* Safe to repeat, as ovpn_newlink() may have to after a register_netdevice() failure */
+static void ovpn_struct_free_workers(struct ovpn_struct *ovpn)
+{
+	if (ovpn->crypto_exec != OVPN_CRYPTO_EXEC_KTHREAD)
+		return;
+
+	ovpn_crypto_workers_free(&ovpn->workers);
+	ovpn->crypto_exec = OVPN_CRYPTO_EXEC_WORKQUEUE;
+}
+
+/* Same as ovpn_struct_free_workers(), no packet must be left in the queues */
+static void ovpn_struct_free_parallel(struct ovpn_struct *ovpn)
+{
+	if (!ovpn->parallel_crypto)
+		return;
+
+	ovpn_parallel_queue_free(&ovpn->encrypt_queue);
+	ovpn_parallel_queue_free(&ovpn->decrypt_queue);
+	ovpn->parallel_crypto = false;
+}
+
 static void ovpn_struct_free(struct net_device *net)
 {
 	struct ovpn_struct *ovpn = netdev_priv(net);
 
 	security_tun_dev_free_security(ovpn->security);
 	free_percpu(net->tstats);
+	ovpn_netlink_uninit(ovpn);
 	flush_workqueue(ovpn->crypto_wq);
 	flush_workqueue(ovpn->events_wq);
 	destroy_workqueue(ovpn->crypto_wq);
 	destroy_workqueue(ovpn->events_wq);
+	ovpn_struct_free_parallel(ovpn);
+	ovpn_struct_free_workers(ovpn);
+	ovpn_route_table_release(&ovpn->routes);
+	ovpn_peers_destroy(ovpn);
 	rcu_barrier();
+	ovpn_page_pools_free(&ovpn->page_pools);
 }
 
 /* Net device open */
@@ -158,12 +189,117 @@ static void ovpn_setup(struct net_device *dev)
 static const struct nla_policy ovpn_policy[IFLA_OVPN_MAX + 1] = {
 	[IFLA_OVPN_MODE] = NLA_POLICY_RANGE(NLA_U8, __OVPN_MODE_FIRST,
 					    __OVPN_MODE_AFTER_LAST - 1),
+	[IFLA_OVPN_PARALLEL_CRYPTO] = NLA_POLICY_MAX(NLA_U8, 1),
+	[IFLA_OVPN_BATCH_SIZE] = NLA_POLICY_RANGE(NLA_U16, 1, OVPN_BATCH_MAX),
+	[IFLA_OVPN_CRYPTO_EXEC] = NLA_POLICY_RANGE(NLA_U8, __OVPN_CRYPTO_EXEC_FIRST,
+						   __OVPN_CRYPTO_EXEC_AFTER_LAST - 1),
+	[IFLA_OVPN_CRYPTO_CPUS] = { .type = NLA_BINARY },
+	[IFLA_OVPN_TX_STEERING] = NLA_POLICY_MAX(NLA_U8, 1),
+	[IFLA_OVPN_LATENCY_STATS] = NLA_POLICY_MAX(NLA_U8, 1),
+	[IFLA_OVPN_STATS_INTERVAL] = { .type = NLA_U16 },
+	[IFLA_OVPN_PEER_NOTIFY] = NLA_POLICY_MAX(NLA_U8, 1),
 };
 
+static void ovpn_set_batch_size(struct ovpn_struct *ovpn, struct nlattr *data[])
+{
+	if (!data || !data[IFLA_OVPN_BATCH_SIZE])
+		return;
+
+	/* read locklessly by the crypto workers */
+	WRITE_ONCE(ovpn->batch_size, nla_get_u16(data[IFLA_OVPN_BATCH_SIZE]));
+	netdev_dbg(ovpn->dev, "%s: setting device (%s) batch size: %u\n", __func__,
+		   ovpn->dev->name, ovpn->batch_size);
+}
+
+static void ovpn_set_tx_steering(struct ovpn_struct *ovpn, struct nlattr *data[])
+{
+	if (!data || !data[IFLA_OVPN_TX_STEERING])
+		return;
+
+	/* read locklessly by the xmit path */
+	WRITE_ONCE(ovpn->tx_steering, !!nla_get_u8(data[IFLA_OVPN_TX_STEERING]));
+	netdev_dbg(ovpn->dev, "%s: setting device (%s) TX steering: %u\n", __func__,
+		   ovpn->dev->name, ovpn->tx_steering);
+}
+
+static void ovpn_set_latency_stats(struct ovpn_struct *ovpn, struct nlattr *data[])
+{
+	if (!data || !data[IFLA_OVPN_LATENCY_STATS])
+		return;
+
+	/* read locklessly by the data path */
+	WRITE_ONCE(ovpn->latency_stats, !!nla_get_u8(data[IFLA_OVPN_LATENCY_STATS]));
+	netdev_dbg(ovpn->dev, "%s: setting device (%s) latency stats: %u\n", __func__,
+		   ovpn->dev->name, ovpn->latency_stats);
+
+	/* histograms are allocated only once needed, and kept until the peer goes */
+	if (ovpn->latency_stats)
+		ovpn_peers_latency_stats_init(ovpn);
+}
+
+static void ovpn_set_peer_notify(struct ovpn_struct *ovpn, struct nlattr *data[])
+{
+	if (!data || !data[IFLA_OVPN_PEER_NOTIFY])
+		return;
+
+	/* read locklessly when adding peers */
+	WRITE_ONCE(ovpn->peer_notify, !!nla_get_u8(data[IFLA_OVPN_PEER_NOTIFY]));
+	netdev_dbg(ovpn->dev, "%s: setting device (%s) peer notifications: %u\n", __func__,
+		   ovpn->dev->name, ovpn->peer_notify);
+}
+
+/* Must be called once the device is registered, as the reports carry its index */
+static void ovpn_set_stats_interval(struct ovpn_struct *ovpn, struct nlattr *data[])
+{
+	if (!data || !data[IFLA_OVPN_STATS_INTERVAL])
+		return;
+
+	ovpn_netlink_set_stats_interval(ovpn, nla_get_u16(data[IFLA_OVPN_STATS_INTERVAL]));
+	netdev_dbg(ovpn->dev, "%s: setting device (%s) stats interval: %u\n", __func__,
+		   ovpn->dev->name, ovpn->nl_stats.interval);
+}
+
+/* Start the per-CPU crypto workers on the CPUs set in the IFLA_OVPN_CRYPTO_CPUS
+ * bitmap, or on all online CPUs if missing
+ */
+static int ovpn_newlink_kthread(struct ovpn_struct *ovpn, struct nlattr *data[],
+				struct netlink_ext_ack *extack)
+{
+	cpumask_var_t mask;
+	const u8 *bits;
+	int cpu, len, ret;
+
+	if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	if (data[IFLA_OVPN_CRYPTO_CPUS]) {
+		bits = nla_data(data[IFLA_OVPN_CRYPTO_CPUS]);
+		len = nla_len(data[IFLA_OVPN_CRYPTO_CPUS]) * BITS_PER_BYTE;
+
+		for (cpu = 0; cpu < min_t(int, len, nr_cpu_ids); cpu++)
+			if (bits[cpu / BITS_PER_BYTE] & BIT(cpu % BITS_PER_BYTE))
+				cpumask_set_cpu(cpu, mask);
+	} else {
+		cpumask_copy(mask, cpu_online_mask);
+	}
+
+	ret = ovpn_crypto_workers_init(&ovpn->workers, mask, ovpn->dev->name);
+	free_cpumask_var(mask);
+	if (ret < 0) {
+		NL_SET_ERR_MSG(extack, "cannot start crypto workers on the requested CPUs");
+		return ret;
+	}
+
+	ovpn->crypto_exec = OVPN_CRYPTO_EXEC_KTHREAD;
+
+	return 0;
+}
+
 static int ovpn_newlink(struct net *src_net, struct net_device *dev, struct nlattr *tb[],
 			struct nlattr *data[], struct netlink_ext_ack *extack)
 {
 	struct ovpn_struct *ovpn = netdev_priv(dev);
+	enum ovpn_crypto_exec crypto_exec;
 	int ret;
 
 	ret = security_tun_dev_create();
@@ -181,19 +317,121 @@ static int ovpn_newlink(struct net *src_net, struct net_device *dev, struct nlat
 			   ovpn->mode);
 	}
 
-	return register_netdevice(dev);
+	if (ovpn->mode == OVPN_MODE_MP) {
+		ret = ovpn_route_table_start(&ovpn->routes, dev_net(dev));
+		if (ret < 0) {
+			NL_SET_ERR_MSG(extack, "cannot register FIB notifier");
+			return ret;
+		}
+	}
+
+	crypto_exec = OVPN_CRYPTO_EXEC_WORKQUEUE;
+	if (data && data[IFLA_OVPN_CRYPTO_EXEC])
+		crypto_exec = nla_get_u8(data[IFLA_OVPN_CRYPTO_EXEC]);
+
+	if (crypto_exec != OVPN_CRYPTO_EXEC_WORKQUEUE && data[IFLA_OVPN_PARALLEL_CRYPTO] &&
+	    nla_get_u8(data[IFLA_OVPN_PARALLEL_CRYPTO])) {
+		NL_SET_ERR_MSG(extack, "parallel crypto requires the workqueue exec mode");
+		ret = -EINVAL;
+		goto err_routes;
+	}
+
+	if (crypto_exec == OVPN_CRYPTO_EXEC_KTHREAD) {
+		ret = ovpn_newlink_kthread(ovpn, data, extack);
+		if (ret < 0)
+			goto err_routes;
+
+		netdev_dbg(dev, "%s: running crypto in per-CPU kthreads on device %s\n", __func__,
+			   dev->name);
+	} else if (data && data[IFLA_OVPN_CRYPTO_CPUS]) {
+		NL_SET_ERR_MSG(extack, "crypto CPUs require the kthread exec mode");
+		ret = -EINVAL;
+		goto err_routes;
+	}
+
+	if (crypto_exec == OVPN_CRYPTO_EXEC_INLINE) {
+		ovpn->crypto_exec = OVPN_CRYPTO_EXEC_INLINE;
+		netdev_dbg(dev, "%s: running crypto inline when possible on device %s\n",
+			   __func__, dev->name);
+	}
+
+	if (data && data[IFLA_OVPN_PARALLEL_CRYPTO] &&
+	    nla_get_u8(data[IFLA_OVPN_PARALLEL_CRYPTO])) {
+		ret = ovpn_struct_init_parallel(ovpn);
+		if (ret < 0)
+			goto err_workers;
+
+		netdev_dbg(dev, "%s: enabling parallel crypto on device %s\n", __func__,
+			   dev->name);
+	}
+
+	ovpn_set_batch_size(ovpn, data);
+	ovpn_set_tx_steering(ovpn, data);
+	ovpn_set_latency_stats(ovpn, data);
+	ovpn_set_peer_notify(ovpn, data);
+
+	/* register_netdevice() may have already run the destructor when failing: every step
+	 * of the unwinding below must be safe to repeat
+	 */
+	ret = register_netdevice(dev);
+	if (ret < 0)
+		goto err_parallel;
+
+	queue_delayed_work(ovpn->events_wq, &ovpn->keepalive_work,
+			   round_jiffies_relative(OVPN_KEEPALIVE_SWEEP_INTERVAL));
+	ovpn_set_stats_interval(ovpn, data);
+
+	return 0;
+
+err_parallel:
+	ovpn_struct_free_parallel(ovpn);
+err_workers:
+	ovpn_struct_free_workers(ovpn);
+err_routes:
+	/* no-op in P2P mode */
+	ovpn_route_table_release(&ovpn->routes);
+	return ret;
+}
+
+static int ovpn_changelink(struct net_device *dev, struct nlattr *tb[], struct nlattr *data[],
+			   struct netlink_ext_ack *extack)
+{
+	struct ovpn_struct *ovpn = netdev_priv(dev);
+
+	if (data && ((data[IFLA_OVPN_MODE] && nla_get_u8(data[IFLA_OVPN_MODE]) != ovpn->mode) ||
+		     (data[IFLA_OVPN_PARALLEL_CRYPTO] &&
+		      !!nla_get_u8(data[IFLA_OVPN_PARALLEL_CRYPTO]) != ovpn->parallel_crypto) ||
+		     (data[IFLA_OVPN_CRYPTO_EXEC] &&
+		      nla_get_u8(data[IFLA_OVPN_CRYPTO_EXEC]) != ovpn->crypto_exec) ||
+		     data[IFLA_OVPN_CRYPTO_CPUS])) {
+		NL_SET_ERR_MSG(extack, "mode and crypto execution cannot be changed at runtime");
+		return -EOPNOTSUPP;
+	}
+
+	ovpn_set_batch_size(ovpn, data);
+	ovpn_set_tx_steering(ovpn, data);
+	ovpn_set_latency_stats(ovpn, data);
+	ovpn_set_peer_notify(ovpn, data);
+	ovpn_set_stats_interval(ovpn, data);
+
+	return 0;
 }
 
 static void ovpn_dellink(struct net_device *dev, struct list_head *head)
 {
 	struct ovpn_struct *ovpn = netdev_priv(dev);
 
+	/* the sweep re-arms itself, stop it before it can see peers being released */
+	cancel_delayed_work_sync(&ovpn->keepalive_work);
+	cancel_delayed_work_sync(&ovpn->nl_stats.work);
+
 	switch (ovpn->mode) {
 	case OVPN_MODE_P2P:
 		ovpn_peer_release_p2p(ovpn);
 		break;
 	default:
 		ovpn_peers_free(ovpn);
+		ovpn_udp_shards_release(ovpn);
 		break;
 	}
 
@@ -220,6 +458,7 @@ static struct rtnl_link_ops ovpn_link_ops __read_mostly = {
 	.policy			= ovpn_policy,
 	.maxtype		= IFLA_OVPN_MAX,
 	.newlink		= ovpn_newlink,
+	.changelink		= ovpn_changelink,
 	.dellink		= ovpn_dellink,
 	.get_num_tx_queues	= ovpn_num_queues,
 	.get_num_rx_queues	= ovpn_num_queues,
@@ -231,23 +470,41 @@ static int __init ovpn_init(void)
 
 	pr_info("%s %s -- %s\n", DRV_DESCRIPTION, DRV_VERSION, DRV_COPYRIGHT);
 
+	err = ovpn_peer_cache_init();
+	if (err) {
+		pr_err("ovpn: can't create peer cache\n");
+		goto err;
+	}
+
 	/* init RTNL link ops */
 	err = rtnl_link_register(&ovpn_link_ops);
 	if (err) {
 		pr_err("ovpn: can't register RTNL link ops\n");
-		goto err;
+		goto err_peer_cache;
+	}
+
+	err = ovpn_offload_init();
+	if (err) {
+		pr_err("ovpn: can't create offload workqueue\n");
+		goto err_rtnl_unregister;
 	}
 
 	err = ovpn_netlink_register();
 	if (err) {
 		pr_err("ovpn: can't register netlink family\n");
-		goto err_rtnl_unregister;
+		goto err_offload;
 	}
 
+	ovpn_bench_run();
+
 	return 0;
 
+err_offload:
+	ovpn_offload_exit();
 err_rtnl_unregister:
 	rtnl_link_unregister(&ovpn_link_ops);
+err_peer_cache:
+	ovpn_peer_cache_destroy();
 err:
 	pr_err("ovpn: initialization failed, error status=%d\n", err);
 	return err;
@@ -258,6 +515,8 @@ static __exit void ovpn_cleanup(void)
 	rtnl_link_unregister(&ovpn_link_ops);
 	ovpn_netlink_unregister();
 	rcu_barrier(); /* because we use call_rcu */
+	ovpn_offload_exit();
+	ovpn_peer_cache_destroy();
 }
 
 module_init(ovpn_init);
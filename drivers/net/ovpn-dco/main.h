@@ -34,6 +34,58 @@ bool ovpn_dev_is_valid(const struct net_device *dev);
 #define OVPN_HEAD_ROOM ALIGN(16 + SKB_HEADER_LEN, 4)
 #define OVPN_MAX_PADDING 16
 #define OVPN_QUEUE_LEN 1024
+/* initial size of the per-peer rings, which grow up to OVPN_QUEUE_LEN on demand */
+#define OVPN_QUEUE_LEN_IDLE 16
 #define OVPN_MAX_TUN_QUEUE_LEN 0x10000
 
+/* period of the sweep sending pings and expiring peers, bounding the keepalive accuracy */
+#define OVPN_KEEPALIVE_SWEEP_INTERVAL HZ
+
+/* number of peers checked by the keepalive sweep under a single RCU read-side section */
+#define OVPN_KEEPALIVE_SWEEP_CHUNK 64
+
+/* largest payload of a UDP GSO skb that still fits the UDP and IP length fields */
+#define OVPN_UDP_GSO_MAX_LEN (U16_MAX - sizeof(struct udphdr) -                \
+			      max(sizeof(struct iphdr), sizeof(struct ipv6hdr)))
+
+/* number of packets pulled at once from a ring by the crypto workers. The default can be
+ * changed at runtime up to OVPN_BATCH_MAX
+ */
+#define OVPN_BATCH_SIZE 16
+#define OVPN_BATCH_MAX 64
+
+/* keys left with fewer packet IDs than this are neither used in inline crypto mode nor to
+ * reserve packet IDs at queue time: packets are then handled one by one by the crypto
+ * workers, which are allowed to sleep and hence to kill the exhausted key
+ */
+#define OVPN_INLINE_PKTID_MARGIN (1U << 24)
+
+/* max number of destinations resolved through the FIB and cached in the route table */
+#define OVPN_ROUTE_CACHE_MAX 4096
+
+/* max number of datagrams aggregated by UDP GRO into a single train */
+#define OVPN_UDP_GRO_MAX_SEGS 64
+
+/* pages cached by each per-CPU page pool of an interface */
+#define OVPN_PAGE_POOL_SIZE 256
+
+/* max number of packets waiting to be delivered to userspace in batches */
+#define OVPN_NL_PACKETS_QUEUE_LEN 1024
+
+/* size of an OVPN_CMD_PACKETS message delivering a batch to userspace */
+#define OVPN_NL_PACKETS_MSG_SIZE (16 * 1024)
+
+/* max number of reuseport UDP sockets sharing the transport load of an interface */
+#define OVPN_UDP_SHARDS_MAX 64
+
+/* number of OVPN_CMD_NEW_PEERS or OVPN_CMD_DEL_PEERS entries applied to the peer tables
+ * under a single acquisition of their locks
+ */
+#define OVPN_PEERS_BATCH 64
+
+/* max number of failed entries listed in the reply to OVPN_CMD_NEW_PEERS or
+ * OVPN_CMD_DEL_PEERS, which keeps it within a page
+ */
+#define OVPN_PEERS_REPLY_MAX_FAILED 256
+
 #endif /* _NET_OVPN_DCO_OVPN_DCO_H_ */
@@ -12,16 +12,20 @@
 #include "proto.h"
 #include "netlink.h"
 #include "ovpnstruct.h"
+#include "skb.h"
 #include "udp.h"
 
 #include <uapi/linux/ovpn_dco.h>
 
+#include <linux/mm.h>
 #include <linux/netdevice.h>
 #include <linux/netlink.h>
 #include <linux/rcupdate.h>
+#include <linux/skbuff.h>
 #include <linux/socket.h>
 #include <linux/types.h>
 #include <linux/spinlock.h>
+#include <linux/workqueue.h>
 #include <net/genetlink.h>
 #include <uapi/linux/in.h>
 #include <uapi/linux/in6.h>
@@ -74,6 +78,7 @@ static const struct nla_policy ovpn_netlink_policy_new_peer[OVPN_NEW_PEER_ATTR_M
 	[OVPN_NEW_PEER_ATTR_IPV4] = { .type = NLA_U32 },
 	[OVPN_NEW_PEER_ATTR_IPV6] = NLA_POLICY_EXACT_LEN(sizeof(struct in6_addr)),
 	[OVPN_NEW_PEER_ATTR_LOCAL_IP] = NLA_POLICY_MAX_LEN(sizeof(struct in6_addr)),
+	[OVPN_NEW_PEER_ATTR_CPU] = { .type = NLA_U32 },
 };
 
 /** CMD_SET_PEER policy */
@@ -93,6 +98,31 @@ static const struct nla_policy ovpn_netlink_policy_del_peer[OVPN_DEL_PEER_ATTR_M
 /** CMD_GET_PEER policy */
 static const struct nla_policy ovpn_netlink_policy_get_peer[OVPN_GET_PEER_ATTR_MAX + 1] = {
 	[OVPN_GET_PEER_ATTR_PEER_ID] = { .type = NLA_U32 },
+	[OVPN_GET_PEER_ATTR_START_ID] = { .type = NLA_U32 },
+	[OVPN_GET_PEER_ATTR_MAX_PEERS] = NLA_POLICY_MIN(NLA_U32, 1),
+	[OVPN_GET_PEER_ATTR_SINCE] = { .type = NLA_U64 },
+	[OVPN_GET_PEER_ATTR_INFO] = { .type = NLA_U32 },
+};
+
+/** CMD_NEW_ROUTE and CMD_DEL_ROUTE policy */
+static const struct nla_policy ovpn_netlink_policy_route[OVPN_ROUTE_ATTR_MAX + 1] = {
+	[OVPN_ROUTE_ATTR_PEER_ID] = { .type = NLA_U32 },
+	[OVPN_ROUTE_ATTR_IPV4] = { .type = NLA_U32 },
+	[OVPN_ROUTE_ATTR_IPV6] = NLA_POLICY_EXACT_LEN(sizeof(struct in6_addr)),
+	[OVPN_ROUTE_ATTR_PREFIX_LEN] = NLA_POLICY_MAX(NLA_U8, 128),
+};
+
+/** CMD_NEW_PEERS and CMD_DEL_PEERS entry policy */
+static const struct nla_policy ovpn_netlink_policy_peers_entry[OVPN_PEERS_ENTRY_ATTR_MAX + 1] = {
+	[OVPN_PEERS_ENTRY_ATTR_NEW_PEER] = NLA_POLICY_NESTED(ovpn_netlink_policy_new_peer),
+	[OVPN_PEERS_ENTRY_ATTR_PRIMARY_KEY] = NLA_POLICY_NESTED(ovpn_netlink_policy_new_key),
+	[OVPN_PEERS_ENTRY_ATTR_SECONDARY_KEY] = NLA_POLICY_NESTED(ovpn_netlink_policy_new_key),
+	[OVPN_PEERS_ENTRY_ATTR_PEER_ID] = { .type = NLA_U32 },
+};
+
+/** CMD_NEW_PEERS and CMD_DEL_PEERS policy */
+static const struct nla_policy ovpn_netlink_policy_peers[OVPN_PEERS_ATTR_MAX + 1] = {
+	[OVPN_PEERS_ATTR_ENTRY] = NLA_POLICY_NESTED(ovpn_netlink_policy_peers_entry),
 };
 
 /** CMD_PACKET polocy */
@@ -101,6 +131,11 @@ static const struct nla_policy ovpn_netlink_policy_packet[OVPN_PACKET_ATTR_MAX +
 	[OVPN_PACKET_ATTR_PACKET] = NLA_POLICY_MAX_LEN(1024 * 4),
 };
 
+/** CMD_PACKETS policy */
+static const struct nla_policy ovpn_netlink_policy_packets[OVPN_PACKETS_ATTR_MAX + 1] = {
+	[OVPN_PACKETS_ATTR_ENTRY] = NLA_POLICY_NESTED(ovpn_netlink_policy_packet),
+};
+
 /** Generic message container policy */
 static const struct nla_policy ovpn_netlink_policy[OVPN_ATTR_MAX + 1] = {
 	[OVPN_ATTR_IFINDEX] = { .type = NLA_U32 },
@@ -112,6 +147,11 @@ static const struct nla_policy ovpn_netlink_policy[OVPN_ATTR_MAX + 1] = {
 	[OVPN_ATTR_SWAP_KEYS] = NLA_POLICY_NESTED(ovpn_netlink_policy_swap_keys),
 	[OVPN_ATTR_DEL_KEY] = NLA_POLICY_NESTED(ovpn_netlink_policy_del_key),
 	[OVPN_ATTR_PACKET] = NLA_POLICY_NESTED(ovpn_netlink_policy_packet),
+	[OVPN_ATTR_ROUTE] = NLA_POLICY_NESTED(ovpn_netlink_policy_route),
+	[OVPN_ATTR_PEERS] = NLA_POLICY_NESTED(ovpn_netlink_policy_peers),
+	[OVPN_ATTR_PACKETS] = NLA_POLICY_NESTED(ovpn_netlink_policy_packets),
+	[OVPN_ATTR_PACKETS_BATCH] = { .type = NLA_FLAG },
+	[OVPN_ATTR_SOCKET] = { .type = NLA_U32 },
 };
 
 static struct net_device *
@@ -217,47 +257,59 @@ static int ovpn_netlink_get_key_dir(struct genl_info *info, struct nlattr *key,
 	return 0;
 }
 
-static int ovpn_netlink_new_key(struct sk_buff *skb, struct genl_info *info)
+/* Parse the key material of a CMD_NEW_KEY message or of a CMD_NEW_PEERS entry. The key slot
+ * and the peer are up to the caller
+ */
+static int ovpn_netlink_parse_key(struct genl_info *info, struct nlattr *key,
+				  struct ovpn_peer_key_reset *pkr, struct nlattr **attrs)
 {
-	struct nlattr *attrs[OVPN_NEW_KEY_ATTR_MAX + 1];
-	struct ovpn_struct *ovpn = info->user_ptr[0];
-	struct ovpn_peer_key_reset pkr;
-	struct ovpn_peer *peer;
-	u32 peer_id;
 	int ret;
 
-	if (!info->attrs[OVPN_ATTR_NEW_KEY])
-		return -EINVAL;
-
-	ret = nla_parse_nested(attrs, OVPN_NEW_KEY_ATTR_MAX, info->attrs[OVPN_ATTR_NEW_KEY],
-			       NULL, info->extack);
+	ret = nla_parse_nested(attrs, OVPN_NEW_KEY_ATTR_MAX, key, NULL, info->extack);
 	if (ret)
 		return ret;
 
-	if (!attrs[OVPN_NEW_KEY_ATTR_PEER_ID] ||
-	    !attrs[OVPN_NEW_KEY_ATTR_KEY_SLOT] ||
-	    !attrs[OVPN_NEW_KEY_ATTR_KEY_ID] ||
+	if (!attrs[OVPN_NEW_KEY_ATTR_KEY_ID] ||
 	    !attrs[OVPN_NEW_KEY_ATTR_CIPHER_ALG] ||
 	    !attrs[OVPN_NEW_KEY_ATTR_ENCRYPT_KEY] ||
 	    !attrs[OVPN_NEW_KEY_ATTR_DECRYPT_KEY])
 		return -EINVAL;
 
-	peer_id = nla_get_u32(attrs[OVPN_NEW_KEY_ATTR_PEER_ID]);
-	pkr.slot = nla_get_u8(attrs[OVPN_NEW_KEY_ATTR_KEY_SLOT]);
-	pkr.key.key_id = nla_get_u16(attrs[OVPN_NEW_KEY_ATTR_KEY_ID]);
+	pkr->key.key_id = nla_get_u16(attrs[OVPN_NEW_KEY_ATTR_KEY_ID]);
 
-	pkr.key.cipher_alg = nla_get_u16(attrs[OVPN_NEW_KEY_ATTR_CIPHER_ALG]);
+	pkr->key.cipher_alg = nla_get_u16(attrs[OVPN_NEW_KEY_ATTR_CIPHER_ALG]);
 
 	ret = ovpn_netlink_get_key_dir(info, attrs[OVPN_NEW_KEY_ATTR_ENCRYPT_KEY],
-				       pkr.key.cipher_alg, &pkr.key.encrypt);
+				       pkr->key.cipher_alg, &pkr->key.encrypt);
 	if (ret < 0)
 		return ret;
 
-	ret = ovpn_netlink_get_key_dir(info, attrs[OVPN_NEW_KEY_ATTR_DECRYPT_KEY],
-				       pkr.key.cipher_alg, &pkr.key.decrypt);
+	return ovpn_netlink_get_key_dir(info, attrs[OVPN_NEW_KEY_ATTR_DECRYPT_KEY],
+					pkr->key.cipher_alg, &pkr->key.decrypt);
+}
+
+static int ovpn_netlink_new_key(struct sk_buff *skb, struct genl_info *info)
+{
+	struct nlattr *attrs[OVPN_NEW_KEY_ATTR_MAX + 1];
+	struct ovpn_struct *ovpn = info->user_ptr[0];
+	struct ovpn_peer_key_reset pkr;
+	struct ovpn_peer *peer;
+	u32 peer_id;
+	int ret;
+
+	if (!info->attrs[OVPN_ATTR_NEW_KEY])
+		return -EINVAL;
+
+	ret = ovpn_netlink_parse_key(info, info->attrs[OVPN_ATTR_NEW_KEY], &pkr, attrs);
 	if (ret < 0)
 		return ret;
 
+	if (!attrs[OVPN_NEW_KEY_ATTR_PEER_ID] || !attrs[OVPN_NEW_KEY_ATTR_KEY_SLOT])
+		return -EINVAL;
+
+	peer_id = nla_get_u32(attrs[OVPN_NEW_KEY_ATTR_PEER_ID]);
+	pkr.slot = nla_get_u8(attrs[OVPN_NEW_KEY_ATTR_KEY_SLOT]);
+
 	peer = ovpn_peer_lookup_id(ovpn, peer_id);
 	if (!peer) {
 		netdev_dbg(ovpn->dev, "%s: no peer with id %u to set key for\n", __func__, peer_id);
@@ -265,7 +317,7 @@ static int ovpn_netlink_new_key(struct sk_buff *skb, struct genl_info *info)
 	}
 
 	mutex_lock(&peer->crypto.mutex);
-	ret = ovpn_crypto_state_reset(&peer->crypto, &pkr);
+	ret = ovpn_crypto_state_reset(&peer->crypto, &pkr, peer);
 	if (ret < 0) {
 		netdev_dbg(ovpn->dev, "%s: cannot install new key for peer %u\n", __func__,
 			   peer_id);
@@ -274,6 +326,7 @@ static int ovpn_netlink_new_key(struct sk_buff *skb, struct genl_info *info)
 
 	netdev_dbg(ovpn->dev, "%s: new key installed (id=%u) for peer %u\n", __func__,
 		   pkr.key.key_id, peer_id);
+	ovpn_peer_touch(peer);
 unlock:
 	mutex_unlock(&peer->crypto.mutex);
 	ovpn_peer_put(peer);
@@ -308,6 +361,7 @@ static int ovpn_netlink_del_key(struct sk_buff *skb, struct genl_info *info)
 		return -ENOENT;
 
 	ovpn_crypto_key_slot_delete(&peer->crypto, slot);
+	ovpn_peer_touch(peer);
 	ovpn_peer_put(peer);
 
 	return 0;
@@ -339,15 +393,15 @@ static int ovpn_netlink_swap_keys(struct sk_buff *skb, struct genl_info *info)
 		return -ENOENT;
 
 	ovpn_crypto_key_slots_swap(&peer->crypto);
+	ovpn_peer_touch(peer);
 	ovpn_peer_put(peer);
 
 	return 0;
 }
 
-static int ovpn_netlink_new_peer(struct sk_buff *skb, struct genl_info *info)
+/* Create the peer described by the CMD_NEW_PEER attributes, without adding it to ovpn yet */
+static struct ovpn_peer *ovpn_netlink_create_peer(struct ovpn_struct *ovpn, struct nlattr **attrs)
 {
-	struct nlattr *attrs[OVPN_NEW_PEER_ATTR_MAX + 1];
-	struct ovpn_struct *ovpn = info->user_ptr[0];
 	struct sockaddr_storage *ss = NULL;
 	struct sockaddr_in mapped;
 	struct sockaddr_in6 *in6;
@@ -356,27 +410,28 @@ static int ovpn_netlink_new_peer(struct sk_buff *skb, struct genl_info *info)
 	struct socket *sock;
 	u8 *local_ip = NULL;
 	u32 sockfd, id;
-	int ret;
-
-	if (!info->attrs[OVPN_ATTR_NEW_PEER])
-		return -EINVAL;
-
-	ret = nla_parse_nested(attrs, OVPN_NEW_PEER_ATTR_MAX, info->attrs[OVPN_ATTR_NEW_PEER], NULL,
-			       info->extack);
-	if (ret)
-		return ret;
+	int ret, cpu = -1;
 
 	if (!attrs[OVPN_NEW_PEER_ATTR_PEER_ID] || !attrs[OVPN_NEW_PEER_ATTR_SOCKET]) {
 		netdev_err(ovpn->dev, "%s: basic attributes missing\n", __func__);
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
 	}
 
+	if (attrs[OVPN_NEW_PEER_ATTR_CPU]) {
+		if (ovpn->crypto_exec != OVPN_CRYPTO_EXEC_KTHREAD) {
+			netdev_err(ovpn->dev, "%s: a crypto CPU requires the kthread exec mode\n",
+				   __func__);
+			return ERR_PTR(-EINVAL);
+		}
+
+		cpu = min_t(u32, nla_get_u32(attrs[OVPN_NEW_PEER_ATTR_CPU]), INT_MAX);
+	}
 
 	if (ovpn->mode == OVPN_MODE_MP && !attrs[OVPN_NEW_PEER_ATTR_IPV4] &&
 	    !attrs[OVPN_NEW_PEER_ATTR_IPV6]) {
 		netdev_err(ovpn->dev, "%s: a VPN IP is required when adding a peer in MP mode\n",
 			   __func__);
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
 	}
 
 	/* lookup the fd in the kernel table and extract the socket object */
@@ -386,7 +441,7 @@ static int ovpn_netlink_new_peer(struct sk_buff *skb, struct genl_info *info)
 	if (!sock) {
 		netdev_dbg(ovpn->dev, "%s: cannot lookup peer socket (fd=%u): %d\n", __func__,
 			   sockfd, ret);
-		return -ENOTSOCK;
+		return ERR_PTR(-ENOTSOCK);
 	}
 
 	/* Only when using UDP as transport protocol the remote endpoint must be configured
@@ -487,7 +542,7 @@ static int ovpn_netlink_new_peer(struct sk_buff *skb, struct genl_info *info)
 	}
 
 	id = nla_get_u32(attrs[OVPN_NEW_PEER_ATTR_PEER_ID]);
-	peer = ovpn_peer_new(ovpn, ss, sock, id, local_ip);
+	peer = ovpn_peer_new(ovpn, ss, sock, id, local_ip, cpu);
 	if (IS_ERR(peer)) {
 		netdev_err(ovpn->dev, "%s: cannot create new peer object for peer %u %pIScp\n",
 			   __func__, id, ss);
@@ -515,29 +570,362 @@ static int ovpn_netlink_new_peer(struct sk_buff *skb, struct genl_info *info)
 	}
 
 	netdev_dbg(ovpn->dev,
-		   "%s: adding peer with endpoint=%pIScp/%s id=%u VPN-IPv4=%pI4 VPN-IPv6=%pI6c\n",
+		   "%s: created peer with endpoint=%pIScp/%s id=%u VPN-IPv4=%pI4 VPN-IPv6=%pI6c\n",
 		   __func__, ss, sock->sk->sk_prot_creator->name, peer->id,
 		   &peer->vpn_addrs.ipv4.s_addr, &peer->vpn_addrs.ipv6);
 
+	return peer;
+
+peer_release:
+	/* release right away because peer is not really used in any context */
+	ovpn_peer_release(peer);
+	return ERR_PTR(ret);
+
+sockfd_release:
+	sockfd_put(sock);
+	return ERR_PTR(ret);
+}
+
+static void ovpn_netlink_notify_new_peer(struct ovpn_peer *peer);
+
+/* Add a peer created by ovpn_netlink_create_peer(), releasing it on failure */
+static int ovpn_netlink_add_peer(struct ovpn_struct *ovpn, struct ovpn_peer *peer)
+{
+	int ret;
+
+	/* the peer may be deleted as soon as it is added: keep it valid until announced */
+	ovpn_peer_hold(peer);
+
 	ret = ovpn_peer_add(ovpn, peer);
 	if (ret < 0) {
 		netdev_err(ovpn->dev, "%s: cannot add new peer (id=%u) to hashtable: %d\n",
 			   __func__, peer->id, ret);
-		goto peer_release;
+		ovpn_peer_put(peer);
+		/* release right away because peer is not really used in any context */
+		ovpn_peer_release(peer);
+		return ret;
 	}
 
+	ovpn_netlink_notify_new_peer(peer);
+	ovpn_peer_put(peer);
+
 	return 0;
+}
+
+static int ovpn_netlink_new_peer(struct sk_buff *skb, struct genl_info *info)
+{
+	struct nlattr *attrs[OVPN_NEW_PEER_ATTR_MAX + 1];
+	struct ovpn_struct *ovpn = info->user_ptr[0];
+	struct ovpn_peer *peer;
+	int ret;
+
+	if (!info->attrs[OVPN_ATTR_NEW_PEER])
+		return -EINVAL;
+
+	ret = nla_parse_nested(attrs, OVPN_NEW_PEER_ATTR_MAX, info->attrs[OVPN_ATTR_NEW_PEER], NULL,
+			       info->extack);
+	if (ret)
+		return ret;
+
+	peer = ovpn_netlink_create_peer(ovpn, attrs);
+	if (IS_ERR(peer))
+		return PTR_ERR(peer);
+
+	return ovpn_netlink_add_peer(ovpn, peer);
+}
+
+/* A CMD_NEW_PEERS or CMD_DEL_PEERS request, whose entries are applied to the peer tables
+ * OVPN_PEERS_BATCH at a time
+ */
+struct ovpn_netlink_peers_batch {
+	struct ovpn_peer *peers[OVPN_PEERS_BATCH];
+	int errs[OVPN_PEERS_BATCH];
+	unsigned int n;
+
+	/* failed entries of the whole request, only the first ones are reported */
+	struct ovpn_peers_failure failed[OVPN_PEERS_REPLY_MAX_FAILED];
+	unsigned int n_failed;
+};
+
+static void ovpn_netlink_peers_fail(struct ovpn_netlink_peers_batch *batch, u32 peer_id,
+				    int error)
+{
+	if (batch->n_failed < OVPN_PEERS_REPLY_MAX_FAILED) {
+		batch->failed[batch->n_failed].peer_id = peer_id;
+		batch->failed[batch->n_failed].error = error;
+	}
+
+	batch->n_failed++;
+}
+
+/* Install the optional key of a CMD_NEW_PEERS entry into a peer not added yet */
+static int ovpn_netlink_peers_key(struct genl_info *info, struct ovpn_peer *peer,
+				  struct nlattr *key, enum ovpn_key_slot slot)
+{
+	struct nlattr *attrs[OVPN_NEW_KEY_ATTR_MAX + 1];
+	struct ovpn_peer_key_reset pkr;
+	int ret;
+
+	if (!key)
+		return 0;
+
+	ret = ovpn_netlink_parse_key(info, key, &pkr, attrs);
+	if (ret < 0)
+		return ret;
+
+	pkr.slot = slot;
+
+	mutex_lock(&peer->crypto.mutex);
+	ret = ovpn_crypto_state_reset(&peer->crypto, &pkr, peer);
+	mutex_unlock(&peer->crypto.mutex);
 
-peer_release:
-	/* release right away because peer is not really used in any context */
-	ovpn_peer_release(peer);
 	return ret;
+}
+
+/* Create the peer of a CMD_NEW_PEERS entry, along with its keys, without adding it */
+static struct ovpn_peer *ovpn_netlink_new_peers_entry(struct genl_info *info,
+						      struct nlattr *entry, u32 *peer_id)
+{
+	struct nlattr *attrs[OVPN_PEERS_ENTRY_ATTR_MAX + 1];
+	struct nlattr *peer_attrs[OVPN_NEW_PEER_ATTR_MAX + 1];
+	struct ovpn_struct *ovpn = info->user_ptr[0];
+	struct ovpn_peer *peer;
+	int ret;
+
+	ret = nla_parse_nested(attrs, OVPN_PEERS_ENTRY_ATTR_MAX, entry, NULL, info->extack);
+	if (ret)
+		return ERR_PTR(ret);
+
+	if (!attrs[OVPN_PEERS_ENTRY_ATTR_NEW_PEER])
+		return ERR_PTR(-EINVAL);
+
+	ret = nla_parse_nested(peer_attrs, OVPN_NEW_PEER_ATTR_MAX,
+			       attrs[OVPN_PEERS_ENTRY_ATTR_NEW_PEER], NULL, info->extack);
+	if (ret)
+		return ERR_PTR(ret);
+
+	if (peer_attrs[OVPN_NEW_PEER_ATTR_PEER_ID])
+		*peer_id = nla_get_u32(peer_attrs[OVPN_NEW_PEER_ATTR_PEER_ID]);
+
+	peer = ovpn_netlink_create_peer(ovpn, peer_attrs);
+	if (IS_ERR(peer))
+		return peer;
+
+	/* keys are in place by the time the peer becomes reachable, no packet is dropped for
+	 * lack of a key in between
+	 */
+	ret = ovpn_netlink_peers_key(info, peer, attrs[OVPN_PEERS_ENTRY_ATTR_PRIMARY_KEY],
+				     OVPN_KEY_SLOT_PRIMARY);
+	if (ret < 0)
+		goto release;
+
+	ret = ovpn_netlink_peers_key(info, peer, attrs[OVPN_PEERS_ENTRY_ATTR_SECONDARY_KEY],
+				     OVPN_KEY_SLOT_SECONDARY);
+	if (ret < 0)
+		goto release;
+
+	return peer;
+
+release:
+	netdev_dbg(ovpn->dev, "%s: cannot install key for peer %u: %d\n", __func__, peer->id,
+		   ret);
+	ovpn_peer_release(peer);
+	return ERR_PTR(ret);
+}
+
+/* Add the peers of a CMD_NEW_PEERS batch, releasing those that cannot be added */
+static void ovpn_netlink_new_peers_flush(struct ovpn_struct *ovpn,
+					 struct ovpn_netlink_peers_batch *batch)
+{
+	struct ovpn_peer *peer;
+	unsigned int i;
+
+	/* the peers may be deleted as soon as they are added: keep them valid until
+	 * announced
+	 */
+	for (i = 0; i < batch->n; i++)
+		ovpn_peer_hold(batch->peers[i]);
+
+	ovpn_peers_add_mp(ovpn, batch->peers, batch->errs, batch->n);
+
+	for (i = 0; i < batch->n; i++) {
+		peer = batch->peers[i];
+
+		if (batch->errs[i] < 0) {
+			netdev_dbg(ovpn->dev, "%s: cannot add new peer (id=%u): %d\n", __func__,
+				   peer->id, batch->errs[i]);
+			ovpn_netlink_peers_fail(batch, peer->id, batch->errs[i]);
+			ovpn_peer_put(peer);
+			/* release right away because peer is not really used in any context */
+			ovpn_peer_release(peer);
+			continue;
+		}
+
+		ovpn_netlink_notify_new_peer(peer);
+		ovpn_peer_put(peer);
+	}
+}
+
+/* Look up the peer of a CMD_DEL_PEERS entry, returned with a reference held */
+static struct ovpn_peer *ovpn_netlink_del_peers_entry(struct genl_info *info,
+						      struct nlattr *entry, u32 *peer_id)
+{
+	struct nlattr *attrs[OVPN_PEERS_ENTRY_ATTR_MAX + 1];
+	struct ovpn_struct *ovpn = info->user_ptr[0];
+	struct ovpn_peer *peer;
+	int ret;
+
+	ret = nla_parse_nested(attrs, OVPN_PEERS_ENTRY_ATTR_MAX, entry, NULL, info->extack);
+	if (ret)
+		return ERR_PTR(ret);
+
+	if (!attrs[OVPN_PEERS_ENTRY_ATTR_PEER_ID])
+		return ERR_PTR(-EINVAL);
+
+	*peer_id = nla_get_u32(attrs[OVPN_PEERS_ENTRY_ATTR_PEER_ID]);
+
+	peer = ovpn_peer_lookup_id(ovpn, *peer_id);
+	if (!peer)
+		return ERR_PTR(-ENOENT);
+
+	return peer;
+}
+
+/* Delete the peers of a CMD_DEL_PEERS batch, consuming the references of the lookups */
+static void ovpn_netlink_del_peers_flush(struct ovpn_struct *ovpn,
+					 struct ovpn_netlink_peers_batch *batch)
+{
+	u32 peer_ids[OVPN_PEERS_BATCH];
+	unsigned int i;
+
+	/* the peers may be freed by the time the deletion outcome is known */
+	for (i = 0; i < batch->n; i++)
+		peer_ids[i] = batch->peers[i]->id;
+
+	ovpn_peers_del_mp(ovpn, batch->peers, batch->errs, batch->n,
+			  OVPN_DEL_PEER_REASON_USERSPACE);
+
+	for (i = 0; i < batch->n; i++)
+		if (batch->errs[i] < 0)
+			ovpn_netlink_peers_fail(batch, peer_ids[i], batch->errs[i]);
+}
+
+/* Reply to CMD_NEW_PEERS or CMD_DEL_PEERS with the number of entries that failed and the
+ * first of them
+ */
+static int ovpn_netlink_peers_reply(struct genl_info *info, u8 cmd,
+				    const struct ovpn_netlink_peers_batch *batch)
+{
+	unsigned int n = min_t(unsigned int, batch->n_failed, OVPN_PEERS_REPLY_MAX_FAILED);
+	struct nlattr *peers;
+	struct sk_buff *msg;
+	size_t size;
+	void *hdr;
+
+	size = nla_total_size(nla_total_size(sizeof(u32)) +
+			      nla_total_size(n * sizeof(struct ovpn_peers_failure)));
+
+	msg = genlmsg_new(size, GFP_KERNEL);
+	if (!msg)
+		return -ENOMEM;
+
+	hdr = genlmsg_put_reply(msg, info, &ovpn_netlink_family, 0, cmd);
+	if (!hdr)
+		goto err;
+
+	peers = nla_nest_start(msg, OVPN_ATTR_PEERS);
+	if (!peers)
+		goto err;
+
+	if (nla_put_u32(msg, OVPN_PEERS_ATTR_N_FAILED, batch->n_failed))
+		goto err;
+
+	if (n && nla_put(msg, OVPN_PEERS_ATTR_FAILED, n * sizeof(struct ovpn_peers_failure),
+			 batch->failed))
+		goto err;
+
+	nla_nest_end(msg, peers);
+	genlmsg_end(msg, hdr);
+
+	return genlmsg_reply(msg, info);
+err:
+	nlmsg_free(msg);
+	return -EMSGSIZE;
+}
+
+/* Process the entries of a CMD_NEW_PEERS or CMD_DEL_PEERS message, so that a failing entry
+ * does not prevent the others from being handled. Entries are parsed one by one and applied
+ * to the peer tables OVPN_PEERS_BATCH at a time. A whole server worth of peers is thus
+ * configured with a single request and device lookup.
+ */
+static int ovpn_netlink_peers(struct genl_info *info, u8 cmd,
+			      struct ovpn_peer *(*parse)(struct genl_info *info,
+							 struct nlattr *entry, u32 *peer_id),
+			      void (*flush)(struct ovpn_struct *ovpn,
+					    struct ovpn_netlink_peers_batch *batch))
+{
+	struct ovpn_struct *ovpn = info->user_ptr[0];
+	struct ovpn_netlink_peers_batch *batch;
+	unsigned int n_entries = 0;
+	struct ovpn_peer *peer;
+	struct nlattr *entry;
+	int ret, rem;
+	u32 peer_id;
+
+	if (ovpn->mode != OVPN_MODE_MP)
+		return -EOPNOTSUPP;
+
+	if (!info->attrs[OVPN_ATTR_PEERS])
+		return -EINVAL;
+
+	batch = kvzalloc(sizeof(*batch), GFP_KERNEL);
+	if (!batch)
+		return -ENOMEM;
+
+	nla_for_each_nested(entry, info->attrs[OVPN_ATTR_PEERS], rem) {
+		if (nla_type(entry) != OVPN_PEERS_ATTR_ENTRY)
+			continue;
+
+		n_entries++;
+		peer_id = 0;
+		peer = parse(info, entry, &peer_id);
+		if (IS_ERR(peer)) {
+			ovpn_netlink_peers_fail(batch, peer_id, PTR_ERR(peer));
+			continue;
+		}
+
+		batch->peers[batch->n++] = peer;
+		if (batch->n == OVPN_PEERS_BATCH) {
+			flush(ovpn, batch);
+			batch->n = 0;
+			cond_resched();
+		}
+	}
+
+	if (batch->n)
+		flush(ovpn, batch);
+
+	netdev_dbg(ovpn->dev, "%s: processed %u peers, %u failed\n", __func__, n_entries,
+		   batch->n_failed);
+
+	ret = ovpn_netlink_peers_reply(info, cmd, batch);
+	kvfree(batch);
 
-sockfd_release:
-	sockfd_put(sock);
 	return ret;
 }
 
+static int ovpn_netlink_new_peers(struct sk_buff *skb, struct genl_info *info)
+{
+	return ovpn_netlink_peers(info, OVPN_CMD_NEW_PEERS, ovpn_netlink_new_peers_entry,
+				  ovpn_netlink_new_peers_flush);
+}
+
+static int ovpn_netlink_del_peers(struct sk_buff *skb, struct genl_info *info)
+{
+	return ovpn_netlink_peers(info, OVPN_CMD_DEL_PEERS, ovpn_netlink_del_peers_entry,
+				  ovpn_netlink_del_peers_flush);
+}
+
 static int ovpn_netlink_set_peer(struct sk_buff *skb, struct genl_info *info)
 {
 	struct nlattr *attrs[OVPN_SET_PEER_ATTR_MAX + 1];
@@ -579,43 +967,151 @@ static int ovpn_netlink_set_peer(struct sk_buff *skb, struct genl_info *info)
 	return 0;
 }
 
-static int ovpn_netlink_send_peer(struct sk_buff *skb, const struct ovpn_peer *peer, u32 portid,
-				  u32 seq, int flags)
+static int ovpn_netlink_put_batch_hist(struct sk_buff *skb, int attrtype,
+				       const struct ovpn_batch_hist *hist)
 {
-	const struct ovpn_bind *bind;
 	struct nlattr *attr;
-	void *hdr;
+	int i;
 
-	hdr = genlmsg_put(skb, portid, seq, &ovpn_netlink_family, flags, OVPN_CMD_GET_PEER);
-	if (!hdr) {
-		netdev_dbg(peer->ovpn->dev, "%s: cannot create message header\n", __func__);
+	BUILD_BUG_ON(OVPN_BATCH_HIST_ATTR_MAX != OVPN_BATCH_HIST_BUCKETS);
+
+	attr = nla_nest_start(skb, attrtype);
+	if (!attr)
 		return -EMSGSIZE;
-	}
 
-	attr = nla_nest_start(skb, OVPN_ATTR_GET_PEER);
-	if (!attr) {
-		netdev_dbg(peer->ovpn->dev, "%s: cannot create submessage\n", __func__);
-		goto err;
+	for (i = 0; i < OVPN_BATCH_HIST_BUCKETS; i++) {
+		if (nla_put_u64_64bit(skb, OVPN_BATCH_HIST_ATTR_1 + i,
+				      atomic64_read(&hist->buckets[i]),
+				      OVPN_BATCH_HIST_ATTR_UNSPEC)) {
+			nla_nest_cancel(skb, attr);
+			return -EMSGSIZE;
+		}
 	}
 
-	if (nla_put_u32(skb, OVPN_GET_PEER_RESP_ATTR_PEER_ID, peer->id))
-		goto err;
-
-	if (peer->vpn_addrs.ipv4.s_addr != htonl(INADDR_ANY))
-		if (nla_put(skb, OVPN_GET_PEER_RESP_ATTR_IPV4, sizeof(peer->vpn_addrs.ipv4),
-			    &peer->vpn_addrs.ipv4))
-			goto err;
+	nla_nest_end(skb, attr);
 
-	if (memcmp(&peer->vpn_addrs.ipv6, &in6addr_any, sizeof(peer->vpn_addrs.ipv6)))
-		if (nla_put(skb, OVPN_GET_PEER_RESP_ATTR_IPV6, sizeof(peer->vpn_addrs.ipv6),
-			    &peer->vpn_addrs.ipv6))
-			goto err;
+	return 0;
+}
+
+static int ovpn_netlink_put_drops(struct sk_buff *skb, const struct ovpn_peer_stats_sum *sum)
+{
+	struct nlattr *attr;
+	int i;
+
+	BUILD_BUG_ON(OVPN_DROP_ATTR_MAX != __OVPN_DROP_REASON_MAX);
+
+	attr = nla_nest_start(skb, OVPN_GET_PEER_RESP_ATTR_DROPS);
+	if (!attr)
+		return -EMSGSIZE;
+
+	for (i = 0; i < __OVPN_DROP_REASON_MAX; i++) {
+		if (nla_put_u64_64bit(skb, OVPN_DROP_ATTR_NO_KEY + i, sum->drops[i],
+				      OVPN_DROP_ATTR_UNSPEC)) {
+			nla_nest_cancel(skb, attr);
+			return -EMSGSIZE;
+		}
+	}
+
+	nla_nest_end(skb, attr);
+
+	return 0;
+}
+
+static int ovpn_netlink_put_ring(struct sk_buff *skb, int attrtype, struct ptr_ring *ring)
+{
+	struct nlattr *attr;
+
+	attr = nla_nest_start(skb, attrtype);
+	if (!attr)
+		return -EMSGSIZE;
+
+	if (nla_put_u32(skb, OVPN_RING_ATTR_LEN, ovpn_peer_ring_len(ring)) ||
+	    nla_put_u32(skb, OVPN_RING_ATTR_SIZE, READ_ONCE(ring->size))) {
+		nla_nest_cancel(skb, attr);
+		return -EMSGSIZE;
+	}
+
+	nla_nest_end(skb, attr);
+
+	return 0;
+}
+
+static int ovpn_netlink_put_rings(struct sk_buff *skb, struct ovpn_peer *peer)
+{
+	struct nlattr *attr;
+
+	attr = nla_nest_start(skb, OVPN_GET_PEER_RESP_ATTR_RINGS);
+	if (!attr)
+		return -EMSGSIZE;
+
+	if (ovpn_netlink_put_ring(skb, OVPN_PEER_RING_ATTR_TX, &peer->tx_ring) ||
+	    ovpn_netlink_put_ring(skb, OVPN_PEER_RING_ATTR_RX, &peer->rx_ring) ||
+	    ovpn_netlink_put_ring(skb, OVPN_PEER_RING_ATTR_NETIF_RX, &peer->netif_rx_ring) ||
+	    (peer->sock->sock->sk->sk_protocol == IPPROTO_TCP &&
+	     ovpn_netlink_put_ring(skb, OVPN_PEER_RING_ATTR_TCP_TX, &peer->tcp.tx_ring))) {
+		nla_nest_cancel(skb, attr);
+		return -EMSGSIZE;
+	}
+
+	nla_nest_end(skb, attr);
+
+	return 0;
+}
+
+static int ovpn_netlink_put_latency(struct sk_buff *skb, const struct ovpn_peer_stats_sum *sum)
+{
+	struct nlattr *attr, *hist;
+	int i, j;
+
+	BUILD_BUG_ON(OVPN_LATENCY_ATTR_MAX != __OVPN_STAGE_MAX);
+	BUILD_BUG_ON(OVPN_LATENCY_HIST_ATTR_MAX != OVPN_LATENCY_HIST_BUCKETS);
+
+	attr = nla_nest_start(skb, OVPN_GET_PEER_RESP_ATTR_LATENCY);
+	if (!attr)
+		return -EMSGSIZE;
+
+	for (i = 0; i < __OVPN_STAGE_MAX; i++) {
+		hist = nla_nest_start(skb, OVPN_LATENCY_ATTR_TX_QUEUE + i);
+		if (!hist)
+			goto err;
+
+		for (j = 0; j < OVPN_LATENCY_HIST_BUCKETS; j++)
+			if (nla_put_u64_64bit(skb, OVPN_LATENCY_HIST_ATTR_LT_1US + j,
+					      sum->latency[i][j], OVPN_LATENCY_HIST_ATTR_UNSPEC))
+				goto err;
+
+		nla_nest_end(skb, hist);
+	}
+
+	nla_nest_end(skb, attr);
+
+	return 0;
+err:
+	nla_nest_cancel(skb, attr);
+	return -EMSGSIZE;
+}
+
+/* Put the addresses, transport and keepalive configuration of peer */
+static int ovpn_netlink_put_peer_config(struct sk_buff *skb, struct ovpn_peer *peer)
+{
+	const struct ovpn_bind *bind;
+	int ret = 0;
+
+	if (peer->vpn_addrs.ipv4.s_addr != htonl(INADDR_ANY))
+		if (nla_put(skb, OVPN_GET_PEER_RESP_ATTR_IPV4, sizeof(peer->vpn_addrs.ipv4),
+			    &peer->vpn_addrs.ipv4))
+			return -EMSGSIZE;
+
+	if (memcmp(&peer->vpn_addrs.ipv6, &in6addr_any, sizeof(peer->vpn_addrs.ipv6)))
+		if (nla_put(skb, OVPN_GET_PEER_RESP_ATTR_IPV6, sizeof(peer->vpn_addrs.ipv6),
+			    &peer->vpn_addrs.ipv6))
+			return -EMSGSIZE;
 
 	if (nla_put_u32(skb, OVPN_GET_PEER_RESP_ATTR_KEEPALIVE_INTERVAL,
 			peer->keepalive_interval) ||
 	    nla_put_u32(skb, OVPN_GET_PEER_RESP_ATTR_KEEPALIVE_TIMEOUT,
 			peer->keepalive_timeout))
-		goto err;
+		return -EMSGSIZE;
 
 	rcu_read_lock();
 	bind = rcu_dereference(peer->bind);
@@ -625,47 +1121,159 @@ static int ovpn_netlink_send_peer(struct sk_buff *skb, const struct ovpn_peer *p
 				    sizeof(bind->sa.in4), &bind->sa.in4) ||
 			    nla_put(skb, OVPN_GET_PEER_RESP_ATTR_LOCAL_IP,
 				    sizeof(bind->local.ipv4), &bind->local.ipv4))
-				goto err_unlock;
+				ret = -EMSGSIZE;
 		} else if (bind->sa.in4.sin_family == AF_INET6) {
 			if (nla_put(skb, OVPN_GET_PEER_RESP_ATTR_SOCKADDR_REMOTE,
 				    sizeof(bind->sa.in6), &bind->sa.in6) ||
 			    nla_put(skb, OVPN_GET_PEER_RESP_ATTR_LOCAL_IP,
 				    sizeof(bind->local.ipv6), &bind->local.ipv6))
-				goto err_unlock;
+				ret = -EMSGSIZE;
 		}
 	}
 	rcu_read_unlock();
+	if (ret < 0)
+		return ret;
 
 	if (nla_put_net16(skb, OVPN_GET_PEER_RESP_ATTR_LOCAL_PORT,
-			  inet_sk(peer->sock->sock->sk)->inet_sport) ||
-	    /* RX stats */
-	    nla_put_u64_64bit(skb, OVPN_GET_PEER_RESP_ATTR_RX_BYTES,
-			      atomic64_read(&peer->stats.rx.bytes),
+			  inet_sk(peer->sock->sock->sk)->inet_sport))
+		return -EMSGSIZE;
+
+	if (peer->crypto_cpu >= 0 &&
+	    nla_put_u32(skb, OVPN_GET_PEER_RESP_ATTR_CPU, peer->crypto_cpu))
+		return -EMSGSIZE;
+
+	return 0;
+}
+
+/* Put the traffic counters of peer */
+static int ovpn_netlink_put_peer_counters(struct sk_buff *skb, struct ovpn_peer *peer,
+					  const struct ovpn_peer_stats_sum *sum)
+{
+	/* RX stats. The 32bit packet counters are kept for older userspace */
+	if (nla_put_u64_64bit(skb, OVPN_GET_PEER_RESP_ATTR_RX_BYTES, sum->rx_bytes,
+			      OVPN_GET_PEER_RESP_ATTR_UNSPEC) ||
+	    nla_put_u32(skb, OVPN_GET_PEER_RESP_ATTR_RX_PACKETS, (u32)sum->rx_packets) ||
+	    nla_put_u64_64bit(skb, OVPN_GET_PEER_RESP_ATTR_RX_PACKETS64, sum->rx_packets,
 			      OVPN_GET_PEER_RESP_ATTR_UNSPEC) ||
-	    nla_put_u32(skb, OVPN_GET_PEER_RESP_ATTR_RX_PACKETS,
-			atomic_read(&peer->stats.rx.packets)) ||
 	    /* TX stats */
-	    nla_put_u64_64bit(skb, OVPN_GET_PEER_RESP_ATTR_TX_BYTES,
-			      atomic64_read(&peer->stats.tx.bytes),
+	    nla_put_u64_64bit(skb, OVPN_GET_PEER_RESP_ATTR_TX_BYTES, sum->tx_bytes,
+			      OVPN_GET_PEER_RESP_ATTR_UNSPEC) ||
+	    nla_put_u32(skb, OVPN_GET_PEER_RESP_ATTR_TX_PACKETS, (u32)sum->tx_packets) ||
+	    nla_put_u64_64bit(skb, OVPN_GET_PEER_RESP_ATTR_TX_PACKETS64, sum->tx_packets,
+			      OVPN_GET_PEER_RESP_ATTR_UNSPEC))
+		return -EMSGSIZE;
+
+	if (peer->sock->sock->sk->sk_protocol == IPPROTO_TCP &&
+	    (nla_put_u64_64bit(skb, OVPN_GET_PEER_RESP_ATTR_TCP_SENDMSG_CALLS,
+			       sum->tcp_sendmsg_calls, OVPN_GET_PEER_RESP_ATTR_UNSPEC) ||
+	     nla_put_u64_64bit(skb, OVPN_GET_PEER_RESP_ATTR_TCP_SENDMSG_BYTES,
+			       sum->tcp_sendmsg_bytes, OVPN_GET_PEER_RESP_ATTR_UNSPEC)))
+		return -EMSGSIZE;
+
+	return 0;
+}
+
+/* Put the counters and histograms of peer meant for troubleshooting */
+static int ovpn_netlink_put_peer_debug(struct sk_buff *skb, struct ovpn_peer *peer,
+				       const struct ovpn_peer_stats_sum *sum)
+{
+	if (nla_put_u64_64bit(skb, OVPN_GET_PEER_RESP_ATTR_CRYPTO_ALLOC_FALLBACK,
+			      sum->crypto_alloc_fallback, OVPN_GET_PEER_RESP_ATTR_UNSPEC) ||
+	    nla_put_u64_64bit(skb, OVPN_GET_PEER_RESP_ATTR_TX_HEADROOM_REALLOC,
+			      sum->tx_headroom_realloc, OVPN_GET_PEER_RESP_ATTR_UNSPEC) ||
+	    nla_put_u64_64bit(skb, OVPN_GET_PEER_RESP_ATTR_POOL_HITS, sum->pool_hits,
+			      OVPN_GET_PEER_RESP_ATTR_UNSPEC) ||
+	    nla_put_u64_64bit(skb, OVPN_GET_PEER_RESP_ATTR_POOL_MISSES, sum->pool_misses,
 			      OVPN_GET_PEER_RESP_ATTR_UNSPEC) ||
-	    nla_put_u32(skb, OVPN_GET_PEER_RESP_ATTR_TX_PACKETS,
-			atomic_read(&peer->stats.tx.packets)))
+	    ovpn_netlink_put_drops(skb, sum) ||
+	    ovpn_netlink_put_batch_hist(skb, OVPN_GET_PEER_RESP_ATTR_RX_BATCH_HIST,
+					&peer->stats.rx_batch) ||
+	    ovpn_netlink_put_batch_hist(skb, OVPN_GET_PEER_RESP_ATTR_TX_BATCH_HIST,
+					&peer->stats.tx_batch) ||
+	    ovpn_netlink_put_rings(skb, peer))
+		return -EMSGSIZE;
+
+	if (READ_ONCE(peer->ovpn->latency_stats) && ovpn_netlink_put_latency(skb, sum))
+		return -EMSGSIZE;
+
+	return 0;
+}
+
+/* Describe peer in a message of type cmd, limited to the groups of attributes set in
+ * info (enum ovpn_get_peer_info). Notifications (portid 0) also carry the interface index.
+ * cookie is the generation of the peer table the request was served in, reported so that
+ * the next delta dump can start from there
+ */
+static int ovpn_netlink_send_peer(struct sk_buff *skb, struct ovpn_peer *peer, u32 portid,
+				  u32 seq, int flags, u8 cmd, u32 info, u64 cookie)
+{
+	struct ovpn_peer_stats_sum sum;
+	struct nlattr *attr;
+	void *hdr;
+
+	hdr = genlmsg_put(skb, portid, seq, &ovpn_netlink_family, flags, cmd);
+	if (!hdr) {
+		netdev_dbg(peer->ovpn->dev, "%s: cannot create message header\n", __func__);
+		return -EMSGSIZE;
+	}
+
+	if (!portid && nla_put_u32(skb, OVPN_ATTR_IFINDEX, peer->ovpn->dev->ifindex))
+		goto err;
+
+	attr = nla_nest_start(skb, OVPN_ATTR_GET_PEER);
+	if (!attr) {
+		netdev_dbg(peer->ovpn->dev, "%s: cannot create submessage\n", __func__);
+		goto err;
+	}
+
+	if (nla_put_u32(skb, OVPN_GET_PEER_RESP_ATTR_PEER_ID, peer->id) ||
+	    nla_put_u64_64bit(skb, OVPN_GET_PEER_RESP_ATTR_COOKIE, cookie,
+			      OVPN_GET_PEER_RESP_ATTR_UNSPEC))
+		goto err;
+
+	if ((info & OVPN_GET_PEER_INFO_CONFIG) && ovpn_netlink_put_peer_config(skb, peer))
+		goto err;
+
+	/* summing the per-CPU counters is the bulk of the work: skip it if not needed */
+	if (info & (OVPN_GET_PEER_INFO_COUNTERS | OVPN_GET_PEER_INFO_DEBUG))
+		ovpn_peer_stats_sum(&peer->stats, &sum);
+
+	if ((info & OVPN_GET_PEER_INFO_COUNTERS) &&
+	    ovpn_netlink_put_peer_counters(skb, peer, &sum))
+		goto err;
+
+	if ((info & OVPN_GET_PEER_INFO_DEBUG) && ovpn_netlink_put_peer_debug(skb, peer, &sum))
 		goto err;
 
 	nla_nest_end(skb, attr);
 	genlmsg_end(skb, hdr);
 
 	return 0;
-err_unlock:
-	rcu_read_unlock();
 err:
 	genlmsg_cancel(skb, hdr);
 	return -EMSGSIZE;
 }
 
+/* Close the current generation of the peer table and return it. Peers touched from now on,
+ * or while the current generation was being closed, are reported by dumps since it
+ */
+static u64 ovpn_netlink_peers_cookie(struct ovpn_struct *ovpn)
+{
+	return atomic64_inc_return(&ovpn->peers_gen) - 1;
+}
+
+/* groups of attributes requested in an OVPN_ATTR_GET_PEER nest, all by default */
+static u32 ovpn_netlink_get_peer_info(struct nlattr **attrs)
+{
+	if (!attrs[OVPN_GET_PEER_ATTR_INFO])
+		return OVPN_GET_PEER_INFO_ALL;
+
+	return nla_get_u32(attrs[OVPN_GET_PEER_ATTR_INFO]) & OVPN_GET_PEER_INFO_ALL;
+}
+
 static int ovpn_netlink_get_peer(struct sk_buff *skb, struct genl_info *info)
 {
-	struct nlattr *attrs[OVPN_SET_PEER_ATTR_MAX + 1];
+	struct nlattr *attrs[OVPN_GET_PEER_ATTR_MAX + 1];
 	struct ovpn_struct *ovpn = info->user_ptr[0];
 	struct ovpn_peer *peer;
 	struct sk_buff *msg;
@@ -692,7 +1300,9 @@ static int ovpn_netlink_get_peer(struct sk_buff *skb, struct genl_info *info)
 	if (!msg)
 		return -ENOMEM;
 
-	ret = ovpn_netlink_send_peer(msg, peer, info->snd_portid, info->snd_seq, 0);
+	ret = ovpn_netlink_send_peer(msg, peer, info->snd_portid, info->snd_seq, 0,
+				     OVPN_CMD_GET_PEER, ovpn_netlink_get_peer_info(attrs),
+				     ovpn_netlink_peers_cookie(ovpn));
 	if (ret < 0) {
 		nlmsg_free(msg);
 		goto err;
@@ -704,14 +1314,25 @@ err:
 	return ret;
 }
 
+/* Dump the peers of an interface, possibly only a page of them or only those that changed
+ * since a previous dump. The state of the dump is kept in cb->args across calls:
+ * [0] is set once the dump started, [1] is the next peer ID to visit, [2] the number of
+ * peers dumped so far, [3] and [4] the low and high halves of the cookie, i.e. the
+ * generation the dump started in.
+ */
 static int ovpn_netlink_dump_peers(struct sk_buff *skb, struct netlink_callback *cb)
 {
+	struct nlattr *attrs[OVPN_GET_PEER_ATTR_MAX + 1] = {};
 	struct net *netns = sock_net(cb->skb->sk);
+	unsigned long id, max_peers;
+	u64 since, cookie;
 	struct nlattr **attrbuf;
 	struct ovpn_struct *ovpn;
 	struct net_device *dev;
-	int ret, bkt, last_idx = cb->args[1], dumped = 0;
 	struct ovpn_peer *peer;
+	bool delta;
+	u32 info;
+	int ret;
 
 	attrbuf = kcalloc(OVPN_ATTR_MAX + 1, sizeof(*attrbuf), GFP_KERNEL);
 	if (!attrbuf)
@@ -733,30 +1354,63 @@ static int ovpn_netlink_dump_peers(struct sk_buff *skb, struct netlink_callback
 
 	ovpn = netdev_priv(dev);
 
-	rcu_read_lock();
-	hash_for_each_rcu(ovpn->peers.by_id, bkt, peer, hash_entry_id) {
-		/* skip already dumped peers that were dumped by previous invocations */
-		if (last_idx > 0) {
-			last_idx--;
-			continue;
-		}
+	if (attrbuf[OVPN_ATTR_GET_PEER]) {
+		ret = nla_parse_nested(attrs, OVPN_GET_PEER_ATTR_MAX, attrbuf[OVPN_ATTR_GET_PEER],
+				       NULL, NULL);
+		if (ret < 0)
+			goto err_put;
+	}
+
+	if (!cb->args[0]) {
+		cb->args[0] = 1;
+		if (attrs[OVPN_GET_PEER_ATTR_START_ID])
+			cb->args[1] = nla_get_u32(attrs[OVPN_GET_PEER_ATTR_START_ID]);
+		cookie = ovpn_netlink_peers_cookie(ovpn);
+		cb->args[3] = lower_32_bits(cookie);
+		cb->args[4] = upper_32_bits(cookie);
+	}
+	cookie = (u64)(u32)cb->args[4] << 32 | (u32)cb->args[3];
+
+	max_peers = ULONG_MAX;
+	if (attrs[OVPN_GET_PEER_ATTR_MAX_PEERS])
+		max_peers = nla_get_u32(attrs[OVPN_GET_PEER_ATTR_MAX_PEERS]);
+
+	delta = !!attrs[OVPN_GET_PEER_ATTR_SINCE];
+	since = delta ? nla_get_u64(attrs[OVPN_GET_PEER_ATTR_SINCE]) : 0;
+	/* cookies are handed out by previous dumps of this interface only */
+	if (since > cookie) {
+		ret = -EINVAL;
+		goto err_put;
+	}
+	info = ovpn_netlink_get_peer_info(attrs);
+	id = cb->args[1];
 
-		if (ovpn_netlink_send_peer(skb, peer, NETLINK_CB(cb->skb).portid,
-					   cb->nlh->nlmsg_seq, NLM_F_MULTI) < 0)
+	/* peers are walked in ID order, starting from the first ID not dumped yet, so that
+	 * concurrent additions and removals do not make the dump skip or repeat any peer
+	 */
+	rcu_read_lock();
+	for (peer = xa_find(&ovpn->peers.by_id, &id, ULONG_MAX, XA_PRESENT); peer;
+	     peer = xa_find_after(&ovpn->peers.by_id, &id, ULONG_MAX, XA_PRESENT)) {
+		if (cb->args[2] >= max_peers)
 			break;
 
-		/* count peers being dumped during this invocation */
-		dumped++;
+		/* idle peers are skipped without touching their per-CPU counters */
+		if (!delta || ovpn_peer_active_since(peer, since)) {
+			if (ovpn_netlink_send_peer(skb, peer, NETLINK_CB(cb->skb).portid,
+						   cb->nlh->nlmsg_seq, NLM_F_MULTI,
+						   OVPN_CMD_GET_PEER, info, cookie) < 0)
+				break;
+
+			cb->args[2]++;
+		}
+
+		cb->args[1] = id + 1;
 	}
 	rcu_read_unlock();
 
-	dev_put(dev);
-
-	/* sum up peers dumped in this message, so that at the next invocation
-	 * we can continue from where we left
-	 */
-	cb->args[1] += dumped;
 	ret = skb->len;
+err_put:
+	dev_put(dev);
 err:
 	kfree(attrbuf);
 	return ret;
@@ -794,6 +1448,97 @@ static int ovpn_netlink_del_peer(struct sk_buff *skb, struct genl_info *info)
 	return ret;
 }
 
+/* Parse the prefix of a CMD_NEW_ROUTE or CMD_DEL_ROUTE message */
+static int ovpn_netlink_parse_route(struct genl_info *info, struct nlattr **attrs,
+				    sa_family_t *family, struct in6_addr *addr, u8 *cidr)
+{
+	struct ovpn_struct *ovpn = info->user_ptr[0];
+	int ret;
+
+	if (ovpn->mode != OVPN_MODE_MP)
+		return -EOPNOTSUPP;
+
+	if (!info->attrs[OVPN_ATTR_ROUTE])
+		return -EINVAL;
+
+	ret = nla_parse_nested(attrs, OVPN_ROUTE_ATTR_MAX, info->attrs[OVPN_ATTR_ROUTE], NULL,
+			       info->extack);
+	if (ret)
+		return ret;
+
+	memset(addr, 0, sizeof(*addr));
+
+	if (attrs[OVPN_ROUTE_ATTR_IPV4] && !attrs[OVPN_ROUTE_ATTR_IPV6]) {
+		*family = AF_INET;
+		*cidr = 32;
+		addr->s6_addr32[0] = nla_get_be32(attrs[OVPN_ROUTE_ATTR_IPV4]);
+	} else if (attrs[OVPN_ROUTE_ATTR_IPV6] && !attrs[OVPN_ROUTE_ATTR_IPV4]) {
+		*family = AF_INET6;
+		*cidr = 128;
+		memcpy(addr, nla_data(attrs[OVPN_ROUTE_ATTR_IPV6]), sizeof(*addr));
+	} else {
+		netdev_err(ovpn->dev, "%s: exactly one of IPv4 and IPv6 prefix is required\n",
+			   __func__);
+		return -EINVAL;
+	}
+
+	if (attrs[OVPN_ROUTE_ATTR_PREFIX_LEN]) {
+		if (nla_get_u8(attrs[OVPN_ROUTE_ATTR_PREFIX_LEN]) > *cidr) {
+			netdev_err(ovpn->dev, "%s: prefix length exceeds address length\n",
+				   __func__);
+			return -EINVAL;
+		}
+
+		*cidr = nla_get_u8(attrs[OVPN_ROUTE_ATTR_PREFIX_LEN]);
+	}
+
+	return 0;
+}
+
+static int ovpn_netlink_new_route(struct sk_buff *skb, struct genl_info *info)
+{
+	struct nlattr *attrs[OVPN_ROUTE_ATTR_MAX + 1];
+	struct ovpn_struct *ovpn = info->user_ptr[0];
+	struct ovpn_peer *peer;
+	struct in6_addr addr;
+	sa_family_t family;
+	u8 cidr;
+	int ret;
+
+	ret = ovpn_netlink_parse_route(info, attrs, &family, &addr, &cidr);
+	if (ret < 0)
+		return ret;
+
+	if (!attrs[OVPN_ROUTE_ATTR_PEER_ID])
+		return -EINVAL;
+
+	peer = ovpn_peer_lookup_id(ovpn, nla_get_u32(attrs[OVPN_ROUTE_ATTR_PEER_ID]));
+	if (!peer)
+		return -ENOENT;
+
+	netdev_dbg(ovpn->dev, "%s: peer id=%u prefix len=%u\n", __func__, peer->id, cidr);
+	ret = ovpn_route_add(&ovpn->routes, peer, family, &addr, cidr);
+	ovpn_peer_put(peer);
+
+	return ret;
+}
+
+static int ovpn_netlink_del_route(struct sk_buff *skb, struct genl_info *info)
+{
+	struct nlattr *attrs[OVPN_ROUTE_ATTR_MAX + 1];
+	struct ovpn_struct *ovpn = info->user_ptr[0];
+	struct in6_addr addr;
+	sa_family_t family;
+	u8 cidr;
+	int ret;
+
+	ret = ovpn_netlink_parse_route(info, attrs, &family, &addr, &cidr);
+	if (ret < 0)
+		return ret;
+
+	return ovpn_route_del(&ovpn->routes, family, &addr, cidr);
+}
+
 static int ovpn_netlink_register_packet(struct sk_buff *skb,
 					struct genl_info *info)
 {
@@ -807,13 +1552,15 @@ static int ovpn_netlink_register_packet(struct sk_buff *skb,
 
 	netdev_dbg(ovpn->dev, "%s: registering userspace at %u\n", __func__, info->snd_portid);
 
+	ovpn->registered_nl_batch = !!info->attrs[OVPN_ATTR_PACKETS_BATCH];
 	ovpn->registered_nl_portid = info->snd_portid;
 	ovpn->registered_nl_portid_set = true;
 
 	return 0;
 }
 
-static int ovpn_netlink_packet(struct sk_buff *skb, struct genl_info *info)
+/* send to its peer the packet described by a nest of enum ovpn_netlink_packet_attrs */
+static int ovpn_netlink_send_entry(struct genl_info *info, struct nlattr *entry)
 {
 	struct nlattr *attrs[OVPN_PACKET_ATTR_MAX + 1];
 	struct ovpn_struct *ovpn = info->user_ptr[0];
@@ -823,11 +1570,7 @@ static int ovpn_netlink_packet(struct sk_buff *skb, struct genl_info *info)
 	u8 opcode;
 	int ret;
 
-	if (!info->attrs[OVPN_ATTR_PACKET])
-		return -EINVAL;
-
-	ret = nla_parse_nested(attrs, OVPN_PACKET_ATTR_MAX, info->attrs[OVPN_ATTR_PACKET],
-			       NULL, info->extack);
+	ret = nla_parse_nested(attrs, OVPN_PACKET_ATTR_MAX, entry, NULL, info->extack);
 	if (ret)
 		return ret;
 
@@ -861,6 +1604,69 @@ static int ovpn_netlink_packet(struct sk_buff *skb, struct genl_info *info)
 	return ovpn_send_data(ovpn, peer_id, packet, len);
 }
 
+static int ovpn_netlink_packet(struct sk_buff *skb, struct genl_info *info)
+{
+	if (!info->attrs[OVPN_ATTR_PACKET])
+		return -EINVAL;
+
+	return ovpn_netlink_send_entry(info, info->attrs[OVPN_ATTR_PACKET]);
+}
+
+static int ovpn_netlink_packets(struct sk_buff *skb, struct genl_info *info)
+{
+	struct ovpn_struct *ovpn = info->user_ptr[0];
+	unsigned int n_entries = 0, n_failed = 0;
+	struct nlattr *entry;
+	int ret, err = 0, rem;
+
+	if (!info->attrs[OVPN_ATTR_PACKETS])
+		return -EINVAL;
+
+	nla_for_each_nested(entry, info->attrs[OVPN_ATTR_PACKETS], rem) {
+		if (nla_type(entry) != OVPN_PACKETS_ATTR_ENTRY)
+			continue;
+
+		n_entries++;
+
+		/* keep going, a packet for a peer being deleted must not hold back the others */
+		ret = ovpn_netlink_send_entry(info, entry);
+		if (ret < 0 && !n_failed++)
+			err = ret;
+
+		cond_resched();
+	}
+
+	netdev_dbg(ovpn->dev, "%s: processed %u packets, %u failed\n", __func__, n_entries,
+		   n_failed);
+
+	return err;
+}
+
+static int ovpn_netlink_new_socket(struct sk_buff *skb, struct genl_info *info)
+{
+	struct ovpn_struct *ovpn = info->user_ptr[0];
+	struct socket *sock;
+	u32 sockfd;
+	int ret;
+
+	if (ovpn->mode != OVPN_MODE_MP)
+		return -EOPNOTSUPP;
+
+	if (!info->attrs[OVPN_ATTR_SOCKET])
+		return -EINVAL;
+
+	sockfd = nla_get_u32(info->attrs[OVPN_ATTR_SOCKET]);
+	/* sockfd_lookup() increases sock's refcounter */
+	sock = sockfd_lookup(sockfd, &ret);
+	if (!sock) {
+		netdev_dbg(ovpn->dev, "%s: cannot lookup socket (fd=%u): %d\n", __func__, sockfd,
+			   ret);
+		return -ENOTSOCK;
+	}
+
+	return ovpn_udp_shard_add(ovpn, sock);
+}
+
 static const struct genl_small_ops ovpn_netlink_ops[] = {
 	{
 		.cmd = OVPN_CMD_NEW_PEER,
@@ -908,6 +1714,36 @@ static const struct genl_small_ops ovpn_netlink_ops[] = {
 		.flags = GENL_ADMIN_PERM | GENL_CMD_CAP_DO,
 		.doit = ovpn_netlink_packet,
 	},
+	{
+		.cmd = OVPN_CMD_NEW_ROUTE,
+		.flags = GENL_ADMIN_PERM | GENL_CMD_CAP_DO,
+		.doit = ovpn_netlink_new_route,
+	},
+	{
+		.cmd = OVPN_CMD_DEL_ROUTE,
+		.flags = GENL_ADMIN_PERM | GENL_CMD_CAP_DO,
+		.doit = ovpn_netlink_del_route,
+	},
+	{
+		.cmd = OVPN_CMD_NEW_PEERS,
+		.flags = GENL_ADMIN_PERM | GENL_CMD_CAP_DO,
+		.doit = ovpn_netlink_new_peers,
+	},
+	{
+		.cmd = OVPN_CMD_DEL_PEERS,
+		.flags = GENL_ADMIN_PERM | GENL_CMD_CAP_DO,
+		.doit = ovpn_netlink_del_peers,
+	},
+	{
+		.cmd = OVPN_CMD_PACKETS,
+		.flags = GENL_ADMIN_PERM | GENL_CMD_CAP_DO,
+		.doit = ovpn_netlink_packets,
+	},
+	{
+		.cmd = OVPN_CMD_NEW_SOCKET,
+		.flags = GENL_ADMIN_PERM | GENL_CMD_CAP_DO,
+		.doit = ovpn_netlink_new_socket,
+	},
 };
 
 static struct genl_family ovpn_netlink_family __ro_after_init = {
@@ -982,10 +1818,141 @@ err_free_msg:
 	return ret;
 }
 
+/* Announce a new peer, if enabled with IFLA_OVPN_PEER_NOTIFY, so that listeners (e.g. the
+ * XDP demux loader) can mirror the peer table. Failures are not fatal to the peer creation
+ */
+static void ovpn_netlink_notify_new_peer(struct ovpn_peer *peer)
+{
+	struct sk_buff *msg;
+
+	if (!READ_ONCE(peer->ovpn->peer_notify))
+		return;
+
+	msg = nlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+	if (!msg)
+		return;
+
+	/* the configuration is all a mirror needs: counters are left to dumps */
+	if (ovpn_netlink_send_peer(msg, peer, 0, 0, 0, OVPN_CMD_NEW_PEER, OVPN_GET_PEER_INFO_CONFIG,
+				   atomic64_read(&peer->ovpn->peers_gen)) < 0) {
+		netdev_dbg(peer->ovpn->dev, "%s: cannot announce peer %u\n", __func__, peer->id);
+		nlmsg_free(msg);
+		return;
+	}
+
+	genlmsg_multicast_netns(&ovpn_netlink_family, dev_net(peer->ovpn->dev), msg, 0,
+				OVPN_MCGRP_PEERS, GFP_KERNEL);
+}
+
+static void ovpn_netlink_multicast_peers(struct ovpn_struct *ovpn, struct sk_buff *msg)
+{
+	genlmsg_multicast_netns(&ovpn_netlink_family, dev_net(ovpn->dev), msg, 0,
+				OVPN_MCGRP_PEERS, GFP_ATOMIC);
+}
+
+/* Multicast the counters of the peers that were active since the previous run, as many
+ * peers per message as fit, so that monitoring does not need to poll full dumps
+ */
+static void ovpn_netlink_stats_work(struct work_struct *work)
+{
+	struct ovpn_struct *ovpn = container_of(work, struct ovpn_struct, nl_stats.work.work);
+	unsigned int interval = READ_ONCE(ovpn->nl_stats.interval);
+	struct sk_buff *msg = NULL;
+	struct ovpn_peer *peer;
+	unsigned long id;
+	u64 cookie;
+
+	if (!interval)
+		return;
+
+	if (!genl_has_listeners(&ovpn_netlink_family, dev_net(ovpn->dev), OVPN_MCGRP_PEERS))
+		goto out;
+
+	cookie = ovpn_netlink_peers_cookie(ovpn);
+
+	/* peers are freed after a grace period: keep them valid while walking */
+	rcu_read_lock();
+	xa_for_each(&ovpn->peers.by_id, id, peer) {
+		if (!ovpn_peer_active_since(peer, ovpn->nl_stats.last))
+			continue;
+
+		if (msg && ovpn_netlink_send_peer(msg, peer, 0, 0, 0, OVPN_CMD_PEER_STATS,
+						  OVPN_GET_PEER_INFO_COUNTERS, cookie) == 0)
+			continue;
+
+		/* the current message is full: send it and start a new one */
+		if (msg)
+			ovpn_netlink_multicast_peers(ovpn, msg);
+
+		msg = nlmsg_new(NLMSG_GOODSIZE, GFP_ATOMIC);
+		if (!msg)
+			break;
+
+		if (ovpn_netlink_send_peer(msg, peer, 0, 0, 0, OVPN_CMD_PEER_STATS,
+					   OVPN_GET_PEER_INFO_COUNTERS, cookie) < 0)
+			netdev_dbg(ovpn->dev, "%s: cannot report peer %u\n", __func__, peer->id);
+	}
+	rcu_read_unlock();
+
+	if (msg && msg->len)
+		ovpn_netlink_multicast_peers(ovpn, msg);
+	else
+		nlmsg_free(msg);
+
+	ovpn->nl_stats.last = cookie;
+out:
+	queue_delayed_work(ovpn->events_wq, &ovpn->nl_stats.work,
+			   round_jiffies_relative(interval * HZ));
+}
+
+/**
+ * ovpn_netlink_set_stats_interval - (re)arm the periodic multicast of the peer counters
+ * @ovpn: the interface to report the peers of
+ * @interval: seconds between two reports, 0 to stop
+ */
+void ovpn_netlink_set_stats_interval(struct ovpn_struct *ovpn, unsigned int interval)
+{
+	WRITE_ONCE(ovpn->nl_stats.interval, interval);
+
+	if (!interval) {
+		cancel_delayed_work(&ovpn->nl_stats.work);
+		return;
+	}
+
+	mod_delayed_work(ovpn->events_wq, &ovpn->nl_stats.work,
+			 round_jiffies_relative(interval * HZ));
+}
+
+/* append a nest of enum ovpn_netlink_packet_attrs carrying the content of skb */
+static int ovpn_netlink_put_packet(struct sk_buff *msg, int attrtype, u32 peer_id,
+				   const struct sk_buff *skb)
+{
+	struct nlattr *attr, *data;
+
+	attr = nla_nest_start(msg, attrtype);
+	if (!attr)
+		return -EMSGSIZE;
+
+	data = nla_reserve(msg, OVPN_PACKET_ATTR_PACKET, skb->len);
+	if (!data || nla_put_u32(msg, OVPN_PACKET_ATTR_PEER_ID, peer_id)) {
+		nla_nest_cancel(msg, attr);
+		return -EMSGSIZE;
+	}
+
+	/* copy straight out of the fragments, no need to linearize the skb first */
+	if (skb_copy_bits(skb, 0, nla_data(data), skb->len) < 0) {
+		nla_nest_cancel(msg, attr);
+		return -EFAULT;
+	}
+
+	nla_nest_end(msg, attr);
+
+	return 0;
+}
+
 int ovpn_netlink_send_packet(struct ovpn_struct *ovpn, const struct ovpn_peer *peer,
-			     const u8 *buf, size_t len)
+			     const struct sk_buff *skb)
 {
-	struct nlattr *attr;
 	struct sk_buff *msg;
 	void *hdr;
 	int ret;
@@ -995,9 +1962,9 @@ int ovpn_netlink_send_packet(struct ovpn_struct *ovpn, const struct ovpn_peer *p
 		return 0;
 	}
 
-	netdev_dbg(ovpn->dev, "%s: sending packet to userspace, len: %zd\n", __func__, len);
+	netdev_dbg(ovpn->dev, "%s: sending packet to userspace, len: %u\n", __func__, skb->len);
 
-	msg = nlmsg_new(100 + len, GFP_ATOMIC);
+	msg = nlmsg_new(100 + skb->len, GFP_ATOMIC);
 	if (!msg)
 		return -ENOMEM;
 
@@ -1013,32 +1980,124 @@ int ovpn_netlink_send_packet(struct ovpn_struct *ovpn, const struct ovpn_peer *p
 		goto err_free_msg;
 	}
 
-	attr = nla_nest_start(msg, OVPN_ATTR_PACKET);
-	if (!attr) {
-		ret = -EMSGSIZE;
+	ret = ovpn_netlink_put_packet(msg, OVPN_ATTR_PACKET, peer->id, skb);
+	if (ret < 0)
 		goto err_free_msg;
+
+	genlmsg_end(msg, hdr);
+
+	return genlmsg_unicast(dev_net(ovpn->dev), msg,
+			       ovpn->registered_nl_portid);
+
+err_free_msg:
+	nlmsg_free(msg);
+	return ret;
+}
+
+static void ovpn_netlink_purge_packets(struct ovpn_struct *ovpn)
+{
+	struct sk_buff *skb;
+
+	while ((skb = skb_dequeue(&ovpn->nl_packets.queue))) {
+		ovpn_peer_put(OVPN_SKB_CB(skb)->peer);
+		kfree_skb(skb);
 	}
+}
 
-	if (nla_put(msg, OVPN_PACKET_ATTR_PACKET, len, buf)) {
-		ret = -EMSGSIZE;
-		goto err_free_msg;
+/* Queue a packet for the next OVPN_CMD_PACKETS message sent to userspace.
+ * Reference to peer is transferred to the skb only in case of success.
+ */
+int ovpn_netlink_queue_packet(struct ovpn_struct *ovpn, struct ovpn_peer *peer,
+			      struct sk_buff *skb)
+{
+	if (!ovpn->registered_nl_portid_set) {
+		net_warn_ratelimited("%s: no userspace listener\n", __func__);
+		ovpn_peer_put(peer);
+		consume_skb(skb);
+		return 0;
 	}
 
-	if (nla_put_u32(msg, OVPN_PACKET_ATTR_PEER_ID, peer->id)) {
-		ret = -EMSGSIZE;
-		goto err_free_msg;
+	if (skb_queue_len(&ovpn->nl_packets.queue) >= OVPN_NL_PACKETS_QUEUE_LEN) {
+		net_warn_ratelimited("%s: too many packets pending for userspace\n", __func__);
+		return -ENOSPC;
 	}
 
-	nla_nest_end(msg, attr);
+	OVPN_SKB_CB(skb)->peer = peer;
+	skb_queue_tail(&ovpn->nl_packets.queue, skb);
+	queue_work(ovpn->events_wq, &ovpn->nl_packets.work);
 
-	genlmsg_end(msg, hdr);
+	return 0;
+}
 
-	return genlmsg_unicast(dev_net(ovpn->dev), msg,
-			       ovpn->registered_nl_portid);
+/* deliver pending packets to userspace, as many per message as possible */
+static void ovpn_netlink_packets_work(struct work_struct *work)
+{
+	struct ovpn_struct *ovpn = container_of(work, struct ovpn_struct, nl_packets.work);
+	struct sk_buff *msg, *skb;
+	unsigned int n_packets;
+	struct nlattr *attr;
+	void *hdr;
+	int ret;
+
+	while ((skb = skb_dequeue(&ovpn->nl_packets.queue))) {
+		if (!ovpn->registered_nl_portid_set)
+			goto err_free_skb;
+
+		/* the first packet always fits, whatever its size */
+		msg = nlmsg_new(max_t(size_t, OVPN_NL_PACKETS_MSG_SIZE, skb->len + 100),
+				GFP_KERNEL);
+		if (!msg)
+			goto err_free_skb;
+
+		hdr = genlmsg_put(msg, 0, 0, &ovpn_netlink_family, 0, OVPN_CMD_PACKETS);
+		if (!hdr || nla_put_u32(msg, OVPN_ATTR_IFINDEX, ovpn->dev->ifindex))
+			goto err_free_msg;
+
+		attr = nla_nest_start(msg, OVPN_ATTR_PACKETS);
+		if (!attr)
+			goto err_free_msg;
+
+		n_packets = 0;
+		do {
+			ret = ovpn_netlink_put_packet(msg, OVPN_PACKETS_ATTR_ENTRY,
+						      OVPN_SKB_CB(skb)->peer->id, skb);
+			if (ret == -EMSGSIZE && n_packets) {
+				/* message is full, the packet goes with the next one */
+				skb_queue_head(&ovpn->nl_packets.queue, skb);
+				break;
+			}
+
+			ovpn_peer_put(OVPN_SKB_CB(skb)->peer);
+			if (ret < 0) {
+				kfree_skb(skb);
+				continue;
+			}
+
+			consume_skb(skb);
+			n_packets++;
+		} while ((skb = skb_dequeue(&ovpn->nl_packets.queue)));
+
+		nla_nest_end(msg, attr);
+		genlmsg_end(msg, hdr);
+
+		netdev_dbg(ovpn->dev, "%s: sending %u packets to userspace\n", __func__, n_packets);
+
+		ret = genlmsg_unicast(dev_net(ovpn->dev), msg, ovpn->registered_nl_portid);
+		if (ret < 0)
+			net_warn_ratelimited("%s: cannot deliver %u packets to userspace: %d\n",
+					     __func__, n_packets, ret);
+
+		cond_resched();
+	}
+
+	return;
 
 err_free_msg:
 	nlmsg_free(msg);
-	return ret;
+err_free_skb:
+	ovpn_peer_put(OVPN_SKB_CB(skb)->peer);
+	kfree_skb(skb);
+	ovpn_netlink_purge_packets(ovpn);
 }
 
 static int ovpn_netlink_notify(struct notifier_block *nb, unsigned long state,
@@ -1086,9 +2145,22 @@ int ovpn_netlink_init(struct ovpn_struct *ovpn)
 {
 	ovpn->registered_nl_portid_set = false;
 
+	skb_queue_head_init(&ovpn->nl_packets.queue);
+	INIT_WORK(&ovpn->nl_packets.work, ovpn_netlink_packets_work);
+
+	INIT_DELAYED_WORK(&ovpn->nl_stats.work, ovpn_netlink_stats_work);
+	ovpn->nl_stats.last = 1;
+
 	return 0;
 }
 
+void ovpn_netlink_uninit(struct ovpn_struct *ovpn)
+{
+	cancel_work_sync(&ovpn->nl_packets.work);
+	cancel_delayed_work_sync(&ovpn->nl_stats.work);
+	ovpn_netlink_purge_packets(ovpn);
+}
+
 /**
  * ovpn_netlink_register() - register the ovpn genl netlink family
  */
@@ -11,12 +11,17 @@
 
 struct ovpn_struct;
 struct ovpn_peer;
+struct sk_buff;
 
 int ovpn_netlink_init(struct ovpn_struct *ovpn);
+void ovpn_netlink_uninit(struct ovpn_struct *ovpn);
 int ovpn_netlink_register(void);
 void ovpn_netlink_unregister(void);
 int ovpn_netlink_send_packet(struct ovpn_struct *ovpn, const struct ovpn_peer *peer,
-			     const u8 *buf, size_t len);
+			     const struct sk_buff *skb);
+int ovpn_netlink_queue_packet(struct ovpn_struct *ovpn, struct ovpn_peer *peer,
+			      struct sk_buff *skb);
 int ovpn_netlink_notify_del_peer(struct ovpn_peer *peer);
+void ovpn_netlink_set_stats_interval(struct ovpn_struct *ovpn, unsigned int interval);
 
 #endif /* _NET_OVPN_DCO_NETLINK_H_ */
@@ -0,0 +1,276 @@
+// SPDX-License-Identifier: GPL-2.0
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+#include "main.h"
+#include "crypto.h"
+#include "offload.h"
+#include "ovpnstruct.h"
+#include "peer.h"
+#include "proto.h"
+#include "sock.h"
+#include "udp.h"
+
+#include <crypto/aead.h>
+#include <linux/kref.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+
+/* a device registered by its driver */
+struct ovpn_offload_dev {
+	struct list_head list;
+	struct net_device *dev;
+	const struct ovpn_offload_ops *ops;
+	/* SAs installed on the device */
+	struct list_head sas;
+	/* held by the registration and by each SA */
+	struct kref refcount;
+};
+
+/* a key installed on a device, owned by its key slot */
+struct ovpn_offload_sa {
+	struct ovpn_offload_dev *odev;
+	void *handle;
+	/* set when the device is unregistered: the data path then falls back to
+	 * software crypto
+	 */
+	bool dead;
+	/* in odev->sas, empty once the key has been deleted from the device */
+	struct list_head list;
+	/* the key is deleted from the device in process context */
+	struct work_struct free_work;
+};
+
+/* protects ovpn_offload_devs and the SA lists */
+static DEFINE_MUTEX(ovpn_offload_mutex);
+static LIST_HEAD(ovpn_offload_devs);
+static struct workqueue_struct *ovpn_offload_wq;
+
+static struct ovpn_offload_dev *ovpn_offload_dev_find(const struct net_device *dev)
+	__must_hold(&ovpn_offload_mutex)
+{
+	struct ovpn_offload_dev *odev;
+
+	list_for_each_entry(odev, &ovpn_offload_devs, list) {
+		if (odev->dev == dev)
+			return odev;
+	}
+
+	return NULL;
+}
+
+static void ovpn_offload_dev_release(struct kref *kref)
+{
+	kfree(container_of(kref, struct ovpn_offload_dev, refcount));
+}
+
+/* Register dev as able to encrypt and decrypt DATA_V2 packets with ops.
+ * The driver must unregister the device before it goes away
+ */
+int ovpn_offload_register(struct net_device *dev, const struct ovpn_offload_ops *ops)
+{
+	struct ovpn_offload_dev *odev;
+	int ret = 0;
+
+	odev = kzalloc(sizeof(*odev), GFP_KERNEL);
+	if (!odev)
+		return -ENOMEM;
+
+	odev->dev = dev;
+	odev->ops = ops;
+	INIT_LIST_HEAD(&odev->sas);
+	kref_init(&odev->refcount);
+
+	mutex_lock(&ovpn_offload_mutex);
+	if (ovpn_offload_dev_find(dev)) {
+		ret = -EEXIST;
+		kfree(odev);
+		goto unlock;
+	}
+
+	list_add_tail(&odev->list, &ovpn_offload_devs);
+unlock:
+	mutex_unlock(&ovpn_offload_mutex);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ovpn_offload_register);
+
+/* Unregister dev and delete all the keys installed on it: the key slots using
+ * them fall back to software crypto
+ */
+void ovpn_offload_unregister(struct net_device *dev)
+{
+	struct ovpn_offload_sa *sa, *tmp;
+	struct ovpn_offload_dev *odev;
+
+	mutex_lock(&ovpn_offload_mutex);
+	odev = ovpn_offload_dev_find(dev);
+	if (!odev)
+		goto unlock;
+
+	list_del(&odev->list);
+	list_for_each_entry(sa, &odev->sas, list)
+		WRITE_ONCE(sa->dead, true);
+
+	/* wait for the data path to stop using the handles */
+	synchronize_rcu();
+
+	list_for_each_entry_safe(sa, tmp, &odev->sas, list) {
+		odev->ops->key_del(dev, sa->handle);
+		list_del_init(&sa->list);
+	}
+
+	kref_put(&odev->refcount, ovpn_offload_dev_release);
+unlock:
+	mutex_unlock(&ovpn_offload_mutex);
+}
+EXPORT_SYMBOL_GPL(ovpn_offload_unregister);
+
+static void ovpn_offload_sa_free_work(struct work_struct *work)
+{
+	struct ovpn_offload_sa *sa = container_of(work, struct ovpn_offload_sa, free_work);
+	struct ovpn_offload_dev *odev = sa->odev;
+
+	mutex_lock(&ovpn_offload_mutex);
+	if (!list_empty(&sa->list)) {
+		odev->ops->key_del(odev->dev, sa->handle);
+		list_del(&sa->list);
+	}
+	mutex_unlock(&ovpn_offload_mutex);
+
+	kref_put(&odev->refcount, ovpn_offload_dev_release);
+	kfree(sa);
+}
+
+/* Release sa along with its key slot, possibly in atomic context */
+void ovpn_offload_sa_release(struct ovpn_offload_sa *sa)
+{
+	if (!sa)
+		return;
+
+	queue_work(ovpn_offload_wq, &sa->free_work);
+}
+
+/* Offer the key of ks to the device peer is routed through. ks must not be
+ * visible to the data path yet, and is left to software crypto if the key is
+ * not accepted
+ */
+void ovpn_offload_key_add(struct ovpn_peer *peer, struct ovpn_crypto_key_slot *ks,
+			  const struct ovpn_key_config *kc)
+{
+	struct ovpn_offload_key key = {
+		.cipher_alg = kc->cipher_alg,
+		.key_id = kc->key_id,
+		.peer_id = peer->id,
+		.encrypt_key = kc->encrypt.cipher_key,
+		.decrypt_key = kc->decrypt.cipher_key,
+		.key_size = kc->encrypt.cipher_key_size,
+		.encrypt_nonce_tail = kc->encrypt.nonce_tail,
+		.decrypt_nonce_tail = kc->decrypt.nonce_tail,
+		.nonce_tail_size = sizeof(struct ovpn_nonce_tail),
+		.ad_len = OVPN_OP_SIZE_V2 + NONCE_WIRE_SIZE,
+		.tag_offset = OVPN_OP_SIZE_V2 + NONCE_WIRE_SIZE,
+		.tag_size = crypto_aead_authsize(ks->encrypt),
+	};
+	struct ovpn_offload_dev *odev;
+	struct ovpn_offload_sa *sa;
+	struct sock *sk;
+	int ifindex, ret;
+
+	key.payload_offset = key.tag_offset + key.tag_size;
+
+	/* only datagrams can be framed by the device */
+	if (!peer->sock || peer->sock->sock->sk->sk_protocol != IPPROTO_UDP ||
+	    kc->encrypt.cipher_key_size != kc->decrypt.cipher_key_size)
+		return;
+
+	sk = peer->sock->sock->sk;
+
+	mutex_lock(&ovpn_offload_mutex);
+	if (list_empty(&ovpn_offload_devs))
+		goto unlock;
+
+	ifindex = ovpn_udp_route_ifindex(peer);
+	if (ifindex < 0)
+		goto unlock;
+
+	list_for_each_entry(odev, &ovpn_offload_devs, list) {
+		if (odev->dev->ifindex == ifindex && net_eq(dev_net(odev->dev), sock_net(sk)))
+			goto found;
+	}
+	goto unlock;
+
+found:
+	sa = kzalloc(sizeof(*sa), GFP_KERNEL);
+	if (!sa)
+		goto unlock;
+
+	ret = odev->ops->key_add(odev->dev, &key, &sa->handle);
+	if (ret < 0) {
+		netdev_dbg(peer->ovpn->dev, "%s: %s declined key %u of peer %u: %d\n", __func__,
+			   odev->dev->name, kc->key_id, peer->id, ret);
+		kfree(sa);
+		goto unlock;
+	}
+
+	sa->odev = odev;
+	kref_get(&odev->refcount);
+	INIT_WORK(&sa->free_work, ovpn_offload_sa_free_work);
+	list_add(&sa->list, &odev->sas);
+
+	ks->offload = sa;
+	WRITE_ONCE(peer->tx_ifindex, ifindex);
+
+	netdev_dbg(peer->ovpn->dev, "%s: key %u of peer %u offloaded to %s\n", __func__,
+		   kc->key_id, peer->id, odev->dev->name);
+unlock:
+	mutex_unlock(&ovpn_offload_mutex);
+}
+
+/* The helpers below are invoked by the data path under rcu_read_lock() */
+
+/* Whether packets routed through ifindex can be encrypted by the device of sa */
+bool ovpn_offload_tx_ok(const struct ovpn_offload_sa *sa, int ifindex)
+{
+	return !READ_ONCE(sa->dead) && sa->odev->dev->ifindex == ifindex;
+}
+
+int ovpn_offload_tx(struct ovpn_offload_sa *sa, struct sk_buff *skb)
+{
+	return sa->odev->ops->tx(sa->odev->dev, sa->handle, skb);
+}
+
+int ovpn_offload_rx(struct ovpn_offload_sa *sa, struct sk_buff *skb)
+{
+	if (READ_ONCE(sa->dead))
+		return -EOPNOTSUPP;
+
+	return sa->odev->ops->rx(sa->odev->dev, sa->handle, skb);
+}
+
+/* Whether a packet left to the device of sa for encryption can leave through dev */
+bool ovpn_offload_dev_ok(const struct ovpn_offload_sa *sa, const struct net_device *dev)
+{
+	return !READ_ONCE(sa->dead) && sa->odev->dev == dev;
+}
+
+int ovpn_offload_init(void)
+{
+	ovpn_offload_wq = alloc_workqueue("ovpn-offload", WQ_MEM_RECLAIM, 0);
+	if (!ovpn_offload_wq)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/* invoked once all key slots have been released */
+void ovpn_offload_exit(void)
+{
+	destroy_workqueue(ovpn_offload_wq);
+}
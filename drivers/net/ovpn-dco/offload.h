@@ -0,0 +1,95 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+#ifndef _NET_OVPN_DCO_OFFLOAD_H_
+#define _NET_OVPN_DCO_OFFLOAD_H_
+
+#include <uapi/linux/ovpn_dco.h>
+#include <linux/module.h>
+#include <linux/netdevice.h>
+#include <linux/skbuff.h>
+#include <linux/types.h>
+
+/* Inline crypto offload of DATA_V2 packets to the lower device.
+ *
+ * A driver able to run AEAD on the wire, as done for IPsec or kTLS, registers its
+ * devices with ovpn_offload_register(). When a key is installed for a peer using
+ * the UDP transport, the device the peer is routed through is offered the key:
+ * once accepted, packets of that key leaving through that device skip the
+ * software tfm, and so do the received packets reported as decrypted by the
+ * device. Packet IDs are still allocated and checked against replays by ovpn-dco.
+ *
+ * Software crypto is used whenever the device declines the key, the route moves
+ * to another device or the device is unregistered.
+ */
+
+/* DATA_V2 key and framing, as offered to the device.
+ *
+ * The packet is laid out as [ AD | tag | payload ], AD being the opcode, the
+ * peer ID and the packet ID, which is also the head of the nonce followed by
+ * the nonce tail of the key
+ */
+struct ovpn_offload_key {
+	enum ovpn_cipher_alg cipher_alg;
+	u8 key_id;
+	u32 peer_id;
+
+	const u8 *encrypt_key;
+	const u8 *decrypt_key;
+	unsigned int key_size;
+	const u8 *encrypt_nonce_tail;
+	const u8 *decrypt_nonce_tail;
+	unsigned int nonce_tail_size;
+
+	unsigned int ad_len;
+	unsigned int tag_offset;
+	unsigned int tag_size;
+	unsigned int payload_offset;
+};
+
+struct ovpn_offload_ops {
+	/* install key on dev and store the device context in handle, or return a
+	 * negative error to leave the key to software
+	 */
+	int (*key_add)(struct net_device *dev, const struct ovpn_offload_key *key,
+		       void **handle);
+	void (*key_del)(struct net_device *dev, void *handle);
+	/* have skb, framed as described by the key with room for the tag, encrypted
+	 * by dev on transmission. Invoked in atomic context
+	 */
+	int (*tx)(struct net_device *dev, void *handle, struct sk_buff *skb);
+	/* 0 if skb was decrypted and authenticated by dev with handle, -EBADMSG if
+	 * authentication failed or -EOPNOTSUPP if the device did not process it.
+	 * Invoked in atomic context
+	 */
+	int (*rx)(struct net_device *dev, void *handle, struct sk_buff *skb);
+};
+
+int ovpn_offload_register(struct net_device *dev, const struct ovpn_offload_ops *ops);
+void ovpn_offload_unregister(struct net_device *dev);
+
+/* internal API */
+
+struct ovpn_offload_sa;
+struct ovpn_crypto_key_slot;
+struct ovpn_key_config;
+struct ovpn_peer;
+
+int ovpn_offload_init(void);
+void ovpn_offload_exit(void);
+
+void ovpn_offload_key_add(struct ovpn_peer *peer, struct ovpn_crypto_key_slot *ks,
+			  const struct ovpn_key_config *kc);
+void ovpn_offload_sa_release(struct ovpn_offload_sa *sa);
+
+bool ovpn_offload_tx_ok(const struct ovpn_offload_sa *sa, int ifindex);
+int ovpn_offload_tx(struct ovpn_offload_sa *sa, struct sk_buff *skb);
+int ovpn_offload_rx(struct ovpn_offload_sa *sa, struct sk_buff *skb);
+bool ovpn_offload_dev_ok(const struct ovpn_offload_sa *sa, const struct net_device *dev);
+
+#endif /* _NET_OVPN_DCO_OFFLOAD_H_ */
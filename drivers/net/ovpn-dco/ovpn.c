@@ -15,12 +15,19 @@
 #include "peer.h"
 #include "stats.h"
 #include "proto.h"
+#include "queue.h"
 #include "crypto.h"
 #include "crypto_aead.h"
+#include "pool.h"
 #include "skb.h"
 #include "tcp.h"
 #include "udp.h"
 
+#define CREATE_TRACE_POINTS
+#include "trace.h"
+
+#include <linux/kthread.h>
+#include <linux/ktime.h>
 #include <linux/workqueue.h>
 #include <uapi/linux/if_ether.h>
 
@@ -64,7 +71,12 @@ int ovpn_struct_init(struct net_device *dev)
 		return err;
 
 	spin_lock_init(&ovpn->lock);
-	spin_lock_init(&ovpn->peers.lock);
+	ovpn_route_table_init(&ovpn->routes);
+	atomic64_set(&ovpn->peers_gen, 1);
+
+	err = ovpn_peers_init(ovpn);
+	if (err < 0)
+		return err;
 
 	ovpn->crypto_wq = alloc_workqueue("ovpn-crypto-wq-%s",
 					  WQ_CPU_INTENSIVE | WQ_MEM_RECLAIM, 0,
@@ -76,10 +88,16 @@ int ovpn_struct_init(struct net_device *dev)
 	if (!ovpn->events_wq)
 		return -ENOMEM;
 
+	INIT_DELAYED_WORK(&ovpn->keepalive_work, ovpn_peers_keepalive_work);
+
 	dev->tstats = netdev_alloc_pcpu_stats(struct pcpu_sw_netstats);
 	if (!dev->tstats)
 		return -ENOMEM;
 
+	err = ovpn_page_pools_init(&ovpn->page_pools);
+	if (err < 0)
+		return err;
+
 	err = security_tun_dev_alloc_security(&ovpn->security);
 	if (err < 0)
 		return err;
@@ -87,9 +105,56 @@ int ovpn_struct_init(struct net_device *dev)
 	/* kernel -> userspace tun queue length */
 	ovpn->max_tun_queue_len = OVPN_MAX_TUN_QUEUE_LEN;
 
+	ovpn->batch_size = OVPN_BATCH_SIZE;
+
+	return 0;
+}
+
+/* Switch the device to parallel crypto mode. Must be invoked before any peer
+ * is added
+ */
+int ovpn_struct_init_parallel(struct ovpn_struct *ovpn)
+{
+	int err;
+
+	err = ovpn_parallel_queue_init(&ovpn->encrypt_queue, ovpn_encrypt_parallel_work);
+	if (err < 0)
+		return err;
+
+	err = ovpn_parallel_queue_init(&ovpn->decrypt_queue, ovpn_decrypt_parallel_work);
+	if (err < 0) {
+		ovpn_parallel_queue_free(&ovpn->encrypt_queue);
+		return err;
+	}
+
+	ovpn->parallel_crypto = true;
+
 	return 0;
 }
 
+/* Start the data path of skb, timestamping it if latency stats are enabled and
+ * the histograms of the peer have been allocated
+ */
+static void ovpn_skb_stamp(const struct ovpn_peer *peer, struct sk_buff *skb)
+{
+	bool stamp = READ_ONCE(peer->ovpn->latency_stats) && READ_ONCE(peer->stats.latency);
+
+	OVPN_SKB_CB(skb)->tstamp = stamp ? ktime_get_ns() : 0;
+}
+
+/* Account the time spent by a timestamped skb in stage and start the next one */
+static void ovpn_skb_stage(struct ovpn_peer *peer, struct sk_buff *skb, enum ovpn_stage stage)
+{
+	u64 now;
+
+	if (likely(!OVPN_SKB_CB(skb)->tstamp))
+		return;
+
+	now = ktime_get_ns();
+	ovpn_peer_stats_add_latency(&peer->stats, stage, now - OVPN_SKB_CB(skb)->tstamp);
+	OVPN_SKB_CB(skb)->tstamp = now;
+}
+
 /* Called after decrypt to write IP packet to tun netdev.
  * This method is expected to manage/free skb.
  */
@@ -108,7 +173,8 @@ static void tun_netdev_write(struct ovpn_peer *peer, struct sk_buff *skb)
 	 * interface, based on __skb_tunnel_rx() in dst.h
 	 */
 	skb->dev = peer->ovpn->dev;
-	skb_set_queue_mapping(skb, 0);
+	/* report the delivering CPU as RX queue, so that RPS can be configured per queue */
+	skb_record_rx_queue(skb, smp_processor_id() % skb->dev->real_num_rx_queues);
 	skb_scrub_packet(skb, true);
 
 	skb_reset_network_header(skb);
@@ -140,6 +206,8 @@ int ovpn_napi_poll(struct napi_struct *napi, int budget)
 	 */
 	while ((work_done < budget) &&
 	       (skb = ptr_ring_consume_bh(&peer->netif_rx_ring))) {
+		ovpn_skb_stage(peer, skb, OVPN_STAGE_RX_DELIVER);
+		trace_ovpn_rx_deliver(peer, skb);
 		tun_netdev_write(peer, skb);
 		work_done++;
 	}
@@ -150,26 +218,214 @@ int ovpn_napi_poll(struct napi_struct *napi, int budget)
 	return work_done;
 }
 
-static int ovpn_transport_to_userspace(struct ovpn_struct *ovpn, const struct ovpn_peer *peer,
+/* Deliver a control packet to userspace, right away or with the next batch.
+ * Reference to peer is dropped only in case of success.
+ */
+static int ovpn_transport_to_userspace(struct ovpn_struct *ovpn, struct ovpn_peer *peer,
 				       struct sk_buff *skb)
 {
 	int ret;
 
-	ret = skb_linearize(skb);
-	if (ret < 0)
-		return ret;
+	if (ovpn->registered_nl_batch)
+		return ovpn_netlink_queue_packet(ovpn, peer, skb);
 
-	ret = ovpn_netlink_send_packet(ovpn, peer, skb->data, skb->len);
+	ret = ovpn_netlink_send_packet(ovpn, peer, skb);
 	if (ret < 0)
 		return ret;
 
+	ovpn_peer_put(peer);
 	consume_skb(skb);
 	return 0;
 }
 
+/* Publish the outcome of the parallel crypto processing of skb and schedule the work
+ * completing it in order. Once published, skb may be consumed by the finish work on
+ * another CPU, together with the last reference to peer it carries: the reference the
+ * work releases upon completion is taken beforehand
+ */
+static void ovpn_peer_publish_state(struct ovpn_peer *peer, struct sk_buff *skb, u8 state,
+				    struct work_struct *work)
+{
+	bool held = ovpn_peer_hold(peer);
+
+	smp_store_release(&OVPN_SKB_CB(skb)->state, state);
+
+	if (likely(held) && !queue_work(peer->ovpn->crypto_wq, work))
+		ovpn_peer_put(peer);
+}
+
+/* Schedule the consumer of the peer RX ring, either on the crypto workqueue or
+ * on the peer kthread worker.
+ * Return false if the consumer was already pending.
+ */
+static bool ovpn_peer_queue_decrypt(struct ovpn_peer *peer)
+{
+	if (peer->crypto_worker)
+		return kthread_queue_work(peer->crypto_worker, &peer->decrypt_kwork);
+
+	return queue_work(peer->ovpn->crypto_wq, &peer->decrypt_work);
+}
+
+/* Same as ovpn_peer_queue_decrypt(), for the peer TX ring */
+static bool ovpn_peer_queue_encrypt(struct ovpn_peer *peer)
+{
+	if (peer->crypto_worker)
+		return kthread_queue_work(peer->crypto_worker, &peer->encrypt_kwork);
+
+	return queue_work(peer->ovpn->crypto_wq, &peer->encrypt_work);
+}
+
+/* Work performed once per batch of packets processed by a crypto worker,
+ * rather than once per packet
+ */
+struct ovpn_batch {
+	/* transport protocol of the peer */
+	u8 proto;
+	/* packets and bytes to account in the peer stats */
+	unsigned int packets;
+	unsigned int bytes;
+	/* an authenticated packet was received or sent: refresh the keepalive stamp */
+	bool keepalive;
+	/* a packet was queued for delivery: schedule NAPI */
+	bool napi;
+};
+
+static void ovpn_batch_init(struct ovpn_batch *batch, const struct ovpn_peer *peer)
+{
+	memset(batch, 0, sizeof(*batch));
+	batch->proto = peer->sock->sock->sk->sk_protocol;
+}
+
+/* Byte queue limits are accounted for the packets sitting in the TX ring of a peer,
+ * from the moment they are queued until they leave the ring for encryption (or, in
+ * parallel mode, until they are encrypted). Once the limit of a device TX queue is
+ * hit, the stack stops it and packets wait in the qdisc, where AQM can act on them,
+ * rather than piling up in the ring.
+ *
+ * The device is LLTX and its TX queues are shared by all peers, so that the producer
+ * lock of a peer ring does not serialize the updates of a queue: the queue lock is
+ * taken explicitly, but only once per packet handed over by the stack on the sent
+ * side, whatever the number of its segments, and once per run of a crypto worker on
+ * the completion side.
+ */
+static void ovpn_tx_completed(struct netdev_queue *txq, unsigned int packets,
+			      unsigned int bytes)
+{
+	__netif_tx_lock_bh(txq);
+	netdev_tx_completed_queue(txq, packets, bytes);
+	__netif_tx_unlock_bh(txq);
+}
+
+static u16 ovpn_tx_queue(const struct ovpn_struct *ovpn, const struct sk_buff *skb)
+{
+	u16 queue = skb_get_queue_mapping(skb);
+
+	return likely(queue < ovpn->dev->real_num_tx_queues) ? queue : 0;
+}
+
+static void ovpn_tx_sent(struct ovpn_struct *ovpn, u16 queue, unsigned int len)
+{
+	struct netdev_queue *txq = netdev_get_tx_queue(ovpn->dev, queue);
+
+	__netif_tx_lock_bh(txq);
+	netdev_tx_sent_queue(txq, len);
+	__netif_tx_unlock_bh(txq);
+}
+
+/* account skb, possibly a list of segments, before putting it in the TX ring */
+static void ovpn_tx_queued(struct ovpn_struct *ovpn, struct sk_buff *skb)
+{
+	unsigned int len = 0;
+	struct sk_buff *curr;
+
+	for (curr = skb; curr; curr = curr->next)
+		len += curr->len;
+
+	OVPN_SKB_CB(skb)->tx_queue = ovpn_tx_queue(ovpn, skb);
+	OVPN_SKB_CB(skb)->tx_len = len;
+	ovpn_tx_sent(ovpn, OVPN_SKB_CB(skb)->tx_queue, len);
+}
+
+/* revert ovpn_tx_queued() for a packet that could not be put in the TX ring */
+static void ovpn_tx_unqueued(struct ovpn_struct *ovpn, const struct sk_buff *skb)
+{
+	ovpn_tx_completed(netdev_get_tx_queue(ovpn->dev, OVPN_SKB_CB(skb)->tx_queue), 1,
+			  OVPN_SKB_CB(skb)->tx_len);
+}
+
+/* packets and bytes that left the TX ring during a run of a crypto worker, to report to
+ * BQL on txq
+ */
+struct ovpn_tx_done {
+	struct netdev_queue *txq;
+	unsigned int packets;
+	unsigned int bytes;
+};
+
+static void ovpn_tx_done_flush(struct ovpn_tx_done *done)
+{
+	if (!done->txq)
+		return;
+
+	ovpn_tx_completed(done->txq, done->packets, done->bytes);
+	done->txq = NULL;
+	done->packets = 0;
+	done->bytes = 0;
+}
+
+/* Note skb left the TX ring. Must be called before skb is processed any further, as
+ * this may overwrite its control block
+ */
+static void ovpn_tx_done_add(struct ovpn_peer *peer, struct ovpn_tx_done *done,
+			     const struct sk_buff *skb)
+{
+	struct netdev_queue *txq = netdev_get_tx_queue(peer->ovpn->dev,
+						       OVPN_SKB_CB(skb)->tx_queue);
+
+	/* the packets of a peer usually belong to the same queue: report them at once */
+	if (done->txq != txq)
+		ovpn_tx_done_flush(done);
+
+	done->txq = txq;
+	done->packets++;
+	done->bytes += OVPN_SKB_CB(skb)->tx_len;
+}
+
+/* Put skb in the given per-peer ring and in the device parallel queue.
+ *
+ * The per-peer ring keeps track of the arrival order and owns the skb.
+ * If the skb cannot be handed over to the parallel queue, it is marked dead
+ * and left to the per-peer ring consumer for disposal.
+ *
+ * The crypto is run on cpu, or on the next CPU in a round-robin fashion if negative.
+ *
+ * Return 0 on success or -ENOSPC if the per-peer ring is full.
+ */
+static int ovpn_queue_parallel(struct ovpn_peer *peer, struct ptr_ring *ring,
+			       struct ovpn_parallel_queue *queue, struct work_struct *work,
+			       struct sk_buff *skb, int cpu)
+{
+	OVPN_SKB_CB(skb)->state = OVPN_SKB_STATE_PENDING;
+
+	if (unlikely(ovpn_peer_ring_produce(ring, skb) < 0)) {
+		ovpn_peer_stats_increment_drop(&peer->stats, OVPN_DROP_RING_FULL);
+		return -ENOSPC;
+	}
+
+	if (unlikely(ovpn_parallel_queue_skb(peer->ovpn->crypto_wq, queue, skb, cpu) < 0)) {
+		ovpn_peer_stats_increment_drop(&peer->stats, OVPN_DROP_RING_FULL);
+		ovpn_peer_publish_state(peer, skb, OVPN_SKB_STATE_DEAD, work);
+	}
+
+	return 0;
+}
+
+static bool ovpn_decrypt_inline(struct ovpn_peer *peer, struct sk_buff *skb);
+
 /* Entry point for processing an incoming packet (in skb form)
  *
- * Enqueue the packet and schedule RX consumer.
+ * Enqueue the packet and schedule RX consumer, or decrypt it right away in
+ * inline crypto mode.
  * Reference to peer is dropped only in case of success.
  *
  * Return 0  if the packet was handled (and consumed)
@@ -179,73 +435,163 @@ int ovpn_recv(struct ovpn_struct *ovpn, struct ovpn_peer *peer, struct sk_buff *
 {
 	int ret;
 
+	BUILD_BUG_ON(sizeof(struct ovpn_skb_cb) > sizeof_field(struct sk_buff, cb));
+
 	/* At this point we know the packet is from a configured peer.
 	 * DATA_V2 packets are handled in kernel space, the rest goes to user space.
 	 *
 	 * Packets are sent to userspace via netlink API in order to be consistenbt across
 	 * UDP and TCP.
 	 */
-	if (unlikely(ovpn_opcode_from_skb(skb, 0) != OVPN_DATA_V2)) {
-		ret = ovpn_transport_to_userspace(ovpn, peer, skb);
-		if (ret < 0)
-			return ret;
+	if (unlikely(ovpn_opcode_from_skb(skb, 0) != OVPN_DATA_V2))
+		return ovpn_transport_to_userspace(ovpn, peer, skb);
+
+	ovpn_skb_stamp(peer, skb);
+	trace_ovpn_rx_queue(peer, skb);
+
+	/* in parallel mode the reference to the peer is transferred to the skb */
+	if (ovpn->parallel_crypto) {
+		OVPN_SKB_CB(skb)->peer = peer;
+		/* the ring consumer releases them even if the packet never reaches the crypto */
+		OVPN_SKB_CB(skb)->ks = NULL;
+		OVPN_SKB_CB(skb)->crypto_tmp = NULL;
+		/* all packets of a peer share the same outer flow: spread them */
+		return ovpn_queue_parallel(peer, &peer->rx_ring, &ovpn->decrypt_queue,
+					   &peer->decrypt_work, skb, -1);
+	}
 
-		ovpn_peer_put(peer);
+	/* in inline mode the reference to the peer is transferred to the skb as well */
+	if (ovpn->crypto_exec == OVPN_CRYPTO_EXEC_INLINE && ovpn_decrypt_inline(peer, skb))
 		return 0;
-	}
 
-	ret = ptr_ring_produce_bh(&peer->rx_ring, skb);
-	if (unlikely(ret < 0))
+	ret = ovpn_peer_ring_produce(&peer->rx_ring, skb);
+	if (unlikely(ret < 0)) {
+		ovpn_peer_stats_increment_drop(&peer->stats, OVPN_DROP_RING_FULL);
 		return -ENOSPC;
+	}
 
-	if (!queue_work(ovpn->crypto_wq, &peer->decrypt_work))
+	if (!ovpn_peer_queue_decrypt(peer))
 		ovpn_peer_put(peer);
 
 	return 0;
 }
 
-static int ovpn_decrypt_one(struct ovpn_peer *peer, struct sk_buff *skb)
+/* Entry point for processing a list of DATA_V2 packets received from the same peer,
+ * as aggregated by UDP GRO.
+ *
+ * The RX ring is locked once and the consumer is kicked once for the whole list.
+ * Packets not fitting the ring are dropped. The list and the reference to peer
+ * are always consumed.
+ */
+void ovpn_recv_list(struct ovpn_struct *ovpn, struct ovpn_peer *peer, struct sk_buff *list)
 {
-	struct ovpn_peer *allowed_peer = NULL;
-	struct ovpn_crypto_key_slot *ks;
-	unsigned int rx_stats_size;
-	__be16 proto;
-	int ret = -1;
-	u8 key_id;
+	const u32 peer_id = peer->id;
+	struct sk_buff *skb, *next;
+	unsigned int dropped = 0;
+	bool peer_ref = true;
+
+	/* packets are dispatched one by one, as they may take different paths */
+	if (ovpn->parallel_crypto || ovpn->crypto_exec == OVPN_CRYPTO_EXEC_INLINE) {
+		skb_list_walk_safe(list, skb, next) {
+			skb_mark_not_on_list(skb);
+
+			/* each packet carries its own reference to the peer */
+			ovpn_peer_hold(peer);
+			if (unlikely(ovpn_recv(ovpn, peer, skb) < 0)) {
+				ovpn_peer_put(peer);
+				kfree_skb(skb);
+				dropped++;
+			}
+		}
+		goto out;
+	}
 
-	/* save original packet size for stats accounting */
-	OVPN_SKB_CB(skb)->rx_stats_size = skb->len;
+	spin_lock_bh(&peer->rx_ring.producer_lock);
+	skb_list_walk_safe(list, skb, next) {
+		skb_mark_not_on_list(skb);
+		ovpn_skb_stamp(peer, skb);
+		trace_ovpn_rx_queue(peer, skb);
 
-	/* get the key slot matching the key Id in the received packet */
-	key_id = ovpn_key_id_from_skb(skb);
-	ks = ovpn_crypto_key_id_to_slot(&peer->crypto, key_id);
-	if (unlikely(!ks)) {
-		net_info_ratelimited("%s: no available key for peer %u, key-id: %u\n", __func__,
-				    peer->id, key_id);
-		goto drop;
+		if (likely(__ptr_ring_produce(&peer->rx_ring, skb) == 0))
+			continue;
+
+		/* resizing takes the producer lock on its own */
+		spin_unlock_bh(&peer->rx_ring.producer_lock);
+		ovpn_peer_ring_grow(&peer->rx_ring);
+		spin_lock_bh(&peer->rx_ring.producer_lock);
+
+		if (unlikely(__ptr_ring_produce(&peer->rx_ring, skb) < 0)) {
+			kfree_skb(skb);
+			dropped++;
+		}
 	}
+	spin_unlock_bh(&peer->rx_ring.producer_lock);
 
-	/* decrypt */
-	ret = ovpn_aead_decrypt(ks, skb);
+	if (unlikely(dropped))
+		ovpn_peer_stats_add_drops(&peer->stats, OVPN_DROP_RING_FULL, dropped);
 
-	ovpn_crypto_key_slot_put(ks);
+	/* the reference to peer is transferred to the work item */
+	if (ovpn_peer_queue_decrypt(peer))
+		peer_ref = false;
+out:
+	if (unlikely(dropped))
+		net_dbg_ratelimited("%s: dropped %u packets from peer %u: RX queue full\n",
+				    ovpn->dev->name, dropped, peer_id);
+	if (peer_ref)
+		ovpn_peer_put(peer);
+}
+
+/* Complete the RX processing of a packet after decryption, in arrival order.
+ *
+ * Consumes the skb and releases the peer and key slot references stored in
+ * its control block. If batch is not NULL, the per-peer work is left to
+ * ovpn_decrypt_batch_flush().
+ */
+static void ovpn_decrypt_finish(struct sk_buff *skb, int ret, struct ovpn_batch *batch)
+{
+	struct ovpn_crypto_key_slot *ks = OVPN_SKB_CB(skb)->ks;
+	struct ovpn_peer *peer = OVPN_SKB_CB(skb)->peer;
+	struct ovpn_peer *allowed_peer = NULL;
+	unsigned int rx_stats_size;
+	__be32 *pid;
+	__be16 proto;
 
+	if (unlikely(ret < 0))
+		goto drop;
+
+	/* PID sits after the op */
+	pid = (__force __be32 *)(skb->data + OVPN_OP_SIZE_V2);
+	ret = ovpn_pktid_recv(&ks->pid_recv, ntohl(*pid), 0);
 	if (unlikely(ret < 0)) {
-		net_err_ratelimited("%s: error during decryption for peer %u, key-id %u: %d\n",
-				   __func__, peer->id, key_id, ret);
+		net_err_ratelimited("%s: PKT ID RX error for peer %u, key-id %u: %d\n",
+				    __func__, peer->id, ks->key_id, ret);
+		ovpn_peer_stats_increment_drop(&peer->stats, OVPN_DROP_REPLAY);
 		goto drop;
 	}
 
-	/* note event of authenticated packet received for keepalive */
-	ovpn_peer_keepalive_recv_reset(peer);
-
-	/* update source and destination endpoint for this peer */
-	if (peer->sock->sock->sk->sk_protocol == IPPROTO_UDP)
-		ovpn_peer_update_local_endpoint(peer, skb);
+	/* point to encapsulated IP packet */
+	__skb_pull(skb, OVPN_SKB_CB(skb)->payload_offset);
 
-	/* increment RX stats */
 	rx_stats_size = OVPN_SKB_CB(skb)->rx_stats_size;
-	ovpn_peer_stats_increment_rx(&peer->stats, rx_stats_size);
+	if (batch) {
+		batch->keepalive = true;
+		batch->packets++;
+		batch->bytes += rx_stats_size;
+
+		if (batch->proto == IPPROTO_UDP)
+			ovpn_peer_update_local_endpoint(peer, skb);
+	} else {
+		/* note event of authenticated packet received for keepalive */
+		ovpn_peer_keepalive_recv_reset(peer);
+		ovpn_peer_touch(peer);
+
+		/* update source and destination endpoint for this peer */
+		if (peer->sock->sock->sk->sk_protocol == IPPROTO_UDP)
+			ovpn_peer_update_local_endpoint(peer, skb);
+
+		/* increment RX stats */
+		ovpn_peer_stats_increment_rx(&peer->stats, rx_stats_size);
+	}
 
 	/* check if this is a valid datapacket that has to be delivered to the
 	 * tun interface
@@ -255,6 +601,7 @@ static int ovpn_decrypt_one(struct ovpn_peer *peer, struct sk_buff *skb)
 	if (unlikely(!proto)) {
 		/* check if null packet */
 		if (unlikely(!pskb_may_pull(skb, 1))) {
+			ovpn_peer_stats_increment_drop(&peer->stats, OVPN_DROP_DECRYPT);
 			ret = -EINVAL;
 			goto drop;
 		}
@@ -265,12 +612,10 @@ static int ovpn_decrypt_one(struct ovpn_peer *peer, struct sk_buff *skb)
 				   __func__, peer->id);
 			/* not an error */
 			consume_skb(skb);
-			/* inform the caller that NAPI should not be scheduled
-			 * for this packet
-			 */
-			return -1;
+			goto out;
 		}
 
+		ovpn_peer_stats_increment_drop(&peer->stats, OVPN_DROP_DECRYPT);
 		ret = -EPROTONOSUPPORT;
 		goto drop;
 	}
@@ -279,145 +624,843 @@ static int ovpn_decrypt_one(struct ovpn_peer *peer, struct sk_buff *skb)
 	/* perform Reverse Path Filtering (RPF) */
 	allowed_peer = ovpn_peer_lookup_vpn_addr(peer->ovpn, skb, true);
 	if (unlikely(allowed_peer != peer)) {
+		ovpn_peer_stats_increment_drop(&peer->stats, OVPN_DROP_RPF);
 		ret = -EPERM;
 		goto drop;
 	}
 
-	ret = ptr_ring_produce_bh(&peer->netif_rx_ring, skb);
+	ret = ovpn_peer_ring_produce(&peer->netif_rx_ring, skb);
+	if (unlikely(ret < 0)) {
+		ovpn_peer_stats_increment_drop(&peer->stats, OVPN_DROP_RING_FULL);
+		goto drop;
+	}
+
+	if (batch) {
+		batch->napi = true;
+		goto out;
+	}
+
+	/* a packet has been enqueued for NAPI: signal availability to the
+	 * networking stack
+	 */
+	local_bh_disable();
+	napi_schedule(&peer->napi);
+	local_bh_enable();
+	goto out;
 drop:
+	kfree_skb(skb);
+out:
 	if (likely(allowed_peer))
 		ovpn_peer_put(allowed_peer);
+	if (likely(ks))
+		ovpn_crypto_key_slot_put(ks);
+	ovpn_peer_put(peer);
+}
 
-	if (unlikely(ret < 0))
-		kfree_skb(skb);
+/* Perform the per-peer work collected by ovpn_decrypt_finish() for a batch */
+static void ovpn_decrypt_batch_flush(struct ovpn_peer *peer, struct ovpn_batch *batch)
+{
+	if (batch->keepalive) {
+		/* note event of authenticated packet received for keepalive */
+		ovpn_peer_keepalive_recv_reset(peer);
+		ovpn_peer_touch(peer);
+	}
 
-	return ret;
+	if (batch->packets)
+		ovpn_peer_stats_add_rx(&peer->stats, batch->bytes, batch->packets);
+
+	if (batch->napi) {
+		/* packets have been enqueued for NAPI: signal availability to
+		 * the networking stack
+		 */
+		local_bh_disable();
+		napi_schedule(&peer->napi);
+		local_bh_enable();
+	}
+}
+
+static void __ovpn_decrypt_post(struct sk_buff *skb, int ret, struct ovpn_batch *batch)
+{
+	struct ovpn_crypto_key_slot *ks = OVPN_SKB_CB(skb)->ks;
+	struct ovpn_peer *peer = OVPN_SKB_CB(skb)->peer;
+
+	/* the request moved from the backlog to the crypto engine queue:
+	 * we will be invoked again upon completion
+	 */
+	if (unlikely(ret == -EINPROGRESS))
+		return;
+
+	ovpn_aead_decrypt_release(skb, ret);
+
+	if (likely(ks))
+		ovpn_skb_stage(peer, skb, OVPN_STAGE_RX_CRYPTO);
+	trace_ovpn_rx_decrypted(peer, skb, ret);
+
+	if (unlikely(ret < 0)) {
+		if (ks)
+			net_err_ratelimited("%s: error during decryption for peer %u, key-id %u: %d\n",
+					    __func__, peer->id, ks->key_id, ret);
+
+		ovpn_peer_stats_increment_drop(&peer->stats, ret == -ENOKEY ? OVPN_DROP_NO_KEY :
+									       OVPN_DROP_DECRYPT);
+	}
+
+	if (!peer->ovpn->parallel_crypto) {
+		ovpn_decrypt_finish(skb, ret, batch);
+		return;
+	}
+
+	ovpn_peer_publish_state(peer, skb, ret < 0 ? OVPN_SKB_STATE_DEAD : OVPN_SKB_STATE_DONE,
+				&peer->decrypt_work);
+}
+
+/* Decryption completion handler.
+ *
+ * Invoked either directly by ovpn_decrypt_one() when the crypto operation
+ * completed synchronously, or by the crypto API completion callback
+ * (possibly in softirq context).
+ * In parallel mode the skb is only marked as processed and the per-peer
+ * consumer is kicked, so that packets are delivered in arrival order.
+ */
+void ovpn_decrypt_post(struct sk_buff *skb, int ret)
+{
+	__ovpn_decrypt_post(skb, ret, NULL);
+}
+
+/* Submit skb for decryption with ks, whose reference is transferred to the skb.
+ * If decryption completes synchronously, its completion is accounted in batch
+ * (if not NULL).
+ */
+static void ovpn_decrypt_submit(struct sk_buff *skb, struct ovpn_crypto_key_slot *ks,
+				struct ovpn_batch *batch, bool may_sleep)
+{
+	int ret;
+
+	/* save original packet size for stats accounting */
+	OVPN_SKB_CB(skb)->rx_stats_size = skb->len;
+	OVPN_SKB_CB(skb)->crypto_tmp = NULL;
+	OVPN_SKB_CB(skb)->ks = ks;
+
+	ovpn_skb_stage(OVPN_SKB_CB(skb)->peer, skb, OVPN_STAGE_RX_QUEUE);
+	trace_ovpn_rx_decrypt(OVPN_SKB_CB(skb)->peer, skb);
+
+	/* decrypt */
+	ret = ovpn_aead_decrypt(skb, may_sleep);
+	if (likely(ret != -EINPROGRESS && ret != -EBUSY))
+		__ovpn_decrypt_post(skb, ret, batch);
+}
+
+/* Submit skb for decryption with the key matching its key ID.
+ * The peer is taken from the skb control block.
+ */
+static void ovpn_decrypt_one(struct sk_buff *skb, struct ovpn_batch *batch)
+{
+	struct ovpn_peer *peer = OVPN_SKB_CB(skb)->peer;
+	struct ovpn_crypto_key_slot *ks;
+	u8 key_id;
+
+	/* get the key slot matching the key Id in the received packet */
+	key_id = ovpn_key_id_from_skb(skb);
+	ks = ovpn_crypto_key_id_to_slot(&peer->crypto, key_id);
+	if (unlikely(!ks)) {
+		net_info_ratelimited("%s: no available key for peer %u, key-id: %u\n", __func__,
+				     peer->id, key_id);
+		OVPN_SKB_CB(skb)->rx_stats_size = skb->len;
+		OVPN_SKB_CB(skb)->crypto_tmp = NULL;
+		OVPN_SKB_CB(skb)->ks = NULL;
+		__ovpn_decrypt_post(skb, -ENOKEY, batch);
+		return;
+	}
+
+	ovpn_decrypt_submit(skb, ks, batch, true);
+}
+
+/* inline mode: decrypt skb right away in softirq context.
+ *
+ * Packets are deferred to the RX ring when it is backlogged, so that they are not
+ * overtaken, or when their key may not complete synchronously. Packets already
+ * pulled by the consumer can still complete after skb: the replay window copes
+ * with such reordering.
+ * On success, the reference to peer passed by the caller is transferred to skb.
+ *
+ * Return true if skb was consumed.
+ */
+static bool ovpn_decrypt_inline(struct ovpn_peer *peer, struct sk_buff *skb)
+{
+	struct ovpn_crypto_key_slot *ks;
+
+	/* the ring may be resized at any time, hence it can only be peeked under lock */
+	if (!ptr_ring_empty_bh(&peer->rx_ring))
+		return false;
+
+	ks = ovpn_crypto_key_id_to_slot(&peer->crypto, ovpn_key_id_from_skb(skb));
+	if (unlikely(!ks))
+		return false;
+
+	if (!ks->sync) {
+		ovpn_crypto_key_slot_put(ks);
+		return false;
+	}
+
+	OVPN_SKB_CB(skb)->peer = peer;
+	ovpn_decrypt_submit(skb, ks, NULL, false);
+
+	return true;
+}
+
+/* Upper bound of the packets processed per batch, as configured on the device */
+static unsigned int ovpn_batch_size(const struct ovpn_struct *ovpn)
+{
+	BUILD_BUG_ON(ilog2(OVPN_BATCH_MAX) >= OVPN_BATCH_HIST_BUCKETS);
+
+	return min_t(unsigned int, READ_ONCE(ovpn->batch_size), OVPN_BATCH_MAX);
+}
+
+/* pick packets from RX queue in batches and submit them for decryption */
+static void ovpn_decrypt_peer(struct ovpn_peer *peer)
+{
+	struct sk_buff *skbs[OVPN_BATCH_MAX];
+	struct ovpn_batch batch;
+	int i, n;
+
+	while ((n = ptr_ring_consume_batched_bh(&peer->rx_ring, (void **)skbs,
+						 ovpn_batch_size(peer->ovpn)))) {
+		ovpn_batch_init(&batch, peer);
+
+		for (i = 0; i < n; i++) {
+			/* the packet may outlive this work item when the crypto
+			 * operation completes asynchronously: let it carry its own
+			 * peer reference. Cannot fail as we already hold one.
+			 */
+			ovpn_peer_hold(peer);
+			OVPN_SKB_CB(skbs[i])->peer = peer;
+
+			ovpn_decrypt_one(skbs[i], &batch);
+		}
+
+		ovpn_decrypt_batch_flush(peer, &batch);
+		ovpn_batch_hist_add(&peer->stats.rx_batch, n);
+
+		/* give a chance to be rescheduled if needed */
+		cond_resched();
+	}
+	ovpn_peer_put(peer);
 }
 
-/* pick packet from RX queue, decrypt and forward it to the tun device */
 void ovpn_decrypt_work(struct work_struct *work)
 {
+	ovpn_decrypt_peer(container_of(work, struct ovpn_peer, decrypt_work));
+}
+
+/* kthread crypto mode: same as ovpn_decrypt_work() */
+void ovpn_decrypt_kwork(struct kthread_work *work)
+{
+	ovpn_decrypt_peer(container_of(work, struct ovpn_peer, decrypt_kwork));
+}
+
+/* Pick the next packet from ring whose crypto operation has completed.
+ * Return NULL if the ring is empty or if the head packet is still pending.
+ *
+ * Must be called from the only consumer of ring.
+ */
+static struct sk_buff *ovpn_ring_consume_processed(struct ptr_ring *ring)
+{
+	struct sk_buff *skb = ptr_ring_peek_bh(ring);
+
+	if (!skb || smp_load_acquire(&OVPN_SKB_CB(skb)->state) == OVPN_SKB_STATE_PENDING)
+		return NULL;
+
+	return ptr_ring_consume_bh(ring);
+}
+
+/* parallel mode: deliver decrypted packets in the order they were received */
+void ovpn_decrypt_parallel_finish_work(struct work_struct *work)
+{
+	unsigned int n, batch_size;
+	struct ovpn_batch batch;
 	struct ovpn_peer *peer;
 	struct sk_buff *skb;
+	int ret;
 
 	peer = container_of(work, struct ovpn_peer, decrypt_work);
-	while ((skb = ptr_ring_consume_bh(&peer->rx_ring))) {
-		if (likely(ovpn_decrypt_one(peer, skb) == 0)) {
-			/* if a packet has been enqueued for NAPI, signal
-			 * availability to the networking stack
-			 */
-			local_bh_disable();
-			napi_schedule(&peer->napi);
-			local_bh_enable();
+	batch_size = ovpn_batch_size(peer->ovpn);
+	do {
+		ovpn_batch_init(&batch, peer);
+
+		for (n = 0; n < batch_size; n++) {
+			skb = ovpn_ring_consume_processed(&peer->rx_ring);
+			if (!skb)
+				break;
+
+			ret = 0;
+			if (OVPN_SKB_CB(skb)->state == OVPN_SKB_STATE_DEAD)
+				ret = -EBADMSG;
+
+			ovpn_decrypt_finish(skb, ret, &batch);
 		}
 
+		if (!n)
+			break;
+
+		ovpn_decrypt_batch_flush(peer, &batch);
+		ovpn_batch_hist_add(&peer->stats.rx_batch, n);
+
+		/* give a chance to be rescheduled if needed */
+		cond_resched();
+	} while (n == batch_size);
+	ovpn_peer_put(peer);
+}
+
+/* parallel mode: per-CPU worker submitting packets of any peer for decryption */
+void ovpn_decrypt_parallel_work(struct work_struct *work)
+{
+	struct ptr_ring *ring = &container_of(work, struct ovpn_parallel_worker, work)->ring;
+	struct sk_buff *skb;
+
+	while ((skb = ptr_ring_consume_bh(ring))) {
+		ovpn_decrypt_one(skb, NULL);
+
 		/* give a chance to be rescheduled if needed */
 		cond_resched();
 	}
+}
+
+/* Complete the TX processing of a packet after encryption, in the order it
+ * was queued, and hand it over to the transport layer.
+ *
+ * Consumes the skb and releases the references stored in its control block.
+ * If batch is not NULL, the keepalive stamp is refreshed by ovpn_encrypt_batch_flush().
+ */
+static void ovpn_encrypt_finish(struct sk_buff *skb, int ret, struct ovpn_batch *batch)
+{
+	struct ovpn_crypto_key_slot *ks = OVPN_SKB_CB(skb)->ks;
+	struct ovpn_peer *peer = OVPN_SKB_CB(skb)->peer;
+
+	if (unlikely(ret < 0)) {
+		kfree_skb(skb);
+		goto out;
+	}
+
+	ovpn_skb_stage(peer, skb, OVPN_STAGE_TX_SEND);
+	trace_ovpn_tx_send(peer, skb);
+
+	switch (batch ? batch->proto : peer->sock->sock->sk->sk_protocol) {
+	case IPPROTO_UDP:
+		ovpn_udp_send_skb(peer->ovpn, peer, skb);
+		break;
+	case IPPROTO_TCP:
+		ovpn_tcp_send_skb(peer, skb);
+		break;
+	default:
+		/* no transport configured yet */
+		consume_skb(skb);
+		break;
+	}
+
+	if (batch) {
+		batch->keepalive = true;
+	} else {
+		/* note event of authenticated packet xmit for keepalive */
+		ovpn_peer_keepalive_xmit_reset(peer);
+		ovpn_peer_touch(peer);
+	}
+out:
+	if (likely(ks))
+		ovpn_crypto_key_slot_put(ks);
 	ovpn_peer_put(peer);
 }
 
-static bool ovpn_encrypt_one(struct ovpn_peer *peer, struct sk_buff *skb)
+/* Perform the per-peer work collected by a TX batch */
+static void ovpn_encrypt_batch_flush(struct ovpn_peer *peer, struct ovpn_batch *batch)
+{
+	if (batch->packets)
+		ovpn_peer_stats_add_tx(&peer->stats, batch->bytes, batch->packets);
+
+	if (batch->keepalive) {
+		/* note event of authenticated packet xmit for keepalive */
+		ovpn_peer_keepalive_xmit_reset(peer);
+		ovpn_peer_touch(peer);
+	}
+}
+
+/* Encryption completion handler.
+ *
+ * Same calling convention as ovpn_decrypt_post().
+ */
+void ovpn_encrypt_post(struct sk_buff *skb, int ret)
+{
+	struct ovpn_crypto_key_slot *ks = OVPN_SKB_CB(skb)->ks;
+	struct ovpn_peer *peer = OVPN_SKB_CB(skb)->peer;
+
+	/* request left the backlog, completion will follow */
+	if (unlikely(ret == -EINPROGRESS))
+		return;
+
+	ovpn_aead_encrypt_release(skb);
+
+	if (likely(ks))
+		ovpn_skb_stage(peer, skb, OVPN_STAGE_TX_CRYPTO);
+	trace_ovpn_tx_encrypted(peer, skb, ret);
+
+	if (unlikely(ret == -ENOKEY))
+		ovpn_peer_stats_increment_drop(&peer->stats, OVPN_DROP_NO_KEY);
+
+	if (unlikely(ret < 0 && ks)) {
+		/* if we ran out of IVs we must kill the key as it can't be used anymore */
+		if (ret == -ERANGE) {
+			/* inline mode stops short of the exhaustion, unless racing with
+			 * other CPUs: let the next packet hit the workers in that case
+			 */
+			if (in_task()) {
+				netdev_warn(peer->ovpn->dev,
+					    "%s: killing primary key as we ran out of IVs\n",
+					    __func__);
+				ovpn_crypto_kill_primary(&peer->crypto);
+			}
+		} else {
+			net_err_ratelimited("%s: error during encryption for peer %u, key-id %u: %d\n",
+					    __func__, peer->id, ks->key_id, ret);
+		}
+	}
+
+	if (!peer->ovpn->parallel_crypto) {
+		ovpn_encrypt_finish(skb, ret, NULL);
+		return;
+	}
+
+	ovpn_peer_publish_state(peer, skb, ret < 0 ? OVPN_SKB_STATE_DEAD : OVPN_SKB_STATE_DONE,
+				&peer->encrypt_work);
+}
+
+/* Pick the primary key for skb, possibly a list of segments, and reserve a run of
+ * consecutive packet IDs for it with a single atomic operation, so that segments
+ * encrypted concurrently by different CPUs still carry increasing packet IDs in the
+ * order they were queued. Keys close to running out of IVs are left to
+ * ovpn_encrypt_one(), which picks the key of each packet on its own.
+ */
+static void ovpn_encrypt_reserve(struct ovpn_peer *peer, struct sk_buff *skb)
 {
 	struct ovpn_crypto_key_slot *ks;
-	bool success = false;
+	struct sk_buff *curr;
+	u32 pktid, n = 0;
+
+	for (curr = skb; curr; curr = curr->next) {
+		OVPN_SKB_CB(curr)->ks = NULL;
+		n++;
+	}
+
+	ks = ovpn_crypto_key_slot_primary(&peer->crypto);
+	if (unlikely(!ks))
+		return;
+
+	if (unlikely(ovpn_pktid_xmit_exhausting(&ks->pid_xmit, OVPN_INLINE_PKTID_MARGIN) ||
+		     ovpn_pktid_xmit_next_n(&ks->pid_xmit, n, &pktid) < 0))
+		goto out;
+
+	for (curr = skb; curr; curr = curr->next) {
+		/* each packet carries its own reference to the key */
+		if (unlikely(!ovpn_crypto_key_slot_hold(ks)))
+			break;
+
+		OVPN_SKB_CB(curr)->ks = ks;
+		OVPN_SKB_CB(curr)->tx_pktid = pktid++;
+	}
+out:
+	ovpn_crypto_key_slot_put(ks);
+}
+
+/* release the keys reserved for a list of packets that will not be encrypted */
+static void ovpn_encrypt_unreserve(struct sk_buff *skb)
+{
+	for (; skb; skb = skb->next) {
+		if (OVPN_SKB_CB(skb)->ks)
+			ovpn_crypto_key_slot_put(OVPN_SKB_CB(skb)->ks);
+		OVPN_SKB_CB(skb)->ks = NULL;
+	}
+}
+
+/* Submit a single skb for encryption with the key reserved by ovpn_encrypt_reserve(),
+ * or with the primary key if none.
+ * The peer is taken from the skb control block.
+ *
+ * Return 0 if the skb was encrypted synchronously: in this case the caller
+ * is responsible for completing it. Otherwise the skb is consumed, either
+ * because it is in flight or because of an error.
+ * TX stats are accounted in batch, if not NULL.
+ */
+static int ovpn_encrypt_one(struct sk_buff *skb, struct ovpn_batch *batch, bool may_sleep)
+{
+	struct ovpn_peer *peer = OVPN_SKB_CB(skb)->peer;
+	struct ovpn_crypto_key_slot *ks;
 	int ret;
 
+	OVPN_SKB_CB(skb)->crypto_tmp = NULL;
+	OVPN_SKB_CB(skb)->offload = false;
+
 	/* get primary key to be used for encrypting data */
-	ks = ovpn_crypto_key_slot_primary(&peer->crypto);
+	ks = OVPN_SKB_CB(skb)->ks;
+	if (!ks) {
+		ks = ovpn_crypto_key_slot_primary(&peer->crypto);
+		OVPN_SKB_CB(skb)->ks = ks;
+		OVPN_SKB_CB(skb)->tx_pktid = 0;
+	}
 	if (unlikely(!ks)) {
 		net_info_ratelimited("%s: error while retrieving primary key slot\n", __func__);
-		return false;
+		ovpn_encrypt_post(skb, -ENOKEY);
+		return -ENOKEY;
 	}
 
 	if (unlikely(skb->ip_summed == CHECKSUM_PARTIAL &&
 		     skb_checksum_help(skb))) {
 		net_err_ratelimited("%s: cannot compute checksum for outgoing packet\n", __func__);
-		goto err;
+		ovpn_encrypt_post(skb, -EINVAL);
+		return -EINVAL;
+	}
+
+	if (batch) {
+		batch->packets++;
+		batch->bytes += skb->len;
+	} else {
+		ovpn_peer_stats_increment_tx(&peer->stats, skb->len);
 	}
 
-	ovpn_peer_stats_increment_tx(&peer->stats, skb->len);
+	ovpn_skb_stage(peer, skb, OVPN_STAGE_TX_QUEUE);
+	trace_ovpn_tx_encrypt(peer, skb);
 
 	/* encrypt */
-	ret = ovpn_aead_encrypt(ks, skb, peer->id);
-	if (unlikely(ret < 0)) {
-		/* if we ran out of IVs we must kill the key as it can't be used anymore */
-		if (ret == -ERANGE) {
-			netdev_warn(peer->ovpn->dev,
-				    "%s: killing primary key as we ran out of IVs\n", __func__);
-			ovpn_crypto_kill_primary(&peer->crypto);
-			goto err;
-		}
-		net_err_ratelimited("%s: error during encryption for peer %u, key-id %u: %d\n",
-				   __func__, peer->id, ks->key_id, ret);
-		goto err;
+	ret = ovpn_aead_encrypt(skb, may_sleep);
+	if (likely(ret == 0)) {
+		ovpn_aead_encrypt_release(skb);
+		return 0;
 	}
 
-	success = true;
-err:
-	ovpn_crypto_key_slot_put(ks);
-	return success;
+	if (likely(ret != -EINPROGRESS && ret != -EBUSY))
+		ovpn_encrypt_post(skb, ret);
+
+	return ret;
+}
+
+/* Send packets that were encrypted synchronously out of the same GSO
+ * super-packet, as part of batch. UDP packets are handed over to the transport as a batch, so
+ * that they can be coalesced into a single UDP GSO skb
+ */
+static void ovpn_encrypt_send_list(struct ovpn_peer *peer, struct sk_buff_head *list,
+				   struct ovpn_batch *batch)
+{
+	bool offload = false;
+	struct sk_buff *skb;
+
+	/* encryption completed synchronously, no ovpn_encrypt_post() involved */
+	skb_queue_walk(list, skb) {
+		ovpn_skb_stage(peer, skb, OVPN_STAGE_TX_CRYPTO);
+		trace_ovpn_tx_encrypted(peer, skb, 0);
+		offload |= OVPN_SKB_CB(skb)->offload;
+	}
+
+	/* packets left to the device for encryption are not coalesced */
+	if (skb_queue_len(list) < 2 || batch->proto != IPPROTO_UDP || offload) {
+		while ((skb = __skb_dequeue(list)))
+			ovpn_encrypt_finish(skb, 0, batch);
+		return;
+	}
+
+	/* references carried by the packets are not needed anymore, as the
+	 * caller holds its own reference to the peer
+	 */
+	skb_queue_walk(list, skb) {
+		ovpn_skb_stage(peer, skb, OVPN_STAGE_TX_SEND);
+		trace_ovpn_tx_send(peer, skb);
+		ovpn_crypto_key_slot_put(OVPN_SKB_CB(skb)->ks);
+		ovpn_peer_put(peer);
+	}
+
+	ovpn_udp_send_skb_list(peer->ovpn, peer, list);
+	batch->keepalive = true;
+}
+
+/* Segment a GSO packet into a list of packets, consuming it.
+ * Return the list, or NULL in case of error.
+ */
+static struct sk_buff *ovpn_gso_segment(struct net_device *dev, struct sk_buff *skb)
+{
+	struct sk_buff *segments;
+
+	segments = skb_gso_segment(skb, 0);
+	if (IS_ERR(segments)) {
+		net_dbg_ratelimited("%s: cannot segment packet: %ld\n", dev->name,
+				    PTR_ERR(segments));
+		skb_tx_error(skb);
+		kfree_skb(skb);
+		return NULL;
+	}
+
+	/* nothing to segment */
+	if (!segments)
+		return skb;
+
+	consume_skb(skb);
+	return segments;
+}
+
+/* Whether GSO packets are queued as they are and segmented by the crypto worker, rather
+ * than in ovpn_net_xmit(): only ring based modes process a GSO packet as a single unit
+ */
+static bool ovpn_gso_deferred(const struct ovpn_struct *ovpn)
+{
+	return !ovpn->parallel_crypto && ovpn->crypto_exec != OVPN_CRYPTO_EXEC_INLINE;
+}
+
+/* Encrypt and send all the segments of skb, as part of batch.
+ * The caller holds a reference to peer.
+ */
+static void ovpn_encrypt_segments(struct ovpn_peer *peer, struct sk_buff *skb,
+				  struct ovpn_batch *batch, bool may_sleep)
+{
+	struct sk_buff *curr, *next;
+	struct sk_buff_head list;
+
+	__skb_queue_head_init(&list);
+	ovpn_encrypt_reserve(peer, skb);
+
+	/* this might be a GSO-segmented skb list: process each skb
+	 * independently. Segments may complete out of order
+	 * when crypto is asynchronous: a failing segment is
+	 * dropped alone and the upper layer will recover it
+	 */
+	skb_list_walk_safe(skb, curr, next) {
+		skb_mark_not_on_list(curr);
+
+		/* same as RX: in-flight packets carry their own peer
+		 * reference
+		 */
+		ovpn_peer_hold(peer);
+		OVPN_SKB_CB(curr)->peer = peer;
+
+		if (!ovpn_encrypt_one(curr, batch, may_sleep))
+			__skb_queue_tail(&list, curr);
+	}
+
+	if (!skb_queue_empty(&list))
+		ovpn_encrypt_send_list(peer, &list, batch);
 }
 
 /* Process packets in TX queue in a transport-specific way.
  *
- * UDP transport - encrypt and send across the tunnel.
- * TCP transport - encrypt and put into TCP TX queue.
+ * Packets are pulled from the ring in batches. Every packet is submitted for
+ * encryption and then sent by ovpn_encrypt_post(), or by ovpn_encrypt_send_list()
+ * if encryption completed synchronously:
+ * UDP transport - send across the tunnel.
+ * TCP transport - put into TCP TX queue.
  */
+static void ovpn_encrypt_peer(struct ovpn_peer *peer)
+{
+	struct sk_buff *skbs[OVPN_BATCH_MAX], *curr;
+	struct ovpn_tx_done done = {};
+	struct ovpn_batch batch;
+	int i, n;
+	u64 tstamp;
+
+	while ((n = ptr_ring_consume_batched_bh(&peer->tx_ring, (void **)skbs,
+						 ovpn_batch_size(peer->ovpn)))) {
+		ovpn_batch_init(&batch, peer);
+
+		for (i = 0; i < n; i++) {
+			ovpn_tx_done_add(peer, &done, skbs[i]);
+
+			/* segmentation was left to us, to return from ovpn_net_xmit() sooner.
+			 * It overwrites the control block, stamp included
+			 */
+			if (skb_is_gso(skbs[i])) {
+				tstamp = OVPN_SKB_CB(skbs[i])->tstamp;
+				skbs[i] = ovpn_gso_segment(peer->ovpn->dev, skbs[i]);
+				if (unlikely(!skbs[i]))
+					continue;
+
+				for (curr = skbs[i]; curr; curr = curr->next)
+					OVPN_SKB_CB(curr)->tstamp = tstamp;
+			}
+
+			ovpn_encrypt_segments(peer, skbs[i], &batch, true);
+		}
+
+		ovpn_encrypt_batch_flush(peer, &batch);
+		ovpn_batch_hist_add(&peer->stats.tx_batch, n);
+
+		/* give a chance to be rescheduled if needed */
+		cond_resched();
+	}
+	ovpn_tx_done_flush(&done);
+	ovpn_peer_put(peer);
+}
+
 void ovpn_encrypt_work(struct work_struct *work)
 {
-	struct sk_buff *skb, *curr, *next;
+	ovpn_encrypt_peer(container_of(work, struct ovpn_peer, encrypt_work));
+}
+
+/* kthread crypto mode: same as ovpn_encrypt_work() */
+void ovpn_encrypt_kwork(struct kthread_work *work)
+{
+	ovpn_encrypt_peer(container_of(work, struct ovpn_peer, encrypt_kwork));
+}
+
+/* parallel mode: transmit encrypted packets in the order they were queued */
+void ovpn_encrypt_parallel_finish_work(struct work_struct *work)
+{
+	struct ovpn_tx_done done = {};
+	unsigned int n, batch_size;
+	struct ovpn_batch batch;
 	struct ovpn_peer *peer;
+	struct sk_buff *skb;
+	int ret;
 
 	peer = container_of(work, struct ovpn_peer, encrypt_work);
-	while ((skb = ptr_ring_consume_bh(&peer->tx_ring))) {
-		/* this might be a GSO-segmented skb list: process each skb
-		 * independently
-		 */
-		skb_list_walk_safe(skb, curr, next) {
-			/* if one segment fails encryption, we drop the entire
-			 * packet, because it does not really make sense to send
-			 * only part of it at this point
-			 */
-			if (unlikely(!ovpn_encrypt_one(peer, curr))) {
-				kfree_skb_list(skb);
-				skb = NULL;
+	batch_size = ovpn_batch_size(peer->ovpn);
+	do {
+		ovpn_batch_init(&batch, peer);
+
+		for (n = 0; n < batch_size; n++) {
+			skb = ovpn_ring_consume_processed(&peer->tx_ring);
+			if (!skb)
 				break;
-			}
-		}
 
-		/* successful encryption */
-		if (skb) {
-			skb_list_walk_safe(skb, curr, next) {
-				skb_mark_not_on_list(curr);
-
-				switch (peer->sock->sock->sk->sk_protocol) {
-				case IPPROTO_UDP:
-					ovpn_udp_send_skb(peer->ovpn, peer, curr);
-					break;
-				case IPPROTO_TCP:
-					ovpn_tcp_send_skb(peer, curr);
-					break;
-				default:
-					/* no transport configured yet */
-					consume_skb(skb);
-					break;
-				}
-			}
+			ret = 0;
+			if (OVPN_SKB_CB(skb)->state == OVPN_SKB_STATE_DEAD)
+				ret = -EBADMSG;
 
-			/* note event of authenticated packet xmit for keepalive */
-			ovpn_peer_keepalive_xmit_reset(peer);
+			ovpn_tx_done_add(peer, &done, skb);
+			ovpn_encrypt_finish(skb, ret, &batch);
 		}
 
+		if (!n)
+			break;
+
+		ovpn_encrypt_batch_flush(peer, &batch);
+		ovpn_batch_hist_add(&peer->stats.tx_batch, n);
+
 		/* give a chance to be rescheduled if needed */
 		cond_resched();
+	} while (n == batch_size);
+	ovpn_tx_done_flush(&done);
+	ovpn_peer_put(peer);
+}
+
+/* parallel mode: per-CPU worker submitting packets of any peer for encryption */
+void ovpn_encrypt_parallel_work(struct work_struct *work)
+{
+	struct ptr_ring *ring = &container_of(work, struct ovpn_parallel_worker, work)->ring;
+	struct sk_buff *skb;
+
+	while ((skb = ptr_ring_consume_bh(ring))) {
+		if (!ovpn_encrypt_one(skb, NULL, true))
+			ovpn_encrypt_post(skb, 0);
+
+		/* give a chance to be rescheduled if needed */
+		cond_resched();
+	}
+}
+
+/* parallel mode: queue every segment on its own, each carrying a reference
+ * to the peer. The reference passed by the caller is released.
+ *
+ * Segments of a GSO packet are spread across all CPUs rather than steered to the
+ * CPU of their TX queue, so that a single bulk flow is not bound to one CPU.
+ */
+static void ovpn_queue_skb_parallel(struct ovpn_struct *ovpn, struct sk_buff *skb,
+				    struct ovpn_peer *peer)
+{
+	bool steering = READ_ONCE(ovpn->tx_steering) && !skb->next;
+	u16 queue = ovpn_tx_queue(ovpn, skb);
+	unsigned int len = 0, n = 0;
+	struct sk_buff *curr, *next;
+
+	ovpn_encrypt_reserve(peer, skb);
+
+	/* segments are accounted at once, and completed one by one */
+	for (curr = skb; curr; curr = curr->next) {
+		OVPN_SKB_CB(curr)->tx_queue = queue;
+		OVPN_SKB_CB(curr)->tx_len = curr->len;
+		len += curr->len;
+	}
+	ovpn_tx_sent(ovpn, queue, len);
+
+	skb_list_walk_safe(skb, curr, next) {
+		skb_mark_not_on_list(curr);
+
+		if (unlikely(!ovpn_peer_hold(peer)))
+			goto drop;
+
+		/* the device has one TX queue per online CPU, picked by the stack
+		 * based on XPS or on the flow hash: with steering, queue N is
+		 * encrypted by the worker of CPU N only
+		 */
+		OVPN_SKB_CB(curr)->peer = peer;
+		if (unlikely(ovpn_queue_parallel(peer, &peer->tx_ring, &ovpn->encrypt_queue,
+						 &peer->encrypt_work, curr,
+						 steering ? skb_get_queue_mapping(curr) : -1) < 0)) {
+			net_err_ratelimited("%s: cannot queue packet to TX ring\n", __func__);
+			ovpn_peer_put(peer);
+			goto drop;
+		}
 	}
+
+	ovpn_peer_put(peer);
+	return;
+drop:
+	curr->next = next;
+
+	/* revert the accounting of the segments left */
+	for (len = 0, next = curr; next; next = next->next, n++)
+		len += next->len;
+	ovpn_tx_completed(netdev_get_tx_queue(ovpn->dev, queue), n, len);
+
+	ovpn_encrypt_unreserve(curr);
+	kfree_skb_list(curr);
 	ovpn_peer_put(peer);
 }
 
+/* inline mode: encrypt and send skb right away in xmit context.
+ *
+ * Same as ovpn_decrypt_inline(), with packets deferred to the TX ring when it is
+ * backlogged or when the primary key is not synchronous. Keys close to running
+ * out of IVs are left to the workers, as killing them may sleep.
+ * The reference to peer passed by the caller is released on success.
+ *
+ * Return true if skb was consumed.
+ */
+static bool ovpn_encrypt_inline(struct ovpn_peer *peer, struct sk_buff *skb)
+{
+	struct ovpn_crypto_key_slot *ks;
+	struct ovpn_batch batch;
+	bool inline_ok;
+
+	/* the ring may be resized at any time, hence it can only be peeked under lock */
+	if (!ptr_ring_empty_bh(&peer->tx_ring))
+		return false;
+
+	ks = ovpn_crypto_key_slot_primary(&peer->crypto);
+	if (unlikely(!ks))
+		return false;
+
+	inline_ok = ks->sync && !ovpn_pktid_xmit_exhausting(&ks->pid_xmit,
+							      OVPN_INLINE_PKTID_MARGIN);
+	ovpn_crypto_key_slot_put(ks);
+	if (!inline_ok)
+		return false;
+
+	ovpn_batch_init(&batch, peer);
+	ovpn_encrypt_segments(peer, skb, &batch, false);
+	ovpn_encrypt_batch_flush(peer, &batch);
+
+	ovpn_peer_put(peer);
+
+	return true;
+}
+
 /* Put skb into TX queue and schedule a consumer */
 static void ovpn_queue_skb(struct ovpn_struct *ovpn, struct sk_buff *skb, struct ovpn_peer *peer)
 {
+	struct sk_buff *curr;
 	int ret;
 
 	if (likely(!peer))
@@ -427,13 +1470,29 @@ static void ovpn_queue_skb(struct ovpn_struct *ovpn, struct sk_buff *skb, struct
 		goto drop;
 	}
 
-	ret = ptr_ring_produce_bh(&peer->tx_ring, skb);
+	for (curr = skb; curr; curr = curr->next) {
+		ovpn_skb_stamp(peer, curr);
+		trace_ovpn_tx_queue(peer, curr);
+	}
+
+	if (ovpn->parallel_crypto) {
+		ovpn_queue_skb_parallel(ovpn, skb, peer);
+		return;
+	}
+
+	if (ovpn->crypto_exec == OVPN_CRYPTO_EXEC_INLINE && ovpn_encrypt_inline(peer, skb))
+		return;
+
+	ovpn_tx_queued(ovpn, skb);
+	ret = ovpn_peer_ring_produce(&peer->tx_ring, skb);
 	if (unlikely(ret < 0)) {
+		ovpn_tx_unqueued(ovpn, skb);
+		ovpn_peer_stats_increment_drop(&peer->stats, OVPN_DROP_RING_FULL);
 		net_err_ratelimited("%s: cannot queue packet to TX ring\n", __func__);
 		goto drop;
 	}
 
-	if (!queue_work(ovpn->crypto_wq, &peer->encrypt_work))
+	if (!ovpn_peer_queue_encrypt(peer))
 		ovpn_peer_put(peer);
 
 	return;
@@ -448,10 +1507,9 @@ drop:
 netdev_tx_t ovpn_net_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct ovpn_struct *ovpn = netdev_priv(dev);
-	struct sk_buff *segments, *tmp, *curr, *next;
+	struct sk_buff *tmp, *curr, *next;
 	struct sk_buff_head skb_list;
 	__be16 proto;
-	int ret;
 
 	/* reset netfilter state */
 	nf_reset_ct(skb);
@@ -464,16 +1522,10 @@ netdev_tx_t ovpn_net_xmit(struct sk_buff *skb, struct net_device *dev)
 		goto drop;
 	}
 
-	if (skb_is_gso(skb)) {
-		segments = skb_gso_segment(skb, 0);
-		if (IS_ERR(segments)) {
-			ret = PTR_ERR(segments);
-			net_dbg_ratelimited("%s: cannot segment packet: %d\n", dev->name, ret);
-			goto drop;
-		}
-
-		consume_skb(skb);
-		skb = segments;
+	if (skb_is_gso(skb) && !ovpn_gso_deferred(ovpn)) {
+		skb = ovpn_gso_segment(dev, skb);
+		if (unlikely(!skb))
+			return NET_XMIT_DROP;
 	}
 
 	/* from this moment on, "skb" might be a list */
@@ -520,13 +1572,12 @@ static void ovpn_xmit_special(struct ovpn_peer *peer, const void *data,
 	if (unlikely(!ovpn))
 		return;
 
-	skb = alloc_skb(256 + len, GFP_ATOMIC);
+	skb = ovpn_pool_alloc_skb(peer, 128, len, GFP_ATOMIC);
 	if (unlikely(!skb))
 		return;
 
-	skb_reserve(skb, 128);
 	skb->priority = TC_PRIO_BESTEFFORT;
-	memcpy(__skb_put(skb, len), data, len);
+	skb_store_bits(skb, 0, data, len);
 
 	/* increase reference counter when passing peer to sending queue */
 	if (!ovpn_peer_hold(peer)) {
@@ -561,7 +1612,6 @@ void ovpn_explicit_exit_notify_xmit(struct ovpn_peer *peer)
  */
 int ovpn_send_data(struct ovpn_struct *ovpn, u32 peer_id, const u8 *data, size_t len)
 {
-	u16 skb_len = SKB_HEADER_LEN + len;
 	struct ovpn_peer *peer;
 	struct sk_buff *skb;
 	bool tcp = false;
@@ -573,19 +1623,17 @@ int ovpn_send_data(struct ovpn_struct *ovpn, u32 peer_id, const u8 *data, size_t
 		return -EHOSTUNREACH;
 	}
 
-	if (peer->sock->sock->sk->sk_protocol == IPPROTO_TCP) {
-		skb_len += sizeof(u16);
+	if (peer->sock->sock->sk->sk_protocol == IPPROTO_TCP)
 		tcp = true;
-	}
 
-	skb = alloc_skb(skb_len, GFP_ATOMIC);
+	/* the TCP size prefix is pushed into the headroom */
+	skb = ovpn_pool_alloc_skb(peer, SKB_HEADER_LEN + (tcp ? sizeof(u16) : 0), len, GFP_ATOMIC);
 	if (unlikely(!skb)) {
 		ret = -ENOMEM;
 		goto out;
 	}
 
-	skb_reserve(skb, SKB_HEADER_LEN);
-	skb_put_data(skb, data, len);
+	skb_store_bits(skb, 0, data, len);
 
 	/* prepend TCP packet with size, as required by OpenVPN protocol */
 	if (tcp) {
@@ -23,6 +23,7 @@ struct ovpn_struct;
 struct net_device;
 
 int ovpn_struct_init(struct net_device *dev);
+int ovpn_struct_init_parallel(struct ovpn_struct *ovpn);
 
 u16 ovpn_select_queue(struct net_device *dev, struct sk_buff *skb,
 		      struct net_device *sb_dev);
@@ -33,9 +34,18 @@ void ovpn_explicit_exit_notify_xmit(struct ovpn_peer *peer);
 netdev_tx_t ovpn_net_xmit(struct sk_buff *skb, struct net_device *dev);
 
 int ovpn_recv(struct ovpn_struct *ovpn, struct ovpn_peer *peer, struct sk_buff *skb);
+void ovpn_recv_list(struct ovpn_struct *ovpn, struct ovpn_peer *peer, struct sk_buff *list);
 
 void ovpn_encrypt_work(struct work_struct *work);
 void ovpn_decrypt_work(struct work_struct *work);
+void ovpn_encrypt_kwork(struct kthread_work *work);
+void ovpn_decrypt_kwork(struct kthread_work *work);
+void ovpn_encrypt_post(struct sk_buff *skb, int ret);
+void ovpn_encrypt_parallel_work(struct work_struct *work);
+void ovpn_decrypt_parallel_work(struct work_struct *work);
+void ovpn_encrypt_parallel_finish_work(struct work_struct *work);
+void ovpn_decrypt_parallel_finish_work(struct work_struct *work);
+void ovpn_decrypt_post(struct sk_buff *skb, int ret);
 int ovpn_napi_poll(struct napi_struct *napi, int budget);
 
 int ovpn_send_data(struct ovpn_struct *ovpn, u32 peer_id, const u8 *data, size_t len);
@@ -10,11 +10,19 @@
 #ifndef _NET_OVPN_DCO_OVPNSTRUCT_H_
 #define _NET_OVPN_DCO_OVPNSTRUCT_H_
 
+#include "main.h"
 #include "peer.h"
+#include "pool.h"
+#include "queue.h"
+#include "route.h"
+#include "worker.h"
 
 #include <uapi/linux/ovpn_dco.h>
+#include <linux/rhashtable.h>
+#include <linux/skbuff.h>
 #include <linux/spinlock.h>
 #include <linux/workqueue.h>
+#include <linux/xarray.h>
 
 /* Our state per ovpn interface */
 struct ovpn_struct {
@@ -24,6 +32,24 @@ struct ovpn_struct {
 	/* device operation mode (i.e. P2P, MP) */
 	enum ovpn_mode mode;
 
+	/* spread crypto operations of each peer across all online CPUs */
+	bool parallel_crypto;
+
+	/* in parallel crypto mode, encrypt on the CPU matching the TX queue of the packet */
+	bool tx_steering;
+
+	/* account the time packets spend in each stage of the data path */
+	bool latency_stats;
+
+	/* announce new peers to the "peers" multicast group */
+	bool peer_notify;
+
+	/* max number of packets processed by a crypto worker per batch */
+	unsigned int batch_size;
+
+	/* execution context of the peer crypto */
+	enum ovpn_crypto_exec crypto_exec;
+
 	/* protect writing to the ovpn_struct object */
 	spinlock_t lock;
 
@@ -34,15 +60,44 @@ struct ovpn_struct {
 	 */
 	struct workqueue_struct *events_wq;
 
-	/* list of known peers */
+	/* sends pings and expires peers, see ovpn_peers_keepalive_work() */
+	struct delayed_work keepalive_work;
+
+	/* device-wide queues used in parallel crypto mode */
+	struct ovpn_parallel_queue encrypt_queue;
+	struct ovpn_parallel_queue decrypt_queue;
+
+	/* per-CPU workers used in kthread crypto mode */
+	struct ovpn_crypto_workers workers;
+
+	/* buffers of the skbs allocated by the data path */
+	struct ovpn_page_pools page_pools;
+
+	/* list of known peers, each table has its own internal locking */
 	struct {
-		DECLARE_HASHTABLE(by_id, 12);
-		DECLARE_HASHTABLE(by_transp_addr, 12);
-		DECLARE_HASHTABLE(by_vpn_addr, 12);
-		/* protects write access to any of the hashtables above */
-		spinlock_t lock;
+		/* directly indexed by peer ID, the entry being the owner of the ID */
+		struct xarray by_id;
+		struct rhltable by_transp_addr;
+		struct rhltable by_vpn_addr4;
+		struct rhltable by_vpn_addr6;
 	} peers;
 
+	/* generation of the peer table, handed to userspace as the cookie of peer dumps
+	 * and advanced by each of them. Starts from 1
+	 */
+	atomic64_t peers_gen;
+
+	/* VPN prefixes routed to peers, in MP mode */
+	struct ovpn_route_table routes;
+
+	/* reuseport group of UDP sockets that peers attached to one of its members transmit
+	 * through, picking the member matching the current CPU. Only grows until dellink
+	 */
+	struct {
+		struct ovpn_socket __rcu *socks[OVPN_UDP_SHARDS_MAX];
+		unsigned int count;
+	} udp_shards;
+
 	/* for p2p mode */
 	struct ovpn_peer __rcu *peer;
 
@@ -54,6 +109,35 @@ struct ovpn_struct {
 
 	u32 registered_nl_portid;
 	bool registered_nl_portid_set;
+	/* the registered process wants packets batched in OVPN_CMD_PACKETS messages */
+	bool registered_nl_batch;
+
+	/* packets waiting to be delivered to the registered process in batches */
+	struct {
+		struct sk_buff_head queue;
+		struct work_struct work;
+	} nl_packets;
+
+	/* periodic multicast of the counters of active peers, see IFLA_OVPN_STATS_INTERVAL */
+	struct {
+		struct delayed_work work;
+		/* seconds between two reports, 0 if disabled */
+		unsigned int interval;
+		/* generation of the peer table at the previous report */
+		u64 last;
+	} nl_stats;
 };
 
+/* Note that the peer moved data or changed state during the current generation of the
+ * peer table. Written at most once per generation, not to bounce the cacheline of the
+ * peer for every packet
+ */
+static inline void ovpn_peer_touch(struct ovpn_peer *peer)
+{
+	s64 gen = atomic64_read(&peer->ovpn->peers_gen);
+
+	if (atomic64_read(&peer->gen) != gen)
+		atomic64_set(&peer->gen, gen);
+}
+
 #endif /* _NET_OVPN_DCO_OVPNSTRUCT_H_ */
@@ -17,33 +17,110 @@
 #include <linux/ip.h>
 #include <linux/ipv6.h>
 #include <linux/list.h>
-#include <linux/timer.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/jiffies.h>
 #include <linux/workqueue.h>
 
-static void ovpn_peer_ping(struct timer_list *t)
+static struct kmem_cache *ovpn_peer_cache;
+
+int ovpn_peer_cache_init(void)
+{
+	ovpn_peer_cache = KMEM_CACHE(ovpn_peer, SLAB_HWCACHE_ALIGN);
+	if (!ovpn_peer_cache)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void ovpn_peer_cache_destroy(void)
+{
+	kmem_cache_destroy(ovpn_peer_cache);
+}
+
+/* Grow ring to OVPN_QUEUE_LEN slots, if not there yet.
+ * Entries are preserved in order, so that consumers are not affected.
+ *
+ * Return true if the ring may now have room for more entries.
+ */
+bool ovpn_peer_ring_grow(struct ptr_ring *ring)
 {
-	struct ovpn_peer *peer = from_timer(peer, t, keepalive_xmit);
+	if (READ_ONCE(ring->size) >= OVPN_QUEUE_LEN)
+		return false;
 
-	netdev_dbg(peer->ovpn->dev, "%s: sending ping to peer %u\n", __func__, peer->id);
-	ovpn_keepalive_xmit(peer);
+	return ptr_ring_resize(ring, OVPN_QUEUE_LEN, GFP_ATOMIC, NULL) == 0;
 }
 
-static void ovpn_peer_expire(struct timer_list *t)
+/* Produce skb into one of the per-peer rings, growing it if full.
+ *
+ * Return 0 on success or -ENOSPC if the ring is full and cannot grow anymore.
+ */
+int ovpn_peer_ring_produce(struct ptr_ring *ring, struct sk_buff *skb)
 {
-	struct ovpn_peer *peer = from_timer(peer, t, keepalive_recv);
+	if (likely(ptr_ring_produce_bh(ring, skb) == 0))
+		return 0;
 
-	netdev_dbg(peer->ovpn->dev, "%s: peer %u expired\n", __func__, peer->id);
-	ovpn_peer_del(peer, OVPN_DEL_PEER_REASON_EXPIRED);
+	if (!ovpn_peer_ring_grow(ring))
+		return -ENOSPC;
+
+	return ptr_ring_produce_bh(ring, skb);
 }
 
-/* Construct a new peer */
-static struct ovpn_peer *ovpn_peer_create(struct ovpn_struct *ovpn, u32 id)
+/* Return the number of entries queued in ring and not consumed yet.
+ * This is a snapshot meant for statistics only.
+ */
+unsigned int ovpn_peer_ring_len(struct ptr_ring *ring)
+{
+	unsigned int len = 0;
+
+	spin_lock_bh(&ring->producer_lock);
+	if (ring->size) {
+		len = (ring->producer - READ_ONCE(ring->consumer_head) + ring->size) % ring->size;
+		/* producer and consumer match on both an empty and a full ring */
+		if (!len && ring->queue[ring->producer])
+			len = ring->size;
+	}
+	spin_unlock_bh(&ring->producer_lock);
+
+	return len;
+}
+
+/* Shrink ring back to OVPN_QUEUE_LEN_IDLE slots, but only if it is empty, so that
+ * no entry is ever lost. Must be called from process context
+ */
+static void ovpn_peer_ring_shrink(struct ptr_ring *ring)
+{
+	void **queue, **old = NULL;
+	unsigned long flags;
+
+	if (READ_ONCE(ring->size) <= OVPN_QUEUE_LEN_IDLE)
+		return;
+
+	queue = __ptr_ring_init_queue_alloc(OVPN_QUEUE_LEN_IDLE, GFP_KERNEL);
+	if (!queue)
+		return;
+
+	spin_lock_irqsave(&ring->consumer_lock, flags);
+	spin_lock(&ring->producer_lock);
+	if (__ptr_ring_empty(ring))
+		old = __ptr_ring_swap_queue(ring, queue, OVPN_QUEUE_LEN_IDLE, GFP_ATOMIC, NULL);
+	spin_unlock(&ring->producer_lock);
+	spin_unlock_irqrestore(&ring->consumer_lock, flags);
+
+	kvfree(old ?: queue);
+}
+
+/* Construct a new peer.
+ * In kthread crypto mode, its crypto runs on the worker of cpu, or on the next
+ * available one if cpu is negative.
+ */
+static struct ovpn_peer *ovpn_peer_create(struct ovpn_struct *ovpn, u32 id, int cpu)
 {
 	struct ovpn_peer *peer;
 	int ret;
 
 	/* alloc and init peer object */
-	peer = kzalloc(sizeof(*peer), GFP_KERNEL);
+	peer = kmem_cache_zalloc(ovpn_peer_cache, GFP_KERNEL);
 	if (!peer)
 		return ERR_PTR(-ENOMEM);
 
@@ -54,34 +131,65 @@ static struct ovpn_peer *ovpn_peer_create(struct ovpn_struct *ovpn, u32 id)
 	peer->vpn_addrs.ipv4.s_addr = htonl(INADDR_ANY);
 	peer->vpn_addrs.ipv6 = in6addr_any;
 
+	INIT_LIST_HEAD(&peer->routes);
+	peer->last_tx = jiffies;
+	peer->last_rx = jiffies;
+	atomic64_set(&peer->gen, atomic64_read(&ovpn->peers_gen));
 	RCU_INIT_POINTER(peer->bind, NULL);
 	ovpn_crypto_state_init(&peer->crypto);
 	spin_lock_init(&peer->lock);
 	kref_init(&peer->refcount);
-	ovpn_peer_stats_init(&peer->stats);
-
-	INIT_WORK(&peer->encrypt_work, ovpn_encrypt_work);
-	INIT_WORK(&peer->decrypt_work, ovpn_decrypt_work);
 
-	ret = dst_cache_init(&peer->dst_cache, GFP_KERNEL);
+	ret = ovpn_peer_stats_init(&peer->stats);
 	if (ret < 0) {
-		netdev_err(ovpn->dev, "%s: cannot initialize dst cache\n", __func__);
+		netdev_err(ovpn->dev, "%s: cannot allocate stats\n", __func__);
 		goto err;
 	}
 
-	ret = ptr_ring_init(&peer->tx_ring, OVPN_QUEUE_LEN, GFP_KERNEL);
+	if (ovpn->parallel_crypto) {
+		/* crypto is performed by the device workers, the peer works
+		 * only restore the packet order
+		 */
+		INIT_WORK(&peer->encrypt_work, ovpn_encrypt_parallel_finish_work);
+		INIT_WORK(&peer->decrypt_work, ovpn_decrypt_parallel_finish_work);
+	} else {
+		INIT_WORK(&peer->encrypt_work, ovpn_encrypt_work);
+		INIT_WORK(&peer->decrypt_work, ovpn_decrypt_work);
+	}
+
+	peer->crypto_cpu = -1;
+	if (ovpn->crypto_exec == OVPN_CRYPTO_EXEC_KTHREAD) {
+		/* the worker cannot change later, as a kthread_work must
+		 * always be queued on the same worker
+		 */
+		ret = ovpn_crypto_workers_pick(&ovpn->workers, cpu);
+		if (ret < 0) {
+			netdev_err(ovpn->dev, "%s: no crypto worker on CPU %d\n", __func__, cpu);
+			goto err;
+		}
+
+		peer->crypto_cpu = ret;
+		peer->crypto_worker = ovpn->workers.worker[ret];
+		kthread_init_work(&peer->encrypt_kwork, ovpn_encrypt_kwork);
+		kthread_init_work(&peer->decrypt_kwork, ovpn_decrypt_kwork);
+	}
+
+	/* conservative until the route to the peer is known */
+	peer->tx_headroom = OVPN_HEAD_ROOM;
+
+	ret = ptr_ring_init(&peer->tx_ring, OVPN_QUEUE_LEN_IDLE, GFP_KERNEL);
 	if (ret < 0) {
 		netdev_err(ovpn->dev, "%s: cannot allocate TX ring\n", __func__);
-		goto err_dst_cache;
+		goto err;
 	}
 
-	ret = ptr_ring_init(&peer->rx_ring, OVPN_QUEUE_LEN, GFP_KERNEL);
+	ret = ptr_ring_init(&peer->rx_ring, OVPN_QUEUE_LEN_IDLE, GFP_KERNEL);
 	if (ret < 0) {
 		netdev_err(ovpn->dev, "%s: cannot allocate RX ring\n", __func__);
 		goto err_tx_ring;
 	}
 
-	ret = ptr_ring_init(&peer->netif_rx_ring, OVPN_QUEUE_LEN, GFP_KERNEL);
+	ret = ptr_ring_init(&peer->netif_rx_ring, OVPN_QUEUE_LEN_IDLE, GFP_KERNEL);
 	if (ret < 0) {
 		netdev_err(ovpn->dev, "%s: cannot allocate NETIF RX ring\n", __func__);
 		goto err_rx_ring;
@@ -94,18 +202,14 @@ static struct ovpn_peer *ovpn_peer_create(struct ovpn_struct *ovpn, u32 id)
 
 	dev_hold(ovpn->dev);
 
-	timer_setup(&peer->keepalive_xmit, ovpn_peer_ping, 0);
-	timer_setup(&peer->keepalive_recv, ovpn_peer_expire, 0);
-
 	return peer;
 err_rx_ring:
 	ptr_ring_cleanup(&peer->rx_ring, NULL);
 err_tx_ring:
 	ptr_ring_cleanup(&peer->tx_ring, NULL);
-err_dst_cache:
-	dst_cache_destroy(&peer->dst_cache);
 err:
-	kfree(peer);
+	ovpn_peer_stats_free(&peer->stats);
+	kmem_cache_free(ovpn_peer_cache, peer);
 	return ERR_PTR(ret);
 }
 
@@ -129,7 +233,7 @@ static int ovpn_peer_reset_sockaddr(struct ovpn_peer *peer, const struct sockadd
 		} else {
 			netdev_dbg(peer->ovpn->dev, "%s: invalid family for remote endpoint\n",
 				   __func__);
-			kfree(bind);
+			ovpn_bind_free(bind);
 			return -EINVAL;
 		}
 
@@ -138,6 +242,7 @@ static int ovpn_peer_reset_sockaddr(struct ovpn_peer *peer, const struct sockadd
 
 	/* set binding */
 	ovpn_bind_reset(peer, bind);
+	ovpn_peer_touch(peer);
 
 	return 0;
 }
@@ -188,16 +293,9 @@ unlock:
 	rcu_read_unlock();
 }
 
-static void ovpn_peer_timer_delete_all(struct ovpn_peer *peer)
-{
-	del_timer_sync(&peer->keepalive_xmit);
-	del_timer_sync(&peer->keepalive_recv);
-}
-
 static void ovpn_peer_free(struct ovpn_peer *peer)
 {
 	ovpn_bind_reset(peer, NULL);
-	ovpn_peer_timer_delete_all(peer);
 
 	WARN_ON(!__ptr_ring_empty(&peer->tx_ring));
 	ptr_ring_cleanup(&peer->tx_ring, NULL);
@@ -206,38 +304,56 @@ static void ovpn_peer_free(struct ovpn_peer *peer)
 	WARN_ON(!__ptr_ring_empty(&peer->netif_rx_ring));
 	ptr_ring_cleanup(&peer->netif_rx_ring, NULL);
 
-	dst_cache_destroy(&peer->dst_cache);
+	ovpn_peer_stats_free(&peer->stats);
 
 	dev_put(peer->ovpn->dev);
 
-	kfree(peer);
+	kmem_cache_free(ovpn_peer_cache, peer);
 }
 
-static void ovpn_peer_release_rcu(struct rcu_head *head)
+/* to be invoked once RCU readers are done with the peer */
+static void ovpn_peer_destroy(struct ovpn_peer *peer)
 {
-	struct ovpn_peer *peer = container_of(head, struct ovpn_peer, rcu);
-
 	ovpn_crypto_state_release(&peer->crypto);
 	ovpn_peer_free(peer);
 }
 
-void ovpn_peer_release(struct ovpn_peer *peer)
+static void ovpn_peer_release_rcu(struct rcu_head *head)
+{
+	ovpn_peer_destroy(container_of(head, struct ovpn_peer, rcu));
+}
+
+/* Stop the peer, whose memory is freed only once RCU readers are done with it */
+static void ovpn_peer_stop(struct ovpn_peer *peer)
 {
 	napi_disable(&peer->napi);
 	netif_napi_del(&peer->napi);
 
 	if (peer->sock)
 		ovpn_socket_put(peer->sock);
+}
 
+void ovpn_peer_release(struct ovpn_peer *peer)
+{
+	ovpn_peer_stop(peer);
 	call_rcu(&peer->rcu, ovpn_peer_release_rcu);
 }
 
+/* Stop a peer whose last reference is gone and let userspace know: the peer is still
+ * to be destroyed once RCU readers are done with it
+ */
+static void ovpn_peer_retire(struct ovpn_peer *peer)
+{
+	ovpn_peer_stop(peer);
+	ovpn_netlink_notify_del_peer(peer);
+}
+
 static void ovpn_peer_delete_work(struct work_struct *work)
 {
 	struct ovpn_peer *peer = container_of(work, struct ovpn_peer,
 					      delete_work);
-	ovpn_peer_release(peer);
-	ovpn_netlink_notify_del_peer(peer);
+	ovpn_peer_retire(peer);
+	call_rcu(&peer->rcu, ovpn_peer_release_rcu);
 }
 
 /* Use with kref_put calls, when releasing refcount
@@ -253,13 +369,13 @@ void ovpn_peer_release_kref(struct kref *kref)
 }
 
 struct ovpn_peer *ovpn_peer_new(struct ovpn_struct *ovpn, const struct sockaddr_storage *sa,
-				struct socket *sock, u32 id, uint8_t *local_ip)
+				struct socket *sock, u32 id, uint8_t *local_ip, int cpu)
 {
 	struct ovpn_peer *peer;
 	int ret;
 
 	/* create new peer */
-	peer = ovpn_peer_create(ovpn, id);
+	peer = ovpn_peer_create(ovpn, id, cpu);
 	if (IS_ERR(peer))
 		return peer;
 
@@ -285,9 +401,9 @@ struct ovpn_peer *ovpn_peer_new(struct ovpn_struct *ovpn, const struct sockaddr_
 		return ERR_PTR(-ENOTSOCK);
 	}
 
-	/* schedule initial TCP RX work only after having assigned peer->sock */
+	/* parse pending TCP data only after having assigned peer->sock */
 	if (peer->sock->sock->sk->sk_protocol == IPPROTO_TCP)
-		queue_work(peer->ovpn->events_wq, &peer->tcp.rx_work);
+		ovpn_tcp_rx_start(peer);
 
 	return peer;
 }
@@ -295,41 +411,229 @@ struct ovpn_peer *ovpn_peer_new(struct ovpn_struct *ovpn, const struct sockaddr_
 /* Configure keepalive parameters */
 void ovpn_peer_keepalive_set(struct ovpn_peer *peer, u32 interval, u32 timeout)
 {
-	u32 delta;
-
 	netdev_dbg(peer->ovpn->dev,
 		   "%s: scheduling keepalive for peer %u: interval=%u timeout=%u\n", __func__,
 		   peer->id, interval, timeout);
 
-	peer->keepalive_interval = interval;
-	if (interval > 0) {
-		delta = msecs_to_jiffies(interval * MSEC_PER_SEC);
-		mod_timer(&peer->keepalive_xmit, jiffies + delta);
-	} else {
-		del_timer(&peer->keepalive_xmit);
+	/* both deadlines restart from now, as when the keepalive is first configured */
+	WRITE_ONCE(peer->last_tx, jiffies);
+	WRITE_ONCE(peer->last_rx, jiffies);
+
+	/* read locklessly by the keepalive sweep */
+	WRITE_ONCE(peer->keepalive_interval, interval);
+	WRITE_ONCE(peer->keepalive_timeout, timeout);
+	ovpn_peer_touch(peer);
+}
+
+/* Send a ping or expire peer if its keepalive deadlines have passed.
+ * Called with BH disabled, as the datapath.
+ *
+ * Return true if the peer saw no traffic since the previous sweep, so that the memory
+ * taken by its rings during the last burst can be given back
+ */
+static bool ovpn_peer_keepalive_check(struct ovpn_peer *peer, unsigned long now)
+{
+	unsigned long interval = READ_ONCE(peer->keepalive_interval) * HZ;
+	unsigned long timeout = READ_ONCE(peer->keepalive_timeout) * HZ;
+	unsigned long last_rx = READ_ONCE(peer->last_rx);
+	unsigned long last_tx = READ_ONCE(peer->last_tx);
+	bool idle;
+
+	if (timeout && time_after_eq(now, last_rx + timeout)) {
+		netdev_dbg(peer->ovpn->dev, "%s: peer %u expired\n", __func__, peer->id);
+		ovpn_peer_del(peer, OVPN_DEL_PEER_REASON_EXPIRED);
+		return false;
 	}
 
-	peer->keepalive_timeout = timeout;
-	if (timeout) {
-		delta = msecs_to_jiffies(timeout * MSEC_PER_SEC);
-		mod_timer(&peer->keepalive_recv, jiffies + delta);
-	} else {
-		del_timer(&peer->keepalive_recv);
+	idle = time_after_eq(now, last_rx + OVPN_KEEPALIVE_SWEEP_INTERVAL) &&
+	       time_after_eq(now, last_tx + OVPN_KEEPALIVE_SWEEP_INTERVAL);
+
+	if (interval && time_after_eq(now, last_tx + interval)) {
+		netdev_dbg(peer->ovpn->dev, "%s: sending ping to peer %u\n", __func__, peer->id);
+		/* if the ping cannot be sent, retry at the next interval only */
+		WRITE_ONCE(peer->last_tx, now);
+		ovpn_keepalive_xmit(peer);
 	}
+
+	return idle;
+}
+
+/* Check peer under RCU and, if idle, keep a reference to it in idle for the caller to
+ * shrink its rings once out of the read-side section
+ */
+static void ovpn_peer_keepalive_check_rcu(struct ovpn_peer *peer, unsigned long now,
+					  struct ovpn_peer **idle, unsigned int *n_idle)
+{
+	bool shrink;
+
+	local_bh_disable();
+	shrink = ovpn_peer_keepalive_check(peer, now);
+	local_bh_enable();
+
+	if (shrink && ovpn_peer_hold(peer))
+		idle[(*n_idle)++] = peer;
 }
 
-#define ovpn_peer_index(_tbl, _key, _key_len)		\
-	(jhash(_key, _key_len, 0) % HASH_SIZE(_tbl))	\
+/* give back the memory taken by the rings of idle peers, releasing them */
+static void ovpn_peers_shrink(struct ovpn_peer **idle, unsigned int n_idle)
+{
+	unsigned int i;
+
+	for (i = 0; i < n_idle; i++) {
+		ovpn_peer_ring_shrink(&idle[i]->tx_ring);
+		ovpn_peer_ring_shrink(&idle[i]->rx_ring);
+		ovpn_peer_ring_shrink(&idle[i]->netif_rx_ring);
+		ovpn_peer_put(idle[i]);
+	}
+}
 
-static struct ovpn_peer *ovpn_peer_lookup_vpn_addr4(struct hlist_head *head, __be32 *addr)
+/* Periodic sweep over all the peers of an interface, sending pings and expiring peers
+ * in bulk. The datapath only records the time of the last packet in each direction.
+ *
+ * Peers are walked in chunks of OVPN_KEEPALIVE_SWEEP_CHUNK, in ID order, each under its
+ * own RCU read-side section: ID order lets the walk resume where the previous chunk
+ * stopped, whatever was added or removed meanwhile
+ */
+void ovpn_peers_keepalive_work(struct work_struct *work)
+{
+	struct ovpn_struct *ovpn = container_of(work, struct ovpn_struct,
+						keepalive_work.work);
+	struct ovpn_peer *idle[OVPN_KEEPALIVE_SWEEP_CHUNK];
+	unsigned int n, n_idle = 0;
+	unsigned long now = jiffies;
+	struct ovpn_peer *peer;
+	unsigned long id = 0;
+
+	switch (ovpn->mode) {
+	case OVPN_MODE_MP:
+		do {
+			n = 0;
+			n_idle = 0;
+
+			/* peers are freed after a grace period: keep them valid while walking */
+			rcu_read_lock();
+			xa_for_each_start(&ovpn->peers.by_id, id, peer, id) {
+				ovpn_peer_keepalive_check_rcu(peer, now, idle, &n_idle);
+				if (++n == OVPN_KEEPALIVE_SWEEP_CHUNK)
+					break;
+			}
+			rcu_read_unlock();
+
+			ovpn_peers_shrink(idle, n_idle);
+			cond_resched();
+		} while (n == OVPN_KEEPALIVE_SWEEP_CHUNK && id++ < ULONG_MAX);
+		break;
+	case OVPN_MODE_P2P:
+		rcu_read_lock();
+		peer = rcu_dereference(ovpn->peer);
+		if (peer)
+			ovpn_peer_keepalive_check_rcu(peer, now, idle, &n_idle);
+		rcu_read_unlock();
+
+		ovpn_peers_shrink(idle, n_idle);
+		break;
+	default:
+		break;
+	}
+
+	queue_delayed_work(ovpn->events_wq, &ovpn->keepalive_work,
+			   round_jiffies_relative(OVPN_KEEPALIVE_SWEEP_INTERVAL));
+}
+
+static const struct rhashtable_params ovpn_peer_transp_addr_params = {
+	.head_offset = offsetof(struct ovpn_peer, hash_entry_transp_addr),
+	.key_offset = offsetof(struct ovpn_peer, transp_key),
+	.key_len = sizeof(struct ovpn_transp_key),
+	.automatic_shrinking = true,
+};
+
+static const struct rhashtable_params ovpn_peer_vpn_addr4_params = {
+	.head_offset = offsetof(struct ovpn_peer, hash_entry_addr4),
+	.key_offset = offsetof(struct ovpn_peer, vpn_addrs.ipv4),
+	.key_len = sizeof(struct in_addr),
+	.automatic_shrinking = true,
+};
+
+static const struct rhashtable_params ovpn_peer_vpn_addr6_params = {
+	.head_offset = offsetof(struct ovpn_peer, hash_entry_addr6),
+	.key_offset = offsetof(struct ovpn_peer, vpn_addrs.ipv6),
+	.key_len = sizeof(struct in6_addr),
+	.automatic_shrinking = true,
+};
+
+/**
+ * ovpn_peers_init - initialize the peer tables of an instance
+ * @ovpn: the instance to initialize the tables of
+ *
+ * Return 0 on success or a negative error code otherwise
+ */
+int ovpn_peers_init(struct ovpn_struct *ovpn)
+{
+	int ret;
+
+	xa_init_flags(&ovpn->peers.by_id, XA_FLAGS_LOCK_BH);
+
+	ret = rhltable_init(&ovpn->peers.by_transp_addr, &ovpn_peer_transp_addr_params);
+	if (ret < 0)
+		return ret;
+
+	ret = rhltable_init(&ovpn->peers.by_vpn_addr4, &ovpn_peer_vpn_addr4_params);
+	if (ret < 0)
+		goto err_transp;
+
+	ret = rhltable_init(&ovpn->peers.by_vpn_addr6, &ovpn_peer_vpn_addr6_params);
+	if (ret < 0)
+		goto err_addr4;
+
+	return 0;
+
+err_addr4:
+	rhltable_destroy(&ovpn->peers.by_vpn_addr4);
+err_transp:
+	rhltable_destroy(&ovpn->peers.by_transp_addr);
+	return ret;
+}
+
+/* Destroy the peer tables, once all peers have been released */
+void ovpn_peers_destroy(struct ovpn_struct *ovpn)
+{
+	rhltable_destroy(&ovpn->peers.by_vpn_addr6);
+	rhltable_destroy(&ovpn->peers.by_vpn_addr4);
+	rhltable_destroy(&ovpn->peers.by_transp_addr);
+	xa_destroy(&ovpn->peers.by_id);
+}
+
+static void ovpn_transp_key_from_sockaddr(struct ovpn_transp_key *key,
+					  const struct sockaddr_storage *ss)
+{
+	const struct sockaddr_in6 *sa6;
+	const struct sockaddr_in *sa4;
+
+	memset(key, 0, sizeof(*key));
+	key->family = ss->ss_family;
+
+	switch (ss->ss_family) {
+	case AF_INET:
+		sa4 = (const struct sockaddr_in *)ss;
+		key->addr.s6_addr32[0] = sa4->sin_addr.s_addr;
+		key->port = sa4->sin_port;
+		break;
+	case AF_INET6:
+		sa6 = (const struct sockaddr_in6 *)ss;
+		key->addr = sa6->sin6_addr;
+		key->port = sa6->sin6_port;
+		break;
+	}
+}
+
+static struct ovpn_peer *ovpn_peer_lookup_vpn_addr4(struct ovpn_struct *ovpn, __be32 *addr)
 {
 	struct ovpn_peer *tmp, *peer = NULL;
+	struct rhlist_head *list, *pos;
 
 	rcu_read_lock();
-	hlist_for_each_entry_rcu(tmp, head, hash_entry_addr4) {
-		if (*addr != tmp->vpn_addrs.ipv4.s_addr)
-			continue;
-
+	list = rhltable_lookup(&ovpn->peers.by_vpn_addr4, addr, ovpn_peer_vpn_addr4_params);
+	rhl_for_each_entry_rcu(tmp, pos, list, hash_entry_addr4) {
 		if (!ovpn_peer_hold(tmp))
 			continue;
 
@@ -341,18 +645,15 @@ static struct ovpn_peer *ovpn_peer_lookup_vpn_addr4(struct hlist_head *head, __b
 	return peer;
 }
 
-static struct ovpn_peer *ovpn_peer_lookup_vpn_addr6(struct hlist_head *head, struct in6_addr *addr)
+static struct ovpn_peer *ovpn_peer_lookup_vpn_addr6(struct ovpn_struct *ovpn,
+						    struct in6_addr *addr)
 {
 	struct ovpn_peer *tmp, *peer = NULL;
-	int i;
+	struct rhlist_head *list, *pos;
 
 	rcu_read_lock();
-	hlist_for_each_entry_rcu(tmp, head, hash_entry_addr6) {
-		for (i = 0; i < 4; i++) {
-			if (addr->s6_addr32[i] != tmp->vpn_addrs.ipv6.s6_addr32[i])
-				continue;
-		}
-
+	list = rhltable_lookup(&ovpn->peers.by_vpn_addr6, addr, ovpn_peer_vpn_addr6_params);
+	rhl_for_each_entry_rcu(tmp, pos, list, hash_entry_addr6) {
 		if (!ovpn_peer_hold(tmp))
 			continue;
 
@@ -444,6 +745,9 @@ out:
  * after encapsulation. The skb is expected to be the in-tunnel packet, without
  * any OpenVPN related header.
  *
+ * The route table is consulted first. Destinations it does not know yet are
+ * resolved through the FIB and cached for the following packets.
+ *
  * Assume that the IP header is accessible in the skb data.
  *
  * @ovpn: the private data representing the current VPN session
@@ -455,11 +759,10 @@ struct ovpn_peer *ovpn_peer_lookup_vpn_addr(struct ovpn_struct *ovpn, struct sk_
 					    bool use_src)
 {
 	struct ovpn_peer *tmp, *peer = NULL;
-	struct hlist_head *head;
+	struct in6_addr addr6, dst6;
+	__be32 addr4, dst4;
 	sa_family_t sa_fam;
-	struct in6_addr addr6;
-	__be32 addr4;
-	u32 index;
+	u32 gen;
 
 	/* in P2P mode, no matter the destination, packets are always sent to the single peer
 	 * listening on the other side
@@ -481,24 +784,34 @@ struct ovpn_peer *ovpn_peer_lookup_vpn_addr(struct ovpn_struct *ovpn, struct sk_
 			addr4 = ip_hdr(skb)->saddr;
 		else
 			addr4 = ip_hdr(skb)->daddr;
-		addr4 = ovpn_nexthop4(ovpn, addr4);
 
-		index = ovpn_peer_index(ovpn->peers.by_vpn_addr, &addr4, sizeof(addr4));
-		head = &ovpn->peers.by_vpn_addr[index];
+		peer = ovpn_route_lookup(&ovpn->routes, AF_INET, &addr4);
+		if (peer)
+			break;
+
+		gen = ovpn_route_fib_gen(&ovpn->routes);
+		dst4 = ovpn_nexthop4(ovpn, addr4);
 
-		peer = ovpn_peer_lookup_vpn_addr4(head, &addr4);
+		peer = ovpn_peer_lookup_vpn_addr4(ovpn, &dst4);
+		if (peer)
+			ovpn_route_cache(&ovpn->routes, peer, AF_INET, &addr4, gen);
 		break;
 	case AF_INET6:
 		if (use_src)
 			addr6 = ipv6_hdr(skb)->saddr;
 		else
 			addr6 = ipv6_hdr(skb)->daddr;
-		addr6 = ovpn_nexthop6(ovpn, addr6);
 
-		index = ovpn_peer_index(ovpn->peers.by_vpn_addr, &addr6, sizeof(addr6));
-		head = &ovpn->peers.by_vpn_addr[index];
+		peer = ovpn_route_lookup(&ovpn->routes, AF_INET6, &addr6);
+		if (peer)
+			break;
+
+		gen = ovpn_route_fib_gen(&ovpn->routes);
+		dst6 = ovpn_nexthop6(ovpn, addr6);
 
-		peer = ovpn_peer_lookup_vpn_addr6(head, &addr6);
+		peer = ovpn_peer_lookup_vpn_addr6(ovpn, &dst6);
+		if (peer)
+			ovpn_route_cache(&ovpn->routes, peer, AF_INET6, &addr6, gen);
 		break;
 	}
 
@@ -583,10 +896,8 @@ struct ovpn_peer *ovpn_peer_lookup_transp_addr(struct ovpn_struct *ovpn, struct
 {
 	struct ovpn_peer *peer = NULL, *tmp;
 	struct sockaddr_storage ss = { 0 };
-	struct hlist_head *head;
-	size_t sa_len;
-	bool found;
-	u32 index;
+	struct rhlist_head *list, *pos;
+	struct ovpn_transp_key key;
 
 	if (unlikely(!ovpn_peer_skb_to_sockaddr(skb, &ss)))
 		return NULL;
@@ -594,24 +905,13 @@ struct ovpn_peer *ovpn_peer_lookup_transp_addr(struct ovpn_struct *ovpn, struct
 	if (ovpn->mode == OVPN_MODE_P2P)
 		return ovpn_peer_lookup_transp_addr_p2p(ovpn, &ss);
 
-	switch (ss.ss_family) {
-	case AF_INET:
-		sa_len = sizeof(struct sockaddr_in);
-		break;
-	case AF_INET6:
-		sa_len = sizeof(struct sockaddr_in6);
-		break;
-	default:
-		return NULL;
-	}
-
-	index = ovpn_peer_index(ovpn->peers.by_transp_addr, &ss, sa_len);
-	head = &ovpn->peers.by_transp_addr[index];
+	ovpn_transp_key_from_sockaddr(&key, &ss);
 
 	rcu_read_lock();
-	hlist_for_each_entry_rcu(tmp, head, hash_entry_transp_addr) {
-		found = ovpn_peer_transp_match(tmp, &ss);
-		if (!found)
+	list = rhltable_lookup(&ovpn->peers.by_transp_addr, &key, ovpn_peer_transp_addr_params);
+	rhl_for_each_entry_rcu(tmp, pos, list, hash_entry_transp_addr) {
+		/* the peer may have floated since it was hashed */
+		if (!ovpn_peer_transp_match(tmp, &ss))
 			continue;
 
 		if (!ovpn_peer_hold(tmp))
@@ -641,31 +941,25 @@ static struct ovpn_peer *ovpn_peer_lookup_id_p2p(struct ovpn_struct *ovpn, u32 p
 struct ovpn_peer *ovpn_peer_lookup_id(struct ovpn_struct *ovpn, u32 peer_id)
 {
 	struct ovpn_peer *tmp,  *peer = NULL;
-	struct hlist_head *head;
-	u32 index;
 
 	if (ovpn->mode == OVPN_MODE_P2P)
 		return ovpn_peer_lookup_id_p2p(ovpn, peer_id);
 
-	index = ovpn_peer_index(ovpn->peers.by_id, &peer_id, sizeof(peer_id));
-	head = &ovpn->peers.by_id[index];
-
 	rcu_read_lock();
-	hlist_for_each_entry_rcu(tmp, head, hash_entry_id) {
-		if (tmp->id != peer_id)
-			continue;
-
-		if (!ovpn_peer_hold(tmp))
-			continue;
-
+	tmp = xa_load(&ovpn->peers.by_id, peer_id);
+	if (tmp && ovpn_peer_hold(tmp))
 		peer = tmp;
-		break;
-	}
 	rcu_read_unlock();
 
 	return peer;
 }
 
+/* Whether peer is currently reachable through the peer tables of its instance */
+bool ovpn_peer_hashed(struct ovpn_peer *peer)
+{
+	return xa_load(&peer->ovpn->peers.by_id, peer->id) == peer;
+}
+
 void ovpn_peer_update_local_endpoint(struct ovpn_peer *peer, struct sk_buff *skb)
 {
 	struct ovpn_bind *bind;
@@ -682,6 +976,7 @@ void ovpn_peer_update_local_endpoint(struct ovpn_peer *peer, struct sk_buff *skb
 				   "%s: learning local IPv4 for peer %d (%pI4 -> %pI4)\n", __func__,
 				   peer->id, &bind->local.ipv4.s_addr, &ip_hdr(skb)->daddr);
 			bind->local.ipv4.s_addr = ip_hdr(skb)->daddr;
+			dst_cache_reset(&bind->dst_cache);
 		}
 		break;
 	case AF_INET6:
@@ -691,6 +986,7 @@ void ovpn_peer_update_local_endpoint(struct ovpn_peer *peer, struct sk_buff *skb
 				   "%s: learning local IPv6 for peer %d (%pI6c -> %pI6c\n",
 				   __func__, peer->id, &bind->local.ipv6, &ipv6_hdr(skb)->daddr);
 			bind->local.ipv6 = ipv6_hdr(skb)->daddr;
+			dst_cache_reset(&bind->dst_cache);
 		}
 		break;
 	default:
@@ -700,28 +996,40 @@ unlock:
 	rcu_read_unlock();
 }
 
-static int ovpn_peer_add_mp(struct ovpn_struct *ovpn, struct ovpn_peer *peer)
+static void ovpn_peer_unhash_addrs(struct ovpn_struct *ovpn, struct ovpn_peer *peer)
+{
+	if (peer->hashed_transp_addr) {
+		rhltable_remove(&ovpn->peers.by_transp_addr, &peer->hash_entry_transp_addr,
+				ovpn_peer_transp_addr_params);
+		peer->hashed_transp_addr = false;
+	}
+
+	if (peer->hashed_addr4) {
+		rhltable_remove(&ovpn->peers.by_vpn_addr4, &peer->hash_entry_addr4,
+				ovpn_peer_vpn_addr4_params);
+		peer->hashed_addr4 = false;
+	}
+
+	if (peer->hashed_addr6) {
+		rhltable_remove(&ovpn->peers.by_vpn_addr6, &peer->hash_entry_addr6,
+				ovpn_peer_vpn_addr6_params);
+		peer->hashed_addr6 = false;
+	}
+}
+
+/* Insert the peer into the tables keyed by its transport and VPN addresses, removing it from
+ * all of them upon failure
+ */
+static int ovpn_peer_hash_addrs(struct ovpn_struct *ovpn, struct ovpn_peer *peer)
 {
 	struct sockaddr_storage sa = { 0 };
 	struct sockaddr_in6 *sa6;
 	struct sockaddr_in *sa4;
 	struct ovpn_bind *bind;
-	struct ovpn_peer *tmp;
-	size_t salen;
 	int ret = 0;
-	u32 index;
-
-	spin_lock_bh(&ovpn->peers.lock);
-	/* do not add duplicates */
-	tmp = ovpn_peer_lookup_id(ovpn, peer->id);
-	if (tmp) {
-		ovpn_peer_put(tmp);
-		ret = -EEXIST;
-		goto unlock;
-	}
 
-	hlist_del_init_rcu(&peer->hash_entry_transp_addr);
-	bind = rcu_dereference_protected(peer->bind, true);
+	rcu_read_lock();
+	bind = rcu_dereference(peer->bind);
 	/* peers connected via UDP have bind == NULL */
 	if (bind) {
 		switch (bind->sa.in4.sin_family) {
@@ -731,7 +1039,6 @@ static int ovpn_peer_add_mp(struct ovpn_struct *ovpn, struct ovpn_peer *peer)
 			sa4->sin_family = AF_INET;
 			sa4->sin_addr.s_addr = bind->sa.in4.sin_addr.s_addr;
 			sa4->sin_port = bind->sa.in4.sin_port;
-			salen = sizeof(*sa4);
 			break;
 		case AF_INET6:
 			sa6 = (struct sockaddr_in6 *)&sa;
@@ -739,40 +1046,84 @@ static int ovpn_peer_add_mp(struct ovpn_struct *ovpn, struct ovpn_peer *peer)
 			sa6->sin6_family = AF_INET6;
 			sa6->sin6_addr = bind->sa.in6.sin6_addr;
 			sa6->sin6_port = bind->sa.in6.sin6_port;
-			salen = sizeof(*sa6);
 			break;
 		default:
 			ret = -EPROTONOSUPPORT;
-			goto unlock;
+			break;
 		}
-
-		index = ovpn_peer_index(ovpn->peers.by_transp_addr, &sa, salen);
-		hlist_add_head_rcu(&peer->hash_entry_transp_addr,
-				   &ovpn->peers.by_transp_addr[index]);
 	}
+	rcu_read_unlock();
 
-	index = ovpn_peer_index(ovpn->peers.by_id, &peer->id, sizeof(peer->id));
-	hlist_add_head_rcu(&peer->hash_entry_id, &ovpn->peers.by_id[index]);
+	if (ret < 0)
+		return ret;
+
+	if (bind) {
+		ovpn_transp_key_from_sockaddr(&peer->transp_key, &sa);
+		ret = rhltable_insert(&ovpn->peers.by_transp_addr, &peer->hash_entry_transp_addr,
+				      ovpn_peer_transp_addr_params);
+		if (ret < 0)
+			goto unhash;
+		peer->hashed_transp_addr = true;
+	}
 
 	if (peer->vpn_addrs.ipv4.s_addr != htonl(INADDR_ANY)) {
-		index = ovpn_peer_index(ovpn->peers.by_vpn_addr, &peer->vpn_addrs.ipv4,
-					sizeof(peer->vpn_addrs.ipv4));
-		hlist_add_head_rcu(&peer->hash_entry_addr4, &ovpn->peers.by_vpn_addr[index]);
+		ret = rhltable_insert(&ovpn->peers.by_vpn_addr4, &peer->hash_entry_addr4,
+				      ovpn_peer_vpn_addr4_params);
+		if (ret < 0)
+			goto unhash;
+		peer->hashed_addr4 = true;
 	}
 
-	hlist_del_init_rcu(&peer->hash_entry_addr6);
 	if (memcmp(&peer->vpn_addrs.ipv6, &in6addr_any, sizeof(peer->vpn_addrs.ipv6))) {
-		index = ovpn_peer_index(ovpn->peers.by_vpn_addr, &peer->vpn_addrs.ipv6,
-					sizeof(peer->vpn_addrs.ipv6));
-		hlist_add_head_rcu(&peer->hash_entry_addr6, &ovpn->peers.by_vpn_addr[index]);
+		ret = rhltable_insert(&ovpn->peers.by_vpn_addr6, &peer->hash_entry_addr6,
+				      ovpn_peer_vpn_addr6_params);
+		if (ret < 0)
+			goto unhash;
+		peer->hashed_addr6 = true;
 	}
 
-unlock:
-	spin_unlock_bh(&ovpn->peers.lock);
+	return 0;
 
+unhash:
+	ovpn_peer_unhash_addrs(ovpn, peer);
 	return ret;
 }
 
+/* The ID slot is reserved first, so that duplicates are rejected before exposing the peer in
+ * any other table, and published last, so that the peer cannot be deleted while it is being
+ * hashed. Each table has its own locking, hence concurrent additions do not serialize
+ */
+static int ovpn_peer_add_mp(struct ovpn_struct *ovpn, struct ovpn_peer *peer)
+{
+	int ret;
+
+	/* do not add duplicates */
+	ret = xa_insert_bh(&ovpn->peers.by_id, peer->id, NULL, GFP_KERNEL);
+	if (ret == -EBUSY)
+		return -EEXIST;
+	if (ret < 0)
+		return ret;
+
+	ret = ovpn_peer_hash_addrs(ovpn, peer);
+	if (ret < 0) {
+		xa_erase_bh(&ovpn->peers.by_id, peer->id);
+		return ret;
+	}
+
+	/* the slot is reserved already, storing into it cannot fail */
+	xa_store_bh(&ovpn->peers.by_id, peer->id, peer, GFP_KERNEL);
+
+	/* failing to route the VPN addresses is not fatal, as lookups fall back to the FIB and
+	 * to the tables above
+	 */
+	if (peer->vpn_addrs.ipv4.s_addr != htonl(INADDR_ANY))
+		ovpn_route_add(&ovpn->routes, peer, AF_INET, &peer->vpn_addrs.ipv4, 32);
+	if (memcmp(&peer->vpn_addrs.ipv6, &in6addr_any, sizeof(peer->vpn_addrs.ipv6)))
+		ovpn_route_add(&ovpn->routes, peer, AF_INET6, &peer->vpn_addrs.ipv6, 128);
+
+	return 0;
+}
+
 static int ovpn_peer_add_p2p(struct ovpn_struct *ovpn, struct ovpn_peer *peer)
 {
 	struct ovpn_peer *tmp;
@@ -793,50 +1144,172 @@ static int ovpn_peer_add_p2p(struct ovpn_struct *ovpn, struct ovpn_peer *peer)
 	return 0;
 }
 
+/* Complete the addition of a peer now reachable through the peer tables */
+static void ovpn_peer_added(struct ovpn_struct *ovpn, struct ovpn_peer *peer)
+{
+	/* a peer published after the walk of ovpn_peers_latency_stats_init() sees
+	 * latency stats enabled: pairs with the barrier there
+	 */
+	smp_mb();
+	if (READ_ONCE(ovpn->latency_stats) &&
+	    ovpn_peer_stats_latency_init(&peer->stats, GFP_KERNEL) < 0)
+		netdev_dbg(ovpn->dev, "%s: cannot allocate latency stats for peer %u\n",
+			   __func__, peer->id);
+}
+
 /* assume refcounter was increased by caller */
 int ovpn_peer_add(struct ovpn_struct *ovpn, struct ovpn_peer *peer)
 {
+	int ret;
+
 	switch (ovpn->mode) {
 	case OVPN_MODE_MP:
-		return ovpn_peer_add_mp(ovpn, peer);
+		ret = ovpn_peer_add_mp(ovpn, peer);
+		break;
 	case OVPN_MODE_P2P:
-		return ovpn_peer_add_p2p(ovpn, peer);
+		ret = ovpn_peer_add_p2p(ovpn, peer);
+		break;
 	default:
 		return -EOPNOTSUPP;
 	}
+
+	if (ret < 0)
+		return ret;
+
+	ovpn_peer_added(ovpn, peer);
+
+	return 0;
 }
 
-static void ovpn_peer_unhash(struct ovpn_peer *peer, enum ovpn_del_peer_reason reason)
+/**
+ * ovpn_peers_add_mp - add a batch of peers in MP mode
+ * @ovpn: the instance to add the peers to
+ * @peers: the peers, whose refcounters were increased by the caller
+ * @errs: where the outcome of each addition is stored, 0 or a negative error code
+ * @n: number of peers
+ *
+ * Same as ovpn_peer_add() for each peer, but the ID slots of the whole batch are reserved
+ * and then published under a single acquisition of the ID table lock, as are the routes
+ * to their VPN addresses
+ */
+void ovpn_peers_add_mp(struct ovpn_struct *ovpn, struct ovpn_peer **peers, int *errs,
+		       unsigned int n)
 {
-	hlist_del_init_rcu(&peer->hash_entry_id);
-	hlist_del_init_rcu(&peer->hash_entry_addr4);
-	hlist_del_init_rcu(&peer->hash_entry_addr6);
-	hlist_del_init_rcu(&peer->hash_entry_transp_addr);
+	unsigned int i;
 
-	ovpn_peer_put(peer);
-	peer->delete_reason = reason;
+	/* do not add duplicates, within the batch either. The lock is dropped only if the
+	 * table needs to grow
+	 */
+	xa_lock_bh(&ovpn->peers.by_id);
+	for (i = 0; i < n; i++) {
+		errs[i] = __xa_insert(&ovpn->peers.by_id, peers[i]->id, NULL, GFP_KERNEL);
+		if (errs[i] == -EBUSY)
+			errs[i] = -EEXIST;
+	}
+	xa_unlock_bh(&ovpn->peers.by_id);
+
+	for (i = 0; i < n; i++) {
+		if (errs[i])
+			continue;
+
+		errs[i] = ovpn_peer_hash_addrs(ovpn, peers[i]);
+		if (errs[i] < 0)
+			xa_erase_bh(&ovpn->peers.by_id, peers[i]->id);
+	}
+
+	/* the slots are reserved already, storing into them cannot fail */
+	xa_lock_bh(&ovpn->peers.by_id);
+	for (i = 0; i < n; i++)
+		if (!errs[i])
+			__xa_store(&ovpn->peers.by_id, peers[i]->id, peers[i], GFP_ATOMIC);
+	xa_unlock_bh(&ovpn->peers.by_id);
+
+	ovpn_route_add_peers(&ovpn->routes, peers, errs, n);
+
+	for (i = 0; i < n; i++)
+		if (!errs[i])
+			ovpn_peer_added(ovpn, peers[i]);
 }
 
+/* Only the caller that clears the ID slot gets to release the peer tables reference */
 static int ovpn_peer_del_mp(struct ovpn_peer *peer, enum ovpn_del_peer_reason reason)
 {
-	struct ovpn_peer *tmp;
-	int ret = 0;
+	struct ovpn_struct *ovpn = peer->ovpn;
 
-	spin_lock_bh(&peer->ovpn->peers.lock);
-	tmp = ovpn_peer_lookup_id(peer->ovpn, peer->id);
-	if (tmp != peer) {
-		ret = -ENOENT;
-		goto unlock;
+	if (xa_cmpxchg_bh(&ovpn->peers.by_id, peer->id, peer, NULL, 0) != peer)
+		return -ENOENT;
+
+	ovpn_peer_unhash_addrs(ovpn, peer);
+	ovpn_route_del_peer(&ovpn->routes, peer);
+
+	peer->delete_reason = reason;
+	ovpn_peer_put(peer);
+
+	return 0;
+}
+
+/* kref_put() callback of ovpn_peers_del_mp(), which is in process context already: the
+ * peer is destroyed by the caller together with the rest of the batch
+ */
+static void ovpn_peer_release_batch(struct kref *kref)
+{
+	ovpn_peer_retire(container_of(kref, struct ovpn_peer, refcount));
+}
+
+/**
+ * ovpn_peers_del_mp - delete a batch of peers in MP mode
+ * @ovpn: the instance the peers belong to
+ * @peers: the peers, each holding a reference of the caller, which is consumed
+ * @errs: where the outcome of each deletion is stored, 0 or a negative error code
+ * @n: number of peers
+ * @reason: the reason of the deletion, reported to userspace
+ *
+ * Same as ovpn_peer_del() for each peer, but the ID slots and then the routes of the whole
+ * batch are cleared under a single acquisition of the respective table lock. The peers
+ * released by the batch are freed together after a single grace period, rather than each
+ * by its own work item and RCU callback
+ */
+void ovpn_peers_del_mp(struct ovpn_struct *ovpn, struct ovpn_peer **peers, int *errs,
+		       unsigned int n, enum ovpn_del_peer_reason reason)
+{
+	struct ovpn_peer *peer, *tmp;
+	LIST_HEAD(release);
+	unsigned int i;
+
+	/* only the caller that clears the ID slot gets to release the tables reference */
+	xa_lock_bh(&ovpn->peers.by_id);
+	for (i = 0; i < n; i++) {
+		peer = __xa_cmpxchg(&ovpn->peers.by_id, peers[i]->id, peers[i], NULL, 0);
+		errs[i] = peer == peers[i] ? 0 : -ENOENT;
 	}
-	ovpn_peer_unhash(peer, reason);
+	xa_unlock_bh(&ovpn->peers.by_id);
 
-unlock:
-	spin_unlock_bh(&peer->ovpn->peers.lock);
+	ovpn_route_del_peers(&ovpn->routes, peers, errs, n);
 
-	if (tmp)
-		ovpn_peer_put(tmp);
+	for (i = 0; i < n; i++) {
+		peer = peers[i];
 
-	return ret;
+		if (!errs[i]) {
+			ovpn_peer_unhash_addrs(ovpn, peer);
+			peer->delete_reason = reason;
+			/* the caller still holds a reference */
+			ovpn_peer_put(peer);
+		}
+
+		/* the peer is released by its last user if not by us, see
+		 * ovpn_peer_release_kref()
+		 */
+		if (kref_put(&peer->refcount, ovpn_peer_release_batch))
+			list_add_tail(&peer->release_entry, &release);
+	}
+
+	if (list_empty(&release))
+		return;
+
+	synchronize_rcu();
+
+	list_for_each_entry_safe(peer, tmp, &release, release_entry)
+		ovpn_peer_destroy(peer);
 }
 
 static int ovpn_peer_del_p2p(struct ovpn_peer *peer, enum ovpn_del_peer_reason reason)
@@ -886,14 +1359,48 @@ int ovpn_peer_del(struct ovpn_peer *peer, enum ovpn_del_peer_reason reason)
 	}
 }
 
+/* Allocate the latency histograms of the peers added before latency stats were
+ * enabled on the interface. Peers whose histograms cannot be allocated are not
+ * timestamped
+ */
+void ovpn_peers_latency_stats_init(struct ovpn_struct *ovpn)
+{
+	struct ovpn_peer *peer;
+	unsigned long id;
+
+	/* pairs with the barrier in ovpn_peer_add() */
+	smp_mb();
+
+	/* peers are freed after a grace period: keep them valid while walking */
+	rcu_read_lock();
+	switch (ovpn->mode) {
+	case OVPN_MODE_MP:
+		xa_for_each(&ovpn->peers.by_id, id, peer) {
+			if (ovpn_peer_stats_latency_init(&peer->stats, GFP_ATOMIC) < 0)
+				netdev_dbg(ovpn->dev, "%s: cannot allocate latency stats for peer %u\n",
+					   __func__, peer->id);
+		}
+		break;
+	case OVPN_MODE_P2P:
+		peer = rcu_dereference(ovpn->peer);
+		if (peer && ovpn_peer_stats_latency_init(&peer->stats, GFP_ATOMIC) < 0)
+			netdev_dbg(ovpn->dev, "%s: cannot allocate latency stats for peer %u\n",
+				   __func__, peer->id);
+		break;
+	default:
+		break;
+	}
+	rcu_read_unlock();
+}
+
 void ovpn_peers_free(struct ovpn_struct *ovpn)
 {
-	struct hlist_node *tmp;
 	struct ovpn_peer *peer;
-	int bkt;
+	unsigned long id;
 
-	spin_lock_bh(&ovpn->peers.lock);
-	hash_for_each_safe(ovpn->peers.by_id, bkt, tmp, peer, hash_entry_id)
-		ovpn_peer_unhash(peer, OVPN_DEL_PEER_REASON_TEARDOWN);
-	spin_unlock_bh(&ovpn->peers.lock);
+	/* peers are freed after a grace period: keep them valid while walking */
+	rcu_read_lock();
+	xa_for_each(&ovpn->peers.by_id, id, peer)
+		ovpn_peer_del_mp(peer, OVPN_DEL_PEER_REASON_TEARDOWN);
+	rcu_read_unlock();
 }
@@ -15,24 +15,85 @@
 #include "sock.h"
 #include "stats.h"
 
-#include <linux/timer.h>
+#include <linux/kthread.h>
+#include <linux/jiffies.h>
 #include <linux/ptr_ring.h>
-#include <net/dst_cache.h>
+#include <linux/rhashtable.h>
+#include <net/strparser.h>
+
+/* transport address of a peer, as hashed in MP mode. IPv4 addresses occupy the first word of
+ * addr, the rest being zero
+ */
+struct ovpn_transp_key {
+	struct in6_addr addr;
+	__be16 port;
+	u16 family;
+};
 
 struct ovpn_peer {
+	/* fields touched for every packet come first, so that the datapath hits as few
+	 * cachelines as possible. The rest is configuration and control state
+	 */
 	struct ovpn_struct *ovpn;
 
 	u32 id;
 
+	/* needed because crypto methods can go async */
+	struct kref refcount;
+
+	/* our crypto state, read for every packet: kept away from refcount */
+	struct ovpn_crypto_state crypto ____cacheline_aligned_in_smp;
+
+	/* our binding to peer, protected by spinlock */
+	struct ovpn_bind __rcu *bind;
+
+	/* rings start at OVPN_QUEUE_LEN_IDLE slots, grow up to OVPN_QUEUE_LEN
+	 * under load and shrink back once the peer is idle
+	 */
+	struct ptr_ring tx_ring;
+	struct ptr_ring rx_ring;
+	struct ptr_ring netif_rx_ring;
+
+	struct ovpn_socket *sock;
+
+	/* headroom for the outer headers, learnt from the route to the peer and
+	 * reserved by the encrypt path on top of the encapsulation overhead
+	 */
+	unsigned int tx_headroom;
+	/* device the peer was last routed through, checked by the crypto offload */
+	int tx_ifindex;
+
+	/* per-peer rx/tx stats */
+	struct ovpn_peer_stats stats;
+
+	/* jiffies of the last authenticated packet sent and received, checked
+	 * by the keepalive sweep
+	 */
+	unsigned long last_tx;
+	unsigned long last_rx;
+	/* last generation of the peer table during which the peer moved data or changed
+	 * configuration, keys or endpoint, see ovpn_peer_touch()
+	 */
+	atomic64_t gen;
+
+	struct napi_struct napi;
+
 	struct {
 		struct in_addr ipv4;
 		struct in6_addr ipv6;
 	} vpn_addrs;
 
-	struct hlist_node hash_entry_id;
-	struct hlist_node hash_entry_addr4;
-	struct hlist_node hash_entry_addr6;
-	struct hlist_node hash_entry_transp_addr;
+	/* entries of the MP peer tables, only used by the peer owning the ID slot */
+	struct rhlist_head hash_entry_addr4;
+	struct rhlist_head hash_entry_addr6;
+	struct rhlist_head hash_entry_transp_addr;
+	struct ovpn_transp_key transp_key;
+	bool hashed_addr4;
+	bool hashed_addr6;
+	bool hashed_transp_addr;
+
+	/* entries of ovpn->routes pointing to this peer, protected by the table lock */
+	struct list_head routes;
 
 	/* work objects to handle encryption/decryption of packets.
 	 * these works are queued on the ovpn->crypt_wq workqueue.
@@ -40,26 +101,32 @@ struct ovpn_peer {
 	struct work_struct encrypt_work;
 	struct work_struct decrypt_work;
 
-	struct ptr_ring tx_ring;
-	struct ptr_ring rx_ring;
-	struct ptr_ring netif_rx_ring;
-
-	struct napi_struct napi;
-
-	struct ovpn_socket *sock;
-
-	/* state of the TCP reading. Needed to keep track of how much of a single packet has already
-	 * been read from the stream and how much is missing
+	/* in kthread crypto mode, the works above are replaced by these, queued
+	 * on the worker of crypto_cpu
+	 */
+	struct kthread_worker *crypto_worker;
+	struct kthread_work encrypt_kwork;
+	struct kthread_work decrypt_kwork;
+	int crypto_cpu;
+
+	/* state of the TCP transport. Records are framed by the stream parser and
+	 * DATA_V2 packets are batched in rx_list until the socket is drained.
+	 * Packets to send are gathered into a single sendmsg() as long as they fit
 	 */
 	struct {
 		struct ptr_ring tx_ring;
 		struct work_struct tx_work;
-		struct work_struct rx_work;
-
-		u8 raw_len[sizeof(u16)];
-		struct sk_buff *skb;
-		u16 offset;
-		u16 data_len;
+		/* packets pulled from tx_ring and not entirely sent yet */
+		struct sk_buff_head tx_queue;
+		/* bytes of the first packet in tx_queue already sent */
+		unsigned int tx_offset;
+		/* scratch array describing the data passed to each sendmsg() */
+		struct bio_vec *tx_bvec;
+
+		struct strparser strp;
+		struct sk_buff *rx_list;
+		struct sk_buff *rx_tail;
+		unsigned int rx_list_len;
 		struct {
 			void (*sk_state_change)(struct sock *sk);
 			void (*sk_data_ready)(struct sock *sk);
@@ -67,55 +134,45 @@ struct ovpn_peer {
 		} sk_cb;
 	} tcp;
 
-	struct dst_cache dst_cache;
-
-	/* our crypto state */
-	struct ovpn_crypto_state crypto;
-
-	/* our binding to peer, protected by spinlock */
-	struct ovpn_bind __rcu *bind;
-
-	/* timer used to send periodic ping messages to the other peer, if no
-	 * other data was sent within the past keepalive_interval seconds
+	/* a ping is sent to the other peer if no other data was sent within the
+	 * past keepalive_interval seconds
 	 */
-	struct timer_list keepalive_xmit;
-	/* keepalive interval in seconds */
 	unsigned long keepalive_interval;
 
-	/* timer used to mark a peer as expired when no data is received for
+	/* the peer is marked as expired when no data is received for
 	 * keepalive_timeout seconds
 	 */
-	struct timer_list keepalive_recv;
-	/* keepalive timeout in seconds */
 	unsigned long keepalive_timeout;
 
 	/* true if ovpn_peer_mark_delete was called */
 	bool halt;
 
-	/* per-peer rx/tx stats */
-	struct ovpn_peer_stats stats;
-
 	/* why peer was deleted - keepalive timeout, module removed etc */
 	enum ovpn_del_peer_reason delete_reason;
 
-	/* protects binding to peer (bind) and timers
-	 * (keepalive_xmit, keepalive_expire)
-	 */
+	/* protects binding to peer (bind) */
 	spinlock_t lock;
 
-	/* needed because crypto methods can go async */
-	struct kref refcount;
-
 	/* needed to free a peer in an RCU safe way */
 	struct rcu_head rcu;
 
 	/* needed to notify userspace about deletion */
 	struct work_struct delete_work;
+
+	/* entry in the list of peers released together by ovpn_peers_del_mp() */
+	struct list_head release_entry;
 };
 
 void ovpn_peer_release_kref(struct kref *kref);
 void ovpn_peer_release(struct ovpn_peer *peer);
 
+int ovpn_peer_ring_produce(struct ptr_ring *ring, struct sk_buff *skb);
+bool ovpn_peer_ring_grow(struct ptr_ring *ring);
+unsigned int ovpn_peer_ring_len(struct ptr_ring *ring);
+
+int ovpn_peer_cache_init(void);
+void ovpn_peer_cache_destroy(void);
+
 static inline bool ovpn_peer_hold(struct ovpn_peer *peer)
 {
 	return kref_get_unless_zero(&peer->refcount);
@@ -126,36 +183,52 @@ static inline void ovpn_peer_put(struct ovpn_peer *peer)
 	kref_put(&peer->refcount, ovpn_peer_release_kref);
 }
 
+/* Note an authenticated packet received. The stamp is written at most once per tick,
+ * not to bounce its cacheline across CPUs for every packet
+ */
 static inline void ovpn_peer_keepalive_recv_reset(struct ovpn_peer *peer)
 {
-	u32 delta = msecs_to_jiffies(peer->keepalive_timeout * MSEC_PER_SEC);
-
-	if (unlikely(!delta))
-		return;
+	unsigned long now = jiffies;
 
-	mod_timer(&peer->keepalive_recv, jiffies + delta);
+	if (READ_ONCE(peer->last_rx) != now)
+		WRITE_ONCE(peer->last_rx, now);
 }
 
+/* Note an authenticated packet sent, see ovpn_peer_keepalive_recv_reset() */
 static inline void ovpn_peer_keepalive_xmit_reset(struct ovpn_peer *peer)
 {
-	u32 delta = msecs_to_jiffies(peer->keepalive_interval * MSEC_PER_SEC);
+	unsigned long now = jiffies;
 
-	if (unlikely(!delta))
-		return;
+	if (READ_ONCE(peer->last_tx) != now)
+		WRITE_ONCE(peer->last_tx, now);
+}
 
-	mod_timer(&peer->keepalive_xmit, jiffies + delta);
+/* Return true if peer moved data or changed state since the given generation */
+static inline bool ovpn_peer_active_since(struct ovpn_peer *peer, u64 since)
+{
+	return (u64)atomic64_read(&peer->gen) >= since;
 }
 
 struct ovpn_peer *ovpn_peer_new(struct ovpn_struct *ovpn, const struct sockaddr_storage *sa,
-				struct socket *sock, u32 id, uint8_t *local_ip);
+				struct socket *sock, u32 id, uint8_t *local_ip, int cpu);
 
 void ovpn_peer_keepalive_set(struct ovpn_peer *peer, u32 interval, u32 timeout);
+void ovpn_peers_keepalive_work(struct work_struct *work);
 
 int ovpn_peer_add(struct ovpn_struct *ovpn, struct ovpn_peer *peer);
+void ovpn_peers_add_mp(struct ovpn_struct *ovpn, struct ovpn_peer **peers, int *errs,
+		       unsigned int n);
 int ovpn_peer_del(struct ovpn_peer *peer, enum ovpn_del_peer_reason reason);
+void ovpn_peers_del_mp(struct ovpn_struct *ovpn, struct ovpn_peer **peers, int *errs,
+		       unsigned int n, enum ovpn_del_peer_reason reason);
 struct ovpn_peer *ovpn_peer_find(struct ovpn_struct *ovpn, u32 peer_id);
 void ovpn_peer_release_p2p(struct ovpn_struct *ovpn);
+void ovpn_peers_latency_stats_init(struct ovpn_struct *ovpn);
 void ovpn_peers_free(struct ovpn_struct *ovpn);
+bool ovpn_peer_hashed(struct ovpn_peer *peer);
+
+int ovpn_peers_init(struct ovpn_struct *ovpn);
+void ovpn_peers_destroy(struct ovpn_struct *ovpn);
 
 struct ovpn_peer *ovpn_peer_lookup_transp_addr(struct ovpn_struct *ovpn, struct sk_buff *skb);
 struct ovpn_peer *ovpn_peer_lookup_vpn_addr(struct ovpn_struct *ovpn, struct sk_buff *skb,
@@ -57,18 +57,23 @@ struct ovpn_pktid_xmit {
 
 #define REPLAY_WINDOW_BYTES BIT(REPLAY_WINDOW_ORDER)
 #define REPLAY_WINDOW_SIZE  (REPLAY_WINDOW_BYTES * 8)
-#define REPLAY_INDEX(base, i) (((base) + (i)) & (REPLAY_WINDOW_SIZE - 1))
+
+/* The history is made of slots, each covering a block of REPLAY_SLOT_BITS
+ * consecutive IDs. A slot packs the block number (upper 32 bits) with the
+ * bitmap of IDs received in that block (lower 32 bits), so that it can be
+ * checked, set or recycled for a newer block with a single cmpxchg.
+ * Slots are twice as many as needed to cover the window, so that the block
+ * being recycled is always outside of it.
+ */
+#define REPLAY_SLOT_BITS 32
+#define REPLAY_SLOTS (2 * REPLAY_WINDOW_SIZE / REPLAY_SLOT_BITS)
 
 /* Packet-ID state for receiver.
  * Other than lock member, can be zeroed to initialize.
  */
 struct ovpn_pktid_recv {
-	/* "sliding window" bitmask of recent packet IDs received */
-	u8 history[REPLAY_WINDOW_BYTES];
-	/* bit position of deque base in history */
-	unsigned int base;
-	/* extent (in bits) of deque in history */
-	unsigned int extent;
+	/* "sliding window" of recent packet IDs received */
+	atomic64_t history[REPLAY_SLOTS];
 	/* expiration of history in jiffies */
 	unsigned long expire;
 	/* highest sequence number received */
@@ -78,7 +83,7 @@ struct ovpn_pktid_recv {
 	/* we will only accept backtrack IDs > id_floor */
 	u32 id_floor;
 	unsigned int max_backtrack;
-	/* protects entire pktd ID state */
+	/* serializes time stamp changes, the rest of the state is lockless */
 	spinlock_t lock;
 };
 
@@ -98,6 +103,28 @@ static inline int ovpn_pktid_xmit_next(struct ovpn_pktid_xmit *pid, u32 *pktid)
 	return 0;
 }
 
+/* Get n consecutive packet IDs for xmit, starting from *pktid */
+static inline int ovpn_pktid_xmit_next_n(struct ovpn_pktid_xmit *pid, u32 n, u32 *pktid)
+{
+	s64 seq_num = atomic64_read(&pid->seq_num);
+
+	do {
+		/* same as ovpn_pktid_xmit_next(): never wrap around */
+		if (unlikely(seq_num + n > 0x100000000LL))
+			return -ERANGE;
+	} while (!atomic64_try_cmpxchg(&pid->seq_num, &seq_num, seq_num + n));
+
+	*pktid = (u32)seq_num;
+
+	return 0;
+}
+
+/* Return true if less than margin packet IDs are left for xmit */
+static inline bool ovpn_pktid_xmit_exhausting(struct ovpn_pktid_xmit *pid, u32 margin)
+{
+	return atomic64_read(&pid->seq_num) > 0x100000000LL - margin;
+}
+
 /* Write 12-byte AEAD IV to dest */
 static inline void ovpn_pktid_aead_write(const u32 pktid,
 					 const struct ovpn_nonce_tail *nt,
@@ -0,0 +1,162 @@
+// SPDX-License-Identifier: GPL-2.0
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+#include "main.h"
+#include "ovpnstruct.h"
+#include "peer.h"
+#include "pool.h"
+#include "stats.h"
+
+#include <linux/slab.h>
+
+#ifdef OVPN_PAGE_POOL
+/* commit a9ca9f9ceff3 split net/page_pool.h */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 6, 0)
+#include <net/page_pool.h>
+#else
+#include <net/page_pool/helpers.h>
+#endif
+#endif
+
+/* largest headroom + data fitting the head of an skb built on a pool page */
+#define OVPN_POOL_SKB_MAX SKB_WITH_OVERHEAD(PAGE_SIZE)
+
+/* data kept in the head of skbs too large for a pool page, the rest going to page frags */
+#define OVPN_POOL_FRAGS_HEADLEN 128
+
+#ifdef OVPN_PAGE_POOL
+
+int ovpn_page_pools_init(struct ovpn_page_pools *pools)
+{
+	struct page_pool_params params = {
+		.order = 0,
+		.pool_size = OVPN_PAGE_POOL_SIZE,
+	};
+	struct page_pool *pool;
+	int cpu;
+
+	pools->pool = kcalloc(nr_cpu_ids, sizeof(*pools->pool), GFP_KERNEL);
+	if (!pools->pool)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		params.nid = cpu_to_node(cpu);
+		pool = page_pool_create(&params);
+		if (IS_ERR(pool)) {
+			ovpn_page_pools_free(pools);
+			return PTR_ERR(pool);
+		}
+
+		pools->pool[cpu] = pool;
+	}
+
+	return 0;
+}
+
+void ovpn_page_pools_free(struct ovpn_page_pools *pools)
+{
+	int cpu;
+
+	if (!pools->pool)
+		return;
+
+	/* pages still held by in-flight skbs are released by the page_pool core later */
+	for_each_possible_cpu(cpu) {
+		if (pools->pool[cpu])
+			page_pool_destroy(pools->pool[cpu]);
+	}
+
+	kfree(pools->pool);
+	pools->pool = NULL;
+}
+
+/* Build a linear skb on a page drawn from the pool of the current CPU */
+static struct sk_buff *ovpn_pool_build_skb(struct ovpn_page_pools *pools)
+{
+	struct page_pool *pool;
+	struct sk_buff *skb;
+	struct page *page;
+
+	if (unlikely(!pools->pool))
+		return NULL;
+
+	/* the allocation side of a pool is lockless: serialize with the softirqs of
+	 * this CPU, which may allocate from the same pool
+	 */
+	local_bh_disable();
+	pool = pools->pool[smp_processor_id()];
+	page = page_pool_dev_alloc_pages(pool);
+	local_bh_enable();
+	if (unlikely(!page))
+		return NULL;
+
+	skb = build_skb(page_address(page), PAGE_SIZE);
+	if (unlikely(!skb)) {
+		page_pool_put_full_page(pool, page, false);
+		return NULL;
+	}
+
+	/* the page goes back to the pool when the skb is consumed */
+	skb_mark_for_recycle(skb);
+
+	return skb;
+}
+
+#else
+
+int ovpn_page_pools_init(struct ovpn_page_pools *pools)
+{
+	pools->pool = NULL;
+	return 0;
+}
+
+void ovpn_page_pools_free(struct ovpn_page_pools *pools)
+{
+}
+
+static struct sk_buff *ovpn_pool_build_skb(struct ovpn_page_pools *pools)
+{
+	return NULL;
+}
+
+#endif /* OVPN_PAGE_POOL */
+
+/* Allocate an skb with headroom bytes reserved and len bytes of uninitialized data.
+ *
+ * The skb is built on a pool page if it fits, otherwise it is allocated as usual,
+ * with page frags beyond its first OVPN_POOL_FRAGS_HEADLEN bytes if large.
+ * The outcome is accounted as a pool hit or miss of peer.
+ */
+struct sk_buff *ovpn_pool_alloc_skb(struct ovpn_peer *peer, unsigned int headroom,
+				    unsigned int len, gfp_t gfp)
+{
+	struct sk_buff *skb = NULL;
+	unsigned int linear = len;
+	int err;
+
+	if (likely(headroom + len <= OVPN_POOL_SKB_MAX))
+		skb = ovpn_pool_build_skb(&peer->ovpn->page_pools);
+	else
+		linear = OVPN_POOL_FRAGS_HEADLEN;
+
+	ovpn_peer_stats_increment_pool(&peer->stats, !!skb);
+
+	if (!skb) {
+		skb = alloc_skb_with_frags(headroom + linear, len - linear,
+					   PAGE_ALLOC_COSTLY_ORDER, &err, gfp);
+		if (unlikely(!skb))
+			return NULL;
+	}
+
+	skb_reserve(skb, headroom);
+	skb_put(skb, linear);
+	skb->len += len - linear;
+	skb->data_len = len - linear;
+
+	return skb;
+}
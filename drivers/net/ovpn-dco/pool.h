@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+#ifndef _NET_OVPN_DCO_POOL_H_
+#define _NET_OVPN_DCO_POOL_H_
+
+#include <linux/skbuff.h>
+#include <linux/version.h>
+
+/* skb_mark_for_recycle() took its current form with v5.15 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 15, 0) && IS_ENABLED(CONFIG_PAGE_POOL)
+#define OVPN_PAGE_POOL 1
+#endif
+
+struct ovpn_peer;
+struct page_pool;
+
+/* Per-CPU page pools of an interface, used for the buffers allocated by the data
+ * path itself: the destination of out of place decryptions and the keepalive and
+ * control packets sent by us.
+ *
+ * The head of such skbs is a pool page, given back to the pool of the allocating
+ * CPU once the skb is consumed, e.g. by GRO or by the transport socket.
+ * Pages are not DMA mapped, as the pools do not belong to any device.
+ */
+struct ovpn_page_pools {
+	/* indexed by CPU, NULL if page_pool is not available */
+	struct page_pool **pool;
+};
+
+int ovpn_page_pools_init(struct ovpn_page_pools *pools);
+void ovpn_page_pools_free(struct ovpn_page_pools *pools);
+
+struct sk_buff *ovpn_pool_alloc_skb(struct ovpn_peer *peer, unsigned int headroom,
+				    unsigned int len, gfp_t gfp);
+
+#endif /* _NET_OVPN_DCO_POOL_H_ */
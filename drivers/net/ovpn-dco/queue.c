@@ -0,0 +1,101 @@
+// SPDX-License-Identifier: GPL-2.0
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+#include "main.h"
+#include "queue.h"
+
+#include <linux/cpumask.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+
+/* shrinking the queues lets tests/overflow-test.sh exercise the overflow path */
+static unsigned int ovpn_parallel_queue_len = OVPN_QUEUE_LEN;
+module_param_named(parallel_queue_len, ovpn_parallel_queue_len, uint, 0444);
+MODULE_PARM_DESC(parallel_queue_len, "length of the per-CPU parallel crypto queues");
+
+int ovpn_parallel_queue_init(struct ovpn_parallel_queue *queue, work_func_t func)
+{
+	struct ovpn_parallel_worker *worker;
+	int cpu, i, ret;
+
+	queue->worker = alloc_percpu(struct ovpn_parallel_worker);
+	if (!queue->worker)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		worker = per_cpu_ptr(queue->worker, cpu);
+		ret = ptr_ring_init(&worker->ring, ovpn_parallel_queue_len ?: OVPN_QUEUE_LEN,
+				    GFP_KERNEL);
+		if (ret < 0)
+			goto err;
+
+		INIT_WORK(&worker->work, func);
+	}
+
+	queue->last_cpu = -1;
+
+	return 0;
+err:
+	for_each_possible_cpu(i) {
+		if (i == cpu)
+			break;
+		ptr_ring_cleanup(&per_cpu_ptr(queue->worker, i)->ring, NULL);
+	}
+	free_percpu(queue->worker);
+	return ret;
+}
+
+/* workers must have been flushed by the caller */
+void ovpn_parallel_queue_free(struct ovpn_parallel_queue *queue)
+{
+	struct ovpn_parallel_worker *worker;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		worker = per_cpu_ptr(queue->worker, cpu);
+		WARN_ON(!__ptr_ring_empty(&worker->ring));
+		ptr_ring_cleanup(&worker->ring, NULL);
+	}
+	free_percpu(queue->worker);
+}
+
+/* pick the next online CPU in a round-robin fashion */
+static int ovpn_parallel_next_cpu(struct ovpn_parallel_queue *queue)
+{
+	int cpu = cpumask_next(READ_ONCE(queue->last_cpu), cpu_online_mask);
+
+	if (cpu >= nr_cpu_ids)
+		cpu = cpumask_first(cpu_online_mask);
+	WRITE_ONCE(queue->last_cpu, cpu);
+
+	return cpu;
+}
+
+/* Put skb into the ring of cpu, or of the next CPU if cpu is negative or offline,
+ * and kick the worker of that CPU.
+ *
+ * Return 0 on success or a negative error code if the ring is full.
+ */
+int ovpn_parallel_queue_skb(struct workqueue_struct *wq, struct ovpn_parallel_queue *queue,
+			    struct sk_buff *skb, int cpu)
+{
+	struct ovpn_parallel_worker *worker;
+	int ret;
+
+	if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_online(cpu))
+		cpu = ovpn_parallel_next_cpu(queue);
+	worker = per_cpu_ptr(queue->worker, cpu);
+
+	ret = ptr_ring_produce_bh(&worker->ring, skb);
+	if (unlikely(ret < 0))
+		return ret;
+
+	queue_work_on(cpu, wq, &worker->work);
+
+	return 0;
+}
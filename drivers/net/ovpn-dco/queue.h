@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+#ifndef _NET_OVPN_DCO_QUEUE_H_
+#define _NET_OVPN_DCO_QUEUE_H_
+
+#include <linux/ptr_ring.h>
+#include <linux/skbuff.h>
+#include <linux/workqueue.h>
+
+/* a CPU ring is drained only by the worker of the same CPU */
+struct ovpn_parallel_worker {
+	struct ptr_ring ring;
+	struct work_struct work;
+};
+
+/* Device-wide queue used in parallel crypto mode.
+ *
+ * Packets are distributed to one ring and worker per CPU, either round-robin or
+ * steered to a given CPU, while each peer keeps the arrival order in its own
+ * rx_ring/tx_ring.
+ * The rings do not own the skbs they contain: they are owned (and freed) by
+ * the per-peer ring they have also been queued to.
+ */
+struct ovpn_parallel_queue {
+	struct ovpn_parallel_worker __percpu *worker;
+	int last_cpu;
+};
+
+int ovpn_parallel_queue_init(struct ovpn_parallel_queue *queue, work_func_t func);
+void ovpn_parallel_queue_free(struct ovpn_parallel_queue *queue);
+
+int ovpn_parallel_queue_skb(struct workqueue_struct *wq, struct ovpn_parallel_queue *queue,
+			    struct sk_buff *skb, int cpu);
+
+#endif /* _NET_OVPN_DCO_QUEUE_H_ */
@@ -0,0 +1,570 @@
+// SPDX-License-Identifier: GPL-2.0
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+#include "main.h"
+#include "peer.h"
+#include "route.h"
+
+#include <linux/bitops.h>
+#include <linux/slab.h>
+#include <linux/version.h>
+#include <net/fib_notifier.h>
+
+static unsigned int ovpn_route_bits(sa_family_t family)
+{
+	return family == AF_INET ? 32 : 128;
+}
+
+static struct ovpn_route_node __rcu **ovpn_route_root(struct ovpn_route_table *table,
+						      sa_family_t family)
+{
+	return family == AF_INET ? &table->root4 : &table->root6;
+}
+
+/* bit of key right after the first i bits */
+static unsigned int ovpn_route_bit(const u8 *key, unsigned int i)
+{
+	return (key[i / 8] >> (7 - (i % 8))) & 1;
+}
+
+/* number of leading bits shared by a and b, up to bits */
+static unsigned int ovpn_route_common_bits(const u8 *a, const u8 *b, unsigned int bits)
+{
+	unsigned int i;
+	u8 x;
+
+	for (i = 0; i < DIV_ROUND_UP(bits, 8); i++) {
+		x = a[i] ^ b[i];
+		if (x)
+			return min_t(unsigned int, i * 8 + 8 - fls(x), bits);
+	}
+
+	return bits;
+}
+
+static bool ovpn_route_node_match(const struct ovpn_route_node *node, const u8 *key)
+{
+	return ovpn_route_common_bits(node->key, key, node->cidr) == node->cidr;
+}
+
+/* copy the first cidr bits of key to dst, zeroing the following ones */
+static void ovpn_route_mask(u8 *dst, const u8 *key, unsigned int cidr)
+{
+	memset(dst, 0, 16);
+	memcpy(dst, key, DIV_ROUND_UP(cidr, 8));
+	if (cidr % 8)
+		dst[cidr / 8] &= 0xff << (8 - cidr % 8);
+}
+
+static struct ovpn_route_node *ovpn_route_node_new(const u8 *key, unsigned int cidr)
+{
+	struct ovpn_route_node *node;
+
+	node = kzalloc(sizeof(*node), GFP_ATOMIC);
+	if (!node)
+		return NULL;
+
+	node->cidr = cidr;
+	ovpn_route_mask(node->key, key, cidr);
+
+	INIT_LIST_HEAD(&node->peer_list);
+	INIT_LIST_HEAD(&node->cache_list);
+
+	return node;
+}
+
+static struct ovpn_route_node __rcu **ovpn_route_parent_slot(struct ovpn_route_table *table,
+							     sa_family_t family,
+							     struct ovpn_route_node *node)
+{
+	if (!node->parent)
+		return ovpn_route_root(table, family);
+
+	return &node->parent->child[ovpn_route_bit(node->key, node->parent->cidr)];
+}
+
+/* nodes do not store their family: tell it from the root of their trie */
+static sa_family_t ovpn_route_node_family(struct ovpn_route_table *table,
+					  struct ovpn_route_node *node)
+{
+	while (node->parent)
+		node = node->parent;
+
+	return rcu_access_pointer(table->root4) == node ? AF_INET : AF_INET6;
+}
+
+static void ovpn_route_node_unlink_peer(struct ovpn_route_table *table,
+					struct ovpn_route_node *node)
+{
+	list_del_init(&node->peer_list);
+	RCU_INIT_POINTER(node->peer, NULL);
+
+	if (node->cached) {
+		list_del_init(&node->cache_list);
+		table->cache_len--;
+		WRITE_ONCE(node->cached, false);
+	}
+}
+
+/* Drop the peer of node and remove whatever node becomes useless: the node
+ * itself, unless it still joins two children, and its parent, if it was a glue
+ * node left with a single child.
+ */
+static void ovpn_route_node_remove(struct ovpn_route_table *table, sa_family_t family,
+				   struct ovpn_route_node *node)
+	__must_hold(&table->lock)
+{
+	struct ovpn_route_node *child, *parent, *other;
+
+	ovpn_route_node_unlink_peer(table, node);
+
+	child = rcu_dereference_protected(node->child[0], lockdep_is_held(&table->lock));
+	other = rcu_dereference_protected(node->child[1], lockdep_is_held(&table->lock));
+	if (child && other)
+		return;
+
+	if (!child)
+		child = other;
+
+	parent = node->parent;
+	rcu_assign_pointer(*ovpn_route_parent_slot(table, family, node), child);
+	if (child)
+		child->parent = parent;
+	kfree_rcu(node, rcu);
+
+	if (child || !parent || rcu_access_pointer(parent->peer))
+		return;
+
+	/* parent was a glue node: replace it with its remaining child */
+	other = rcu_dereference_protected(parent->child[0], lockdep_is_held(&table->lock)) ?:
+		rcu_dereference_protected(parent->child[1], lockdep_is_held(&table->lock));
+	rcu_assign_pointer(*ovpn_route_parent_slot(table, family, parent), other);
+	if (other)
+		other->parent = parent->parent;
+	kfree_rcu(parent, rcu);
+}
+
+static void ovpn_route_node_set_peer(struct ovpn_route_table *table,
+				     struct ovpn_route_node *node, struct ovpn_peer *peer,
+				     bool cached, u32 gen)
+	__must_hold(&table->lock)
+{
+	if (node->cached && !cached) {
+		list_del_init(&node->cache_list);
+		table->cache_len--;
+	} else if (!node->cached && cached) {
+		list_add_tail(&node->cache_list, &table->cache);
+		table->cache_len++;
+	}
+
+	WRITE_ONCE(node->gen, gen);
+	WRITE_ONCE(node->cached, cached);
+	list_move(&node->peer_list, &peer->routes);
+	rcu_assign_pointer(node->peer, peer);
+}
+
+/* Insert or replace the entry of key/cidr. Cached entries never replace
+ * configured routes.
+ */
+static int ovpn_route_insert(struct ovpn_route_table *table, struct ovpn_peer *peer,
+			     sa_family_t family, const u8 *key, unsigned int cidr, bool cached,
+			     u32 gen)
+	__must_hold(&table->lock)
+{
+	struct ovpn_route_node __rcu **slot = ovpn_route_root(table, family);
+	struct ovpn_route_node *node, *new, *glue, *parent = NULL;
+	unsigned int common;
+
+	/* the peer may be on its way out: do not leave entries behind */
+	if (!ovpn_peer_hashed(peer))
+		return -ENOENT;
+
+	for (;;) {
+		node = rcu_dereference_protected(*slot, lockdep_is_held(&table->lock));
+		if (!node)
+			break;
+
+		common = ovpn_route_common_bits(node->key, key, min_t(unsigned int, node->cidr,
+								      cidr));
+		if (common == node->cidr && common == cidr) {
+			if (cached && rcu_access_pointer(node->peer) && !node->cached)
+				return -EEXIST;
+
+			ovpn_route_node_set_peer(table, node, peer, cached, gen);
+			return 0;
+		}
+
+		if (common < node->cidr)
+			break;
+
+		/* node prefix covers key: descend */
+		parent = node;
+		slot = &node->child[ovpn_route_bit(key, node->cidr)];
+	}
+
+	new = ovpn_route_node_new(key, cidr);
+	if (!new)
+		return -ENOMEM;
+
+	new->parent = parent;
+	ovpn_route_node_set_peer(table, new, peer, cached, gen);
+
+	if (!node) {
+		rcu_assign_pointer(*slot, new);
+		return 0;
+	}
+
+	/* new prefix covers node: insert new in between */
+	if (common == cidr) {
+		RCU_INIT_POINTER(new->child[ovpn_route_bit(node->key, cidr)], node);
+		node->parent = new;
+		rcu_assign_pointer(*slot, new);
+		return 0;
+	}
+
+	/* prefixes diverge after common bits: join them with a glue node */
+	glue = ovpn_route_node_new(key, common);
+	if (!glue) {
+		ovpn_route_node_unlink_peer(table, new);
+		kfree(new);
+		return -ENOMEM;
+	}
+
+	glue->parent = parent;
+	RCU_INIT_POINTER(glue->child[ovpn_route_bit(key, common)], new);
+	RCU_INIT_POINTER(glue->child[ovpn_route_bit(node->key, common)], node);
+	new->parent = glue;
+	node->parent = glue;
+	rcu_assign_pointer(*slot, glue);
+
+	return 0;
+}
+
+/**
+ * ovpn_route_add - route the prefix addr/cidr to peer
+ * @table: the route table
+ * @peer: the peer to route to, must be hashed
+ * @family: AF_INET or AF_INET6
+ * @addr: the prefix, in network byte order
+ * @cidr: the prefix length
+ *
+ * An existing route for the same prefix is replaced.
+ *
+ * Return 0 on success or a negative error code otherwise
+ */
+int ovpn_route_add(struct ovpn_route_table *table, struct ovpn_peer *peer, sa_family_t family,
+		   const void *addr, u8 cidr)
+{
+	int ret;
+
+	if (cidr > ovpn_route_bits(family))
+		return -EINVAL;
+
+	spin_lock_bh(&table->lock);
+	ret = ovpn_route_insert(table, peer, family, addr, cidr, false, 0);
+	spin_unlock_bh(&table->lock);
+
+	return ret;
+}
+
+/**
+ * ovpn_route_add_peers - route the VPN addresses of a batch of peers
+ * @table: the route table
+ * @peers: the peers to route to, must be hashed
+ * @errs: peers whose entry is not 0 are skipped
+ * @n: number of peers
+ *
+ * Same as ovpn_route_add() with a host route for each VPN address of each peer, but under
+ * a single acquisition of the table lock. Failures are ignored, as lookups fall back to
+ * the FIB and to the peer tables
+ */
+void ovpn_route_add_peers(struct ovpn_route_table *table, struct ovpn_peer **peers,
+			  const int *errs, unsigned int n)
+{
+	const struct in6_addr *addr6;
+	const struct in_addr *addr4;
+	struct ovpn_peer *peer;
+	unsigned int i;
+
+	spin_lock_bh(&table->lock);
+	for (i = 0; i < n; i++) {
+		if (errs[i])
+			continue;
+
+		peer = peers[i];
+		addr4 = &peer->vpn_addrs.ipv4;
+		addr6 = &peer->vpn_addrs.ipv6;
+
+		if (addr4->s_addr != htonl(INADDR_ANY))
+			ovpn_route_insert(table, peer, AF_INET, (const u8 *)addr4, 32, false, 0);
+		if (memcmp(addr6, &in6addr_any, sizeof(*addr6)))
+			ovpn_route_insert(table, peer, AF_INET6, (const u8 *)addr6, 128, false, 0);
+	}
+	spin_unlock_bh(&table->lock);
+}
+
+/**
+ * ovpn_route_del - remove the route of the prefix addr/cidr
+ * @table: the route table
+ * @family: AF_INET or AF_INET6
+ * @addr: the prefix, in network byte order
+ * @cidr: the prefix length
+ *
+ * Return 0 on success or -ENOENT if no such route was configured
+ */
+int ovpn_route_del(struct ovpn_route_table *table, sa_family_t family, const void *addr,
+		   u8 cidr)
+{
+	struct ovpn_route_node *node;
+	u8 key[16] __aligned(4);
+	int ret = -ENOENT;
+
+	if (cidr > ovpn_route_bits(family))
+		return -EINVAL;
+
+	ovpn_route_mask(key, addr, cidr);
+
+	spin_lock_bh(&table->lock);
+	node = rcu_dereference_protected(*ovpn_route_root(table, family),
+					 lockdep_is_held(&table->lock));
+	while (node && node->cidr <= cidr && ovpn_route_node_match(node, key)) {
+		if (node->cidr == cidr) {
+			if (rcu_access_pointer(node->peer) && !node->cached) {
+				ovpn_route_node_remove(table, family, node);
+				ret = 0;
+			}
+			break;
+		}
+
+		node = rcu_dereference_protected(node->child[ovpn_route_bit(key, node->cidr)],
+						 lockdep_is_held(&table->lock));
+	}
+	spin_unlock_bh(&table->lock);
+
+	return ret;
+}
+
+/* Remove all the entries pointing to peer, upon its removal */
+void ovpn_route_del_peer(struct ovpn_route_table *table, struct ovpn_peer *peer)
+{
+	struct ovpn_route_node *node, *tmp;
+
+	spin_lock_bh(&table->lock);
+	list_for_each_entry_safe(node, tmp, &peer->routes, peer_list)
+		ovpn_route_node_remove(table, ovpn_route_node_family(table, node), node);
+	spin_unlock_bh(&table->lock);
+}
+
+/* Same as ovpn_route_del_peer() for a batch of peers, skipping those whose errs entry is not
+ * 0, under a single acquisition of the table lock
+ */
+void ovpn_route_del_peers(struct ovpn_route_table *table, struct ovpn_peer **peers,
+			  const int *errs, unsigned int n)
+{
+	struct ovpn_route_node *node, *tmp;
+	unsigned int i;
+
+	spin_lock_bh(&table->lock);
+	for (i = 0; i < n; i++) {
+		if (errs[i])
+			continue;
+
+		list_for_each_entry_safe(node, tmp, &peers[i]->routes, peer_list)
+			ovpn_route_node_remove(table, ovpn_route_node_family(table, node), node);
+	}
+	spin_unlock_bh(&table->lock);
+}
+
+/**
+ * ovpn_route_lookup - find the peer routing addr
+ * @table: the route table
+ * @family: AF_INET or AF_INET6
+ * @addr: the address to look up, in network byte order
+ *
+ * Return the peer of the longest prefix matching addr, with a reference held,
+ * or NULL if no route or valid cached entry matches
+ */
+struct ovpn_peer *ovpn_route_lookup(struct ovpn_route_table *table, sa_family_t family,
+				    const void *addr)
+{
+	const unsigned int bits = ovpn_route_bits(family);
+	struct ovpn_route_node *node, *best = NULL;
+	struct ovpn_peer *peer = NULL;
+	u32 gen;
+
+	gen = ovpn_route_fib_gen(table);
+
+	rcu_read_lock();
+	node = rcu_dereference(*ovpn_route_root(table, family));
+	while (node && ovpn_route_node_match(node, addr)) {
+		if (rcu_access_pointer(node->peer) &&
+		    (!READ_ONCE(node->cached) || READ_ONCE(node->gen) == gen))
+			best = node;
+
+		if (node->cidr == bits)
+			break;
+
+		node = rcu_dereference(node->child[ovpn_route_bit(addr, node->cidr)]);
+	}
+
+	if (best) {
+		peer = rcu_dereference(best->peer);
+		if (peer && !ovpn_peer_hold(peer))
+			peer = NULL;
+	}
+	rcu_read_unlock();
+
+	return peer;
+}
+
+/**
+ * ovpn_route_cache - remember that addr was resolved to peer through the FIB
+ * @table: the route table
+ * @peer: the peer addr was resolved to
+ * @family: AF_INET or AF_INET6
+ * @addr: the address that was looked up, in network byte order
+ * @gen: the FIB generation read before the FIB lookup
+ *
+ * Best effort: nothing is cached once the cache is full or if the FIB changed
+ * in the meantime.
+ */
+void ovpn_route_cache(struct ovpn_route_table *table, struct ovpn_peer *peer,
+		      sa_family_t family, const void *addr, u32 gen)
+{
+	if (gen != ovpn_route_fib_gen(table) || READ_ONCE(table->cache_len) >= OVPN_ROUTE_CACHE_MAX)
+		return;
+
+	spin_lock_bh(&table->lock);
+	if (table->cache_len < OVPN_ROUTE_CACHE_MAX)
+		ovpn_route_insert(table, peer, family, addr, ovpn_route_bits(family), true, gen);
+	spin_unlock_bh(&table->lock);
+}
+
+static void ovpn_route_flush_work(struct work_struct *work)
+{
+	struct ovpn_route_table *table = container_of(work, struct ovpn_route_table, flush_work);
+	struct ovpn_route_node *node, *tmp;
+	u32 gen = ovpn_route_fib_gen(table);
+
+	spin_lock_bh(&table->lock);
+	list_for_each_entry_safe(node, tmp, &table->cache, cache_list) {
+		if (node->gen != gen)
+			ovpn_route_node_remove(table, ovpn_route_node_family(table, node), node);
+	}
+	spin_unlock_bh(&table->lock);
+}
+
+/* Any FIB change may redirect cached destinations: invalidate them all. This is
+ * invoked in atomic context, hence stale entries are only reaped later on
+ */
+static int ovpn_route_fib_event(struct notifier_block *nb, unsigned long event, void *ptr)
+{
+	struct ovpn_route_table *table = container_of(nb, struct ovpn_route_table, fib_nb);
+	struct fib_notifier_info *info = ptr;
+
+	if (info->family != AF_INET && info->family != AF_INET6)
+		return NOTIFY_DONE;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0)
+	/* notifications are not per-netns yet */
+	if (!net_eq(info->net, table->net))
+		return NOTIFY_DONE;
+#endif
+
+	atomic_inc(&table->fib_gen);
+	if (READ_ONCE(table->cache_len))
+		schedule_work(&table->flush_work);
+
+	return NOTIFY_DONE;
+}
+
+static void ovpn_route_fib_dump_flush(struct notifier_block *nb)
+{
+	struct ovpn_route_table *table = container_of(nb, struct ovpn_route_table, fib_nb);
+
+	atomic_inc(&table->fib_gen);
+}
+
+void ovpn_route_table_init(struct ovpn_route_table *table)
+{
+	RCU_INIT_POINTER(table->root4, NULL);
+	RCU_INIT_POINTER(table->root6, NULL);
+	atomic_set(&table->fib_gen, 0);
+	INIT_LIST_HEAD(&table->cache);
+	table->cache_len = 0;
+	spin_lock_init(&table->lock);
+	INIT_WORK(&table->flush_work, ovpn_route_flush_work);
+	table->fib_nb_registered = false;
+}
+
+/* Start listening to FIB changes in net. Needed only in MP mode */
+int ovpn_route_table_start(struct ovpn_route_table *table, struct net *net)
+{
+	int ret;
+
+	table->net = net;
+	table->fib_nb.notifier_call = ovpn_route_fib_event;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0)
+	ret = register_fib_notifier(net, &table->fib_nb, ovpn_route_fib_dump_flush, NULL);
+#else
+	ret = register_fib_notifier(&table->fib_nb, ovpn_route_fib_dump_flush);
+#endif
+	if (ret < 0)
+		return ret;
+
+	table->fib_nb_registered = true;
+
+	return 0;
+}
+
+static void ovpn_route_trie_free(struct ovpn_route_node __rcu **root)
+{
+	struct ovpn_route_node *node, *child, *parent;
+	int i;
+
+	node = rcu_dereference_protected(*root, true);
+	RCU_INIT_POINTER(*root, NULL);
+
+	/* post-order walk, detaching each child before descending into it */
+	while (node) {
+		child = NULL;
+		for (i = 0; i < 2 && !child; i++) {
+			child = rcu_dereference_protected(node->child[i], true);
+			if (child)
+				RCU_INIT_POINTER(node->child[i], NULL);
+		}
+
+		if (child) {
+			node = child;
+			continue;
+		}
+
+		parent = node->parent;
+		kfree_rcu(node, rcu);
+		node = parent;
+	}
+}
+
+/* Release the table, once all peers are gone */
+void ovpn_route_table_release(struct ovpn_route_table *table)
+{
+	if (table->fib_nb_registered) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0)
+		unregister_fib_notifier(table->net, &table->fib_nb);
+#else
+		unregister_fib_notifier(&table->fib_nb);
+#endif
+		table->fib_nb_registered = false;
+	}
+
+	cancel_work_sync(&table->flush_work);
+
+	ovpn_route_trie_free(&table->root4);
+	ovpn_route_trie_free(&table->root6);
+}
@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+#ifndef _NET_OVPN_DCO_ROUTE_H_
+#define _NET_OVPN_DCO_ROUTE_H_
+
+#include <linux/atomic.h>
+#include <linux/list.h>
+#include <linux/notifier.h>
+#include <linux/rcupdate.h>
+#include <linux/socket.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+struct net;
+struct ovpn_peer;
+
+/* node of the longest-prefix-match trie of one address family.
+ *
+ * The trie is path-compressed: children extend the prefix of their parent by at
+ * least one bit, selected by the bit right after the parent prefix. Nodes without
+ * a peer are glue nodes joining two diverging prefixes.
+ */
+struct ovpn_route_node {
+	struct ovpn_route_node __rcu *child[2];
+	/* only accessed by writers */
+	struct ovpn_route_node *parent;
+	struct ovpn_peer __rcu *peer;
+
+	/* entry learned from a FIB lookup, valid as long as gen is current */
+	bool cached;
+	u32 gen;
+
+	u8 cidr;
+	/* prefix in network byte order, bits after cidr are zero */
+	u8 key[16] __aligned(4);
+
+	/* entries pointing to the same peer */
+	struct list_head peer_list;
+	/* cached entries, linked in ovpn_route_table.cache */
+	struct list_head cache_list;
+
+	struct rcu_head rcu;
+};
+
+/* Map of VPN prefixes (i.e. iroutes) to peers, looked up in place of the FIB.
+ *
+ * Routes are configured via netlink. Destinations not covered by any route are
+ * resolved through the FIB once and cached as host entries, which are invalidated
+ * all at once upon any FIB change.
+ */
+struct ovpn_route_table {
+	struct ovpn_route_node __rcu *root4;
+	struct ovpn_route_node __rcu *root6;
+
+	/* bumped by FIB notifications, stale cached entries are ignored */
+	atomic_t fib_gen;
+	struct list_head cache;
+	unsigned int cache_len;
+
+	/* protects writes to the tries */
+	spinlock_t lock;
+
+	struct net *net;
+	struct notifier_block fib_nb;
+	bool fib_nb_registered;
+	/* reaps stale cached entries */
+	struct work_struct flush_work;
+};
+
+void ovpn_route_table_init(struct ovpn_route_table *table);
+int ovpn_route_table_start(struct ovpn_route_table *table, struct net *net);
+void ovpn_route_table_release(struct ovpn_route_table *table);
+
+int ovpn_route_add(struct ovpn_route_table *table, struct ovpn_peer *peer, sa_family_t family,
+		   const void *addr, u8 cidr);
+void ovpn_route_add_peers(struct ovpn_route_table *table, struct ovpn_peer **peers,
+			  const int *errs, unsigned int n);
+int ovpn_route_del(struct ovpn_route_table *table, sa_family_t family, const void *addr,
+		   u8 cidr);
+void ovpn_route_del_peer(struct ovpn_route_table *table, struct ovpn_peer *peer);
+void ovpn_route_del_peers(struct ovpn_route_table *table, struct ovpn_peer **peers,
+			  const int *errs, unsigned int n);
+
+struct ovpn_peer *ovpn_route_lookup(struct ovpn_route_table *table, sa_family_t family,
+				    const void *addr);
+void ovpn_route_cache(struct ovpn_route_table *table, struct ovpn_peer *peer,
+		      sa_family_t family, const void *addr, u32 gen);
+
+/* FIB generation to pass to ovpn_route_cache(), read before consulting the FIB */
+static inline u32 ovpn_route_fib_gen(const struct ovpn_route_table *table)
+{
+	return atomic_read(&table->fib_gen);
+}
+
+#endif /* _NET_OVPN_DCO_ROUTE_H_ */
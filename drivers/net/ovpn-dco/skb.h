@@ -19,15 +19,43 @@
 
 #define OVPN_SKB_CB(skb) ((struct ovpn_skb_cb *)&((skb)->cb))
 
-struct ovpn_skb_cb {
-	/* original recv packet size for stats accounting */
-	unsigned int rx_stats_size;
+struct ovpn_peer;
+struct ovpn_crypto_key_slot;
+
+/* progress of a packet through the crypto layer in parallel mode */
+enum ovpn_skb_state {
+	OVPN_SKB_STATE_PENDING = 0,
+	OVPN_SKB_STATE_DONE,
+	OVPN_SKB_STATE_DEAD,
+};
 
+struct ovpn_skb_cb {
+	/* peer and key slot the packet is being processed for. Both hold a
+	 * reference that is released once the crypto operation has completed
+	 */
+	struct ovpn_peer *peer;
+	struct ovpn_crypto_key_slot *ks;
+	/* IV, aead_request and scatterlist of an in-flight crypto operation */
+	void *crypto_tmp;
 	union {
-		struct in_addr ipv4;
-		struct in6_addr ipv6;
-	} local;
-	sa_family_t sa_fam;
+		/* original recv packet size for stats accounting */
+		unsigned int rx_stats_size;
+		/* packet ID reserved along with ks before encryption, or 0 */
+		u32 tx_pktid;
+	};
+	/* offset of the encapsulated packet after decryption */
+	unsigned int payload_offset;
+	/* ns timestamp of the start of the current data path stage, or 0 if
+	 * latency stats were disabled when the packet entered the data path
+	 */
+	u64 tstamp;
+	/* bytes and device TX queue accounted to BQL while in the peer TX ring */
+	unsigned int tx_len;
+	u16 tx_queue;
+	/* enum ovpn_skb_state, accessed with acquire/release semantics */
+	u8 state;
+	/* left to the lower device for encryption with the offload of ks */
+	bool offload;
 };
 
 /* Return IP protocol version from skb header.
@@ -60,18 +60,19 @@ static struct ovpn_socket *ovpn_socket_get(struct socket *sock)
 	return ovpn_sock;
 }
 
-/* Finalize release of socket, called after RCU grace period */
-static int ovpn_socket_attach(struct socket *sock, struct ovpn_peer *peer)
+/* Attach the socket to the interface or, for TCP, to its unique peer */
+static int ovpn_socket_attach(struct socket *sock, struct ovpn_struct *ovpn,
+			      struct ovpn_peer *peer)
 {
 	int ret = -EOPNOTSUPP;
 
-	if (!sock || !peer)
+	if (!sock)
 		return -EINVAL;
 
 	if (sock->sk->sk_protocol == IPPROTO_UDP)
-		ret = ovpn_udp_socket_attach(sock, peer->ovpn);
+		ret = ovpn_udp_socket_attach(sock, ovpn);
 	else if (sock->sk->sk_protocol == IPPROTO_TCP)
-		ret = ovpn_tcp_socket_attach(sock, peer);
+		ret = peer ? ovpn_tcp_socket_attach(sock, peer) : -EINVAL;
 
 	return ret;
 }
@@ -96,12 +97,13 @@ struct ovpn_struct *ovpn_from_udp_sock(struct sock *sk)
 	return ovpn_sock->ovpn;
 }
 
-struct ovpn_socket *ovpn_socket_new(struct socket *sock, struct ovpn_peer *peer)
+static struct ovpn_socket *__ovpn_socket_new(struct socket *sock, struct ovpn_struct *ovpn,
+					      struct ovpn_peer *peer)
 {
 	struct ovpn_socket *ovpn_sock;
 	int ret;
 
-	ret = ovpn_socket_attach(sock, peer);
+	ret = ovpn_socket_attach(sock, ovpn, peer);
 	if (ret < 0 && ret != -EALREADY)
 		return ERR_PTR(ret);
 
@@ -112,6 +114,9 @@ struct ovpn_socket *ovpn_socket_new(struct socket *sock, struct ovpn_peer *peer)
 		 * already owned.
 		 */
 		ovpn_sock = ovpn_socket_get(sock);
+		if (!ovpn_sock)
+			return ERR_PTR(-ENOTSOCK);
+
 		sockfd_put(sock);
 		return ovpn_sock;
 	}
@@ -120,7 +125,7 @@ struct ovpn_socket *ovpn_socket_new(struct socket *sock, struct ovpn_peer *peer)
 	if (!ovpn_sock)
 		return ERR_PTR(-ENOMEM);
 
-	ovpn_sock->ovpn = peer->ovpn;
+	ovpn_sock->ovpn = ovpn;
 	ovpn_sock->sock = sock;
 	kref_init(&ovpn_sock->refcount);
 
@@ -132,3 +137,17 @@ struct ovpn_socket *ovpn_socket_new(struct socket *sock, struct ovpn_peer *peer)
 
 	return ovpn_sock;
 }
+
+struct ovpn_socket *ovpn_socket_new(struct socket *sock, struct ovpn_peer *peer)
+{
+	if (!peer)
+		return ERR_PTR(-EINVAL);
+
+	return __ovpn_socket_new(sock, peer->ovpn, peer);
+}
+
+/* Attach a UDP socket to the interface without binding it to any peer */
+struct ovpn_socket *ovpn_socket_new_udp(struct socket *sock, struct ovpn_struct *ovpn)
+{
+	return __ovpn_socket_new(sock, ovpn, NULL);
+}
@@ -33,6 +33,9 @@ struct ovpn_socket {
 	/** @sock: the kernel socket */
 	struct socket *sock;
 
+	/** @shard: member of the reuseport group of the interface (UDP only) */
+	bool shard;
+
 	/** @refcount: amount of contexts currently referencing this object */
 	struct kref refcount;
 
@@ -50,5 +53,6 @@ static inline void ovpn_socket_put(struct ovpn_socket *sock)
 }
 
 struct ovpn_socket *ovpn_socket_new(struct socket *sock, struct ovpn_peer *peer);
+struct ovpn_socket *ovpn_socket_new_udp(struct socket *sock, struct ovpn_struct *ovpn);
 
 #endif /* _NET_OVPN_DCO_SOCK_H_ */
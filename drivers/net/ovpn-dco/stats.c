@@ -10,11 +10,120 @@
 #include "main.h"
 #include "stats.h"
 
-void ovpn_peer_stats_init(struct ovpn_peer_stats *ps)
+static void ovpn_batch_hist_init(struct ovpn_batch_hist *hist)
 {
-	atomic64_set(&ps->rx.bytes, 0);
-	atomic_set(&ps->rx.packets, 0);
+	int i;
 
-	atomic64_set(&ps->tx.bytes, 0);
-	atomic_set(&ps->tx.packets, 0);
+	for (i = 0; i < OVPN_BATCH_HIST_BUCKETS; i++)
+		atomic64_set(&hist->buckets[i], 0);
+}
+
+int ovpn_peer_stats_init(struct ovpn_peer_stats *ps)
+{
+	struct ovpn_peer_pcpu_stats *pcpu;
+	int cpu;
+
+	ps->pcpu = alloc_percpu(struct ovpn_peer_pcpu_stats);
+	if (!ps->pcpu)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		pcpu = per_cpu_ptr(ps->pcpu, cpu);
+		u64_stats_init(&pcpu->syncp);
+	}
+
+	ovpn_batch_hist_init(&ps->rx_batch);
+	ovpn_batch_hist_init(&ps->tx_batch);
+
+	return 0;
+}
+
+/* Allocate the latency histograms of a peer, unless they already exist. May race
+ * with itself, when latency stats are enabled while the peer is being added
+ */
+int ovpn_peer_stats_latency_init(struct ovpn_peer_stats *ps, gfp_t gfp)
+{
+	struct ovpn_peer_pcpu_latency __percpu *latency;
+
+	if (READ_ONCE(ps->latency))
+		return 0;
+
+	latency = alloc_percpu_gfp(struct ovpn_peer_pcpu_latency, gfp);
+	if (!latency)
+		return -ENOMEM;
+
+	if (cmpxchg(&ps->latency, NULL, latency))
+		free_percpu(latency);
+
+	return 0;
+}
+
+void ovpn_peer_stats_free(struct ovpn_peer_stats *ps)
+{
+	free_percpu(ps->latency);
+	ps->latency = NULL;
+	free_percpu(ps->pcpu);
+	ps->pcpu = NULL;
+}
+
+/* Sum up the per-CPU counters of a peer. Each CPU is read consistently, while
+ * the total is only a snapshot as writers keep going on the other CPUs
+ */
+void ovpn_peer_stats_sum(const struct ovpn_peer_stats *ps, struct ovpn_peer_stats_sum *sum)
+{
+	const struct ovpn_peer_pcpu_latency __percpu *pcpu_latency = READ_ONCE(ps->latency);
+	const struct ovpn_peer_pcpu_latency *lat = NULL;
+	const struct ovpn_peer_pcpu_stats *pcpu;
+	u64 latency[__OVPN_STAGE_MAX][OVPN_LATENCY_HIST_BUCKETS];
+	u64 drops[__OVPN_DROP_REASON_MAX];
+	u64 rx_bytes, rx_packets;
+	u64 tx_bytes, tx_packets;
+	u64 tcp_sendmsg_calls, tcp_sendmsg_bytes;
+	u64 crypto_alloc_fallback, tx_headroom_realloc;
+	u64 pool_hits, pool_misses;
+	unsigned int start;
+	int cpu, i, j;
+
+	memset(sum, 0, sizeof(*sum));
+
+	for_each_possible_cpu(cpu) {
+		pcpu = per_cpu_ptr(ps->pcpu, cpu);
+		if (pcpu_latency)
+			lat = per_cpu_ptr(pcpu_latency, cpu);
+
+		do {
+			start = u64_stats_fetch_begin(&pcpu->syncp);
+			rx_bytes = u64_stats_read(&pcpu->rx.bytes);
+			rx_packets = u64_stats_read(&pcpu->rx.packets);
+			tx_bytes = u64_stats_read(&pcpu->tx.bytes);
+			tx_packets = u64_stats_read(&pcpu->tx.packets);
+			for (i = 0; i < __OVPN_DROP_REASON_MAX; i++)
+				drops[i] = u64_stats_read(&pcpu->drops[i]);
+			crypto_alloc_fallback = u64_stats_read(&pcpu->crypto_alloc_fallback);
+			tx_headroom_realloc = u64_stats_read(&pcpu->tx_headroom_realloc);
+			pool_hits = u64_stats_read(&pcpu->pool_hits);
+			pool_misses = u64_stats_read(&pcpu->pool_misses);
+			tcp_sendmsg_calls = u64_stats_read(&pcpu->tcp_sendmsg_calls);
+			tcp_sendmsg_bytes = u64_stats_read(&pcpu->tcp_sendmsg_bytes);
+			for (i = 0; lat && i < __OVPN_STAGE_MAX; i++)
+				for (j = 0; j < OVPN_LATENCY_HIST_BUCKETS; j++)
+					latency[i][j] = u64_stats_read(&lat->hist[i][j]);
+		} while (u64_stats_fetch_retry(&pcpu->syncp, start));
+
+		sum->rx_bytes += rx_bytes;
+		sum->rx_packets += rx_packets;
+		sum->tx_bytes += tx_bytes;
+		sum->tx_packets += tx_packets;
+		for (i = 0; i < __OVPN_DROP_REASON_MAX; i++)
+			sum->drops[i] += drops[i];
+		sum->crypto_alloc_fallback += crypto_alloc_fallback;
+		sum->tx_headroom_realloc += tx_headroom_realloc;
+		sum->pool_hits += pool_hits;
+		sum->pool_misses += pool_misses;
+		sum->tcp_sendmsg_calls += tcp_sendmsg_calls;
+		sum->tcp_sendmsg_bytes += tcp_sendmsg_bytes;
+		for (i = 0; lat && i < __OVPN_STAGE_MAX; i++)
+			for (j = 0; j < OVPN_LATENCY_HIST_BUCKETS; j++)
+				sum->latency[i][j] += latency[i][j];
+	}
 }
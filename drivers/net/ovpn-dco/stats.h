@@ -13,21 +13,125 @@
 
 #include <linux/atomic.h>
 #include <linux/jiffies.h>
+#include <linux/log2.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
 
 struct ovpn_struct;
 
 /* per-peer stats, measured on transport layer */
 
+/* reasons for dropping a data channel packet, accounted per peer */
+enum ovpn_drop_reason {
+	/* no key slot matching the received key ID */
+	OVPN_DROP_NO_KEY = 0,
+	/* authentication failure or malformed packet */
+	OVPN_DROP_DECRYPT,
+	/* packet ID rejected by the replay window */
+	OVPN_DROP_REPLAY,
+	/* inner source address not routed to the sending peer */
+	OVPN_DROP_RPF,
+	/* packet did not fit a peer ring */
+	OVPN_DROP_RING_FULL,
+
+	__OVPN_DROP_REASON_MAX,
+};
+
+/* stages of the data path whose latency is accounted per peer, if enabled with
+ * IFLA_OVPN_LATENCY_STATS. Same order as enum ovpn_netlink_latency_attrs
+ */
+enum ovpn_stage {
+	OVPN_STAGE_TX_QUEUE = 0,
+	OVPN_STAGE_TX_CRYPTO,
+	OVPN_STAGE_TX_SEND,
+	OVPN_STAGE_RX_QUEUE,
+	OVPN_STAGE_RX_CRYPTO,
+	OVPN_STAGE_RX_DELIVER,
+
+	__OVPN_STAGE_MAX,
+};
+
+/* time spent in a stage: bucket 0 counts packets below 1us, bucket N packets in
+ * [4^(N-1), 4^N) us, with the last bucket collecting anything larger
+ */
+#define OVPN_LATENCY_HIST_BUCKETS 8
+
 /* one stat */
 struct ovpn_peer_stat {
-	atomic64_t bytes;
-	atomic_t packets;
+	u64_stats_t bytes;
+	u64_stats_t packets;
 };
 
-/* rx and tx stats, enabled by notify_per != 0 or period != 0 */
-struct ovpn_peer_stats {
+/* per-CPU counters of a peer, written without any shared cacheline and summed up
+ * only when reported to userspace
+ */
+struct ovpn_peer_pcpu_stats {
 	struct ovpn_peer_stat rx;
 	struct ovpn_peer_stat tx;
+
+	u64_stats_t drops[__OVPN_DROP_REASON_MAX];
+
+	/* crypto scratch areas allocated on the fly as the per-CPU one was in use */
+	u64_stats_t crypto_alloc_fallback;
+
+	/* packets whose head had to be reallocated to fit the encapsulation */
+	u64_stats_t tx_headroom_realloc;
+
+	/* skbs allocated by us, drawn from the page pool or not */
+	u64_stats_t pool_hits;
+	u64_stats_t pool_misses;
+
+	/* sendmsg() calls on the TCP transport socket and bytes they pushed */
+	u64_stats_t tcp_sendmsg_calls;
+	u64_stats_t tcp_sendmsg_bytes;
+
+	struct u64_stats_sync syncp;
+};
+
+/* per-CPU latency histograms of a peer, written under the syncp of the
+ * per-CPU counters of the same CPU
+ */
+struct ovpn_peer_pcpu_latency {
+	u64_stats_t hist[__OVPN_STAGE_MAX][OVPN_LATENCY_HIST_BUCKETS];
+};
+
+/* number of packets processed per batch: bucket N counts batches of [2^N, 2^(N+1))
+ * packets, with the last bucket collecting anything larger
+ */
+#define OVPN_BATCH_HIST_BUCKETS 7
+
+struct ovpn_batch_hist {
+	atomic64_t buckets[OVPN_BATCH_HIST_BUCKETS];
+};
+
+/* rx and tx stats, enabled by notify_per != 0 or period != 0 */
+struct ovpn_peer_stats {
+	struct ovpn_peer_pcpu_stats __percpu *pcpu;
+
+	/* allocated once latency stats are enabled on the interface, NULL till then */
+	struct ovpn_peer_pcpu_latency __percpu *latency;
+
+	/* batches processed by the crypto workers, updated once per batch */
+	struct ovpn_batch_hist rx_batch;
+	struct ovpn_batch_hist tx_batch;
+};
+
+/* sum of the per-CPU counters of a peer */
+struct ovpn_peer_stats_sum {
+	u64 rx_bytes;
+	u64 rx_packets;
+	u64 tx_bytes;
+	u64 tx_packets;
+	u64 drops[__OVPN_DROP_REASON_MAX];
+	u64 crypto_alloc_fallback;
+	u64 tx_headroom_realloc;
+	u64 pool_hits;
+	u64 pool_misses;
+	u64 tcp_sendmsg_calls;
+	u64 tcp_sendmsg_bytes;
+	u64 latency[__OVPN_STAGE_MAX][OVPN_LATENCY_HIST_BUCKETS];
 };
 
 /* struct for OVPN_ERR_STATS */
@@ -46,22 +150,153 @@ struct ovpn_err_stats {
 	struct ovpn_err_stat stats[];
 };
 
-void ovpn_peer_stats_init(struct ovpn_peer_stats *ps);
+int ovpn_peer_stats_init(struct ovpn_peer_stats *ps);
+int ovpn_peer_stats_latency_init(struct ovpn_peer_stats *ps, gfp_t gfp);
+void ovpn_peer_stats_free(struct ovpn_peer_stats *ps);
+void ovpn_peer_stats_sum(const struct ovpn_peer_stats *ps, struct ovpn_peer_stats_sum *sum);
+
+/* Counters may be updated both from process context (crypto workers) and from
+ * softirq context (inline crypto, crypto completion callbacks): pin the CPU and
+ * make the update irq-safe. Both are no-ops besides preemption on 64bit hosts.
+ */
+static inline struct ovpn_peer_pcpu_stats *ovpn_peer_stats_begin(struct ovpn_peer_stats *ps,
+								 unsigned long *flags)
+{
+	struct ovpn_peer_pcpu_stats *pcpu = get_cpu_ptr(ps->pcpu);
+
+	*flags = u64_stats_update_begin_irqsave(&pcpu->syncp);
+	return pcpu;
+}
+
+static inline void ovpn_peer_stats_end(struct ovpn_peer_stats *ps,
+				       struct ovpn_peer_pcpu_stats *pcpu, unsigned long flags)
+{
+	u64_stats_update_end_irqrestore(&pcpu->syncp, flags);
+	put_cpu_ptr(ps->pcpu);
+}
 
-static inline void ovpn_peer_stats_increment(struct ovpn_peer_stat *stat, const unsigned int n)
+static inline void ovpn_peer_stats_add(struct ovpn_peer_stat *stat, const unsigned int n,
+				       const unsigned int packets)
 {
-	atomic64_add(n, &stat->bytes);
-	atomic_inc(&stat->packets);
+	u64_stats_add(&stat->bytes, n);
+	u64_stats_add(&stat->packets, packets);
+}
+
+static inline void ovpn_peer_stats_add_rx(struct ovpn_peer_stats *stats, const unsigned int n,
+					  const unsigned int packets)
+{
+	struct ovpn_peer_pcpu_stats *pcpu;
+	unsigned long flags;
+
+	pcpu = ovpn_peer_stats_begin(stats, &flags);
+	ovpn_peer_stats_add(&pcpu->rx, n, packets);
+	ovpn_peer_stats_end(stats, pcpu, flags);
+}
+
+static inline void ovpn_peer_stats_add_tx(struct ovpn_peer_stats *stats, const unsigned int n,
+					  const unsigned int packets)
+{
+	struct ovpn_peer_pcpu_stats *pcpu;
+	unsigned long flags;
+
+	pcpu = ovpn_peer_stats_begin(stats, &flags);
+	ovpn_peer_stats_add(&pcpu->tx, n, packets);
+	ovpn_peer_stats_end(stats, pcpu, flags);
 }
 
 static inline void ovpn_peer_stats_increment_rx(struct ovpn_peer_stats *stats, const unsigned int n)
 {
-	ovpn_peer_stats_increment(&stats->rx, n);
+	ovpn_peer_stats_add_rx(stats, n, 1);
 }
 
 static inline void ovpn_peer_stats_increment_tx(struct ovpn_peer_stats *stats, const unsigned int n)
 {
-	ovpn_peer_stats_increment(&stats->tx, n);
+	ovpn_peer_stats_add_tx(stats, n, 1);
+}
+
+static inline void ovpn_peer_stats_add_drops(struct ovpn_peer_stats *stats,
+					     enum ovpn_drop_reason reason, const unsigned int n)
+{
+	struct ovpn_peer_pcpu_stats *pcpu;
+	unsigned long flags;
+
+	pcpu = ovpn_peer_stats_begin(stats, &flags);
+	u64_stats_add(&pcpu->drops[reason], n);
+	ovpn_peer_stats_end(stats, pcpu, flags);
+}
+
+static inline void ovpn_peer_stats_increment_drop(struct ovpn_peer_stats *stats,
+						  enum ovpn_drop_reason reason)
+{
+	ovpn_peer_stats_add_drops(stats, reason, 1);
+}
+
+static inline void ovpn_batch_hist_add(struct ovpn_batch_hist *hist, const unsigned int packets)
+{
+	atomic64_inc(&hist->buckets[min_t(unsigned int, ilog2(packets),
+					  OVPN_BATCH_HIST_BUCKETS - 1)]);
+}
+
+static inline void ovpn_peer_stats_increment_crypto_fallback(struct ovpn_peer_stats *stats)
+{
+	struct ovpn_peer_pcpu_stats *pcpu;
+	unsigned long flags;
+
+	pcpu = ovpn_peer_stats_begin(stats, &flags);
+	u64_stats_inc(&pcpu->crypto_alloc_fallback);
+	ovpn_peer_stats_end(stats, pcpu, flags);
+}
+
+static inline void ovpn_peer_stats_increment_headroom_realloc(struct ovpn_peer_stats *stats)
+{
+	struct ovpn_peer_pcpu_stats *pcpu;
+	unsigned long flags;
+
+	pcpu = ovpn_peer_stats_begin(stats, &flags);
+	u64_stats_inc(&pcpu->tx_headroom_realloc);
+	ovpn_peer_stats_end(stats, pcpu, flags);
+}
+
+static inline void ovpn_peer_stats_increment_pool(struct ovpn_peer_stats *stats, bool hit)
+{
+	struct ovpn_peer_pcpu_stats *pcpu;
+	unsigned long flags;
+
+	pcpu = ovpn_peer_stats_begin(stats, &flags);
+	u64_stats_inc(hit ? &pcpu->pool_hits : &pcpu->pool_misses);
+	ovpn_peer_stats_end(stats, pcpu, flags);
+}
+
+static inline void ovpn_peer_stats_add_tcp_sendmsg(struct ovpn_peer_stats *stats,
+						   const unsigned int n)
+{
+	struct ovpn_peer_pcpu_stats *pcpu;
+	unsigned long flags;
+
+	pcpu = ovpn_peer_stats_begin(stats, &flags);
+	u64_stats_inc(&pcpu->tcp_sendmsg_calls);
+	u64_stats_add(&pcpu->tcp_sendmsg_bytes, n);
+	ovpn_peer_stats_end(stats, pcpu, flags);
+}
+
+static inline void ovpn_peer_stats_add_latency(struct ovpn_peer_stats *stats,
+					       enum ovpn_stage stage, const u64 ns)
+{
+	struct ovpn_peer_pcpu_latency __percpu *latency = READ_ONCE(stats->latency);
+	const u64 us = div_u64(ns, NSEC_PER_USEC);
+	struct ovpn_peer_pcpu_stats *pcpu;
+	unsigned int bucket = 0;
+	unsigned long flags;
+
+	if (unlikely(!latency))
+		return;
+
+	if (us)
+		bucket = min_t(unsigned int, ilog2(us) / 2 + 1, OVPN_LATENCY_HIST_BUCKETS - 1);
+
+	pcpu = ovpn_peer_stats_begin(stats, &flags);
+	u64_stats_inc(&this_cpu_ptr(latency)->hist[stage][bucket]);
+	ovpn_peer_stats_end(stats, pcpu, flags);
 }
 
 #endif /* _NET_OVPN_DCO_OVPNSTATS_H_ */
@@ -10,12 +10,20 @@
 #include "ovpnstruct.h"
 #include "ovpn.h"
 #include "peer.h"
+#include "proto.h"
 #include "skb.h"
 #include "tcp.h"
 
+#include <linux/bvec.h>
 #include <linux/ptr_ring.h>
 #include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <linux/uio.h>
 #include <net/route.h>
+#include <net/strparser.h>
+
+/* max number of page fragments handed to the TCP socket by a single sendmsg() */
+#define OVPN_TCP_TX_BVECS 64
 
 static void ovpn_tcp_state_change(struct sock *sk)
 {
@@ -44,7 +52,10 @@ static void ovpn_tcp_data_ready(struct sock *sk)
 	if (!sock || !sock->peer)
 		return;
 
-	queue_work(sock->peer->ovpn->events_wq, &sock->peer->tcp.rx_work);
+	/* records are framed right from the socket receive queue, in softirq context
+	 * unless the socket is owned by a user
+	 */
+	strp_data_ready(&sock->peer->tcp.strp);
 }
 
 static void ovpn_tcp_write_space(struct sock *sk)
@@ -95,166 +106,312 @@ void ovpn_tcp_socket_detach(struct socket *sock)
 	 * re-armed
 	 */
 	cancel_work_sync(&peer->tcp.tx_work);
-	cancel_work_sync(&peer->tcp.rx_work);
+	__skb_queue_purge(&peer->tcp.tx_queue);
+	kfree(peer->tcp.tx_bvec);
+	strp_stop(&peer->tcp.strp);
+	strp_done(&peer->tcp.strp);
+	/* records are flushed once the socket is drained, but the parser may have stopped
+	 * before getting there
+	 */
+	kfree_skb_list(peer->tcp.rx_list);
+	peer->tcp.rx_list = NULL;
 
 	ptr_ring_cleanup(&peer->tcp.tx_ring, ovpn_destroy_skb);
 }
 
-/* Try to send one skb (or part of it) over the TCP stream.
+/* Append len bytes starting at offset off of page to the bvec array, split at page
+ * boundaries, and account them in size. Whatever does not fit the array is left out.
  *
- * Return 0 on success or a negative error code otherwise.
+ * Return the number of entries now used in the array.
+ */
+static unsigned int ovpn_tcp_bvec_add(struct bio_vec *bvec, unsigned int n, struct page *page,
+				      unsigned int off, unsigned int len, size_t *size)
+{
+	unsigned int chunk;
+
+	page = nth_page(page, off >> PAGE_SHIFT);
+	off = offset_in_page(off);
+
+	while (len && n < OVPN_TCP_TX_BVECS) {
+		chunk = min_t(unsigned int, len, PAGE_SIZE - off);
+
+		bvec[n].bv_page = page;
+		bvec[n].bv_offset = off;
+		bvec[n].bv_len = chunk;
+		n++;
+
+		*size += chunk;
+		len -= chunk;
+		off = 0;
+		page = nth_page(page, 1);
+	}
+
+	return n;
+}
+
+/* Describe the data of skb past its first skip bytes with bvec entries, without copying
+ * or linearizing. skb must not have a frag_list.
  *
- * Note that the skb is modified by putting away the data being sent, therefore
- * the caller should check if skb->len is zero to understand if the full skb was
- * sent or not.
+ * Return the number of entries now used in the array.
  */
-static int ovpn_tcp_send_one(struct ovpn_peer *peer, struct sk_buff *skb)
+static unsigned int ovpn_tcp_skb_to_bvec(const struct sk_buff *skb, unsigned int skip,
+					 struct bio_vec *bvec, unsigned int n, size_t *size)
 {
-	struct msghdr msg = { .msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL };
-	struct kvec iv = { 0 };
-	int ret;
+	unsigned int len = skb_headlen(skb);
+	const skb_frag_t *frag;
+	int i;
+
+	if (skip < len)
+		n = ovpn_tcp_bvec_add(bvec, n, virt_to_page(skb->data + skip),
+				      offset_in_page(skb->data + skip), len - skip, size);
+	skip = skip > len ? skip - len : 0;
+
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
+		frag = &skb_shinfo(skb)->frags[i];
+		len = skb_frag_size(frag);
+
+		if (skip >= len) {
+			skip -= len;
+			continue;
+		}
 
-	if (skb_linearize(skb) < 0) {
-		net_err_ratelimited("%s: can't linearize packet\n", __func__);
-		return -ENOMEM;
+		n = ovpn_tcp_bvec_add(bvec, n, skb_frag_page(frag), skb_frag_off(frag) + skip,
+				      len - skip, size);
+		skip = 0;
 	}
 
-	/* initialize iv structure now as skb_linearize() may have changed skb->data */
-	iv.iov_base = skb->data;
-	iv.iov_len = skb->len;
+	return n;
+}
 
-	ret = kernel_sendmsg(peer->sock->sock, &msg, &iv, 1, iv.iov_len);
-	if (ret > 0) {
-		__skb_pull(skb, ret);
+/* Move skbs from the TX ring to the list of packets being sent */
+static void ovpn_tcp_tx_refill(struct ovpn_peer *peer)
+{
+	struct sk_buff *skb;
 
-		/* since we update per-cpu stats in process context,
-		 * we need to disable softirqs
-		 */
-		local_bh_disable();
-		dev_sw_netstats_tx_add(peer->ovpn->dev, 1, ret);
-		local_bh_enable();
+	/* each packet takes at least one bvec entry: do not pull more than can be sent */
+	while (skb_queue_len(&peer->tcp.tx_queue) < OVPN_TCP_TX_BVECS &&
+	       (skb = __ptr_ring_consume(&peer->tcp.tx_ring))) {
+		/* frag_lists are not expected from the encryption path, flatten them if any */
+		if (unlikely(skb_has_frag_list(skb) && skb_linearize(skb) < 0)) {
+			net_err_ratelimited("%s: can't linearize packet\n", __func__);
+			kfree_skb(skb);
+			continue;
+		}
 
-		return 0;
+		__skb_queue_tail(&peer->tcp.tx_queue, skb);
 	}
+}
 
-	return ret;
+/* Release the packets entirely sent to the stream, remembering how much of the first
+ * one still in the list went out already
+ */
+static void ovpn_tcp_tx_complete(struct ovpn_peer *peer, size_t sent)
+{
+	unsigned int packets = 0, bytes = 0;
+	struct sk_buff *skb;
+	size_t left;
+
+	while (sent && (skb = skb_peek(&peer->tcp.tx_queue))) {
+		left = skb->len - peer->tcp.tx_offset;
+		if (sent < left) {
+			peer->tcp.tx_offset += sent;
+			break;
+		}
+
+		sent -= left;
+		peer->tcp.tx_offset = 0;
+
+		packets++;
+		bytes += skb->len;
+		__skb_unlink(skb, &peer->tcp.tx_queue);
+		consume_skb(skb);
+	}
+
+	if (!packets)
+		return;
+
+	/* since we update per-cpu stats in process context,
+	 * we need to disable softirqs
+	 */
+	local_bh_disable();
+	dev_sw_netstats_tx_add(peer->ovpn->dev, packets, bytes);
+	local_bh_enable();
 }
 
-/* Process packets in TCP TX queue */
+/* Process packets in TCP TX queue.
+ *
+ * Packets are gathered from the ring and handed to TCP as one bvec array per
+ * sendmsg(), referencing their head and page fragments directly. A packet sent only
+ * partially stays at the head of tx_queue, with tx_offset telling where to resume.
+ */
 static void ovpn_tcp_tx_work(struct work_struct *work)
 {
+	struct msghdr msg = { .msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL };
 	struct ovpn_peer *peer;
 	struct sk_buff *skb;
+	unsigned int n, skip;
+	size_t size;
 	int ret;
 
 	peer = container_of(work, struct ovpn_peer, tcp.tx_work);
-	while ((skb = __ptr_ring_peek(&peer->tcp.tx_ring))) {
-		ret = ovpn_tcp_send_one(peer, skb);
-		if (ret < 0 && ret != -EAGAIN) {
+	while (true) {
+		ovpn_tcp_tx_refill(peer);
+		if (skb_queue_empty(&peer->tcp.tx_queue))
+			break;
+
+		n = 0;
+		size = 0;
+		skip = peer->tcp.tx_offset;
+		skb_queue_walk(&peer->tcp.tx_queue, skb) {
+			n = ovpn_tcp_skb_to_bvec(skb, skip, peer->tcp.tx_bvec, n, &size);
+			if (n == OVPN_TCP_TX_BVECS)
+				break;
+			skip = 0;
+		}
+
+		iov_iter_bvec(&msg.msg_iter, ITER_SOURCE, peer->tcp.tx_bvec, n, size);
+		ret = sock_sendmsg(peer->sock->sock, &msg);
+		/* socket buffer full: sk_write_space will reschedule this work */
+		if (ret == -EAGAIN)
+			break;
+
+		if (ret < 0) {
 			net_warn_ratelimited("%s: cannot send TCP packet to peer %u: %d\n", __func__,
 					    peer->id, ret);
 			/* in case of TCP error stop sending loop and delete peer */
 			ovpn_peer_del(peer, OVPN_DEL_PEER_REASON_TRANSPORT_ERROR);
 			break;
-		} else if (!skb->len) {
-			/* skb was entirely consumed and can now be removed from the ring */
-			__ptr_ring_discard_one(&peer->tcp.tx_ring);
-			consume_skb(skb);
 		}
 
+		ovpn_peer_stats_add_tcp_sendmsg(&peer->stats, ret);
+		ovpn_tcp_tx_complete(peer, ret);
+
 		/* give a chance to be rescheduled if needed */
 		cond_resched();
 	}
 }
 
-static int ovpn_tcp_rx_one(struct ovpn_peer *peer)
+/* Return the size of the record starting at the current stream offset, including the
+ * 2 bytes prefix, 0 if more data is needed to know it or a negative error code to abort
+ * reading from the stream
+ */
+static int ovpn_tcp_parse(struct strparser *strp, struct sk_buff *skb)
+{
+	struct strp_msg *rxm = strp_msg(skb);
+	__be16 blen;
+	u16 len;
+	int err;
+
+	if (skb->len < rxm->offset + sizeof(blen))
+		return 0;
+
+	err = skb_copy_bits(skb, rxm->offset, &blen, sizeof(blen));
+	if (err < 0)
+		return err;
+
+	len = ntohs(blen);
+	/* invalid packet length: this is a fatal TCP error */
+	if (!len) {
+		net_err_ratelimited("%s: received invalid packet length\n", __func__);
+		return -EINVAL;
+	}
+
+	return len + sizeof(blen);
+}
+
+/* Hand the pending DATA_V2 records over to the datapath in a single batch */
+static void ovpn_tcp_rx_flush(struct ovpn_peer *peer)
 {
-	struct msghdr msg = { .msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL };
-	struct ovpn_skb_cb *cb;
-	int status, ret;
+	struct sk_buff *list = peer->tcp.rx_list;
 
-	/* no skb allocated means that we have to read (or finish reading) the 2 bytes prefix
-	 * containing the actual packet size.
-	 */
-	if (!peer->tcp.skb) {
-		struct kvec iv = {
-			.iov_base = peer->tcp.raw_len + peer->tcp.offset,
-			.iov_len = sizeof(u16) - peer->tcp.offset,
-		};
-
-		ret = kernel_recvmsg(peer->sock->sock, &msg, &iv, 1, iv.iov_len, msg.msg_flags);
-		if (ret <= 0)
-			return ret;
-
-		peer->tcp.offset += ret;
-		/* the entire packet size was read, prepare skb for reading data */
-		if (peer->tcp.offset == sizeof(u16)) {
-			u16 len = ntohs(*(__be16 *)peer->tcp.raw_len);
-			/* invalid packet length: this is a fatal TCP error */
-			if (!len) {
-				netdev_err(peer->ovpn->dev, "%s: received invalid packet length\n",
-					   __func__);
-				return -EINVAL;
-			}
-
-			peer->tcp.skb = netdev_alloc_skb_ip_align(peer->ovpn->dev, len);
-			peer->tcp.offset = 0;
-			peer->tcp.data_len = len;
-		}
-	} else {
-		struct kvec iv = {
-			.iov_base = peer->tcp.skb->data + peer->tcp.offset,
-			.iov_len = peer->tcp.data_len - peer->tcp.offset,
-		};
-
-		ret = kernel_recvmsg(peer->sock->sock, &msg, &iv, 1, iv.iov_len, msg.msg_flags);
-		if (ret <= 0)
-			return ret;
-
-		peer->tcp.offset += ret;
-		/* full packet received, send it up for processing */
-		if (peer->tcp.offset == peer->tcp.data_len) {
-			/* update the skb data structure with the amount of data written by
-			 * kernel_recvmsg()
-			 */
-			skb_put(peer->tcp.skb, peer->tcp.data_len);
-
-			/* do not perform IP caching for TCP connections */
-			cb = OVPN_SKB_CB(peer->tcp.skb);
-			cb->sa_fam = AF_UNSPEC;
-
-			/* hold reference to peer as requird by ovpn_recv() */
-			ovpn_peer_hold(peer);
-			status = ovpn_recv(peer->ovpn, peer, peer->tcp.skb);
-			/* skb not consumed - free it now */
-			if (unlikely(status < 0))
-				kfree_skb(peer->tcp.skb);
-
-			peer->tcp.skb = NULL;
-			peer->tcp.offset = 0;
-			peer->tcp.data_len = 0;
-		}
+	if (!list)
+		return;
+
+	peer->tcp.rx_list = NULL;
+	peer->tcp.rx_tail = NULL;
+	peer->tcp.rx_list_len = 0;
+
+	/* hold reference to peer as required by ovpn_recv_list() */
+	if (unlikely(!ovpn_peer_hold(peer))) {
+		kfree_skb_list(list);
+		return;
 	}
 
-	return ret;
+	ovpn_recv_list(peer->ovpn, peer, list);
 }
 
-static void ovpn_tcp_rx_work(struct work_struct *work)
+/* Receive one record framed by the parser. The skb still references the socket receive
+ * queue data: it is trimmed down to the packet, without any copy
+ */
+static void ovpn_tcp_rcv(struct strparser *strp, struct sk_buff *skb)
 {
-	struct ovpn_peer *peer = container_of(work, struct ovpn_peer, tcp.rx_work);
-	int ret;
+	struct ovpn_peer *peer = container_of(strp, struct ovpn_peer, tcp.strp);
+	struct strp_msg *rxm = strp_msg(skb);
+	size_t pkt_len = rxm->full_len - sizeof(u16);
+	size_t off = rxm->offset + sizeof(u16);
+	int status;
+
+	/* ensure skb->data points to the beginning of the openvpn packet, with its opcode
+	 * and peer ID accessible
+	 */
+	if (unlikely(!pskb_pull(skb, off) || pskb_trim(skb, pkt_len) ||
+		     !pskb_may_pull(skb, OVPN_OP_SIZE_V2))) {
+		net_warn_ratelimited("%s: cannot extract packet from TCP stream of peer %u\n",
+				     __func__, peer->id);
+		kfree_skb(skb);
+		return;
+	}
 
-	while (true) {
-		/* give a chance to be rescheduled if needed */
-		cond_resched();
+	/* the parser state in the control block is not needed anymore */
+	memset(skb->cb, 0, sizeof(skb->cb));
 
-		ret = ovpn_tcp_rx_one(peer);
-		if (ret <= 0)
-			break;
+	if (likely(ovpn_opcode_from_skb(skb, 0) == OVPN_DATA_V2)) {
+		skb->next = NULL;
+		if (peer->tcp.rx_tail)
+			peer->tcp.rx_tail->next = skb;
+		else
+			peer->tcp.rx_list = skb;
+		peer->tcp.rx_tail = skb;
+
+		if (++peer->tcp.rx_list_len >= OVPN_BATCH_MAX)
+			ovpn_tcp_rx_flush(peer);
+		return;
+	}
+
+	/* control packets go to userspace, after the data packets that preceded them */
+	ovpn_tcp_rx_flush(peer);
+
+	/* hold reference to peer as required by ovpn_recv() */
+	if (unlikely(!ovpn_peer_hold(peer))) {
+		kfree_skb(skb);
+		return;
+	}
+
+	status = ovpn_recv(peer->ovpn, peer, skb);
+	/* skb not consumed - free it now */
+	if (unlikely(status < 0)) {
+		ovpn_peer_put(peer);
+		kfree_skb(skb);
 	}
+}
+
+/* Called once all the data available on the socket has been parsed */
+static int ovpn_tcp_read_sock_done(struct strparser *strp, int err)
+{
+	struct ovpn_peer *peer = container_of(strp, struct ovpn_peer, tcp.strp);
+
+	ovpn_tcp_rx_flush(peer);
+
+	if (err < 0 && err != -EAGAIN)
+		netdev_err(peer->ovpn->dev, "%s: TCP socket error: %d\n", __func__, err);
 
-	if (ret < 0 && ret != -EAGAIN)
-		netdev_err(peer->ovpn->dev, "%s: TCP socket error: %d\n", __func__, ret);
+	return err;
+}
+
+/* Start framing the data already queued on the socket, if any */
+void ovpn_tcp_rx_start(struct ovpn_peer *peer)
+{
+	strp_check_rcv(&peer->tcp.strp);
 }
 
 /* Put packet into TCP TX queue and schedule a consumer */
@@ -274,21 +431,40 @@ void ovpn_queue_tcp_skb(struct ovpn_peer *peer, struct sk_buff *skb)
 /* Set TCP encapsulation callbacks */
 int ovpn_tcp_socket_attach(struct socket *sock, struct ovpn_peer *peer)
 {
+	static const struct strp_callbacks cb = {
+		.parse_msg = ovpn_tcp_parse,
+		.rcv_msg = ovpn_tcp_rcv,
+		.read_sock_done = ovpn_tcp_read_sock_done,
+	};
 	void *old_data;
 	int ret;
 
 	INIT_WORK(&peer->tcp.tx_work, ovpn_tcp_tx_work);
-	INIT_WORK(&peer->tcp.rx_work, ovpn_tcp_rx_work);
+	skb_queue_head_init(&peer->tcp.tx_queue);
+	peer->tcp.tx_offset = 0;
+
+	peer->tcp.tx_bvec = kcalloc(OVPN_TCP_TX_BVECS, sizeof(*peer->tcp.tx_bvec), GFP_KERNEL);
+	if (!peer->tcp.tx_bvec)
+		return -ENOMEM;
 
 	ret = ptr_ring_init(&peer->tcp.tx_ring, OVPN_QUEUE_LEN, GFP_KERNEL);
 	if (ret < 0) {
 		netdev_err(peer->ovpn->dev, "cannot allocate TCP TX ring\n");
+		kfree(peer->tcp.tx_bvec);
 		return ret;
 	}
 
-	peer->tcp.skb = NULL;
-	peer->tcp.offset = 0;
-	peer->tcp.data_len = 0;
+	peer->tcp.rx_list = NULL;
+	peer->tcp.rx_tail = NULL;
+	peer->tcp.rx_list_len = 0;
+
+	ret = strp_init(&peer->tcp.strp, sock->sk, &cb);
+	if (ret < 0) {
+		netdev_err(peer->ovpn->dev, "cannot initialize TCP stream parser\n");
+		ptr_ring_cleanup(&peer->tcp.tx_ring, NULL);
+		kfree(peer->tcp.tx_bvec);
+		return ret;
+	}
 
 	write_lock_bh(&sock->sk->sk_callback_lock);
 
@@ -332,7 +508,9 @@ int ovpn_tcp_socket_attach(struct socket *sock, struct ovpn_peer *peer)
 	return 0;
 err:
 	write_unlock_bh(&sock->sk->sk_callback_lock);
+	strp_done(&peer->tcp.strp);
 	ptr_ring_cleanup(&peer->tcp.tx_ring, NULL);
+	kfree(peer->tcp.tx_bvec);
 
 	return ret;
 }
@@ -20,6 +20,7 @@ void ovpn_queue_tcp_skb(struct ovpn_peer *peer, struct sk_buff *skb);
 
 int ovpn_tcp_socket_attach(struct socket *sock, struct ovpn_peer *peer);
 void ovpn_tcp_socket_detach(struct socket *sock);
+void ovpn_tcp_rx_start(struct ovpn_peer *peer);
 
 /* Prepare skb and enqueue it for sending to peer.
  *
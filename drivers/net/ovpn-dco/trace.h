@@ -0,0 +1,148 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+/* Tracepoints at each handoff of the data path:
+ *
+ * TX: ovpn_net_xmit() -> tx_queue -> tx_encrypt -> tx_encrypted -> tx_send -> transport
+ * RX: transport -> rx_queue -> rx_decrypt -> rx_decrypted -> rx_deliver -> NAPI
+ *
+ * e.g. with bpftrace:
+ *	tracepoint:ovpn_dco:ovpn_rx_queue { @t[args->skbaddr] = nsecs; }
+ *	tracepoint:ovpn_dco:ovpn_rx_deliver /@t[args->skbaddr]/ {
+ *		@rx_ns = hist(nsecs - @t[args->skbaddr]); delete(@t[args->skbaddr]);
+ *	}
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ovpn_dco
+
+#if !defined(_NET_OVPN_DCO_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _NET_OVPN_DCO_TRACE_H_
+
+#include "peer.h"
+
+#include <linux/skbuff.h>
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(ovpn_skb,
+	TP_PROTO(const struct ovpn_peer *peer, const struct sk_buff *skb),
+
+	TP_ARGS(peer, skb),
+
+	TP_STRUCT__entry(
+		__field(u32, peer_id)
+		__field(const void *, skbaddr)
+		__field(unsigned int, len)
+	),
+
+	TP_fast_assign(
+		__entry->peer_id = peer->id;
+		__entry->skbaddr = skb;
+		__entry->len = skb->len;
+	),
+
+	TP_printk("peer=%u skbaddr=%p len=%u", __entry->peer_id, __entry->skbaddr, __entry->len)
+);
+
+DECLARE_EVENT_CLASS(ovpn_skb_ret,
+	TP_PROTO(const struct ovpn_peer *peer, const struct sk_buff *skb, int ret),
+
+	TP_ARGS(peer, skb, ret),
+
+	TP_STRUCT__entry(
+		__field(u32, peer_id)
+		__field(const void *, skbaddr)
+		__field(unsigned int, len)
+		__field(int, ret)
+	),
+
+	TP_fast_assign(
+		__entry->peer_id = peer->id;
+		__entry->skbaddr = skb;
+		__entry->len = skb->len;
+		__entry->ret = ret;
+	),
+
+	TP_printk("peer=%u skbaddr=%p len=%u ret=%d", __entry->peer_id, __entry->skbaddr,
+		  __entry->len, __entry->ret)
+);
+
+/* packet to be encrypted, about to enter the TX ring or to be encrypted inline */
+DEFINE_EVENT(ovpn_skb, ovpn_tx_queue,
+	TP_PROTO(const struct ovpn_peer *peer, const struct sk_buff *skb),
+	TP_ARGS(peer, skb)
+);
+
+/* packet submitted for encryption, from the TX queue picked by the stack */
+TRACE_EVENT(ovpn_tx_encrypt,
+	TP_PROTO(const struct ovpn_peer *peer, const struct sk_buff *skb),
+
+	TP_ARGS(peer, skb),
+
+	TP_STRUCT__entry(
+		__field(u32, peer_id)
+		__field(const void *, skbaddr)
+		__field(unsigned int, len)
+		__field(u16, queue)
+	),
+
+	TP_fast_assign(
+		__entry->peer_id = peer->id;
+		__entry->skbaddr = skb;
+		__entry->len = skb->len;
+		__entry->queue = skb_get_queue_mapping(skb);
+	),
+
+	TP_printk("peer=%u skbaddr=%p len=%u queue=%u", __entry->peer_id, __entry->skbaddr,
+		  __entry->len, __entry->queue)
+);
+
+/* encryption completed */
+DEFINE_EVENT(ovpn_skb_ret, ovpn_tx_encrypted,
+	TP_PROTO(const struct ovpn_peer *peer, const struct sk_buff *skb, int ret),
+	TP_ARGS(peer, skb, ret)
+);
+
+/* encrypted packet handed over to the transport socket */
+DEFINE_EVENT(ovpn_skb, ovpn_tx_send,
+	TP_PROTO(const struct ovpn_peer *peer, const struct sk_buff *skb),
+	TP_ARGS(peer, skb)
+);
+
+/* DATA_V2 packet received, about to enter the RX ring or to be decrypted inline */
+DEFINE_EVENT(ovpn_skb, ovpn_rx_queue,
+	TP_PROTO(const struct ovpn_peer *peer, const struct sk_buff *skb),
+	TP_ARGS(peer, skb)
+);
+
+/* packet submitted for decryption */
+DEFINE_EVENT(ovpn_skb, ovpn_rx_decrypt,
+	TP_PROTO(const struct ovpn_peer *peer, const struct sk_buff *skb),
+	TP_ARGS(peer, skb)
+);
+
+/* decryption completed */
+DEFINE_EVENT(ovpn_skb_ret, ovpn_rx_decrypted,
+	TP_PROTO(const struct ovpn_peer *peer, const struct sk_buff *skb, int ret),
+	TP_ARGS(peer, skb, ret)
+);
+
+/* decrypted packet pulled from the netif RX ring and passed to GRO */
+DEFINE_EVENT(ovpn_skb, ovpn_rx_deliver,
+	TP_PROTO(const struct ovpn_peer *peer, const struct sk_buff *skb),
+	TP_ARGS(peer, skb)
+);
+
+#endif /* _NET_OVPN_DCO_TRACE_H_ */
+
+/* this part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE trace
+#include <trace/define_trace.h>
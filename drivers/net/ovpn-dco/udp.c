@@ -8,6 +8,8 @@
 
 #include "main.h"
 #include "bind.h"
+#include "crypto.h"
+#include "offload.h"
 #include "ovpn.h"
 #include "ovpnstruct.h"
 #include "peer.h"
@@ -16,14 +18,71 @@
 #include "udp.h"
 
 #include <linux/inetdevice.h>
+#include <linux/netdevice.h>
 #include <linux/skbuff.h>
 #include <linux/socket.h>
 #include <net/addrconf.h>
 #include <net/dst_cache.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+#include <net/gro.h>
+#endif
 #include <net/route.h>
 #include <net/ipv6_stubs.h>
 #include <net/udp_tunnel.h>
 
+/* Process a train of DATA_V2 packets aggregated by ovpn_udp_gro_receive().
+ *
+ * The train is split back into the original packets, which are queued at once
+ * for decryption. Since all the packets come from the same peer, the lookup
+ * performed on the first one holds for the whole train. Trains built elsewhere
+ * (i.e. locally generated UDP GSO packets) are accepted only if all packets carry
+ * the same OpenVPN header.
+ *
+ * The train and the reference to peer are always consumed.
+ */
+static void ovpn_udp_recv_train(struct sock *sk, struct ovpn_struct *ovpn,
+				struct ovpn_peer *peer, struct sk_buff *skb)
+{
+	const __be32 op = *(__be32 *)(skb->data + sizeof(struct udphdr));
+	struct sk_buff *segs, *seg;
+
+	if (unlikely(ovpn_opcode_from_skb(skb, sizeof(struct udphdr)) != OVPN_DATA_V2)) {
+		net_dbg_ratelimited("%s: non-data GSO packet from peer %u\n", __func__, peer->id);
+		kfree_skb(skb);
+		goto drop;
+	}
+
+	/* split as the UDP stack does for sockets not accepting GSO packets, which
+	 * accounts and frees the train on failure. The segmentation code expects the
+	 * data pointer at the MAC header
+	 */
+	__skb_push(skb, -skb_mac_offset(skb));
+	segs = udp_rcv_segment(sk, skb, skb->protocol == htons(ETH_P_IP));
+	if (unlikely(!segs)) {
+		net_dbg_ratelimited("%s: cannot split GRO packet from peer %u\n", __func__,
+				    peer->id);
+		goto drop;
+	}
+
+	for (seg = segs; seg; seg = seg->next) {
+		/* pop off outer UDP header */
+		__skb_pull(seg, skb_transport_offset(seg) + sizeof(struct udphdr));
+
+		if (unlikely(!pskb_may_pull(seg, OVPN_OP_SIZE_V2) || *(__be32 *)seg->data != op)) {
+			net_dbg_ratelimited("%s: heterogeneous GSO packet from peer %u\n",
+					    __func__, peer->id);
+			kfree_skb_list(segs);
+			goto drop;
+		}
+	}
+
+	ovpn_recv_list(ovpn, peer, segs);
+	return;
+
+drop:
+	ovpn_peer_put(peer);
+}
+
 /**
  * ovpn_udp_encap_recv() - Start processing a received UDP packet.
  * If the first byte of the payload is DATA_V2, the packet is further processed,
@@ -69,8 +128,9 @@ static int ovpn_udp_encap_recv(struct sock *sk, struct sk_buff *skb)
 		if (peer_id != OVPN_PEER_ID_UNDEF) {
 			peer = ovpn_peer_lookup_id(ovpn, peer_id);
 			if (!peer) {
-				net_err_ratelimited("%s: received data from unknown peer (id: %d)\n",
-						   __func__, peer_id);
+				/* may be a flood: keep it out of the default log level */
+				net_dbg_ratelimited("%s: received data from unknown peer (id: %d)\n",
+						    __func__, peer_id);
 				goto drop;
 			}
 
@@ -97,6 +157,14 @@ static int ovpn_udp_encap_recv(struct sock *sk, struct sk_buff *skb)
 		}
 	}
 
+	/* a train of DATA_V2 packets from this peer, aggregated by GRO: all packets are
+	 * queued at once
+	 */
+	if (skb_is_gso(skb)) {
+		ovpn_udp_recv_train(sk, ovpn, peer, skb);
+		return 0;
+	}
+
 	/* pop off outer UDP header */
 	__skb_pull(skb, sizeof(struct udphdr));
 
@@ -119,12 +187,188 @@ drop:
 	return 0;
 }
 
-static int ovpn_udp4_output(struct ovpn_struct *ovpn, struct ovpn_bind *bind,
-			    struct dst_cache *cache, struct sock *sk,
-			    struct sk_buff *skb)
+/**
+ * ovpn_udp_gro_receive() - Aggregate DATA_V2 packets received from the same peer.
+ * Packets are merged as long as they carry the same OpenVPN header (opcode, key ID
+ * and peer ID) and have the same size, but the last one which may be shorter.
+ * Anything else is flushed and delivered as is.
+ *
+ * @sk: the socket the packet was received on
+ * @head: the list of packets held by GRO
+ * @skb: the new packet, with the GRO offset pointing past the UDP header
+ *
+ * Return the held packet to flush (if any) or NULL.
+ */
+static struct sk_buff *ovpn_udp_gro_receive(struct sock *sk, struct list_head *head,
+					    struct sk_buff *skb)
+{
+	const unsigned int off = skb_gro_offset(skb);
+	const unsigned int len = skb_gro_len(skb);
+	const unsigned int hlen = off + OVPN_OP_SIZE_V2;
+	struct sk_buff *pp = NULL, *p;
+	__be32 *op, *op2, op_buf;
+	struct udphdr *uh;
+
+	uh = skb_gro_header_fast(skb, off - sizeof(*uh));
+	if (skb_gro_header_hard(skb, hlen)) {
+		uh = skb_gro_header_slow(skb, hlen, off - sizeof(*uh));
+		if (unlikely(!uh))
+			goto flush;
+	}
+	op = (__be32 *)(uh + 1);
+
+	/* as for plain UDP GRO, a non-zero checksum is required for symmetry with GSO and
+	 * padded packets are not dealt with
+	 */
+	if (!uh->check || ntohs(uh->len) != len + sizeof(*uh) || len <= OVPN_OP_SIZE_V2 ||
+	    ovpn_opcode_from_byte(*(u8 *)op) != OVPN_DATA_V2)
+		goto flush;
+
+	list_for_each_entry(p, head, list) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		op2 = skb_header_pointer(p, off, sizeof(op_buf), &op_buf);
+		if (!op2 || *op != *op2) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+
+		/* a packet larger than the train cannot join it: complete the train.
+		 * Otherwise the first packet shorter than the others closes the train
+		 */
+		if (len > skb_shinfo(p)->gso_size || skb_gro_receive(p, skb) ||
+		    len != skb_shinfo(p)->gso_size ||
+		    NAPI_GRO_CB(p)->count >= OVPN_UDP_GRO_MAX_SEGS)
+			pp = p;
+
+		return pp;
+	}
+
+	return NULL;
+
+flush:
+	NAPI_GRO_CB(skb)->flush = 1;
+	return NULL;
+}
+
+/**
+ * ovpn_udp_gro_complete() - Finalize a train of packets built by ovpn_udp_gro_receive().
+ * The GRO packet is turned into a plain UDP GSO packet, so that ovpn_udp_encap_recv()
+ * can process the whole train at once.
+ *
+ * @sk: the socket the packet was received on
+ * @skb: the GRO packet
+ * @nhoff: offset of the UDP payload
+ *
+ * Return 0.
+ */
+static int ovpn_udp_gro_complete(struct sock *sk, struct sk_buff *skb, int nhoff)
 {
-	struct rtable *rt;
-	struct flowi4 fl = {
+	struct udphdr *uh = (struct udphdr *)(skb->data + nhoff - sizeof(*uh));
+
+	/* UDP GRO marked the packet as tunnel GSO: no inner protocol can be parsed here */
+	skb->encapsulation = 0;
+	skb->csum_start = (unsigned char *)uh - skb->head;
+	skb->csum_offset = offsetof(struct udphdr, check);
+	skb->ip_summed = CHECKSUM_PARTIAL;
+
+	skb_shinfo(skb)->gso_type = SKB_GSO_UDP_L4;
+	skb_shinfo(skb)->gso_segs = NAPI_GRO_CB(skb)->count;
+
+	return 0;
+}
+
+/* Let UDP GSO packets built by ovpn_udp_gro_complete() reach ovpn_udp_encap_recv() as
+ * they are, rather than being segmented by the UDP stack.
+ * Older kernels lack accept_udp_l4 and keep segmenting them: gro_enabled is not
+ * abused instead, as it also changes how the socket handles UDP GRO
+ */
+static void ovpn_udp_accept_gso(struct sock *sk, bool accept)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	udp_assign_bit(ACCEPT_L4, sk, accept);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 12, 0)
+	udp_sk(sk)->accept_udp_l4 = accept;
+#endif
+}
+
+/* Learn the headroom needed by the outer headers of packets routed through dst, and
+ * the device they leave through.
+ * Invoked only when the route is looked up, i.e. when the bind or the route changes
+ */
+static unsigned int ovpn_udp_headroom(const struct dst_entry *dst, unsigned int iph_len)
+{
+	return LL_RESERVED_SPACE(dst->dev) + dst->header_len + iph_len + sizeof(struct udphdr);
+}
+
+static void ovpn_udp_learn_route(struct ovpn_peer *peer, const struct dst_entry *dst,
+				 unsigned int iph_len)
+{
+	unsigned int headroom = ovpn_udp_headroom(dst, iph_len);
+
+	if (unlikely(headroom != READ_ONCE(peer->tx_headroom)))
+		WRITE_ONCE(peer->tx_headroom, headroom);
+
+	if (unlikely(dst->dev->ifindex != READ_ONCE(peer->tx_ifindex)))
+		WRITE_ONCE(peer->tx_ifindex, dst->dev->ifindex);
+}
+
+/* peer->tx_headroom is only a hint to the encryption step, which may be stale when the
+ * packet reaches the route, e.g. after the peer floated from IPv4 to IPv6: make room for
+ * the outer headers of the route actually taken
+ */
+static int ovpn_udp_cow_head(struct ovpn_peer *peer, struct sk_buff *skb,
+			     const struct dst_entry *dst, unsigned int iph_len)
+{
+	unsigned int headroom = ovpn_udp_headroom(dst, iph_len);
+
+	if (likely(skb_headroom(skb) >= headroom && !skb_header_cloned(skb)))
+		return 0;
+
+	ovpn_peer_stats_increment_headroom_realloc(&peer->stats);
+	return skb_cow_head(skb, headroom);
+}
+
+/* Packets left to the device for encryption must not leave through another one */
+static bool ovpn_udp_offload_ok(const struct sk_buff *skb, const struct net_device *dev)
+{
+	if (likely(!OVPN_SKB_CB(skb)->offload))
+		return true;
+
+	if (ovpn_offload_dev_ok(OVPN_SKB_CB(skb)->ks->offload, dev))
+		return true;
+
+	net_dbg_ratelimited("%s: route moved away from the crypto offload device\n", __func__);
+	return false;
+}
+
+/* GSO trains are checksummed as they are split, in software or by the NIC, which
+ * udp_set_csum() and udp6_set_csum() seed: the checksum cannot be turned off for them
+ */
+static bool ovpn_udp_no_check_tx(const struct sk_buff *skb, bool no_check_tx)
+{
+	return no_check_tx && !skb_is_gso(skb);
+}
+
+/* The UDP header is pushed by the tunnel helpers right in front of the payload */
+static void ovpn_udp_set_csum_mode(struct sk_buff *skb)
+{
+	if (!skb_is_gso(skb)) {
+		/* no checksum performed at this layer */
+		skb->ip_summed = CHECKSUM_NONE;
+		return;
+	}
+
+	skb->ip_summed = CHECKSUM_PARTIAL;
+	skb->csum_start = skb_headroom(skb) - sizeof(struct udphdr);
+	skb->csum_offset = offsetof(struct udphdr, check);
+}
+
+static void ovpn_udp4_flow(const struct ovpn_bind *bind, const struct sock *sk,
+			   struct flowi4 *fl)
+{
+	*fl = (struct flowi4) {
 		.saddr = bind->local.ipv4.s_addr,
 		.daddr = bind->sa.in4.sin_addr.s_addr,
 		.fl4_sport = inet_sk(sk)->inet_sport,
@@ -132,8 +376,18 @@ static int ovpn_udp4_output(struct ovpn_struct *ovpn, struct ovpn_bind *bind,
 		.flowi4_proto = sk->sk_protocol,
 		.flowi4_mark = sk->sk_mark,
 	};
+}
+
+static int ovpn_udp4_output(struct ovpn_struct *ovpn, struct ovpn_peer *peer,
+			    struct ovpn_bind *bind, struct sock *sk, struct sk_buff *skb)
+{
+	struct dst_cache *cache = &bind->dst_cache;
+	struct rtable *rt;
+	struct flowi4 fl;
 	int ret;
 
+	ovpn_udp4_flow(bind, sk, &fl);
+
 	local_bh_disable();
 	rt = dst_cache_get_ip4(cache, &fl.saddr);
 	if (rt)
@@ -164,11 +418,24 @@ static int ovpn_udp4_output(struct ovpn_struct *ovpn, struct ovpn_bind *bind,
 		goto err;
 	}
 	dst_cache_set_ip4(cache, &rt->dst, fl.saddr);
+	ovpn_udp_learn_route(peer, &rt->dst, sizeof(struct iphdr));
 
 transmit:
+	if (unlikely(!ovpn_udp_offload_ok(skb, rt->dst.dev))) {
+		ip_rt_put(rt);
+		ret = -ENETUNREACH;
+		goto err;
+	}
+
+	ret = ovpn_udp_cow_head(peer, skb, &rt->dst, sizeof(struct iphdr));
+	if (unlikely(ret < 0)) {
+		ip_rt_put(rt);
+		goto err;
+	}
+
 	udp_tunnel_xmit_skb(rt, sk, skb, fl.saddr, fl.daddr, 0,
 			    ip4_dst_hoplimit(&rt->dst), 0, fl.fl4_sport,
-			    fl.fl4_dport, false, sk->sk_no_check_tx);
+			    fl.fl4_dport, false, ovpn_udp_no_check_tx(skb, sk->sk_no_check_tx));
 	ret = 0;
 err:
 	local_bh_enable();
@@ -176,14 +443,10 @@ err:
 }
 
 #if IS_ENABLED(CONFIG_IPV6)
-static int ovpn_udp6_output(struct ovpn_struct *ovpn, struct ovpn_bind *bind,
-			    struct dst_cache *cache, struct sock *sk,
-			    struct sk_buff *skb)
+static void ovpn_udp6_flow(const struct ovpn_bind *bind, const struct sock *sk,
+			   struct flowi6 *fl)
 {
-	struct dst_entry *dst;
-	int ret;
-
-	struct flowi6 fl = {
+	*fl = (struct flowi6) {
 		.saddr = bind->local.ipv6,
 		.daddr = bind->sa.in6.sin6_addr,
 		.fl6_sport = inet_sk(sk)->inet_sport,
@@ -192,6 +455,17 @@ static int ovpn_udp6_output(struct ovpn_struct *ovpn, struct ovpn_bind *bind,
 		.flowi6_mark = sk->sk_mark,
 		.flowi6_oif = bind->sa.in6.sin6_scope_id,
 	};
+}
+
+static int ovpn_udp6_output(struct ovpn_struct *ovpn, struct ovpn_peer *peer,
+			    struct ovpn_bind *bind, struct sock *sk, struct sk_buff *skb)
+{
+	struct dst_cache *cache = &bind->dst_cache;
+	struct dst_entry *dst;
+	struct flowi6 fl;
+	int ret;
+
+	ovpn_udp6_flow(bind, sk, &fl);
 
 	local_bh_disable();
 	dst = dst_cache_get_ip6(cache, &fl.saddr);
@@ -215,11 +489,24 @@ static int ovpn_udp6_output(struct ovpn_struct *ovpn, struct ovpn_bind *bind,
 		goto err;
 	}
 	dst_cache_set_ip6(cache, dst, &fl.saddr);
+	ovpn_udp_learn_route(peer, dst, sizeof(struct ipv6hdr));
 
 transmit:
+	if (unlikely(!ovpn_udp_offload_ok(skb, dst->dev))) {
+		dst_release(dst);
+		ret = -ENETUNREACH;
+		goto err;
+	}
+
+	ret = ovpn_udp_cow_head(peer, skb, dst, sizeof(struct ipv6hdr));
+	if (unlikely(ret < 0)) {
+		dst_release(dst);
+		goto err;
+	}
+
 	udp_tunnel6_xmit_skb(dst, sk, skb, skb->dev, &fl.saddr, &fl.daddr, 0,
 			     ip6_dst_hoplimit(dst), 0, fl.fl6_sport,
-			     fl.fl6_dport, udp_get_no_check6_tx(sk));
+			     fl.fl6_dport, ovpn_udp_no_check_tx(skb, udp_get_no_check6_tx(sk)));
 	ret = 0;
 err:
 	local_bh_enable();
@@ -232,9 +519,8 @@ err:
  * rcu_read_lock should be held on entry.
  * On return, the skb is consumed.
  */
-static int ovpn_udp_output(struct ovpn_struct *ovpn, struct ovpn_bind *bind,
-			   struct dst_cache *cache, struct sock *sk,
-			   struct sk_buff *skb)
+static int ovpn_udp_output(struct ovpn_struct *ovpn, struct ovpn_peer *peer,
+			   struct ovpn_bind *bind, struct sock *sk, struct sk_buff *skb)
 {
 	int ret;
 
@@ -249,11 +535,11 @@ static int ovpn_udp_output(struct ovpn_struct *ovpn, struct ovpn_bind *bind,
 
 	switch (bind->sa.in4.sin_family) {
 	case AF_INET:
-		ret = ovpn_udp4_output(ovpn, bind, cache, sk, skb);
+		ret = ovpn_udp4_output(ovpn, peer, bind, sk, skb);
 		break;
 #if IS_ENABLED(CONFIG_IPV6)
 	case AF_INET6:
-		ret = ovpn_udp6_output(ovpn, bind, cache, sk, skb);
+		ret = ovpn_udp6_output(ovpn, peer, bind, sk, skb);
 		break;
 #endif
 	default:
@@ -264,6 +550,32 @@ static int ovpn_udp_output(struct ovpn_struct *ovpn, struct ovpn_bind *bind,
 	return ret;
 }
 
+/* Pick the socket to transmit to the peer through. Members of the reuseport group all
+ * share the same local port, therefore the peer is free to use the one matching the
+ * current CPU rather than contending with the other CPUs on its own socket.
+ *
+ * rcu_read_lock should be held on entry.
+ */
+static struct socket *ovpn_udp_xmit_sock(struct ovpn_struct *ovpn, struct ovpn_peer *peer)
+{
+	struct ovpn_socket *shard;
+	unsigned int count;
+
+	if (!READ_ONCE(peer->sock->shard))
+		return peer->sock->sock;
+
+	/* pairs with smp_store_release() in ovpn_udp_shard_add() */
+	count = smp_load_acquire(&ovpn->udp_shards.count);
+	if (unlikely(!count))
+		return peer->sock->sock;
+
+	shard = rcu_dereference(ovpn->udp_shards.socks[raw_smp_processor_id() % count]);
+	if (unlikely(!shard))
+		return peer->sock->sock;
+
+	return shard->sock;
+}
+
 void ovpn_udp_send_skb(struct ovpn_struct *ovpn, struct ovpn_peer *peer,
 		       struct sk_buff *skb)
 {
@@ -272,17 +584,16 @@ void ovpn_udp_send_skb(struct ovpn_struct *ovpn, struct ovpn_peer *peer,
 	int ret = -1;
 
 	skb->dev = ovpn->dev;
-	/* no checksum performed at this layer */
-	skb->ip_summed = CHECKSUM_NONE;
+	ovpn_udp_set_csum_mode(skb);
 
+	rcu_read_lock();
 	/* get socket info */
-	sock = peer->sock->sock;
+	sock = ovpn_udp_xmit_sock(ovpn, peer);
 	if (unlikely(!sock)) {
 		net_dbg_ratelimited("%s: no sock for remote peer\n", __func__);
-		goto out;
+		goto out_unlock;
 	}
 
-	rcu_read_lock();
 	/* get binding */
 	bind = rcu_dereference(peer->bind);
 	if (unlikely(!bind)) {
@@ -291,15 +602,131 @@ void ovpn_udp_send_skb(struct ovpn_struct *ovpn, struct ovpn_peer *peer,
 	}
 
 	/* crypto layer -> transport (UDP) */
-	ret = ovpn_udp_output(ovpn, bind, &peer->dst_cache, sock->sk, skb);
+	ret = ovpn_udp_output(ovpn, peer, bind, sock->sk, skb);
 
 out_unlock:
 	rcu_read_unlock();
-out:
 	if (ret < 0)
 		kfree_skb(skb);
 }
 
+/* Return the ifindex of the device the peer is currently routed through, or a
+ * negative error. The route cache of the bind is bypassed
+ */
+int ovpn_udp_route_ifindex(struct ovpn_peer *peer)
+{
+	struct sock *sk = peer->sock->sock->sk;
+	struct ovpn_bind *bind;
+	struct dst_entry *dst;
+	struct flowi4 fl4;
+	struct rtable *rt;
+#if IS_ENABLED(CONFIG_IPV6)
+	struct flowi6 fl6;
+#endif
+	int ret;
+
+	rcu_read_lock();
+	bind = rcu_dereference(peer->bind);
+	if (!bind) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	switch (bind->sa.in4.sin_family) {
+	case AF_INET:
+		ovpn_udp4_flow(bind, sk, &fl4);
+		rt = ip_route_output_flow(sock_net(sk), &fl4, sk);
+		if (IS_ERR(rt)) {
+			ret = PTR_ERR(rt);
+			goto out;
+		}
+		dst = &rt->dst;
+		break;
+#if IS_ENABLED(CONFIG_IPV6)
+	case AF_INET6:
+		ovpn_udp6_flow(bind, sk, &fl6);
+		dst = ipv6_stub->ipv6_dst_lookup_flow(sock_net(sk), sk, &fl6, NULL);
+		if (IS_ERR(dst)) {
+			ret = PTR_ERR(dst);
+			goto out;
+		}
+		break;
+#endif
+	default:
+		ret = -EAFNOSUPPORT;
+		goto out;
+	}
+
+	ret = dst->dev->ifindex;
+	dst_release(dst);
+out:
+	rcu_read_unlock();
+	return ret;
+}
+
+/* Coalesce the packets at the head of list into a single UDP GSO skb.
+ *
+ * As required by UDP segmentation, all packets must have the same size, but
+ * the last one, which may be shorter. Packets are expected to be linear, as
+ * left by the encryption step.
+ * The first packet becomes the GSO skb and the pool pages holding the others
+ * are attached to it as page frags, one segment each, through
+ * skb_try_coalesce(): no payload is copied, but for a packet small enough to
+ * fit the tailroom of the first one, and the result can be handed as is to a
+ * NIC doing UDP segmentation. The outer headers are pushed into the
+ * headroom that the encryption step reserved according to peer->tx_headroom.
+ * Coalescing stops at the first packet that cannot be attached, for instance
+ * because it was not built on a pool page or the frags are exhausted.
+ * Return the first packet, coalesced or not, dequeued from list.
+ */
+static struct sk_buff *ovpn_udp_gso_coalesce(struct sk_buff_head *list)
+{
+	struct sk_buff *gso = __skb_dequeue(list), *skb;
+	const unsigned int gso_size = gso->len;
+	unsigned int segs = 1;
+	bool stolen;
+	int delta;
+
+	if (skb_cloned(gso) || skb_is_nonlinear(gso))
+		return gso;
+
+	while ((skb = skb_peek(list)) && segs < UDP_MAX_SEGMENTS) {
+		/* a shorter packet can only be the last segment */
+		if (skb_is_nonlinear(skb) || skb->len > gso_size ||
+		    gso->len - (segs - 1) * gso_size != gso_size ||
+		    gso->len + skb->len > OVPN_UDP_GSO_MAX_LEN)
+			break;
+
+		if (!skb_try_coalesce(gso, skb, &stolen, &delta))
+			break;
+
+		__skb_unlink(skb, list);
+		kfree_skb_partial(skb, stolen);
+		segs++;
+	}
+
+	if (segs > 1) {
+		skb_shinfo(gso)->gso_size = gso_size;
+		skb_shinfo(gso)->gso_type = SKB_GSO_UDP_L4;
+		skb_shinfo(gso)->gso_segs = segs;
+	}
+
+	return gso;
+}
+
+/* Send a list of packets to the same peer.
+ *
+ * Whenever possible, the packets are coalesced into UDP GSO skbs, so that
+ * route lookup and encapsulation happen once per train and the final
+ * segmentation is left to the lower stack or to the NIC. The list is consumed.
+ */
+void ovpn_udp_send_skb_list(struct ovpn_struct *ovpn, struct ovpn_peer *peer,
+			    struct sk_buff_head *list)
+{
+	while (!skb_queue_empty(list))
+		ovpn_udp_send_skb(ovpn, peer, ovpn_udp_gso_coalesce(list));
+}
+
 /* Set UDP encapsulation callbacks */
 int ovpn_udp_socket_attach(struct socket *sock, struct ovpn_struct *ovpn)
 {
@@ -307,6 +734,8 @@ int ovpn_udp_socket_attach(struct socket *sock, struct ovpn_struct *ovpn)
 		.sk_user_data = ovpn,
 		.encap_type = UDP_ENCAP_OVPNINUDP,
 		.encap_rcv = ovpn_udp_encap_recv,
+		.gro_receive = ovpn_udp_gro_receive,
+		.gro_complete = ovpn_udp_gro_complete,
 	};
 	struct ovpn_socket *old_data;
 
@@ -334,6 +763,7 @@ int ovpn_udp_socket_attach(struct socket *sock, struct ovpn_struct *ovpn)
 	}
 
 	setup_udp_tunnel_sock(sock_net(sock->sk), sock, &cfg);
+	ovpn_udp_accept_gso(sock->sk, true);
 
 	return 0;
 }
@@ -343,5 +773,106 @@ void ovpn_udp_socket_detach(struct socket *sock)
 {
 	struct udp_tunnel_sock_cfg cfg = { };
 
+	ovpn_udp_accept_gso(sock->sk, false);
 	setup_udp_tunnel_sock(sock_net(sock->sk), sock, &cfg);
 }
+
+/**
+ * ovpn_udp_shard_add() - add a socket to the reuseport group of the interface
+ * @ovpn: the interface to attach the socket to
+ * @sock: a UDP socket bound with SO_REUSEPORT to the port of the other members
+ *
+ * The socket receives like any other socket attached to the interface, while
+ * peers attached to any member of the group transmit through the member matching
+ * the current CPU. The reference to @sock is always consumed.
+ *
+ * Return 0 on success or a negative error code otherwise.
+ */
+int ovpn_udp_shard_add(struct ovpn_struct *ovpn, struct socket *sock)
+{
+	struct ovpn_socket *ovpn_sock, *shard;
+	struct sock *sk = sock->sk;
+	unsigned int i, count;
+	int ret = 0;
+
+	if (sk->sk_protocol != IPPROTO_UDP || !sk->sk_reuseport || !inet_sk(sk)->inet_sport) {
+		netdev_err(ovpn->dev, "%s: expected a UDP socket bound with SO_REUSEPORT\n",
+			   __func__);
+		sockfd_put(sock);
+		return -EINVAL;
+	}
+
+	ovpn_sock = ovpn_socket_new_udp(sock, ovpn);
+	if (IS_ERR(ovpn_sock)) {
+		sockfd_put(sock);
+		return PTR_ERR(ovpn_sock);
+	}
+
+	spin_lock_bh(&ovpn->lock);
+	count = ovpn->udp_shards.count;
+	for (i = 0; i < count; i++) {
+		shard = rcu_dereference_protected(ovpn->udp_shards.socks[i],
+						  lockdep_is_held(&ovpn->lock));
+		if (shard == ovpn_sock) {
+			ret = -EEXIST;
+			goto unlock;
+		}
+	}
+
+	if (count == OVPN_UDP_SHARDS_MAX) {
+		ret = -ENOSPC;
+		goto unlock;
+	}
+
+	/* peers switch between members freely: they must all look the same to the remote */
+	shard = rcu_dereference_protected(ovpn->udp_shards.socks[0], lockdep_is_held(&ovpn->lock));
+	if (shard && (shard->sock->sk->sk_family != sk->sk_family ||
+		      inet_sk(shard->sock->sk)->inet_sport != inet_sk(sk)->inet_sport)) {
+		netdev_err(ovpn->dev, "%s: socket not bound like the other members\n", __func__);
+		ret = -EINVAL;
+		goto unlock;
+	}
+
+	WRITE_ONCE(ovpn_sock->shard, true);
+	rcu_assign_pointer(ovpn->udp_shards.socks[count], ovpn_sock);
+	/* publish the new member only once its slot is set */
+	smp_store_release(&ovpn->udp_shards.count, count + 1);
+unlock:
+	spin_unlock_bh(&ovpn->lock);
+
+	if (ret < 0)
+		ovpn_socket_put(ovpn_sock);
+	else
+		netdev_dbg(ovpn->dev, "%s: %u sockets in the reuseport group\n", __func__,
+			   count + 1);
+
+	return ret;
+}
+
+/* Drop the references held by the reuseport group. Peers keep the sockets they are
+ * attached to and go back to transmitting through them
+ */
+void ovpn_udp_shards_release(struct ovpn_struct *ovpn)
+{
+	struct ovpn_socket *socks[OVPN_UDP_SHARDS_MAX];
+	unsigned int i, count;
+
+	spin_lock_bh(&ovpn->lock);
+	count = ovpn->udp_shards.count;
+	WRITE_ONCE(ovpn->udp_shards.count, 0);
+	for (i = 0; i < count; i++) {
+		socks[i] = rcu_dereference_protected(ovpn->udp_shards.socks[i],
+						     lockdep_is_held(&ovpn->lock));
+		RCU_INIT_POINTER(ovpn->udp_shards.socks[i], NULL);
+	}
+	spin_unlock_bh(&ovpn->lock);
+
+	if (!count)
+		return;
+
+	/* wait for the senders still using the members */
+	synchronize_net();
+
+	for (i = 0; i < count; i++)
+		ovpn_socket_put(socks[i]);
+}
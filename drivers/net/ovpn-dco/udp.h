@@ -19,7 +19,12 @@
 
 int ovpn_udp_socket_attach(struct socket *sock, struct ovpn_struct *ovpn);
 void ovpn_udp_socket_detach(struct socket *sock);
+int ovpn_udp_shard_add(struct ovpn_struct *ovpn, struct socket *sock);
+void ovpn_udp_shards_release(struct ovpn_struct *ovpn);
 void ovpn_udp_send_skb(struct ovpn_struct *ovpn, struct ovpn_peer *peer,
 		       struct sk_buff *skb);
+void ovpn_udp_send_skb_list(struct ovpn_struct *ovpn, struct ovpn_peer *peer,
+			    struct sk_buff_head *list);
+int ovpn_udp_route_ifindex(struct ovpn_peer *peer);
 
 #endif /* _NET_OVPN_DCO_UDP_H_ */
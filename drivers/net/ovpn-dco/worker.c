@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: GPL-2.0
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+#include "main.h"
+#include "worker.h"
+
+#include <linux/sched.h>
+#include <linux/slab.h>
+
+int ovpn_crypto_workers_init(struct ovpn_crypto_workers *workers, const struct cpumask *mask,
+			     const char *name)
+{
+	struct kthread_worker *worker;
+	int cpu, ret;
+
+	if (!zalloc_cpumask_var(&workers->mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	cpumask_and(workers->mask, mask, cpu_online_mask);
+	if (cpumask_empty(workers->mask)) {
+		ret = -EINVAL;
+		goto err;
+	}
+
+	workers->worker = kcalloc(nr_cpu_ids, sizeof(*workers->worker), GFP_KERNEL);
+	if (!workers->worker) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	for_each_cpu(cpu, workers->mask) {
+		worker = kthread_create_worker(0, "ovpn-crypto-%s/%d", name, cpu);
+		if (IS_ERR(worker)) {
+			ret = PTR_ERR(worker);
+			goto err_workers;
+		}
+
+		/* the worker may or may not be running already, depending on the
+		 * kernel version: bind it and make sure it is woken up
+		 */
+		ret = set_cpus_allowed_ptr(worker->task, cpumask_of(cpu));
+		wake_up_process(worker->task);
+		workers->worker[cpu] = worker;
+		if (ret < 0)
+			goto err_workers;
+	}
+
+	workers->last_cpu = -1;
+
+	return 0;
+
+err_workers:
+	ovpn_crypto_workers_free(workers);
+	return ret;
+err:
+	free_cpumask_var(workers->mask);
+	return ret;
+}
+
+/* all peers must be gone, so that no work is left */
+void ovpn_crypto_workers_free(struct ovpn_crypto_workers *workers)
+{
+	int cpu;
+
+	for_each_cpu(cpu, workers->mask)
+		if (workers->worker[cpu])
+			kthread_destroy_worker(workers->worker[cpu]);
+
+	kfree(workers->worker);
+	free_cpumask_var(workers->mask);
+}
+
+/* Pick the CPU whose worker will run the crypto of a new peer.
+ *
+ * If cpu is negative, workers are picked in a round-robin fashion.
+ * Return the CPU or -EINVAL if the requested CPU has no worker.
+ */
+int ovpn_crypto_workers_pick(struct ovpn_crypto_workers *workers, int cpu)
+{
+	if (cpu >= 0)
+		return cpu < nr_cpu_ids && workers->worker[cpu] ? cpu : -EINVAL;
+
+	cpu = cpumask_next(READ_ONCE(workers->last_cpu), workers->mask);
+	if (cpu >= nr_cpu_ids)
+		cpu = cpumask_first(workers->mask);
+	WRITE_ONCE(workers->last_cpu, cpu);
+
+	return cpu;
+}
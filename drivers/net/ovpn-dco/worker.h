@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+#ifndef _NET_OVPN_DCO_WORKER_H_
+#define _NET_OVPN_DCO_WORKER_H_
+
+#include <linux/cpumask.h>
+#include <linux/kthread.h>
+
+/* Per-CPU kthread workers used in the OVPN_CRYPTO_EXEC_KTHREAD mode.
+ *
+ * A worker is created for every online CPU of the configured mask and is bound
+ * to it. Each peer is assigned to one worker for its whole lifetime, so that its
+ * crypto always runs on the same CPU without going through the crypto workqueue.
+ */
+struct ovpn_crypto_workers {
+	/* indexed by CPU, NULL for CPUs without a worker */
+	struct kthread_worker **worker;
+	cpumask_var_t mask;
+	int last_cpu;
+};
+
+int ovpn_crypto_workers_init(struct ovpn_crypto_workers *workers, const struct cpumask *mask,
+			     const char *name);
+void ovpn_crypto_workers_free(struct ovpn_crypto_workers *workers);
+
+int ovpn_crypto_workers_pick(struct ovpn_crypto_workers *workers, int cpu);
+
+#endif /* _NET_OVPN_DCO_WORKER_H_ */
@@ -11,6 +11,8 @@
 #ifndef _UAPI_LINUX_OVPN_DCO_H_
 #define _UAPI_LINUX_OVPN_DCO_H_
 
+#include <linux/types.h>
+
 #define OVPN_NL_NAME "ovpn-dco"
 
 #define OVPN_NL_MULTICAST_GROUP_PEERS "peers"
@@ -25,7 +27,10 @@ enum ovpn_nl_commands {
 	OVPN_CMD_UNSPEC = 0,
 
 	/**
-	 * @OVPN_CMD_NEW_PEER: Configure peer with its crypto keys
+	 * @OVPN_CMD_NEW_PEER: Configure peer with its crypto keys. With
+	 * IFLA_OVPN_PEER_NOTIFY set, the peer is also announced to the "peers"
+	 * multicast group once added, with its OVPN_ATTR_IFINDEX and an
+	 * OVPN_ATTR_GET_PEER nest limited to OVPN_GET_PEER_INFO_CONFIG
 	 */
 	OVPN_CMD_NEW_PEER,
 
@@ -47,7 +52,8 @@ enum ovpn_nl_commands {
 
 	/**
 	 * @OVPN_CMD_REGISTER_PACKET: Register for specific packet types to be
-	 * forwarded to userspace
+	 * forwarded to userspace. With OVPN_ATTR_PACKETS_BATCH set, packets are
+	 * delivered in batches with OVPN_CMD_PACKETS instead of OVPN_CMD_PACKET
 	 */
 	OVPN_CMD_REGISTER_PACKET,
 
@@ -62,6 +68,55 @@ enum ovpn_nl_commands {
 	 * @OVPN_CMD_GET_PEER: Retrieve the status of a peer or all peers
 	 */
 	OVPN_CMD_GET_PEER,
+
+	/**
+	 * @OVPN_CMD_NEW_ROUTE: Route a VPN prefix (i.e. an iroute) to a peer, in
+	 * MP mode. An existing route for the same prefix is replaced
+	 */
+	OVPN_CMD_NEW_ROUTE,
+
+	/**
+	 * @OVPN_CMD_DEL_ROUTE: Remove the route of a VPN prefix
+	 */
+	OVPN_CMD_DEL_ROUTE,
+
+	/**
+	 * @OVPN_CMD_NEW_PEERS: Configure many peers with their crypto keys at
+	 * once, in MP mode. Entries are processed independently: the reply
+	 * counts the entries that failed and lists the first ones along with
+	 * their error, see enum ovpn_netlink_peers_attrs
+	 */
+	OVPN_CMD_NEW_PEERS,
+
+	/**
+	 * @OVPN_CMD_DEL_PEERS: Remove many peers at once and reply with the
+	 * entries that failed, like OVPN_CMD_NEW_PEERS
+	 */
+	OVPN_CMD_DEL_PEERS,
+
+	/**
+	 * @OVPN_CMD_PACKETS: Send many packets from userspace to kernelspace at
+	 * once. Entries are processed independently and the error of the first
+	 * failed entry, if any, is returned. Also used to deliver packets to a
+	 * process registered with OVPN_ATTR_PACKETS_BATCH
+	 */
+	OVPN_CMD_PACKETS,
+
+	/**
+	 * @OVPN_CMD_PEER_STATS: Counters of the peers that sent or received data
+	 * since the previous message, multicast on the peers group every
+	 * IFLA_OVPN_STATS_INTERVAL seconds. Each message carries OVPN_ATTR_IFINDEX
+	 * and an OVPN_ATTR_GET_PEER nest limited to OVPN_GET_PEER_INFO_COUNTERS
+	 */
+	OVPN_CMD_PEER_STATS,
+
+	/**
+	 * @OVPN_CMD_NEW_SOCKET: Add the UDP socket in OVPN_ATTR_SOCKET to the
+	 * reuseport group of the interface, in MP mode. All members must be
+	 * bound with SO_REUSEPORT to the same port: peers created with any of
+	 * them then transmit through the member matching the current CPU
+	 */
+	OVPN_CMD_NEW_SOCKET,
 };
 
 enum ovpn_cipher_alg {
@@ -107,6 +162,11 @@ enum ovpn_netlink_attrs {
 	OVPN_ATTR_DEL_KEY,
 	OVPN_ATTR_PACKET,
 	OVPN_ATTR_GET_PEER,
+	OVPN_ATTR_ROUTE,
+	OVPN_ATTR_PEERS,
+	OVPN_ATTR_PACKETS,
+	OVPN_ATTR_PACKETS_BATCH,
+	OVPN_ATTR_SOCKET,
 
 	__OVPN_ATTR_AFTER_LAST,
 	OVPN_ATTR_MAX = __OVPN_ATTR_AFTER_LAST - 1,
@@ -160,6 +220,7 @@ enum ovpn_netlink_new_peer_attrs {
 	OVPN_NEW_PEER_ATTR_IPV4,
 	OVPN_NEW_PEER_ATTR_IPV6,
 	OVPN_NEW_PEER_ATTR_LOCAL_IP,
+	OVPN_NEW_PEER_ATTR_CPU,
 
 	__OVPN_NEW_PEER_ATTR_AFTER_LAST,
 	OVPN_NEW_PEER_ATTR_MAX = __OVPN_NEW_PEER_ATTR_AFTER_LAST - 1,
@@ -184,14 +245,142 @@ enum ovpn_netlink_del_peer_attrs {
 	OVPN_DEL_PEER_ATTR_MAX = __OVPN_DEL_PEER_ATTR_AFTER_LAST - 1,
 };
 
+/**
+ * enum ovpn_netlink_get_peer_attrs - attributes of OVPN_CMD_GET_PEER
+ *
+ * @OVPN_GET_PEER_ATTR_PEER_ID: peer to report, all peers are dumped if missing
+ * @OVPN_GET_PEER_ATTR_START_ID: dumps only, first peer ID to report (u32). Peers
+ *	are dumped in ID order: a dump can be resumed from the last ID received + 1
+ * @OVPN_GET_PEER_ATTR_MAX_PEERS: dumps only, stop after this many peers (u32)
+ * @OVPN_GET_PEER_ATTR_SINCE: dumps only, report only the peers that sent or
+ *	received data or were reconfigured since this cookie (u64), taken from
+ *	OVPN_GET_PEER_RESP_ATTR_COOKIE of a previous reply. Cookies are
+ *	generations of the peer table of the interface, advanced by each dump:
+ *	a cookie not handed out yet is rejected with -EINVAL
+ * @OVPN_GET_PEER_ATTR_INFO: attributes to report (u32), a mask of
+ *	enum ovpn_get_peer_info. Everything is reported if missing
+ */
 enum ovpn_netlink_get_peer_attrs {
 	OVPN_GET_PEER_ATTR_UNSPEC = 0,
 	OVPN_GET_PEER_ATTR_PEER_ID,
+	OVPN_GET_PEER_ATTR_START_ID,
+	OVPN_GET_PEER_ATTR_MAX_PEERS,
+	OVPN_GET_PEER_ATTR_SINCE,
+	OVPN_GET_PEER_ATTR_INFO,
 
 	__OVPN_GET_PEER_ATTR_AFTER_LAST,
 	OVPN_GET_PEER_ATTR_MAX = __OVPN_GET_PEER_ATTR_AFTER_LAST - 1,
 };
 
+/**
+ * Groups of attributes selected with OVPN_GET_PEER_ATTR_INFO. The peer ID and the
+ * cookie are always reported
+ */
+enum ovpn_get_peer_info {
+	/**
+	 * @OVPN_GET_PEER_INFO_CONFIG: addresses, transport, keepalive and crypto CPU
+	 */
+	OVPN_GET_PEER_INFO_CONFIG = 1 << 0,
+	/**
+	 * @OVPN_GET_PEER_INFO_COUNTERS: RX, TX and TCP sendmsg() counters
+	 */
+	OVPN_GET_PEER_INFO_COUNTERS = 1 << 1,
+	/**
+	 * @OVPN_GET_PEER_INFO_DEBUG: drops, allocation counters, batch histograms,
+	 * queues and latency
+	 */
+	OVPN_GET_PEER_INFO_DEBUG = 1 << 2,
+
+	OVPN_GET_PEER_INFO_ALL = OVPN_GET_PEER_INFO_CONFIG | OVPN_GET_PEER_INFO_COUNTERS |
+				 OVPN_GET_PEER_INFO_DEBUG,
+};
+
+/**
+ * enum ovpn_netlink_route_attrs - attributes of OVPN_CMD_NEW_ROUTE and
+ * OVPN_CMD_DEL_ROUTE
+ *
+ * Exactly one of IPV4 and IPV6 is expected. PREFIX_LEN defaults to the full
+ * address length and PEER_ID is ignored by OVPN_CMD_DEL_ROUTE
+ */
+enum ovpn_netlink_route_attrs {
+	OVPN_ROUTE_ATTR_UNSPEC = 0,
+	OVPN_ROUTE_ATTR_PEER_ID,
+	OVPN_ROUTE_ATTR_IPV4,
+	OVPN_ROUTE_ATTR_IPV6,
+	OVPN_ROUTE_ATTR_PREFIX_LEN,
+
+	__OVPN_ROUTE_ATTR_AFTER_LAST,
+	OVPN_ROUTE_ATTR_MAX = __OVPN_ROUTE_ATTR_AFTER_LAST - 1,
+};
+
+/**
+ * enum ovpn_netlink_peers_attrs - content of OVPN_ATTR_PEERS
+ *
+ * @OVPN_PEERS_ATTR_ENTRY: requests only, one peer, repeated for each peer.
+ * Attributes are from enum ovpn_netlink_peers_entry_attrs
+ * @OVPN_PEERS_ATTR_N_FAILED: replies only, number of entries that failed (u32)
+ * @OVPN_PEERS_ATTR_FAILED: replies only, array of struct ovpn_peers_failure for
+ * the first entries that failed, in request order. It is omitted if no entry
+ * failed and may list fewer entries than OVPN_PEERS_ATTR_N_FAILED, so that the
+ * reply stays small
+ */
+enum ovpn_netlink_peers_attrs {
+	OVPN_PEERS_ATTR_UNSPEC = 0,
+	OVPN_PEERS_ATTR_ENTRY,
+	OVPN_PEERS_ATTR_N_FAILED,
+	OVPN_PEERS_ATTR_FAILED,
+
+	__OVPN_PEERS_ATTR_AFTER_LAST,
+	OVPN_PEERS_ATTR_MAX = __OVPN_PEERS_ATTR_AFTER_LAST - 1,
+};
+
+/**
+ * enum ovpn_netlink_packets_attrs - content of OVPN_ATTR_PACKETS
+ *
+ * @OVPN_PACKETS_ATTR_ENTRY: one packet, repeated for each packet. Attributes
+ * are from enum ovpn_netlink_packet_attrs
+ */
+enum ovpn_netlink_packets_attrs {
+	OVPN_PACKETS_ATTR_UNSPEC = 0,
+	OVPN_PACKETS_ATTR_ENTRY,
+
+	__OVPN_PACKETS_ATTR_AFTER_LAST,
+	OVPN_PACKETS_ATTR_MAX = __OVPN_PACKETS_ATTR_AFTER_LAST - 1,
+};
+
+/**
+ * enum ovpn_netlink_peers_entry_attrs - attributes of an OVPN_PEERS_ATTR_ENTRY
+ *
+ * @OVPN_PEERS_ENTRY_ATTR_NEW_PEER: OVPN_CMD_NEW_PEERS only, the peer as
+ * described by enum ovpn_netlink_new_peer_attrs
+ * @OVPN_PEERS_ENTRY_ATTR_PRIMARY_KEY: OVPN_CMD_NEW_PEERS only, optional key
+ * installed before the peer becomes reachable, as described by
+ * enum ovpn_netlink_new_key_attrs. PEER_ID and KEY_SLOT are ignored
+ * @OVPN_PEERS_ENTRY_ATTR_SECONDARY_KEY: same as above, for the secondary slot
+ * @OVPN_PEERS_ENTRY_ATTR_PEER_ID: OVPN_CMD_DEL_PEERS only, the peer ID
+ */
+enum ovpn_netlink_peers_entry_attrs {
+	OVPN_PEERS_ENTRY_ATTR_UNSPEC = 0,
+	OVPN_PEERS_ENTRY_ATTR_NEW_PEER,
+	OVPN_PEERS_ENTRY_ATTR_PRIMARY_KEY,
+	OVPN_PEERS_ENTRY_ATTR_SECONDARY_KEY,
+	OVPN_PEERS_ENTRY_ATTR_PEER_ID,
+
+	__OVPN_PEERS_ENTRY_ATTR_AFTER_LAST,
+	OVPN_PEERS_ENTRY_ATTR_MAX = __OVPN_PEERS_ENTRY_ATTR_AFTER_LAST - 1,
+};
+
+/**
+ * struct ovpn_peers_failure - failed entry of OVPN_CMD_NEW_PEERS or
+ * OVPN_CMD_DEL_PEERS, as listed in OVPN_PEERS_ATTR_FAILED
+ * @peer_id: the peer ID of the entry, 0 if it could not be parsed
+ * @error: negative error code
+ */
+struct ovpn_peers_failure {
+	__u32 peer_id;
+	__s32 error;
+};
+
 enum ovpn_netlink_get_peer_response_attrs {
 	OVPN_GET_PEER_RESP_ATTR_UNSPEC = 0,
 	OVPN_GET_PEER_RESP_ATTR_PEER_ID,
@@ -206,11 +395,165 @@ enum ovpn_netlink_get_peer_response_attrs {
 	OVPN_GET_PEER_RESP_ATTR_TX_BYTES,
 	OVPN_GET_PEER_RESP_ATTR_RX_PACKETS,
 	OVPN_GET_PEER_RESP_ATTR_TX_PACKETS,
+	OVPN_GET_PEER_RESP_ATTR_CRYPTO_ALLOC_FALLBACK,
+	OVPN_GET_PEER_RESP_ATTR_RX_BATCH_HIST,
+	OVPN_GET_PEER_RESP_ATTR_TX_BATCH_HIST,
+	OVPN_GET_PEER_RESP_ATTR_CPU,
+	OVPN_GET_PEER_RESP_ATTR_RX_PACKETS64,
+	OVPN_GET_PEER_RESP_ATTR_TX_PACKETS64,
+	OVPN_GET_PEER_RESP_ATTR_DROPS,
+	OVPN_GET_PEER_RESP_ATTR_TCP_SENDMSG_CALLS,
+	OVPN_GET_PEER_RESP_ATTR_TCP_SENDMSG_BYTES,
+	OVPN_GET_PEER_RESP_ATTR_RINGS,
+	OVPN_GET_PEER_RESP_ATTR_LATENCY,
+	OVPN_GET_PEER_RESP_ATTR_TX_HEADROOM_REALLOC,
+	OVPN_GET_PEER_RESP_ATTR_POOL_HITS,
+	OVPN_GET_PEER_RESP_ATTR_POOL_MISSES,
+	/* u64, to pass as OVPN_GET_PEER_ATTR_SINCE to get what changed after this reply */
+	OVPN_GET_PEER_RESP_ATTR_COOKIE,
 
 	__OVPN_GET_PEER_RESP_ATTR_AFTER_LAST,
 	OVPN_GET_PEER_RESP_ATTR_MAX = __OVPN_GET_PEER_RESP_ATTR_AFTER_LAST - 1,
 };
 
+/**
+ * Buckets of the OVPN_GET_PEER_RESP_ATTR_{RX,TX}_BATCH_HIST nested attributes:
+ * bucket N carries, as u64, the number of batches made of [2^N, 2^(N+1)) packets.
+ */
+enum ovpn_netlink_batch_hist_attrs {
+	OVPN_BATCH_HIST_ATTR_UNSPEC = 0,
+	OVPN_BATCH_HIST_ATTR_1,
+	OVPN_BATCH_HIST_ATTR_2,
+	OVPN_BATCH_HIST_ATTR_4,
+	OVPN_BATCH_HIST_ATTR_8,
+	OVPN_BATCH_HIST_ATTR_16,
+	OVPN_BATCH_HIST_ATTR_32,
+	OVPN_BATCH_HIST_ATTR_64,
+
+	__OVPN_BATCH_HIST_ATTR_AFTER_LAST,
+	OVPN_BATCH_HIST_ATTR_MAX = __OVPN_BATCH_HIST_ATTR_AFTER_LAST - 1,
+};
+
+/**
+ * Counters of the OVPN_GET_PEER_RESP_ATTR_DROPS nested attribute, each carrying as
+ * u64 the number of data channel packets dropped for that reason.
+ */
+enum ovpn_netlink_drop_attrs {
+	OVPN_DROP_ATTR_UNSPEC = 0,
+	/**
+	 * @OVPN_DROP_ATTR_NO_KEY: no key matching the key ID of the packet
+	 */
+	OVPN_DROP_ATTR_NO_KEY,
+	/**
+	 * @OVPN_DROP_ATTR_DECRYPT: authentication failed or packet malformed
+	 */
+	OVPN_DROP_ATTR_DECRYPT,
+	/**
+	 * @OVPN_DROP_ATTR_REPLAY: packet ID rejected by the replay protection
+	 */
+	OVPN_DROP_ATTR_REPLAY,
+	/**
+	 * @OVPN_DROP_ATTR_RPF: inner source address not belonging to the peer
+	 */
+	OVPN_DROP_ATTR_RPF,
+	/**
+	 * @OVPN_DROP_ATTR_RING_FULL: packet did not fit a queue of the peer
+	 */
+	OVPN_DROP_ATTR_RING_FULL,
+
+	__OVPN_DROP_ATTR_AFTER_LAST,
+	OVPN_DROP_ATTR_MAX = __OVPN_DROP_ATTR_AFTER_LAST - 1,
+};
+
+/**
+ * Queues of a peer reported in the OVPN_GET_PEER_RESP_ATTR_RINGS nested attribute,
+ * each being a nest of enum ovpn_netlink_ring_attrs. OVPN_PEER_RING_ATTR_TCP_TX is
+ * reported for TCP peers only
+ */
+enum ovpn_netlink_peer_ring_attrs {
+	OVPN_PEER_RING_ATTR_UNSPEC = 0,
+	OVPN_PEER_RING_ATTR_TX,
+	OVPN_PEER_RING_ATTR_RX,
+	OVPN_PEER_RING_ATTR_NETIF_RX,
+	OVPN_PEER_RING_ATTR_TCP_TX,
+
+	__OVPN_PEER_RING_ATTR_AFTER_LAST,
+	OVPN_PEER_RING_ATTR_MAX = __OVPN_PEER_RING_ATTR_AFTER_LAST - 1,
+};
+
+/**
+ * enum ovpn_netlink_ring_attrs - occupancy of a queue, sampled when replying
+ *
+ * @OVPN_RING_ATTR_LEN: packets in the queue (u32)
+ * @OVPN_RING_ATTR_SIZE: current capacity of the queue (u32)
+ */
+enum ovpn_netlink_ring_attrs {
+	OVPN_RING_ATTR_UNSPEC = 0,
+	OVPN_RING_ATTR_LEN,
+	OVPN_RING_ATTR_SIZE,
+
+	__OVPN_RING_ATTR_AFTER_LAST,
+	OVPN_RING_ATTR_MAX = __OVPN_RING_ATTR_AFTER_LAST - 1,
+};
+
+/**
+ * Stages of the data path reported in the OVPN_GET_PEER_RESP_ATTR_LATENCY nested
+ * attribute when IFLA_OVPN_LATENCY_STATS is enabled, each being a histogram as
+ * described by enum ovpn_netlink_latency_hist_attrs
+ */
+enum ovpn_netlink_latency_attrs {
+	OVPN_LATENCY_ATTR_UNSPEC = 0,
+	/**
+	 * @OVPN_LATENCY_ATTR_TX_QUEUE: from xmit to the start of encryption
+	 */
+	OVPN_LATENCY_ATTR_TX_QUEUE,
+	/**
+	 * @OVPN_LATENCY_ATTR_TX_CRYPTO: encryption, including the crypto engine queue
+	 */
+	OVPN_LATENCY_ATTR_TX_CRYPTO,
+	/**
+	 * @OVPN_LATENCY_ATTR_TX_SEND: from the end of encryption to the transport
+	 * socket, including reordering in parallel crypto mode
+	 */
+	OVPN_LATENCY_ATTR_TX_SEND,
+	/**
+	 * @OVPN_LATENCY_ATTR_RX_QUEUE: from the transport socket to the start of
+	 * decryption
+	 */
+	OVPN_LATENCY_ATTR_RX_QUEUE,
+	/**
+	 * @OVPN_LATENCY_ATTR_RX_CRYPTO: decryption, including the crypto engine queue
+	 */
+	OVPN_LATENCY_ATTR_RX_CRYPTO,
+	/**
+	 * @OVPN_LATENCY_ATTR_RX_DELIVER: from the end of decryption to NAPI, including
+	 * reordering in parallel crypto mode
+	 */
+	OVPN_LATENCY_ATTR_RX_DELIVER,
+
+	__OVPN_LATENCY_ATTR_AFTER_LAST,
+	OVPN_LATENCY_ATTR_MAX = __OVPN_LATENCY_ATTR_AFTER_LAST - 1,
+};
+
+/**
+ * Buckets of a latency histogram, each carrying as u64 the number of packets
+ * that spent the given time in the stage
+ */
+enum ovpn_netlink_latency_hist_attrs {
+	OVPN_LATENCY_HIST_ATTR_UNSPEC = 0,
+	OVPN_LATENCY_HIST_ATTR_LT_1US,
+	OVPN_LATENCY_HIST_ATTR_LT_4US,
+	OVPN_LATENCY_HIST_ATTR_LT_16US,
+	OVPN_LATENCY_HIST_ATTR_LT_64US,
+	OVPN_LATENCY_HIST_ATTR_LT_256US,
+	OVPN_LATENCY_HIST_ATTR_LT_1MS,
+	OVPN_LATENCY_HIST_ATTR_LT_4MS,
+	OVPN_LATENCY_HIST_ATTR_GE_4MS,
+
+	__OVPN_LATENCY_HIST_ATTR_AFTER_LAST,
+	OVPN_LATENCY_HIST_ATTR_MAX = __OVPN_LATENCY_HIST_ATTR_AFTER_LAST - 1,
+};
+
 enum ovpn_netlink_peer_stats_attrs {
 	OVPN_PEER_STATS_ATTR_UNSPEC = 0,
 	OVPN_PEER_STATS_BYTES,
@@ -250,11 +593,58 @@ enum ovpn_netlink_packet_attrs {
 enum ovpn_ifla_attrs {
 	IFLA_OVPN_UNSPEC = 0,
 	IFLA_OVPN_MODE,
+	IFLA_OVPN_PARALLEL_CRYPTO,
+	IFLA_OVPN_BATCH_SIZE,
+	IFLA_OVPN_CRYPTO_EXEC,
+	IFLA_OVPN_CRYPTO_CPUS,
+	/* u8 flag: in parallel crypto mode, encrypt each packet on the CPU matching its
+	 * TX queue rather than round-robin, so that flows stick to their own worker
+	 */
+	IFLA_OVPN_TX_STEERING,
+	/* u8 flag: timestamp packets at each stage of the data path and account
+	 * the time they spent there in per-peer histograms
+	 */
+	IFLA_OVPN_LATENCY_STATS,
+	/* u16: multicast OVPN_CMD_PEER_STATS every this many seconds, 0 (default) to
+	 * disable
+	 */
+	IFLA_OVPN_STATS_INTERVAL,
+	/* u8 flag: announce new peers to the "peers" multicast group with
+	 * OVPN_CMD_NEW_PEER
+	 */
+	IFLA_OVPN_PEER_NOTIFY,
 
 	__IFLA_OVPN_AFTER_LAST,
 	IFLA_OVPN_MAX = __IFLA_OVPN_AFTER_LAST - 1,
 };
 
+/**
+ * Execution context of the peer crypto, selected with IFLA_OVPN_CRYPTO_EXEC
+ */
+enum ovpn_crypto_exec {
+	__OVPN_CRYPTO_EXEC_FIRST = 0,
+	/**
+	 * @OVPN_CRYPTO_EXEC_WORKQUEUE: crypto is run by the device workqueue
+	 */
+	OVPN_CRYPTO_EXEC_WORKQUEUE = __OVPN_CRYPTO_EXEC_FIRST,
+	/**
+	 * @OVPN_CRYPTO_EXEC_KTHREAD: crypto of each peer is run by a kthread bound to
+	 * one of the CPUs set in IFLA_OVPN_CRYPTO_CPUS (a bitmap where bit N of byte
+	 * N / 8 stands for CPU N, all online CPUs by default). The CPU can be chosen
+	 * per peer with OVPN_NEW_PEER_ATTR_CPU
+	 */
+	OVPN_CRYPTO_EXEC_KTHREAD,
+	/**
+	 * @OVPN_CRYPTO_EXEC_INLINE: packets are encrypted and decrypted directly in
+	 * the xmit and receive softirq contexts when the cipher implementation is
+	 * synchronous. The device workqueue is used only when the peer rings are
+	 * backlogged or the cipher is asynchronous
+	 */
+	OVPN_CRYPTO_EXEC_INLINE,
+
+	__OVPN_CRYPTO_EXEC_AFTER_LAST,
+};
+
 enum ovpn_mode {
 	__OVPN_MODE_FIRST = 0,
 	OVPN_MODE_P2P = __OVPN_MODE_FIRST,
@@ -22,6 +22,15 @@
 #endif
 #endif
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+
+/* commit de4eda9de2d9 introduced ITER_SOURCE as an alias of WRITE */
+#ifndef ITER_SOURCE
+#define ITER_SOURCE WRITE
+#endif
+
+#endif /* LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0) */
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
 
 #define genl_split_ops genl_ops
@@ -111,6 +120,49 @@ static inline void dev_sw_netstats_rx_add(struct net_device *dev, unsigned int l
 	__tmp;								\
 })
 
+#include <linux/u64_stats_sync.h>
+#include <asm/local64.h>
+
+#if BITS_PER_LONG == 64
+typedef struct {
+	local64_t v;
+} u64_stats_t;
+
+static inline u64 u64_stats_read(const u64_stats_t *p)
+{
+	return local64_read(&p->v);
+}
+
+static inline void u64_stats_add(u64_stats_t *p, unsigned long val)
+{
+	local64_add(val, &p->v);
+}
+
+static inline void u64_stats_inc(u64_stats_t *p)
+{
+	local64_inc(&p->v);
+}
+#else
+typedef struct {
+	u64 v;
+} u64_stats_t;
+
+static inline u64 u64_stats_read(const u64_stats_t *p)
+{
+	return p->v;
+}
+
+static inline void u64_stats_add(u64_stats_t *p, unsigned long val)
+{
+	p->v += val;
+}
+
+static inline void u64_stats_inc(u64_stats_t *p)
+{
+	p->v++;
+}
+#endif
+
 #endif /* LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0) */
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 4, 0)
@@ -119,6 +171,14 @@ static inline void dev_sw_netstats_rx_add(struct net_device *dev, unsigned int l
 #undef nf_reset_ct
 #define nf_reset_ct nf_reset
 
+#include <linux/skbuff.h>
+
+/* commit 7240b60c98d6 introduced skb_frag_off() */
+static inline unsigned int skb_frag_off(const skb_frag_t *frag)
+{
+	return frag->page_offset;
+}
+
 #endif /* LINUX_VERSION_CODE < KERNEL_VERSION(5, 4, 0) */
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(5, 2, 0)
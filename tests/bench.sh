@@ -0,0 +1,204 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+# Copyright (C) 2022 OpenVPN, Inc.
+#
+#  Author:	Antonio Quartulli <antonio@openvpn.net>
+
+# Data path benchmark, built on the same topology as netns-test.sh: peer0 is
+# the MP server and every other peer runs iperf3 against it through the tunnel,
+# all at the same time.
+#
+# For each combination of transport, cipher and packet size, prints one line with:
+# - Mpps and Gbit/s received by peer0 on tun0 (i.e. decrypted packets);
+# - CPU cycles per packet, if perf is available;
+# - ping RTT percentiles, measured with the tunnel under load.
+#
+# Usage: bench.sh [-t] [-u], default is both transports
+#	-t: TCP transport only
+#	-u: UDP transport only
+#
+# Environment:
+#	NUM_PEERS: number of peers, defaults to the length of the peers file
+#	ALGS: ciphers to test (aes, chachapoly, none)
+#	SIZES: payload sizes in bytes passed to iperf3 -l
+#	DURATION: seconds per run
+#	BENCH_DIRECTION: -R to make peer0 send instead of receive
+
+#set -x
+set -e
+
+UDP_PEERS_FILE=${UDP_PEERS_FILE:-udp_peers.txt}
+TCP_PEERS_FILE=${TCP_PEERS_FILE:-tcp_peers.txt}
+OVPN_CLI=${OVPN_CLI:-./ovpn-cli}
+IPERF=${IPERF:-iperf3}
+ALGS=${ALGS:-aes chachapoly}
+SIZES=${SIZES:-64 512 1400}
+DURATION=${DURATION:-10}
+PING_COUNT=${PING_COUNT:-500}
+
+function cleanup() {
+	for p in $(seq 1 10); do
+		ip -n peer0 link del veth${p} 2>/dev/null || true
+	done
+	for p in $(seq 0 10); do
+		ip netns pids peer${p} 2>/dev/null | xargs -r kill 2>/dev/null || true
+		ip -n peer${p} link del tun0 2>/dev/null || true
+		ip netns del peer${p} 2>/dev/null || true
+	done
+}
+
+function setup() {
+	local tcp=$1 alg=$2 p
+
+	for p in $(seq 0 $NUM_PEERS); do
+		ip netns add peer${p}
+	done
+
+	for p in $(seq 1 $NUM_PEERS); do
+		ip link add veth${p} netns peer0 type veth peer name veth${p} netns peer${p}
+
+		ip -n peer0 addr add 10.10.${p}.1/24 dev veth${p}
+		ip -n peer0 link set veth${p} up
+
+		ip -n peer${p} addr add 10.10.${p}.2/24 dev veth${p}
+		ip -n peer${p} link set veth${p} up
+	done
+
+	for p in $(seq 0 $NUM_PEERS); do
+		ip -n peer${p} link add tun0 type ovpn-dco
+		ip -n peer${p} addr add 5.5.5.$((${p} + 1))/24 dev tun0
+		ip -n peer${p} link set tun0 up
+	done
+
+	if [ $tcp -eq 0 ]; then
+		ip netns exec peer0 $OVPN_CLI tun0 new_multi_peer 1 $UDP_PEERS_FILE
+		for p in $(seq 1 $NUM_PEERS); do
+			ip netns exec peer0 $OVPN_CLI tun0 new_key ${p} $alg 0 data64.key
+			ip netns exec peer${p} $OVPN_CLI tun0 new_peer 1 ${p} 10.10.${p}.1 1 5.5.5.1
+			ip netns exec peer${p} $OVPN_CLI tun0 new_key ${p} $alg 1 data64.key
+		done
+	else
+		(ip netns exec peer0 $OVPN_CLI tun0 listen 1 $TCP_PEERS_FILE && {
+			for p in $(seq 1 $NUM_PEERS); do
+				ip netns exec peer0 $OVPN_CLI tun0 new_key ${p} $alg 0 data64.key
+			done
+		}) &
+		sleep 2
+		for p in $(seq 1 $NUM_PEERS); do
+			ip netns exec peer${p} $OVPN_CLI tun0 connect ${p} 10.10.${p}.1 1 5.5.5.1
+			ip netns exec peer${p} $OVPN_CLI tun0 new_key ${p} $alg 1 data64.key
+		done
+		wait
+	fi
+
+	for p in $(seq 1 $NUM_PEERS); do
+		ip netns exec peer0 ping -qc 3 -w 5 5.5.5.$((${p} + 1)) >/dev/null
+	done
+}
+
+# print "<packets> <bytes>" received on tun0 in peer0
+function tun_counters() {
+	ip -n peer0 -s link show tun0 | awk '/RX:/ { getline; print $2, $1; exit }'
+}
+
+# print the p50/p90/p99 RTT in ms of a ping through the tunnel
+function rtt_percentiles() {
+	ip netns exec peer1 ping -i 0.01 -c $PING_COUNT 5.5.5.1 2>/dev/null |
+		sed -n 's/.*time=\([0-9.]*\).*/\1/p' | sort -n |
+		awk '{ rtt[NR] = $1 }
+		     END {
+			if (!NR) { print "n/a n/a n/a"; exit }
+			printf "%s %s %s\n", rtt[int(NR * 0.5) + 1], rtt[int(NR * 0.9) + 1],
+			       rtt[int(NR * 0.99) + 1]
+		     }'
+}
+
+function run() {
+	local tcp=$1 alg=$2 size=$3 proto=udp mode="-u -b 0" p
+	local cycles="n/a" perf_out rtt_out rtt
+
+	if [ $tcp -eq 1 ]; then
+		proto=tcp
+		mode=""
+	fi
+
+	# one single-shot server per client
+	for p in $(seq 1 $NUM_PEERS); do
+		ip netns exec peer0 $IPERF -s -D -1 -p $((5200 + p)) >/dev/null
+	done
+	sleep 0.5
+
+	read -r start_pkts start_bytes < <(tun_counters)
+
+	for p in $(seq 1 $NUM_PEERS); do
+		ip netns exec peer${p} $IPERF -c 5.5.5.1 -p $((5200 + p)) $mode -l $size \
+			-t $DURATION $BENCH_DIRECTION >/dev/null 2>&1 &
+	done
+
+	# latency is sampled while the tunnel is loaded
+	rtt_out=$(mktemp)
+	rtt_percentiles >$rtt_out &
+
+	perf_out=$(mktemp)
+	if command -v perf >/dev/null; then
+		perf stat -a -x, -e cycles -o $perf_out sleep $DURATION || true
+	else
+		sleep $DURATION
+	fi
+	wait
+	rtt=$(cat $rtt_out)
+	rm -f $rtt_out
+
+	read -r end_pkts end_bytes < <(tun_counters)
+
+	pkts=$((end_pkts - start_pkts))
+	bytes=$((end_bytes - start_bytes))
+	if [ -s $perf_out ] && [ $pkts -gt 0 ]; then
+		cycles=$(awk -F, -v pkts=$pkts '/cycles/ { printf "%d", $1 / pkts }' $perf_out)
+	fi
+	rm -f $perf_out
+
+	awk -v proto=$proto -v alg=$alg -v size=$size -v peers=$NUM_PEERS -v pkts=$pkts \
+	    -v bytes=$bytes -v t=$DURATION -v cycles=$cycles -v rtt="$rtt" \
+	    'BEGIN {
+		split(rtt, r, " ")
+		printf "%-4s %-10s %5u %5u %8.3f %8.3f %10s %8s %8s %8s\n", proto, alg, size,
+		       peers, pkts / t / 1e6, bytes * 8 / t / 1e9, cycles, r[1], r[2], r[3]
+	    }'
+}
+
+udp=1
+tcp=1
+if [ "$1" == "-t" ]; then
+	udp=0
+elif [ "$1" == "-u" ]; then
+	tcp=0
+fi
+
+printf "%-4s %-10s %5s %5s %8s %8s %10s %8s %8s %8s\n" proto alg size peers Mpps Gbit/s \
+	cycles/pkt p50ms p90ms p99ms
+
+for transport in 0 1; do
+	if [ $transport -eq 0 ] && [ $udp -eq 0 ]; then
+		continue
+	fi
+	if [ $transport -eq 1 ] && [ $tcp -eq 0 ]; then
+		continue
+	fi
+
+	if [ $transport -eq 0 ]; then
+		NUM_PEERS=${NUM_PEERS:-$(wc -l $UDP_PEERS_FILE | awk '{print $1}')}
+	else
+		NUM_PEERS=${NUM_PEERS:-$(wc -l $TCP_PEERS_FILE | awk '{print $1}')}
+	fi
+
+	for alg in $ALGS; do
+		cleanup
+		setup $transport $alg >/dev/null
+		for size in $SIZES; do
+			run $transport $alg $size
+		done
+	done
+done
+
+cleanup
@@ -0,0 +1,91 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+# Copyright (C) 2022 OpenVPN, Inc.
+#
+#  Author:	Antonio Quartulli <antonio@openvpn.net>
+
+# Overflow of the parallel crypto queues: two peers in parallel crypto mode flood
+# each other while the device-wide queues only have room for a couple of packets,
+# so that most packets are dropped after having entered the per-peer rings.
+#
+# The module must be loaded with a short queue, e.g.:
+#	modprobe ovpn-dco parallel_queue_len=2
+#
+# The test passes if packets were dropped, the kernel did not complain and the
+# tunnel still works once the flood is over.
+
+#set -x
+set -e
+
+OVPN_CLI=${OVPN_CLI:-./ovpn-cli}
+ALG=${ALG:-aes}
+FLOODS=${FLOODS:-4}
+QUEUE_LEN_PARAM=/sys/module/ovpn_dco/parameters/parallel_queue_len
+
+function cleanup() {
+	ip -n peer0 link del veth1 2>/dev/null || true
+	for p in 0 1; do
+		ip -n peer${p} link del tun0 2>/dev/null || true
+		ip netns del peer${p} 2>/dev/null || true
+	done
+}
+
+if [ ! -r $QUEUE_LEN_PARAM ] || [ $(cat $QUEUE_LEN_PARAM) -gt 16 ]; then
+	echo "load ovpn-dco with parallel_queue_len=2 first"
+	exit 1
+fi
+
+cleanup
+
+for p in 0 1; do
+	ip netns add peer${p}
+done
+
+ip link add veth1 netns peer0 type veth peer name veth1 netns peer1
+ip -n peer0 addr add 10.10.1.1/24 dev veth1
+ip -n peer0 link set veth1 up
+ip -n peer1 addr add 10.10.1.2/24 dev veth1
+ip -n peer1 link set veth1 up
+
+for p in 0 1; do
+	ip netns exec peer${p} $OVPN_CLI tun0 new_iface P2P parallel
+	ip -n peer${p} addr add 5.5.5.$((${p} + 1))/24 dev tun0
+	ip -n peer${p} link set tun0 up
+done
+
+ip netns exec peer0 $OVPN_CLI tun0 new_peer 1 1 10.10.1.2 1 5.5.5.2
+ip netns exec peer0 $OVPN_CLI tun0 new_key 1 $ALG 0 data64.key
+ip netns exec peer1 $OVPN_CLI tun0 new_peer 1 1 10.10.1.1 1 5.5.5.1
+ip netns exec peer1 $OVPN_CLI tun0 new_key 1 $ALG 1 data64.key
+
+ip netns exec peer0 ping -qc 3 -w 5 5.5.5.2
+
+dmesg_start=$(dmesg | wc -l)
+
+for i in $(seq 1 $FLOODS); do
+	ip netns exec peer1 ping -qfc 20000 -s 1400 -w 20 5.5.5.1 >/dev/null || true &
+	ip netns exec peer0 ping -qfc 20000 -s 1400 -w 20 5.5.5.2 >/dev/null || true &
+done
+wait
+
+drops=$(ip netns exec peer0 $OVPN_CLI tun0 get_peer 2>&1 |
+	sed -n 's/.*ring full: \([0-9]*\).*/\1/p')
+echo "packets dropped by peer0 on full queues: ${drops:-0}"
+
+if dmesg | tail -n +$((dmesg_start + 1)) | grep -E "BUG|WARNING|KASAN|refcount"; then
+	echo "kernel complained while the queues were overflowing"
+	exit 1
+fi
+
+# the key slots must have survived the dropped packets
+ip netns exec peer0 ping -qc 3 -w 5 5.5.5.2
+
+ip netns exec peer0 $OVPN_CLI tun0 del_peer 1
+ip netns exec peer1 $OVPN_CLI tun0 del_peer 1
+
+cleanup
+
+if [ -z "$drops" ] || [ $drops -eq 0 ]; then
+	echo "the flood did not overflow the queues, try a larger FLOODS"
+	exit 1
+fi
@@ -19,6 +19,8 @@
 #include <linux/ovpn_dco.h>
 #include <linux/types.h>
 #include <linux/netlink.h>
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
 
 #include <netlink/socket.h>
 #include <netlink/netlink.h>
@@ -86,6 +88,12 @@ struct ovpn_ctx {
 	__u32 keepalive_timeout;
 
 	enum ovpn_key_direction key_dir;
+
+	/* prefix of new_route and del_route, stored in peer_ip */
+	__u8 prefix_len;
+
+	/* get_peer dumps only the peers changed since this cookie, if not 0 */
+	__u64 since;
 };
 
 static int ovpn_nl_recvmsgs(struct nl_ctx *ctx)
@@ -659,6 +667,290 @@ nla_put_failure:
 	return ret;
 }
 
+/* create an ovpn-dco interface through rtnetlink, for the attributes iproute2 does not know */
+static int ovpn_new_iface(const char *ifname, enum ovpn_mode mode, bool parallel, bool steering,
+			  bool notify)
+{
+	struct ifinfomsg ifi = { .ifi_family = AF_UNSPEC };
+	struct nlattr *linkinfo, *data;
+	struct nl_sock *sock;
+	struct nl_msg *msg;
+	int ret;
+
+	sock = nl_socket_alloc();
+	if (!sock) {
+		fprintf(stderr, "cannot allocate netlink socket\n");
+		return -ENOMEM;
+	}
+
+	ret = nl_connect(sock, NETLINK_ROUTE);
+	if (ret) {
+		fprintf(stderr, "cannot connect to rtnetlink: %s\n", nl_geterror(ret));
+		goto free_sock;
+	}
+
+	msg = nlmsg_alloc_simple(RTM_NEWLINK, NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL);
+	if (!msg) {
+		ret = -ENOMEM;
+		goto free_sock;
+	}
+
+	ret = -1;
+	if (nlmsg_append(msg, &ifi, sizeof(ifi), NLMSG_ALIGNTO) < 0)
+		goto nla_put_failure;
+
+	NLA_PUT_STRING(msg, IFLA_IFNAME, ifname);
+	linkinfo = nla_nest_start(msg, IFLA_LINKINFO);
+	NLA_PUT_STRING(msg, IFLA_INFO_KIND, "ovpn-dco");
+	data = nla_nest_start(msg, IFLA_INFO_DATA);
+	NLA_PUT_U8(msg, IFLA_OVPN_MODE, mode);
+	if (parallel)
+		NLA_PUT_U8(msg, IFLA_OVPN_PARALLEL_CRYPTO, 1);
+	if (steering)
+		NLA_PUT_U8(msg, IFLA_OVPN_TX_STEERING, 1);
+	if (notify)
+		NLA_PUT_U8(msg, IFLA_OVPN_PEER_NOTIFY, 1);
+	nla_nest_end(msg, data);
+	nla_nest_end(msg, linkinfo);
+
+	ret = nl_send_auto(sock, msg);
+	if (ret >= 0)
+		ret = nl_wait_for_ack(sock);
+	if (ret < 0)
+		fprintf(stderr, "cannot create interface %s: %s\n", ifname, nl_geterror(ret));
+nla_put_failure:
+	nlmsg_free(msg);
+free_sock:
+	nl_socket_free(sock);
+	return ret;
+}
+
+static int ovpn_new_socket(struct ovpn_ctx *ovpn)
+{
+	struct nl_ctx *ctx;
+	int ret = -1;
+
+	ctx = nl_ctx_alloc(ovpn, OVPN_CMD_NEW_SOCKET);
+	if (!ctx)
+		return -ENOMEM;
+
+	NLA_PUT_U32(ctx->nl_msg, OVPN_ATTR_SOCKET, ovpn->socket);
+
+	ret = ovpn_nl_msg_send(ctx, NULL);
+nla_put_failure:
+	nl_ctx_free(ctx);
+	return ret;
+}
+
+static int ovpn_handle_peers(struct nl_msg *msg, void *arg)
+{
+	struct nlattr *attrs_peers[OVPN_PEERS_ATTR_MAX + 1];
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *attrs[OVPN_ATTR_MAX + 1];
+	const struct ovpn_peers_failure *failed;
+	unsigned int i, n = 0;
+
+	nla_parse(attrs, OVPN_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+		  genlmsg_attrlen(gnlh, 0), NULL);
+
+	if (!attrs[OVPN_ATTR_PEERS])
+		return NL_SKIP;
+
+	nla_parse_nested(attrs_peers, OVPN_PEERS_ATTR_MAX, attrs[OVPN_ATTR_PEERS], NULL);
+
+	if (attrs_peers[OVPN_PEERS_ATTR_FAILED]) {
+		failed = nla_data(attrs_peers[OVPN_PEERS_ATTR_FAILED]);
+		n = nla_len(attrs_peers[OVPN_PEERS_ATTR_FAILED]) / sizeof(*failed);
+
+		for (i = 0; i < n; i++)
+			fprintf(stderr, "peer %u failed: %s\n", failed[i].peer_id,
+				strerror(-failed[i].error));
+	}
+
+	if (attrs_peers[OVPN_PEERS_ATTR_N_FAILED] &&
+	    nla_get_u32(attrs_peers[OVPN_PEERS_ATTR_N_FAILED]) > n)
+		fprintf(stderr, "%u more peers failed\n",
+			nla_get_u32(attrs_peers[OVPN_PEERS_ATTR_N_FAILED]) - n);
+
+	return NL_SKIP;
+}
+
+static int ovpn_del_peers(struct ovpn_ctx *ovpn, int argc, char *argv[])
+{
+	struct nlattr *attr, *entry;
+	struct nl_ctx *ctx;
+	int i, ret = -1;
+
+	ctx = nl_ctx_alloc(ovpn, OVPN_CMD_DEL_PEERS);
+	if (!ctx)
+		return -ENOMEM;
+
+	attr = nla_nest_start(ctx->nl_msg, OVPN_ATTR_PEERS);
+	for (i = 0; i < argc; i++) {
+		entry = nla_nest_start(ctx->nl_msg, OVPN_PEERS_ATTR_ENTRY);
+		NLA_PUT_U32(ctx->nl_msg, OVPN_PEERS_ENTRY_ATTR_PEER_ID,
+			    strtoul(argv[i], NULL, 10));
+		nla_nest_end(ctx->nl_msg, entry);
+	}
+	nla_nest_end(ctx->nl_msg, attr);
+
+	ret = ovpn_nl_msg_send(ctx, ovpn_handle_peers);
+nla_put_failure:
+	nl_ctx_free(ctx);
+	return ret;
+}
+
+static int ovpn_route(struct ovpn_ctx *ovpn, enum ovpn_nl_commands cmd)
+{
+	struct nlattr *attr;
+	struct nl_ctx *ctx;
+	int ret = -1;
+
+	ctx = nl_ctx_alloc(ovpn, cmd);
+	if (!ctx)
+		return -ENOMEM;
+
+	attr = nla_nest_start(ctx->nl_msg, OVPN_ATTR_ROUTE);
+	if (cmd == OVPN_CMD_NEW_ROUTE)
+		NLA_PUT_U32(ctx->nl_msg, OVPN_ROUTE_ATTR_PEER_ID, ovpn->peer_id);
+
+	switch (ovpn->peer_ip.in4.sin_family) {
+	case AF_INET:
+		NLA_PUT_U32(ctx->nl_msg, OVPN_ROUTE_ATTR_IPV4, ovpn->peer_ip.in4.sin_addr.s_addr);
+		break;
+	case AF_INET6:
+		NLA_PUT(ctx->nl_msg, OVPN_ROUTE_ATTR_IPV6, sizeof(struct in6_addr),
+			&ovpn->peer_ip.in6.sin6_addr);
+		break;
+	default:
+		fprintf(stderr, "Invalid family for route prefix\n");
+		goto nla_put_failure;
+	}
+
+	NLA_PUT_U8(ctx->nl_msg, OVPN_ROUTE_ATTR_PREFIX_LEN, ovpn->prefix_len);
+	nla_nest_end(ctx->nl_msg, attr);
+
+	ret = ovpn_nl_msg_send(ctx, NULL);
+nla_put_failure:
+	nl_ctx_free(ctx);
+	return ret;
+}
+
+static void ovpn_print_batch_hist(const char *name, struct nlattr *attr)
+{
+	struct nlattr *buckets[OVPN_BATCH_HIST_ATTR_MAX + 1];
+	int i;
+
+	nla_parse(buckets, OVPN_BATCH_HIST_ATTR_MAX, nla_data(attr), nla_len(attr), NULL);
+
+	fprintf(stderr, "\t%s batches:", name);
+	for (i = OVPN_BATCH_HIST_ATTR_1; i <= OVPN_BATCH_HIST_ATTR_MAX; i++) {
+		if (!buckets[i])
+			continue;
+
+		fprintf(stderr, " %u%s: %" PRIu64, 1U << (i - OVPN_BATCH_HIST_ATTR_1),
+			i == OVPN_BATCH_HIST_ATTR_MAX ? "+" : "", nla_get_u64(buckets[i]));
+	}
+	fprintf(stderr, "\n");
+}
+
+static void ovpn_print_drops(struct nlattr *attr)
+{
+	static const char * const names[OVPN_DROP_ATTR_MAX + 1] = {
+		[OVPN_DROP_ATTR_NO_KEY] = "no key",
+		[OVPN_DROP_ATTR_DECRYPT] = "decrypt",
+		[OVPN_DROP_ATTR_REPLAY] = "replay",
+		[OVPN_DROP_ATTR_RPF] = "rpf",
+		[OVPN_DROP_ATTR_RING_FULL] = "ring full",
+	};
+	struct nlattr *drops[OVPN_DROP_ATTR_MAX + 1];
+	int i;
+
+	nla_parse(drops, OVPN_DROP_ATTR_MAX, nla_data(attr), nla_len(attr), NULL);
+
+	fprintf(stderr, "\tDrops:");
+	for (i = OVPN_DROP_ATTR_NO_KEY; i <= OVPN_DROP_ATTR_MAX; i++) {
+		if (!drops[i])
+			continue;
+
+		fprintf(stderr, " %s: %" PRIu64, names[i], nla_get_u64(drops[i]));
+	}
+	fprintf(stderr, "\n");
+}
+
+static void ovpn_print_rings(struct nlattr *attr)
+{
+	static const char * const names[OVPN_PEER_RING_ATTR_MAX + 1] = {
+		[OVPN_PEER_RING_ATTR_TX] = "tx",
+		[OVPN_PEER_RING_ATTR_RX] = "rx",
+		[OVPN_PEER_RING_ATTR_NETIF_RX] = "netif rx",
+		[OVPN_PEER_RING_ATTR_TCP_TX] = "tcp tx",
+	};
+	struct nlattr *rings[OVPN_PEER_RING_ATTR_MAX + 1];
+	struct nlattr *ring[OVPN_RING_ATTR_MAX + 1];
+	int i;
+
+	nla_parse(rings, OVPN_PEER_RING_ATTR_MAX, nla_data(attr), nla_len(attr), NULL);
+
+	fprintf(stderr, "	Rings:");
+	for (i = OVPN_PEER_RING_ATTR_TX; i <= OVPN_PEER_RING_ATTR_MAX; i++) {
+		if (!rings[i])
+			continue;
+
+		nla_parse(ring, OVPN_RING_ATTR_MAX, nla_data(rings[i]), nla_len(rings[i]), NULL);
+		if (!ring[OVPN_RING_ATTR_LEN] || !ring[OVPN_RING_ATTR_SIZE])
+			continue;
+
+		fprintf(stderr, " %s: %u/%u", names[i], nla_get_u32(ring[OVPN_RING_ATTR_LEN]),
+			nla_get_u32(ring[OVPN_RING_ATTR_SIZE]));
+	}
+	fprintf(stderr, "\n");
+}
+
+static void ovpn_print_latency(struct nlattr *attr)
+{
+	static const char * const stages[OVPN_LATENCY_ATTR_MAX + 1] = {
+		[OVPN_LATENCY_ATTR_TX_QUEUE] = "TX queue",
+		[OVPN_LATENCY_ATTR_TX_CRYPTO] = "TX crypto",
+		[OVPN_LATENCY_ATTR_TX_SEND] = "TX send",
+		[OVPN_LATENCY_ATTR_RX_QUEUE] = "RX queue",
+		[OVPN_LATENCY_ATTR_RX_CRYPTO] = "RX crypto",
+		[OVPN_LATENCY_ATTR_RX_DELIVER] = "RX deliver",
+	};
+	static const char * const buckets[OVPN_LATENCY_HIST_ATTR_MAX + 1] = {
+		[OVPN_LATENCY_HIST_ATTR_LT_1US] = "<1us",
+		[OVPN_LATENCY_HIST_ATTR_LT_4US] = "<4us",
+		[OVPN_LATENCY_HIST_ATTR_LT_16US] = "<16us",
+		[OVPN_LATENCY_HIST_ATTR_LT_64US] = "<64us",
+		[OVPN_LATENCY_HIST_ATTR_LT_256US] = "<256us",
+		[OVPN_LATENCY_HIST_ATTR_LT_1MS] = "<1ms",
+		[OVPN_LATENCY_HIST_ATTR_LT_4MS] = "<4ms",
+		[OVPN_LATENCY_HIST_ATTR_GE_4MS] = "4ms+",
+	};
+	struct nlattr *hist[OVPN_LATENCY_HIST_ATTR_MAX + 1];
+	struct nlattr *latency[OVPN_LATENCY_ATTR_MAX + 1];
+	int i, j;
+
+	nla_parse(latency, OVPN_LATENCY_ATTR_MAX, nla_data(attr), nla_len(attr), NULL);
+
+	for (i = OVPN_LATENCY_ATTR_TX_QUEUE; i <= OVPN_LATENCY_ATTR_MAX; i++) {
+		if (!latency[i])
+			continue;
+
+		nla_parse(hist, OVPN_LATENCY_HIST_ATTR_MAX, nla_data(latency[i]),
+			  nla_len(latency[i]), NULL);
+
+		fprintf(stderr, "\t%s latency:", stages[i]);
+		for (j = OVPN_LATENCY_HIST_ATTR_LT_1US; j <= OVPN_LATENCY_HIST_ATTR_MAX; j++) {
+			if (!hist[j])
+				continue;
+
+			fprintf(stderr, " %s: %" PRIu64, buckets[j], nla_get_u64(hist[j]));
+		}
+		fprintf(stderr, "\n");
+	}
+}
+
 static int ovpn_handle_peer(struct nl_msg *msg, void *arg)
 {
 	struct nlattr *attrs_peer[OVPN_GET_PEER_RESP_ATTR_MAX + 1];
@@ -681,6 +973,10 @@ static int ovpn_handle_peer(struct nl_msg *msg, void *arg)
 		fprintf(stderr, "* Peer %u\n",
 			nla_get_u32(attrs_peer[OVPN_GET_PEER_RESP_ATTR_PEER_ID]));
 
+	if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_COOKIE])
+		fprintf(stderr, "\tcookie: %llu\n",
+			nla_get_u64(attrs_peer[OVPN_GET_PEER_RESP_ATTR_COOKIE]));
+
 	if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_IPV4]) {
 		char buf[INET_ADDRSTRLEN];
 		inet_ntop(AF_INET, nla_data(attrs_peer[OVPN_GET_PEER_RESP_ATTR_IPV4]), buf,
@@ -750,14 +1046,63 @@ static int ovpn_handle_peer(struct nl_msg *msg, void *arg)
 		fprintf(stderr, "\tTX bytes: %" PRIu64 "\n",
 			nla_get_u64(attrs_peer[OVPN_GET_PEER_RESP_ATTR_TX_BYTES]));
 
-	if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_RX_PACKETS])
+	if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_RX_PACKETS64])
+		fprintf(stderr, "\tRX packets: %" PRIu64 "\n",
+			nla_get_u64(attrs_peer[OVPN_GET_PEER_RESP_ATTR_RX_PACKETS64]));
+	else if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_RX_PACKETS])
 		fprintf(stderr, "\tRX packets: %u\n",
 			nla_get_u32(attrs_peer[OVPN_GET_PEER_RESP_ATTR_RX_PACKETS]));
 
-	if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_TX_PACKETS])
+	if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_TX_PACKETS64])
+		fprintf(stderr, "\tTX packets: %" PRIu64 "\n",
+			nla_get_u64(attrs_peer[OVPN_GET_PEER_RESP_ATTR_TX_PACKETS64]));
+	else if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_TX_PACKETS])
 		fprintf(stderr, "\tTX packets: %u\n",
 			nla_get_u32(attrs_peer[OVPN_GET_PEER_RESP_ATTR_TX_PACKETS]));
 
+	if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_DROPS])
+		ovpn_print_drops(attrs_peer[OVPN_GET_PEER_RESP_ATTR_DROPS]);
+
+	if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_CRYPTO_ALLOC_FALLBACK])
+		fprintf(stderr, "\tCrypto alloc fallbacks: %" PRIu64 "\n",
+			nla_get_u64(attrs_peer[OVPN_GET_PEER_RESP_ATTR_CRYPTO_ALLOC_FALLBACK]));
+
+	if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_TX_HEADROOM_REALLOC])
+		fprintf(stderr, "\tTX headroom reallocations: %" PRIu64 "\n",
+			nla_get_u64(attrs_peer[OVPN_GET_PEER_RESP_ATTR_TX_HEADROOM_REALLOC]));
+
+	if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_POOL_HITS] &&
+	    attrs_peer[OVPN_GET_PEER_RESP_ATTR_POOL_MISSES])
+		fprintf(stderr, "\tPage pool hits/misses: %" PRIu64 "/%" PRIu64 "\n",
+			nla_get_u64(attrs_peer[OVPN_GET_PEER_RESP_ATTR_POOL_HITS]),
+			nla_get_u64(attrs_peer[OVPN_GET_PEER_RESP_ATTR_POOL_MISSES]));
+
+	if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_CPU])
+		fprintf(stderr, "\tCrypto CPU: %u\n",
+			nla_get_u32(attrs_peer[OVPN_GET_PEER_RESP_ATTR_CPU]));
+
+	if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_TCP_SENDMSG_CALLS] &&
+	    attrs_peer[OVPN_GET_PEER_RESP_ATTR_TCP_SENDMSG_BYTES]) {
+		uint64_t calls, bytes;
+
+		calls = nla_get_u64(attrs_peer[OVPN_GET_PEER_RESP_ATTR_TCP_SENDMSG_CALLS]);
+		bytes = nla_get_u64(attrs_peer[OVPN_GET_PEER_RESP_ATTR_TCP_SENDMSG_BYTES]);
+		fprintf(stderr, "\tTCP sendmsg: %" PRIu64 " calls, %" PRIu64 " bytes/call\n",
+			calls, calls ? bytes / calls : 0);
+	}
+
+	if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_RX_BATCH_HIST])
+		ovpn_print_batch_hist("RX", attrs_peer[OVPN_GET_PEER_RESP_ATTR_RX_BATCH_HIST]);
+
+	if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_TX_BATCH_HIST])
+		ovpn_print_batch_hist("TX", attrs_peer[OVPN_GET_PEER_RESP_ATTR_TX_BATCH_HIST]);
+
+	if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_RINGS])
+		ovpn_print_rings(attrs_peer[OVPN_GET_PEER_RESP_ATTR_RINGS]);
+
+	if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_LATENCY])
+		ovpn_print_latency(attrs_peer[OVPN_GET_PEER_RESP_ATTR_LATENCY]);
+
 	return NL_SKIP;
 }
 
@@ -774,10 +1119,14 @@ static int ovpn_get_peer(struct ovpn_ctx *ovpn)
 	if (!ctx)
 		return -ENOMEM;
 
-	if (ovpn->peer_id >= 0) {
+	if (ovpn->peer_id != PEER_ID_UNDEF) {
 		attr = nla_nest_start(ctx->nl_msg, OVPN_ATTR_GET_PEER);
 		NLA_PUT_U32(ctx->nl_msg, OVPN_GET_PEER_ATTR_PEER_ID, ovpn->peer_id);
 		nla_nest_end(ctx->nl_msg, attr);
+	} else if (ovpn->since) {
+		attr = nla_nest_start(ctx->nl_msg, OVPN_ATTR_GET_PEER);
+		NLA_PUT_U64(ctx->nl_msg, OVPN_GET_PEER_ATTR_SINCE, ovpn->since);
+		nla_nest_end(ctx->nl_msg, attr);
 	}
 
 	ret = ovpn_nl_msg_send(ctx, ovpn_handle_peer);
@@ -1044,6 +1393,13 @@ static int ovpn_handle_msg(struct nl_msg *msg, void *arg)
 		*/
 		fprintf(stdout, "received CMD_DEL_PEER\n");
 		break;
+	case OVPN_CMD_NEW_PEER:
+		fprintf(stdout, "received CMD_NEW_PEER\n");
+		break;
+	case OVPN_CMD_PEER_STATS:
+		fprintf(stdout, "received CMD_PEER_STATS\n");
+		ovpn_handle_peer(msg, arg);
+		break;
 	default:
 		fprintf(stderr, "received unknown command: %d\n", gnlh->cmd);
 		return NL_STOP;
@@ -1155,10 +1511,15 @@ static void usage(const char *cmd)
 {
 	fprintf(stderr, "Error: invalid arguments.\n\n");
 	fprintf(stderr,
-		"Usage %s <iface> <connect|listen|new_peer|new_multi_peer|set_peer|del_peer|new_key|del_key|recv|send|listen_mcast> [arguments..]\n",
+		"Usage %s <iface> <new_iface|connect|listen|new_peer|new_multi_peer|set_peer|del_peer|new_key|del_key|recv|send|listen_mcast> [arguments..]\n",
 		cmd);
 	fprintf(stderr, "\tiface: tun interface name\n\n");
 
+	fprintf(stderr, "* new_iface [P2P|MP] [parallel] [steering] [notify]: create the interface\n");
+	fprintf(stderr, "\tparallel: spread the crypto of each peer across all CPUs\n");
+	fprintf(stderr, "\tsteering: encrypt packets on the CPU of their TX queue\n");
+	fprintf(stderr, "\tnotify: announce new peers to the peers multicast group\n\n");
+
 	fprintf(stderr, "* connect <peer_id> <raddr> <rport> <vpnaddr>: start connecting peer of TCP-based VPN session\n");
 	fprintf(stderr, "\tpeer-id: peer ID of the connecting peer\n");
 	fprintf(stderr, "\tremote-addr: peer IP address\n");
@@ -1177,10 +1538,11 @@ static void usage(const char *cmd)
 	fprintf(stderr, "\tremote-port: peer UDP port\n");
 	fprintf(stderr, "\tvpnaddr: peer VPN IP\n\n");
 
-	fprintf(stderr, "* new_multi_peer <lport> <file>: add multiple peers as listed in the file\n");
+	fprintf(stderr, "* new_multi_peer <lport> <file> [<sockets>]: add multiple peers as listed in the file\n");
 	fprintf(stderr, "\tlport: local UDP port to bind to\n");
 	fprintf(stderr, "\tfile: text file containing one peer per line. Line format:\n");
-	fprintf(stderr, "\t\t<peer-id> <raddr> <rport> <vpnaddr>\n\n");
+	fprintf(stderr, "\t\t<peer-id> <raddr> <rport> <vpnaddr>\n");
+	fprintf(stderr, "\tsockets: number of reuseport sockets sharing the port, defaults to 1\n\n");
 
 	fprintf(stderr,
 		"* set_peer <peer-id> <keepalive_interval> <keepalive_timeout>: set peer attributes\n");
@@ -1193,6 +1555,19 @@ static void usage(const char *cmd)
 	fprintf(stderr, "* del_peer <peer-id>: delete peer\n");
 	fprintf(stderr, "\tpeer-id: peer ID of the peer to delete\n\n");
 
+	fprintf(stderr, "* del_peers <peer-id> [<peer-id> ...]: delete many peers at once\n\n");
+
+	fprintf(stderr, "* get_peer [<peer-id> | since <cookie>]: show one or all peers\n");
+	fprintf(stderr, "\tpeer-id: peer ID of the peer to show\n");
+	fprintf(stderr, "\tcookie: show only the peers changed since a previous dump\n\n");
+
+	fprintf(stderr, "* new_route <peer-id> <prefix>/<len>: route a VPN prefix to a peer\n");
+	fprintf(stderr, "\tpeer-id: peer ID of the peer to route the prefix to\n");
+	fprintf(stderr, "\tprefix: IPv4 or IPv6 prefix\n");
+	fprintf(stderr, "\tlen: prefix length, defaults to the full address\n\n");
+
+	fprintf(stderr, "* del_route <prefix>/<len>: remove the route of a VPN prefix\n\n");
+
 	fprintf(stderr,
 		"* new_key <peer-id> <cipher> <key_dir> <key_file>: set data channel key\n");
 	fprintf(stderr, "\tpeer-id: peer ID of the peer to configure the key for\n");
@@ -1272,6 +1647,40 @@ static int ovpn_parse_new_peer(struct ovpn_ctx *ovpn, const char *peer_id, const
 	return ovpn_parse_remote(ovpn, raddr, rport, vpnip);
 }
 
+static int ovpn_parse_prefix(struct ovpn_ctx *ovpn, char *prefix)
+{
+	char *len = strchr(prefix, '/');
+
+	if (len)
+		*len++ = '\0';
+
+	memset(&ovpn->peer_ip, 0, sizeof(ovpn->peer_ip));
+
+	if (inet_pton(AF_INET, prefix, &ovpn->peer_ip.in4.sin_addr) == 1) {
+		ovpn->peer_ip.in4.sin_family = AF_INET;
+		ovpn->prefix_len = 32;
+	} else if (inet_pton(AF_INET6, prefix, &ovpn->peer_ip.in6.sin6_addr) == 1) {
+		ovpn->peer_ip.in6.sin6_family = AF_INET6;
+		ovpn->prefix_len = 128;
+	} else {
+		fprintf(stderr, "invalid prefix %s\n", prefix);
+		return -1;
+	}
+
+	if (len) {
+		unsigned long val = strtoul(len, NULL, 10);
+
+		if (val > ovpn->prefix_len) {
+			fprintf(stderr, "prefix length out of range\n");
+			return -1;
+		}
+
+		ovpn->prefix_len = val;
+	}
+
+	return 0;
+}
+
 static int ovpn_parse_set_peer(struct ovpn_ctx *ovpn, int argc, char *argv[])
 {
 	if (argc < 5) {
@@ -1308,6 +1717,30 @@ int main(int argc, char *argv[])
 	memset(&ovpn, 0, sizeof(ovpn));
 	ovpn.sa_family = AF_INET;
 
+	/* the only command not expecting the interface to exist */
+	if (!strcmp(argv[2], "new_iface")) {
+		enum ovpn_mode mode = OVPN_MODE_P2P;
+		bool parallel = false, steering = false, notify = false;
+		int i;
+
+		for (i = 3; i < argc; i++) {
+			if (!strcmp(argv[i], "MP")) {
+				mode = OVPN_MODE_MP;
+			} else if (!strcmp(argv[i], "parallel")) {
+				parallel = true;
+			} else if (!strcmp(argv[i], "steering")) {
+				steering = true;
+			} else if (!strcmp(argv[i], "notify")) {
+				notify = true;
+			} else if (strcmp(argv[i], "P2P")) {
+				usage(argv[0]);
+				return -1;
+			}
+		}
+
+		return ovpn_new_iface(argv[1], mode, parallel, steering, notify);
+	}
+
 	ovpn.ifindex = if_nametoindex(argv[1]);
 	if (!ovpn.ifindex) {
 		fprintf(stderr, "cannot find interface: %s\n",
@@ -1423,6 +1856,7 @@ int main(int argc, char *argv[])
 		}
 	} else if (!strcmp(argv[2], "new_multi_peer")) {
 		char peer_id[10], raddr[128], rport[10], vpnip[100];
+		unsigned int i, n_socks = 1;
 		FILE *fp;
 		int n;
 
@@ -1443,9 +1877,29 @@ int main(int argc, char *argv[])
 			return -1;
 		}
 
-		ret = ovpn_udp_socket(&ovpn, AF_INET6);
-		if (ret < 0)
-			return ret;
+		if (argc > 5) {
+			n_socks = strtoul(argv[5], NULL, 10);
+			if (!n_socks) {
+				usage(argv[0]);
+				return -1;
+			}
+		}
+
+		/* the peers use the last socket, all of them being equivalent */
+		for (i = 0; i < n_socks; i++) {
+			ret = ovpn_udp_socket(&ovpn, AF_INET6);
+			if (ret < 0)
+				return ret;
+
+			if (n_socks == 1)
+				break;
+
+			ret = ovpn_new_socket(&ovpn);
+			if (ret < 0) {
+				fprintf(stderr, "cannot add socket to VPN: %d\n", ret);
+				return ret;
+			}
+		}
 
 		while ((n = fscanf(fp, "%s %s %s %s\n", peer_id, raddr, rport, vpnip)) == 4) {
 			struct ovpn_ctx peer_ctx = { 0 };
@@ -1503,9 +1957,58 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "cannot delete peer to VPN\n");
 			return ret;
 		}
+	} else if (!strcmp(argv[2], "del_peers")) {
+		if (argc < 4) {
+			usage(argv[0]);
+			return -1;
+		}
+
+		ret = ovpn_del_peers(&ovpn, argc - 3, argv + 3);
+		if (ret < 0) {
+			fprintf(stderr, "cannot delete peers from VPN\n");
+			return ret;
+		}
+	} else if (!strcmp(argv[2], "new_route")) {
+		if (argc < 5) {
+			usage(argv[0]);
+			return -1;
+		}
+
+		ovpn.peer_id = strtoul(argv[3], NULL, 10);
+		if (errno == ERANGE) {
+			fprintf(stderr, "peer ID value out of range\n");
+			return -1;
+		}
+
+		ret = ovpn_parse_prefix(&ovpn, argv[4]);
+		if (ret < 0)
+			return ret;
+
+		ret = ovpn_route(&ovpn, OVPN_CMD_NEW_ROUTE);
+		if (ret < 0) {
+			fprintf(stderr, "cannot add route\n");
+			return ret;
+		}
+	} else if (!strcmp(argv[2], "del_route")) {
+		if (argc < 4) {
+			usage(argv[0]);
+			return -1;
+		}
+
+		ret = ovpn_parse_prefix(&ovpn, argv[3]);
+		if (ret < 0)
+			return ret;
+
+		ret = ovpn_route(&ovpn, OVPN_CMD_DEL_ROUTE);
+		if (ret < 0) {
+			fprintf(stderr, "cannot delete route\n");
+			return ret;
+		}
 	} else if (!strcmp(argv[2], "get_peer")) {
 		ovpn.peer_id = PEER_ID_UNDEF;
-		if (argc > 3)
+		if (argc > 4 && !strcmp(argv[3], "since"))
+			ovpn.since = strtoull(argv[4], NULL, 10);
+		else if (argc > 3)
 			ovpn.peer_id = strtoul(argv[3], NULL, 10);
 
 		fprintf(stderr, "List of peers connected to: %s\n", argv[1]);
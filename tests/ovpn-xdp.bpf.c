@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: GPL-2.0
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+/* XDP demux of DATA_V2 packets, attached by ovpn-xdp to the interface(s) facing the
+ * clients of an MP server.
+ *
+ * DATA_V2 packets sent to the ovpn UDP port are dropped right at the driver when
+ * malformed or carrying an unknown peer ID, before reaching the UDP stack. Packets
+ * of known peers are redirected to the CPU running the crypto worker of the peer,
+ * if any. Anything else (control channel, other traffic) is passed untouched.
+ *
+ * ovpn_peers mirrors the peer table of the ovpn interface and is kept in sync by
+ * ovpn-xdp with the "peers" multicast group.
+ */
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+
+#include <bpf/bpf_endian.h>
+#include <bpf/bpf_helpers.h>
+
+#include "ovpn-xdp.h"
+
+/* see drivers/net/ovpn-dco/proto.h */
+#define OVPN_OPCODE_SHIFT 3
+#define OVPN_DATA_V2 9
+#define OVPN_PEER_ID_MASK 0x00FFFFFF
+#define OVPN_PEER_ID_UNDEF 0x00FFFFFF
+/* opcode/key-id + peer-id, packet ID and AEAD tag */
+#define OVPN_DATA_V2_MIN_LEN (4 + 4 + 16)
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, __u32);
+	__type(value, struct ovpn_xdp_config);
+} ovpn_config SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, OVPN_XDP_MAX_PEERS);
+	__type(key, __u32);
+	__type(value, struct ovpn_xdp_peer);
+} ovpn_peers SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, __OVPN_XDP_STAT_MAX);
+	__type(key, __u32);
+	__type(value, __u64);
+} ovpn_stats SEC(".maps");
+
+/* max_entries is set to the number of possible CPUs by the loader */
+struct {
+	__uint(type, BPF_MAP_TYPE_CPUMAP);
+	__uint(max_entries, 1);
+	__type(key, __u32);
+	__type(value, struct bpf_cpumap_val);
+} ovpn_cpus SEC(".maps");
+
+static __always_inline int ovpn_xdp_count(__u32 stat, int action)
+{
+	__u64 *counter = bpf_map_lookup_elem(&ovpn_stats, &stat);
+
+	if (counter)
+		(*counter)++;
+
+	return action;
+}
+
+/* Return the UDP header of the packet, or NULL if not UDP */
+static __always_inline struct udphdr *ovpn_xdp_udp(void *data, void *data_end)
+{
+	struct ethhdr *eth = data;
+	struct ipv6hdr *ip6;
+	struct iphdr *ip4;
+
+	if ((void *)(eth + 1) > data_end)
+		return NULL;
+
+	switch (eth->h_proto) {
+	case bpf_htons(ETH_P_IP):
+		ip4 = (void *)(eth + 1);
+		if ((void *)(ip4 + 1) > data_end || ip4->protocol != IPPROTO_UDP)
+			return NULL;
+		/* fragments are reassembled by the stack */
+		if (ip4->frag_off & bpf_htons(0x3fff))
+			return NULL;
+		return (void *)ip4 + ip4->ihl * 4;
+	case bpf_htons(ETH_P_IPV6):
+		ip6 = (void *)(eth + 1);
+		/* extension headers are left to the stack */
+		if ((void *)(ip6 + 1) > data_end || ip6->nexthdr != IPPROTO_UDP)
+			return NULL;
+		return (void *)(ip6 + 1);
+	default:
+		return NULL;
+	}
+}
+
+SEC("xdp")
+int ovpn_xdp_demux(struct xdp_md *ctx)
+{
+	void *data_end = (void *)(long)ctx->data_end;
+	void *data = (void *)(long)ctx->data;
+	struct ovpn_xdp_config *config;
+	struct ovpn_xdp_peer *peer;
+	struct udphdr *udp;
+	__u32 zero = 0, id;
+	__u8 *payload;
+
+	config = bpf_map_lookup_elem(&ovpn_config, &zero);
+	if (!config)
+		return XDP_PASS;
+
+	udp = ovpn_xdp_udp(data, data_end);
+	if (!udp || (void *)(udp + 1) > data_end || udp->dest != config->port)
+		return XDP_PASS;
+
+	payload = (void *)(udp + 1);
+	if ((void *)(payload + 1) > data_end || payload[0] >> OVPN_OPCODE_SHIFT != OVPN_DATA_V2)
+		return XDP_PASS;
+
+	if ((void *)(payload + OVPN_DATA_V2_MIN_LEN) > data_end)
+		return ovpn_xdp_count(OVPN_XDP_STAT_MALFORMED, XDP_DROP);
+
+	id = ((__u32)payload[1] << 16 | (__u32)payload[2] << 8 | payload[3]) & OVPN_PEER_ID_MASK;
+	/* looked up by transport address in the kernel */
+	if (id == OVPN_PEER_ID_UNDEF)
+		return XDP_PASS;
+
+	peer = bpf_map_lookup_elem(&ovpn_peers, &id);
+	if (!peer)
+		return ovpn_xdp_count(OVPN_XDP_STAT_UNKNOWN_PEER, XDP_DROP);
+
+	if (peer->cpu < 0)
+		return ovpn_xdp_count(OVPN_XDP_STAT_PASS, XDP_PASS);
+
+	ovpn_xdp_count(OVPN_XDP_STAT_REDIRECT, XDP_REDIRECT);
+	return bpf_redirect_map(&ovpn_cpus, peer->cpu, XDP_PASS);
+}
+
+char _license[] SEC("license") = "GPL";
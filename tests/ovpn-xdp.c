@@ -0,0 +1,374 @@
+// SPDX-License-Identifier: GPL-2.0
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+/* Loader of ovpn-xdp.bpf.o: attaches the DATA_V2 demux to the interface facing the
+ * clients and mirrors the peer table of an ovpn MP interface into its ovpn_peers map,
+ * first by dumping the peers and then by following the "peers" multicast group,
+ * until interrupted. New peers are announced only by interfaces created with
+ * IFLA_OVPN_PEER_NOTIFY.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include <linux/ovpn_dco.h>
+#include <linux/if_link.h>
+#include <linux/types.h>
+
+#include <netlink/socket.h>
+#include <netlink/netlink.h>
+#include <netlink/genl/genl.h>
+#include <netlink/genl/family.h>
+#include <netlink/genl/ctrl.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "ovpn-xdp.h"
+
+struct ovpn_xdp_ctx {
+	unsigned int ovpn_ifindex;
+	unsigned int ifindex;
+	__u32 xdp_flags;
+
+	struct bpf_object *obj;
+	int peers_fd;
+	int stats_fd;
+};
+
+static volatile sig_atomic_t ovpn_xdp_stop;
+
+static void ovpn_xdp_signal(int sig)
+{
+	ovpn_xdp_stop = 1;
+}
+
+static void ovpn_xdp_peer_update(struct ovpn_xdp_ctx *ctx, __u32 peer_id, __s32 cpu)
+{
+	struct ovpn_xdp_peer peer = { .cpu = cpu };
+
+	if (bpf_map_update_elem(ctx->peers_fd, &peer_id, &peer, BPF_ANY))
+		fprintf(stderr, "cannot add peer %u to map: %s\n", peer_id, strerror(errno));
+}
+
+static void ovpn_xdp_peer_delete(struct ovpn_xdp_ctx *ctx, __u32 peer_id)
+{
+	if (bpf_map_delete_elem(ctx->peers_fd, &peer_id) && errno != ENOENT)
+		fprintf(stderr, "cannot remove peer %u from map: %s\n", peer_id, strerror(errno));
+}
+
+/* handle OVPN_CMD_GET_PEER replies and OVPN_CMD_NEW_PEER/DEL_PEER notifications */
+static int ovpn_xdp_handle_msg(struct nl_msg *msg, void *arg)
+{
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *attrs_peer[OVPN_GET_PEER_RESP_ATTR_MAX + 1];
+	struct nlattr *attrs_del[OVPN_DEL_PEER_ATTR_MAX + 1];
+	struct nlattr *attrs[OVPN_ATTR_MAX + 1];
+	struct ovpn_xdp_ctx *ctx = arg;
+	__s32 cpu = -1;
+
+	if (nla_parse(attrs, OVPN_ATTR_MAX, genlmsg_attrdata(gnlh, 0), genlmsg_attrlen(gnlh, 0),
+		      NULL))
+		return NL_SKIP;
+
+	/* notifications are sent for all the ovpn interfaces of the namespace */
+	if (gnlh->cmd != OVPN_CMD_GET_PEER &&
+	    (!attrs[OVPN_ATTR_IFINDEX] || nla_get_u32(attrs[OVPN_ATTR_IFINDEX]) != ctx->ovpn_ifindex))
+		return NL_SKIP;
+
+	switch (gnlh->cmd) {
+	case OVPN_CMD_GET_PEER:
+	case OVPN_CMD_NEW_PEER:
+		if (!attrs[OVPN_ATTR_GET_PEER])
+			return NL_SKIP;
+
+		nla_parse(attrs_peer, OVPN_GET_PEER_RESP_ATTR_MAX,
+			  nla_data(attrs[OVPN_ATTR_GET_PEER]), nla_len(attrs[OVPN_ATTR_GET_PEER]),
+			  NULL);
+		if (!attrs_peer[OVPN_GET_PEER_RESP_ATTR_PEER_ID])
+			return NL_SKIP;
+
+		if (attrs_peer[OVPN_GET_PEER_RESP_ATTR_CPU])
+			cpu = nla_get_u32(attrs_peer[OVPN_GET_PEER_RESP_ATTR_CPU]);
+
+		ovpn_xdp_peer_update(ctx, nla_get_u32(attrs_peer[OVPN_GET_PEER_RESP_ATTR_PEER_ID]),
+				     cpu);
+		break;
+	case OVPN_CMD_DEL_PEER:
+		if (!attrs[OVPN_ATTR_DEL_PEER])
+			return NL_SKIP;
+
+		nla_parse(attrs_del, OVPN_DEL_PEER_ATTR_MAX, nla_data(attrs[OVPN_ATTR_DEL_PEER]),
+			  nla_len(attrs[OVPN_ATTR_DEL_PEER]), NULL);
+		if (!attrs_del[OVPN_DEL_PEER_ATTR_PEER_ID])
+			return NL_SKIP;
+
+		ovpn_xdp_peer_delete(ctx, nla_get_u32(attrs_del[OVPN_DEL_PEER_ATTR_PEER_ID]));
+		break;
+	default:
+		break;
+	}
+
+	return NL_OK;
+}
+
+static int ovpn_xdp_seq_check(struct nl_msg *msg, void *arg)
+{
+	return NL_OK;
+}
+
+static struct nl_sock *ovpn_xdp_nl_socket(void)
+{
+	struct nl_sock *sock;
+	int ret;
+
+	sock = nl_socket_alloc();
+	if (!sock) {
+		fprintf(stderr, "cannot allocate netlink socket\n");
+		return NULL;
+	}
+
+	ret = genl_connect(sock);
+	if (ret < 0) {
+		fprintf(stderr, "cannot connect to generic netlink: %s\n", nl_geterror(ret));
+		nl_socket_free(sock);
+		return NULL;
+	}
+
+	return sock;
+}
+
+/* fill the peers map with the peers existing at startup */
+static int ovpn_xdp_dump_peers(struct ovpn_xdp_ctx *ctx)
+{
+	struct nl_sock *sock;
+	struct nl_msg *msg;
+	int family, ret = -ENOMEM;
+
+	sock = ovpn_xdp_nl_socket();
+	if (!sock)
+		return -ENOMEM;
+
+	family = genl_ctrl_resolve(sock, OVPN_NL_NAME);
+	if (family < 0) {
+		fprintf(stderr, "cannot find ovpn-dco netlink component: %d\n", family);
+		ret = family;
+		goto err_sock;
+	}
+
+	msg = nlmsg_alloc();
+	if (!msg)
+		goto err_sock;
+
+	genlmsg_put(msg, NL_AUTO_PORT, NL_AUTO_SEQ, family, 0, NLM_F_DUMP, OVPN_CMD_GET_PEER,
+		    0);
+	NLA_PUT_U32(msg, OVPN_ATTR_IFINDEX, ctx->ovpn_ifindex);
+
+	nl_socket_modify_cb(sock, NL_CB_VALID, NL_CB_CUSTOM, ovpn_xdp_handle_msg, ctx);
+
+	ret = nl_send_auto(sock, msg);
+	if (ret >= 0)
+		ret = nl_recvmsgs_default(sock);
+	if (ret < 0)
+		fprintf(stderr, "cannot dump peers: %s\n", nl_geterror(ret));
+
+nla_put_failure:
+	nlmsg_free(msg);
+err_sock:
+	nl_socket_free(sock);
+	return ret;
+}
+
+/* size the CPU map to all the possible CPUs, so that any crypto worker can be targeted */
+static void ovpn_xdp_setup_cpus(int fd)
+{
+	struct bpf_cpumap_val val = { .qsize = 2048 };
+	int cpus = libbpf_num_possible_cpus();
+	__u32 cpu;
+
+	for (cpu = 0; cpu < cpus; cpu++) {
+		/* offline CPUs are refused, packets for them are just passed */
+		bpf_map_update_elem(fd, &cpu, &val, BPF_ANY);
+	}
+}
+
+static int ovpn_xdp_load(struct ovpn_xdp_ctx *ctx, const char *path, __u16 port)
+{
+	struct ovpn_xdp_config config = { .port = htons(port) };
+	struct bpf_program *prog;
+	struct bpf_map *cpus;
+	__u32 zero = 0;
+	int ret;
+
+	ctx->obj = bpf_object__open_file(path, NULL);
+	ret = libbpf_get_error(ctx->obj);
+	if (ret) {
+		fprintf(stderr, "cannot open %s: %d\n", path, ret);
+		ctx->obj = NULL;
+		return ret;
+	}
+
+	cpus = bpf_object__find_map_by_name(ctx->obj, "ovpn_cpus");
+	if (!cpus || bpf_map__set_max_entries(cpus, libbpf_num_possible_cpus())) {
+		fprintf(stderr, "cannot size CPU map\n");
+		return -EINVAL;
+	}
+
+	ret = bpf_object__load(ctx->obj);
+	if (ret) {
+		fprintf(stderr, "cannot load %s: %d\n", path, ret);
+		return ret;
+	}
+
+	ctx->peers_fd = bpf_object__find_map_fd_by_name(ctx->obj, "ovpn_peers");
+	ctx->stats_fd = bpf_object__find_map_fd_by_name(ctx->obj, "ovpn_stats");
+	if (ctx->peers_fd < 0 || ctx->stats_fd < 0)
+		return -ENOENT;
+
+	ret = bpf_map_update_elem(bpf_object__find_map_fd_by_name(ctx->obj, "ovpn_config"),
+				  &zero, &config, BPF_ANY);
+	if (ret)
+		return ret;
+
+	ovpn_xdp_setup_cpus(bpf_map__fd(cpus));
+
+	prog = bpf_object__find_program_by_name(ctx->obj, "ovpn_xdp_demux");
+	if (!prog)
+		return -ENOENT;
+
+	ret = bpf_xdp_attach(ctx->ifindex, bpf_program__fd(prog), ctx->xdp_flags, NULL);
+	if (ret)
+		fprintf(stderr, "cannot attach XDP program: %d\n", ret);
+
+	return ret;
+}
+
+static void ovpn_xdp_print_stats(struct ovpn_xdp_ctx *ctx)
+{
+	static const char * const names[__OVPN_XDP_STAT_MAX] = {
+		[OVPN_XDP_STAT_PASS] = "pass",
+		[OVPN_XDP_STAT_REDIRECT] = "redirect",
+		[OVPN_XDP_STAT_MALFORMED] = "malformed",
+		[OVPN_XDP_STAT_UNKNOWN_PEER] = "unknown peer",
+	};
+	int cpus = libbpf_num_possible_cpus();
+	__u64 values[cpus], sum;
+	__u32 i;
+	int j;
+
+	fprintf(stderr, "DATA_V2 packets:");
+	for (i = 0; i < __OVPN_XDP_STAT_MAX; i++) {
+		if (bpf_map_lookup_elem(ctx->stats_fd, &i, values))
+			continue;
+
+		for (sum = 0, j = 0; j < cpus; j++)
+			sum += values[j];
+
+		fprintf(stderr, " %s: %" PRIu64, names[i], (uint64_t)sum);
+	}
+	fprintf(stderr, "\n");
+}
+
+static void usage(const char *cmd)
+{
+	fprintf(stderr, "Usage %s <ovpn iface> <iface> <lport> [skb|native] [bpf object]\n", cmd);
+	fprintf(stderr, "\tovpn iface: ovpn MP interface whose peers are mirrored\n");
+	fprintf(stderr, "\tiface: interface receiving the traffic of the peers\n");
+	fprintf(stderr, "\tlport: UDP port of the ovpn socket\n");
+	fprintf(stderr, "\tskb|native: XDP mode, defaults to the best available\n");
+	fprintf(stderr, "\tbpf object: defaults to ovpn-xdp.bpf.o\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = "ovpn-xdp.bpf.o";
+	/* no SA_RESTART: the blocking netlink receive must be interrupted */
+	struct sigaction sa = { .sa_handler = ovpn_xdp_signal };
+	struct ovpn_xdp_ctx ctx = { 0 };
+	struct nl_sock *sock;
+	int mcid, ret = 1;
+	__u16 port;
+
+	if (argc < 4) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	ctx.ovpn_ifindex = if_nametoindex(argv[1]);
+	ctx.ifindex = if_nametoindex(argv[2]);
+	if (!ctx.ovpn_ifindex || !ctx.ifindex) {
+		fprintf(stderr, "cannot find interface: %s\n", strerror(errno));
+		return 1;
+	}
+
+	port = strtoul(argv[3], NULL, 10);
+
+	if (argc > 4) {
+		if (!strcmp(argv[4], "skb")) {
+			ctx.xdp_flags = XDP_FLAGS_SKB_MODE;
+		} else if (!strcmp(argv[4], "native")) {
+			ctx.xdp_flags = XDP_FLAGS_DRV_MODE;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (argc > 5)
+		path = argv[5];
+
+	/* join the group before dumping, so that no change is missed in between */
+	sock = ovpn_xdp_nl_socket();
+	if (!sock)
+		return 1;
+
+	mcid = genl_ctrl_resolve_grp(sock, OVPN_NL_NAME, OVPN_NL_MULTICAST_GROUP_PEERS);
+	if (mcid < 0 || nl_socket_add_membership(sock, mcid)) {
+		fprintf(stderr, "cannot join mcast group: %s\n", nl_geterror(mcid));
+		goto err_sock;
+	}
+
+	nl_socket_modify_cb(sock, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, ovpn_xdp_seq_check, NULL);
+	nl_socket_modify_cb(sock, NL_CB_VALID, NL_CB_CUSTOM, ovpn_xdp_handle_msg, &ctx);
+
+	if (ovpn_xdp_load(&ctx, path, port))
+		goto err_obj;
+
+	if (ovpn_xdp_dump_peers(&ctx) < 0)
+		goto err_detach;
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	while (!ovpn_xdp_stop) {
+		ret = nl_recvmsgs_default(sock);
+		if (ret < 0 && ret != -NLE_INTR) {
+			fprintf(stderr, "netlink reports error (%d): %s\n", ret, nl_geterror(ret));
+			break;
+		}
+	}
+
+	ovpn_xdp_print_stats(&ctx);
+	ret = ovpn_xdp_stop ? 0 : 1;
+
+err_detach:
+	bpf_xdp_detach(ctx.ifindex, ctx.xdp_flags, NULL);
+err_obj:
+	bpf_object__close(ctx.obj);
+err_sock:
+	nl_socket_free(sock);
+	return ret;
+}
@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+/* maps shared by ovpn-xdp.bpf.c and its loader ovpn-xdp.c */
+
+#ifndef _OVPN_XDP_H_
+#define _OVPN_XDP_H_
+
+#include <linux/types.h>
+
+#define OVPN_XDP_MAX_PEERS (1 << 17)
+
+struct ovpn_xdp_config {
+	/* UDP port the ovpn socket is bound to, network order */
+	__be16 port;
+};
+
+struct ovpn_xdp_peer {
+	/* CPU running the crypto worker of the peer, or -1 if none */
+	__s32 cpu;
+};
+
+enum ovpn_xdp_stat {
+	OVPN_XDP_STAT_PASS,
+	OVPN_XDP_STAT_REDIRECT,
+	OVPN_XDP_STAT_MALFORMED,
+	OVPN_XDP_STAT_UNKNOWN_PEER,
+
+	__OVPN_XDP_STAT_MAX,
+};
+
+#endif /* _OVPN_XDP_H_ */
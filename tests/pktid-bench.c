@@ -0,0 +1,443 @@
+// SPDX-License-Identifier: GPL-2.0
+/*  OpenVPN data channel accelerator
+ *
+ *  Copyright (C) 2022 OpenVPN, Inc.
+ *
+ *  Author:	Antonio Quartulli <antonio@openvpn.net>
+ */
+
+/* Userspace microbenchmark of the replay window implemented in pktid.c.
+ *
+ * The module code is built as is on top of kshim/ and compared against the
+ * previous spinlock-based implementation, kept below for reference:
+ * - both implementations are fed the same random trace, which must produce
+ *   the same accept/reject decisions;
+ * - single thread throughput is measured with in-order, reordered and
+ *   jumping ID sequences;
+ * - multi thread throughput is measured with all threads sharing one
+ *   receiver state, as in parallel decryption mode.
+ */
+
+#include "pktid.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+unsigned long jiffies;
+
+/* previous implementation */
+
+#define LEGACY_REPLAY_INDEX(base, i) (((base) + (i)) & (REPLAY_WINDOW_SIZE - 1))
+
+struct legacy_pktid_recv {
+	u8 history[REPLAY_WINDOW_BYTES];
+	unsigned int base;
+	unsigned int extent;
+	unsigned long expire;
+	u32 id;
+	u32 time;
+	u32 id_floor;
+	unsigned int max_backtrack;
+	spinlock_t lock;
+};
+
+static void legacy_pktid_recv_init(struct legacy_pktid_recv *pr)
+{
+	memset(pr, 0, sizeof(*pr));
+	spin_lock_init(&pr->lock);
+}
+
+static int legacy_pktid_recv(struct legacy_pktid_recv *pr, u32 pkt_id, u32 pkt_time)
+{
+	const unsigned long now = jiffies;
+	int ret;
+
+	spin_lock(&pr->lock);
+
+	if (unlikely(time_after_eq(now, pr->expire)))
+		pr->id_floor = pr->id;
+
+	if (unlikely(pkt_id == 0)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (unlikely(pkt_time != pr->time)) {
+		if (pkt_time > pr->time) {
+			pr->base = 0;
+			pr->extent = 0;
+			pr->id = 0;
+			pr->time = pkt_time;
+			pr->id_floor = 0;
+		} else {
+			ret = -ETIME;
+			goto out;
+		}
+	}
+
+	if (likely(pkt_id == pr->id + 1)) {
+		pr->base = LEGACY_REPLAY_INDEX(pr->base, -1);
+		pr->history[pr->base / 8] |= (1 << (pr->base % 8));
+		if (pr->extent < REPLAY_WINDOW_SIZE)
+			++pr->extent;
+		pr->id = pkt_id;
+	} else if (pkt_id > pr->id) {
+		const unsigned int delta = pkt_id - pr->id;
+
+		if (delta < REPLAY_WINDOW_SIZE) {
+			unsigned int i;
+
+			pr->base = LEGACY_REPLAY_INDEX(pr->base, -delta);
+			pr->history[pr->base / 8] |= (1 << (pr->base % 8));
+			pr->extent += delta;
+			if (pr->extent > REPLAY_WINDOW_SIZE)
+				pr->extent = REPLAY_WINDOW_SIZE;
+			for (i = 1; i < delta; ++i) {
+				unsigned int newb = LEGACY_REPLAY_INDEX(pr->base, i);
+
+				pr->history[newb / 8] &= ~BIT(newb % 8);
+			}
+		} else {
+			pr->base = 0;
+			pr->extent = REPLAY_WINDOW_SIZE;
+			memset(pr->history, 0, sizeof(pr->history));
+			pr->history[0] = 1;
+		}
+		pr->id = pkt_id;
+	} else {
+		const unsigned int delta = pr->id - pkt_id;
+
+		if (delta > pr->max_backtrack)
+			pr->max_backtrack = delta;
+		if (delta < pr->extent) {
+			if (pkt_id > pr->id_floor) {
+				const unsigned int ri = LEGACY_REPLAY_INDEX(pr->base, delta);
+				u8 *p = &pr->history[ri / 8];
+				const u8 mask = (1 << (ri % 8));
+
+				if (*p & mask) {
+					ret = -EINVAL;
+					goto out;
+				}
+				*p |= mask;
+			} else {
+				ret = -EINVAL;
+				goto out;
+			}
+		} else {
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	pr->expire = now + PKTID_RECV_EXPIRE;
+	ret = 0;
+out:
+	spin_unlock(&pr->lock);
+	return ret;
+}
+
+/* helpers */
+
+static u64 xorshift_state = 88172645463325252ULL;
+
+static u64 rnd(void)
+{
+	xorshift_state ^= xorshift_state << 13;
+	xorshift_state ^= xorshift_state >> 7;
+	xorshift_state ^= xorshift_state << 17;
+	return xorshift_state;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+enum trace_type {
+	TRACE_INORDER,
+	TRACE_REORDER,
+	TRACE_JUMP,
+	TRACE_MIXED,
+};
+
+static const char * const trace_names[] = {
+	[TRACE_INORDER] = "in-order",
+	[TRACE_REORDER] = "reordered",
+	[TRACE_JUMP] = "jumping",
+	[TRACE_MIXED] = "mixed",
+};
+
+/* Build a trace of packet IDs:
+ * - in-order: 1, 2, 3, ...
+ * - reordered: in-order with neighbours swapped within 64 positions
+ * - jumping: IDs moving forward by up to REPLAY_WINDOW_SIZE - 1 at a time
+ * - mixed: all of the above plus duplicates, old and very far IDs
+ */
+static u32 *trace_build(enum trace_type type, size_t len)
+{
+	u32 *ids = malloc(len * sizeof(*ids));
+	u32 id = 0;
+	size_t i;
+
+	if (!ids)
+		return NULL;
+
+	for (i = 0; i < len; i++) {
+		switch (type) {
+		case TRACE_INORDER:
+		case TRACE_REORDER:
+			ids[i] = ++id;
+			break;
+		case TRACE_JUMP:
+			id += 1 + rnd() % (REPLAY_WINDOW_SIZE - 1);
+			ids[i] = id;
+			break;
+		case TRACE_MIXED:
+			switch (rnd() % 64) {
+			case 0 ... 3:
+				/* duplicate or old ID, possibly outside the window */
+				if (id > 2 * REPLAY_WINDOW_SIZE) {
+					ids[i] = id - rnd() % (2 * REPLAY_WINDOW_SIZE);
+					break;
+				}
+				ids[i] = ++id;
+				break;
+			case 4:
+				/* jump, possibly beyond the window */
+				id += rnd() % (3 * REPLAY_WINDOW_SIZE);
+				ids[i] = id;
+				break;
+			default:
+				ids[i] = ++id;
+				break;
+			}
+			break;
+		}
+	}
+
+	if (type == TRACE_REORDER || type == TRACE_MIXED) {
+		for (i = 0; i + 64 < len; i++) {
+			size_t j = i + rnd() % 64;
+			u32 tmp = ids[i];
+
+			if (rnd() % 4)
+				continue;
+			ids[i] = ids[j];
+			ids[j] = tmp;
+		}
+	}
+
+	return ids;
+}
+
+/* feed the same trace to both implementations and compare the results */
+static int check(size_t len)
+{
+	struct legacy_pktid_recv *legacy = malloc(sizeof(*legacy));
+	struct ovpn_pktid_recv *pr = malloc(sizeof(*pr));
+	u32 *ids = trace_build(TRACE_MIXED, len);
+	size_t i, accepted = 0, mismatches = 0;
+	int r1, r2;
+
+	if (!legacy || !pr || !ids) {
+		fprintf(stderr, "cannot allocate memory\n");
+		return -1;
+	}
+
+	legacy_pktid_recv_init(legacy);
+	ovpn_pktid_recv_init(pr);
+	jiffies = 1;
+
+	for (i = 0; i < len; i++) {
+		/* let the history expire from time to time */
+		if (rnd() % 100000 == 0)
+			jiffies += PKTID_RECV_EXPIRE;
+
+		r1 = legacy_pktid_recv(legacy, ids[i], 0);
+		r2 = ovpn_pktid_recv(pr, ids[i], 0);
+		if (r1 != r2) {
+			if (mismatches++ < 10)
+				fprintf(stderr, "mismatch at %zu: id=%u legacy=%d new=%d\n", i,
+					ids[i], r1, r2);
+		}
+		accepted += !r2;
+	}
+
+	printf("check: %zu IDs, %zu accepted, %zu mismatches\n", len, accepted, mismatches);
+
+	free(ids);
+	free(pr);
+	free(legacy);
+
+	return mismatches ? -1 : 0;
+}
+
+static void bench_single(enum trace_type type, size_t len)
+{
+	struct legacy_pktid_recv *legacy = malloc(sizeof(*legacy));
+	struct ovpn_pktid_recv *pr = malloc(sizeof(*pr));
+	u32 *ids = trace_build(type, len);
+	double start, t_legacy, t_new;
+	size_t i;
+
+	if (!legacy || !pr || !ids) {
+		fprintf(stderr, "cannot allocate memory\n");
+		exit(1);
+	}
+
+	jiffies = 1;
+
+	legacy_pktid_recv_init(legacy);
+	start = now_sec();
+	for (i = 0; i < len; i++)
+		legacy_pktid_recv(legacy, ids[i], 0);
+	t_legacy = now_sec() - start;
+
+	ovpn_pktid_recv_init(pr);
+	start = now_sec();
+	for (i = 0; i < len; i++)
+		ovpn_pktid_recv(pr, ids[i], 0);
+	t_new = now_sec() - start;
+
+	printf("1 thread,  %-9s: legacy %8.2f Mpps, new %8.2f Mpps\n", trace_names[type],
+	       len / t_legacy / 1e6, len / t_new / 1e6);
+
+	free(ids);
+	free(pr);
+	free(legacy);
+}
+
+struct mt_ctx {
+	struct legacy_pktid_recv *legacy;
+	struct ovpn_pktid_recv *pr;
+	u32 next_id;
+	size_t len;
+	size_t accepted;
+};
+
+/* IDs are handed out in order, but threads complete them in any order, like
+ * parallel decryption workers do
+ */
+static void *mt_worker(void *arg)
+{
+	struct mt_ctx *ctx = arg;
+	size_t accepted = 0;
+	u32 id;
+
+	while ((id = __atomic_add_fetch(&ctx->next_id, 1, __ATOMIC_RELAXED)) <= ctx->len) {
+		if (ctx->legacy)
+			accepted += !legacy_pktid_recv(ctx->legacy, id, 0);
+		else
+			accepted += !ovpn_pktid_recv(ctx->pr, id, 0);
+	}
+
+	__atomic_add_fetch(&ctx->accepted, accepted, __ATOMIC_RELAXED);
+
+	return NULL;
+}
+
+static double mt_run(struct mt_ctx *ctx, int threads)
+{
+	pthread_t tids[threads];
+	double start;
+	int i;
+
+	ctx->next_id = 0;
+	ctx->accepted = 0;
+
+	start = now_sec();
+	for (i = 0; i < threads; i++)
+		pthread_create(&tids[i], NULL, mt_worker, ctx);
+	for (i = 0; i < threads; i++)
+		pthread_join(tids[i], NULL);
+
+	return now_sec() - start;
+}
+
+static void bench_multi(int threads, size_t len)
+{
+	struct legacy_pktid_recv *legacy = malloc(sizeof(*legacy));
+	struct ovpn_pktid_recv *pr = malloc(sizeof(*pr));
+	struct mt_ctx ctx = { .len = len };
+	size_t acc_legacy, acc_new;
+	double t_legacy, t_new;
+
+	if (!legacy || !pr) {
+		fprintf(stderr, "cannot allocate memory\n");
+		exit(1);
+	}
+
+	jiffies = 1;
+
+	legacy_pktid_recv_init(legacy);
+	ctx.legacy = legacy;
+	t_legacy = mt_run(&ctx, threads);
+	acc_legacy = ctx.accepted;
+
+	ovpn_pktid_recv_init(pr);
+	ctx.legacy = NULL;
+	ctx.pr = pr;
+	t_new = mt_run(&ctx, threads);
+	acc_new = ctx.accepted;
+
+	printf("%d threads, in-order : legacy %8.2f Mpps (%zu lost), new %8.2f Mpps (%zu lost)\n",
+	       threads, len / t_legacy / 1e6, len - acc_legacy, len / t_new / 1e6,
+	       len - acc_new);
+
+	free(pr);
+	free(legacy);
+}
+
+static void usage(const char *cmd)
+{
+	fprintf(stderr, "Usage: %s [-n packets] [-t threads]\n", cmd);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t len = 2000000;
+	long threads;
+	int opt;
+
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > 8)
+		threads = 8;
+
+	while ((opt = getopt(argc, argv, "n:t:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			len = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			threads = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!len || threads < 1 || len > UINT32_MAX / REPLAY_WINDOW_SIZE)
+		usage(argv[0]);
+
+	if (check(len) < 0)
+		return 1;
+
+	bench_single(TRACE_INORDER, len);
+	bench_single(TRACE_REORDER, len);
+	bench_single(TRACE_JUMP, len);
+	bench_single(TRACE_MIXED, len);
+
+	if (threads > 1)
+		bench_multi(threads, len);
+
+	return 0;
+}
@@ -0,0 +1,90 @@
+#!/bin/bash
+# SPDX-License-Identifier: GPL-2.0
+# Copyright (C) 2022 OpenVPN, Inc.
+#
+#  Author:	Antonio Quartulli <antonio@openvpn.net>
+
+# TX steering in parallel crypto mode: two peers ping each other from every online
+# CPU while the ovpn_tx_encrypt tracepoint is recorded. The CPU each event fired on
+# is printed by ftrace next to the TX queue the packet was picked for.
+#
+# The test passes if packets were traced and every packet of queue N was encrypted
+# on CPU N.
+
+#set -x
+set -e
+
+OVPN_CLI=${OVPN_CLI:-./ovpn-cli}
+ALG=${ALG:-aes}
+PINGS=${PINGS:-20}
+TRACEFS=${TRACEFS:-/sys/kernel/tracing}
+EVENT=$TRACEFS/events/ovpn_dco/ovpn_tx_encrypt
+
+function cleanup() {
+	echo 0 > $EVENT/enable 2>/dev/null || true
+	ip -n peer0 link del veth1 2>/dev/null || true
+	for p in 0 1; do
+		ip -n peer${p} link del tun0 2>/dev/null || true
+		ip netns del peer${p} 2>/dev/null || true
+	done
+}
+
+if [ ! -w $EVENT/enable ]; then
+	echo "cannot find the ovpn_tx_encrypt tracepoint in $TRACEFS, is ovpn-dco loaded?"
+	exit 1
+fi
+
+cleanup
+
+for p in 0 1; do
+	ip netns add peer${p}
+done
+
+ip link add veth1 netns peer0 type veth peer name veth1 netns peer1
+ip -n peer0 addr add 10.10.1.1/24 dev veth1
+ip -n peer0 link set veth1 up
+ip -n peer1 addr add 10.10.1.2/24 dev veth1
+ip -n peer1 link set veth1 up
+
+for p in 0 1; do
+	ip netns exec peer${p} $OVPN_CLI tun0 new_iface P2P parallel steering
+	ip -n peer${p} addr add 5.5.5.$((${p} + 1))/24 dev tun0
+	ip -n peer${p} link set tun0 up
+done
+
+ip netns exec peer0 $OVPN_CLI tun0 new_peer 1 1 10.10.1.2 1 5.5.5.2
+ip netns exec peer0 $OVPN_CLI tun0 new_key 1 $ALG 0 data64.key
+ip netns exec peer1 $OVPN_CLI tun0 new_peer 1 1 10.10.1.1 1 5.5.5.1
+ip netns exec peer1 $OVPN_CLI tun0 new_key 1 $ALG 1 data64.key
+
+ip netns exec peer0 ping -qc 3 -w 5 5.5.5.2
+
+echo > $TRACEFS/trace
+echo 1 > $EVENT/enable
+
+for cpu in $(seq 0 $(($(nproc) - 1))); do
+	ip netns exec peer0 taskset -c $cpu ping -qc $PINGS -i 0.01 -w 5 5.5.5.2 >/dev/null
+done
+
+echo 0 > $EVENT/enable
+
+# e.g. "kworker/3:1-123 [003] ..... 42.000000: ovpn_tx_encrypt: peer=1 ... queue=3"
+events=$(grep -c "ovpn_tx_encrypt:" $TRACEFS/trace || true)
+misses=$(sed -n 's/.*\[0*\([0-9][0-9]*\)\].*ovpn_tx_encrypt:.* queue=\([0-9]*\)$/\1 \2/p' \
+	$TRACEFS/trace | awk '$1 != $2' | wc -l)
+echo "packets encrypted: ${events:-0}, on a CPU other than the one of their queue: $misses"
+
+ip netns exec peer0 $OVPN_CLI tun0 del_peer 1
+ip netns exec peer1 $OVPN_CLI tun0 del_peer 1
+
+cleanup
+
+if [ -z "$events" ] || [ $events -eq 0 ]; then
+	echo "no packet was traced"
+	exit 1
+fi
+
+if [ $misses -gt 0 ]; then
+	echo "packets were not encrypted on the CPU of their TX queue"
+	exit 1
+fi